@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Offline pipeline benchmark.
+ *
+ * The filter and video encoder modules are loaded with ga_load_module() and
+ * fed by a synthetic video source that generates deterministic BGRA frames.
+ * Encoded packets are counted by a sink server stub instead of being sent
+ * to the network, so no display, capture device, or client is required.
+ *
+ * pipeline:
+ *	synthetic source -- [video-%d] --> filter -- [filter-%d] --> encoder --> counting sink
+ */
+
+#include <ga/avcodec.hpp>
+#include <ga/common.hpp>
+#include <ga/conf.hpp>
+#include <ga/dpipe.hpp>
+#include <ga/encoder_common.hpp>
+#include <ga/module.hpp>
+#include <ga/rtsp_conf.hpp>
+#include <ga/trace.hpp>
+#include <ga/vsource.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define SOURCES 1
+
+static char imagepipefmt[]	= VIDEO_SOURCE_PIPEFORMAT;
+static char filterpipefmt[] = "filter-%d";
+static char* filter_param[] = {imagepipefmt, filterpipefmt};
+
+static ga_module_t *m_filter, *m_vencoder;
+static ga_module_t bench_sink;
+
+static int bench_width	 = 1280;
+static int bench_height = 720;
+static int bench_fps		 = 30;
+static int bench_seconds = 10;
+static const char* bench_filter	= "mod/filter-rgb2yuv";
+static const char* bench_encoder = "mod/encoder-video";
+
+static unsigned char* pattern = NULL; /**< BGRA pattern, twice the frame width */
+static std::atomic<int> source_started{0};
+static std::atomic<unsigned long long> source_frames{0};
+static std::atomic<unsigned long long> source_late{0};
+
+/**
+ * Counters of a sink channel, updated by the encoder thread of the channel.
+ */
+typedef struct bench_counter_s {
+	std::atomic<unsigned long long> packets;
+	std::atomic<unsigned long long> bytes;
+	std::atomic<unsigned long long> frames;
+	int64_t lastpts;
+} bench_counter_t;
+
+static bench_counter_t counter[VIDEO_SOURCE_CHANNEL_MAX + 1];
+
+/**
+ * Fill the pattern buffer.
+ *
+ * The pattern is wide enough that each frame is a horizontally scrolled
+ * window of it, so consecutive frames differ but the sequence is the same
+ * for every run.
+ */
+static void bench_pattern_init(int width, int height)
+{
+	int x, y, pwidth = width * 2;
+	unsigned char* p;
+	pattern = (unsigned char*)malloc((size_t)pwidth * height * 4);
+	for(y = 0, p = pattern; y < height; y++)
+	{
+		for(x = 0; x < pwidth; x++, p += 4)
+		{
+			p[0] = (unsigned char)(x ^ y);				  // B
+			p[1] = (unsigned char)(x + (y << 1));		  // G
+			p[2] = (unsigned char)(((x >> 4) * (y >> 4)) << 2); // R
+			p[3] = 0xff;										  // A
+		}
+	}
+}
+
+/**
+ * Synthetic video source: publish one frame per interval to the source pipes.
+ */
+static void bench_source_threadproc()
+{
+	int i;
+	long long interval, next, now;
+	unsigned long long frameno = 0;
+	struct timeval captureTv;
+	dpipe_t* pipe[SOURCES];
+	//
+	for(i = 0; i < SOURCES; i++)
+	{
+		char pipename[64];
+		snprintf(pipename, sizeof(pipename), VIDEO_SOURCE_PIPEFORMAT, i);
+		if((pipe[i] = dpipe_lookup(pipename)) == NULL)
+		{
+			ga_error("bench: cannot find pipeline '%s'\n", pipename);
+			exit(-1);
+		}
+	}
+	interval = 1000000LL / bench_fps;
+	next		= ga_trace_now();
+	while(source_started != 0)
+	{
+		dpipe_buffer_t* data;
+		vsource_frame_t* frame;
+		int y, offset;
+		//
+		now = ga_trace_now();
+		if(now < next)
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(next - now < 1000 ? next - now : 1000));
+			continue;
+		}
+		next += interval;
+		// more than two frames behind: do not try to catch up
+		if(now - next > (interval << 1))
+		{
+			source_late += (now - next) / interval;
+			next = now + interval;
+		}
+		//
+		if((data = dpipe_get_shared(pipe, SOURCES)) == NULL)
+		{
+			source_late++;
+			continue;
+		}
+		frame				 = (vsource_frame_t*)data->pointer;
+		frame->pixelformat = AV_PIX_FMT_BGRA;
+		frame->realwidth	 = bench_width;
+		frame->realheight	 = bench_height;
+		frame->realstride	 = bench_width << 2;
+		frame->realsize	 = bench_height * frame->realstride;
+		frame->linesize[0] = frame->realstride;
+		// scroll by 8 pixels per frame
+		offset = (int)((frameno * 8) % bench_width);
+		for(y = 0; y < bench_height; y++)
+		{
+			bcopy(pattern + ((size_t)y * bench_width * 2 + offset) * 4,
+					frame->imgbuf + (size_t)y * frame->realstride,
+					frame->realstride);
+		}
+		gettimeofday(&captureTv, NULL);
+		frame->imgpts	  = frameno++;
+		frame->timestamp = captureTv;
+		ga_trace_begin(&frame->trace);
+		ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+		dpipe_store_shared(pipe, SOURCES, data);
+		source_frames++;
+	}
+}
+
+/**
+ * Sink server stub: count the packets instead of sending them.
+ */
+static int bench_send_packet(const char* prefix, int channelId, AVPacket* pkt, int64_t encoderPts, struct timeval* ptv)
+{
+	bench_counter_t* c;
+	ga_trace_t* trace;
+	//
+	if(channelId < 0 || channelId > VIDEO_SOURCE_CHANNEL_MAX)
+		return -1;
+	c = &counter[channelId];
+	if(channelId < video_source_channels() && (trace = encoder_get_trace(channelId)) != NULL)
+	{
+		ga_trace_stamp(trace, GA_TRACE_QUEUE);
+		ga_trace_stamp(trace, GA_TRACE_SEND);
+		encoder_set_trace(channelId, NULL);
+	}
+	if(c->packets == 0 || encoderPts != c->lastpts)
+	{
+		c->frames++;
+		c->lastpts = encoderPts;
+	}
+	c->packets++;
+	c->bytes += pkt->size;
+	return 0;
+}
+
+/**
+ * Get the CPU time consumed by the process.
+ *
+ * @return CPU time (user + system) in microseconds.
+ */
+static long long bench_cputime()
+{
+#ifdef WIN32
+	FILETIME c, e, k, u;
+	if(GetProcessTimes(GetCurrentProcess(), &c, &e, &k, &u) == 0)
+		return 0;
+	return ((((long long)k.dwHighDateTime << 32) | k.dwLowDateTime) + (((long long)u.dwHighDateTime << 32) | u.dwLowDateTime))
+			 / 10;
+#else
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+			  "usage: %s [options] config-file\n"
+			  "options:\n"
+			  "  -s WxH      frame size (default %dx%d)\n"
+			  "  -r fps      frame rate (default %d)\n"
+			  "  -t seconds  duration (default %d)\n"
+			  "  -f module   filter module (default %s)\n"
+			  "  -e module   video encoder module (default %s)\n",
+			  prog,
+			  bench_width,
+			  bench_height,
+			  bench_fps,
+			  bench_seconds,
+			  bench_filter,
+			  bench_encoder);
+}
+
+static int parse_args(int argc, char* argv[], const char** config)
+{
+	int i;
+	*config = NULL;
+	for(i = 1; i < argc; i++)
+	{
+		if(argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0')
+		{
+			if(*config != NULL)
+				return -1;
+			*config = argv[i];
+			continue;
+		}
+		if(i + 1 >= argc)
+			return -1;
+		switch(argv[i][1])
+		{
+			case 's':
+				if(sscanf(argv[++i], "%dx%d", &bench_width, &bench_height) != 2)
+					return -1;
+				break;
+			case 'r':
+				bench_fps = atoi(argv[++i]);
+				break;
+			case 't':
+				bench_seconds = atoi(argv[++i]);
+				break;
+			case 'f':
+				bench_filter = argv[++i];
+				break;
+			case 'e':
+				bench_encoder = argv[++i];
+				break;
+			default:
+				return -1;
+		}
+	}
+	if(*config == NULL || bench_width <= 0 || bench_height <= 0 || (bench_width & 1) || (bench_height & 1)
+		|| bench_fps <= 0 || bench_seconds <= 0)
+		return -1;
+	return 0;
+}
+
+/**
+ * Override the configurations that must match the synthetic source.
+ */
+static void bench_setup_conf()
+{
+	char buf[64];
+	int maxres[2];
+	// the frame rate is read by the encoders from the RTSP configuration
+	snprintf(buf, sizeof(buf), "%d", bench_fps);
+	ga_conf_writev("video-fps", buf);
+	// frame buffers must be large enough for the synthetic frames
+	if(ga_conf_readints("max-resolution", maxres, 2) != 2)
+	{
+		maxres[0] = VIDEO_SOURCE_DEF_MAXWIDTH;
+		maxres[1] = VIDEO_SOURCE_DEF_MAXHEIGHT;
+	}
+	if(bench_width > maxres[0] || bench_height > maxres[1])
+	{
+		snprintf(buf,
+					sizeof(buf),
+					"%d %d",
+					bench_width > maxres[0] ? bench_width : maxres[0],
+					bench_height > maxres[1] ? bench_height : maxres[1]);
+		ga_conf_writev("max-resolution", buf);
+	}
+	// latency is reported once at the end
+	ga_conf_writev("latency-trace", "1");
+	ga_conf_writev("latency-trace-interval", "0");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* config;
+	char buf[1024];
+	vsource_config_t vconfig[SOURCES];
+	long long t0, t1, cpu0, cpu1;
+	unsigned long long packets = 0, bytes = 0, frames = 0, late;
+	double elapsed;
+	int i;
+	//
+	if(parse_args(argc, argv, &config) < 0)
+	{
+		usage(argv[0]);
+		return -1;
+	}
+	if(ga_init(config, NULL) < 0)
+		return -1;
+	ga_openlog();
+	bench_setup_conf();
+	if(rtspconf_parse(rtspconf_global()) < 0)
+		return -1;
+	// load modules
+	if((m_filter = ga_load_module(bench_filter, "filter_RGB2YUV_")) == NULL)
+		return -1;
+	if((m_vencoder = ga_load_module(bench_encoder, "vencoder_")) == NULL)
+		return -1;
+	// synthetic source
+	bzero(vconfig, sizeof(vconfig));
+	for(i = 0; i < SOURCES; i++)
+	{
+		vconfig[i].curr_width  = bench_width;
+		vconfig[i].curr_height = bench_height;
+		vconfig[i].curr_stride = bench_width << 2;
+	}
+	if(video_source_setup_ex(vconfig, SOURCES) < 0)
+		return -1;
+	bench_pattern_init(bench_width, bench_height);
+	// init and run modules
+	ga_init_single_module_or_quit("filter", m_filter, (void*)filter_param);
+	ga_init_single_module_or_quit("video-encoder", m_vencoder, filterpipefmt);
+	if(m_filter->start(filter_param) < 0)
+		return -1;
+	encoder_register_vencoder(m_vencoder, filterpipefmt);
+	bzero(&bench_sink, sizeof(bench_sink));
+	bench_sink.type		  = GA_MODULE_TYPE_SERVER;
+	bench_sink.name		  = (char*)"bench-sink";
+	bench_sink.send_packet = bench_send_packet;
+	if(encoder_register_sinkserver(&bench_sink) < 0)
+		return -1;
+	// a registered client launches the encoder
+	encoder_register_client(&bench_sink);
+	//
+	ga_error("bench: %s + %s, %dx%d@%dfps for %ds\n",
+				bench_filter,
+				bench_encoder,
+				bench_width,
+				bench_height,
+				bench_fps,
+				bench_seconds);
+	t0				 = ga_trace_now();
+	cpu0			 = bench_cputime();
+	source_started = 1;
+	std::thread source(bench_source_threadproc);
+	std::this_thread::sleep_for(std::chrono::seconds(bench_seconds));
+	source_started = 0;
+	source.join();
+	t1		  = ga_trace_now();
+	cpu1	  = bench_cputime();
+	elapsed = (t1 - t0) / 1000000.0;
+	// report before stopping the modules, so that no packet is counted late
+	for(i = 0; i < video_source_channels(); i++)
+	{
+		packets += counter[i].packets;
+		bytes += counter[i].bytes;
+		frames += counter[i].frames;
+	}
+	late = source_late;
+	printf("frames: generated=%llu late=%llu encoded=%llu (%.2f fps)\n",
+			 (unsigned long long)source_frames,
+			 late,
+			 frames,
+			 frames / elapsed);
+	printf("packets: %llu, %llu bytes (%.3f Mbps)\n", packets, bytes, bytes * 8.0 / elapsed / 1000000.0);
+	printf("cpu: %.1f%% (%.3fs in %.3fs)\n",
+			 100.0 * (cpu1 - cpu0) / (t1 - t0),
+			 (cpu1 - cpu0) / 1000000.0,
+			 elapsed);
+	if(ga_trace_report(buf, sizeof(buf), 0) > 0)
+		printf("latency (us): %s\n", buf);
+	fflush(stdout);
+	//
+	encoder_unregister_client(&bench_sink);
+	if(m_filter->stop != NULL)
+		m_filter->stop(filter_param);
+	ga_deinit();
+	// fail if nothing went through the pipeline
+	return frames > 0 ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2013-2014 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Glass-to-glass latency probe.
+ *
+ * The server embeds a color code into each captured frame (embed-colorcode)
+ * and logs the capture time of each code (save-colorcode-timestamp).
+ * The client reads the code back from each decoded frame, stamps it right
+ * after the frame is presented, and looks up the capture time in the
+ * server's log. Both ends use the wall clock, so the server log must be
+ * written on the same host, e.g., when streaming over the loopback.
+ *
+ * All the functions are called from the rendering thread.
+ */
+
+#include "latency_probe.hpp"
+#include "rtsp_client.hpp"
+
+#include <ga/common.hpp>
+#include <ga/conf.hpp>
+#include <ga/vsource.hpp>
+#include <string.h>
+#include <unordered_map>
+
+static int probe_enabled	= 0;
+static long long probe_interval = 0; /* report interval in microseconds */
+static FILE* probe_serverlog		= NULL; /* server's code-timestamp log */
+static FILE* savefp_probe			= NULL; /* per-frame samples */
+static std::unordered_map<unsigned int, long long> probe_capture; /* code -> capture time */
+
+/* per-channel state */
+static unsigned int probe_code[VIDEO_SOURCE_CHANNEL_MAX];
+static bool probe_detected[VIDEO_SOURCE_CHANNEL_MAX];
+
+/* per-channel measurement window */
+typedef struct probe_stat_s
+{
+	unsigned int hist[LATENCY_PROBE_BUCKETS];
+	unsigned int frames;		/* presented frames */
+	unsigned int detected;	/* frames with a valid code */
+	unsigned int matched;	/* codes found in the server log */
+	long long sum, min, max;
+	long long start;
+} probe_stat_t;
+
+static probe_stat_t probe_stat[VIDEO_SOURCE_CHANNEL_MAX];
+
+static long long probe_now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void probe_reset(int ch, long long now)
+{
+	bzero(&probe_stat[ch], sizeof(probe_stat_t));
+	probe_stat[ch].start = now;
+}
+
+/*
+ * Read the lines appended to the server log since the last call.
+ * An incomplete line is left for the next call.
+ */
+static void probe_read_serverlog()
+{
+	char line[256];
+	unsigned int code, sec, usec;
+	long pos;
+	//
+	if(probe_serverlog == NULL)
+		return;
+	clearerr(probe_serverlog);
+	pos = ftell(probe_serverlog);
+	while(fgets(line, sizeof(line), probe_serverlog) != NULL)
+	{
+		if(strchr(line, '\n') == NULL)
+		{
+			fseek(probe_serverlog, pos, SEEK_SET);
+			break;
+		}
+		pos = ftell(probe_serverlog);
+		if(sscanf(line, "COLORCODE-TIMESTAMP: %u -> %u.%u", &code, &sec, &usec) != 3)
+			continue;
+		// codes are reused when the counter wraps, keep the latest one
+		probe_capture[code] = sec * 1000000LL + usec;
+	}
+}
+
+/*
+ * Percentile of a measurement window, in milliseconds.
+ */
+static int probe_percentile(probe_stat_t* st, double pct)
+{
+	unsigned int i, acc = 0, need;
+	need = (unsigned int)(pct * st->matched + 0.5);
+	if(need == 0)
+		need = 1;
+	for(i = 0; i < LATENCY_PROBE_BUCKETS; i++)
+	{
+		acc += st->hist[i];
+		if(acc >= need)
+			return i;
+	}
+	return LATENCY_PROBE_BUCKETS - 1;
+}
+
+static void probe_report(int ch, long long now)
+{
+	static const int edge[] = {16, 33, 50, 100, 200};
+	probe_stat_t* st = &probe_stat[ch];
+	unsigned int coarse[6] = {0, 0, 0, 0, 0, 0};
+	unsigned int i, j;
+	//
+	if(st->frames == 0)
+		return;
+	if(st->matched == 0)
+	{
+		rtsperror("latency-probe: ch%d %u frames, %u codes detected, none found in the server log\n",
+					 ch,
+					 st->frames,
+					 st->detected);
+		return;
+	}
+	for(i = 0, j = 0; i < LATENCY_PROBE_BUCKETS; i++)
+	{
+		while(j < 5 && (int)i >= edge[j])
+			j++;
+		coarse[j] += st->hist[i];
+	}
+	rtsperror("latency-probe: ch%d %.1fs, %u frames, %u detected, %u matched; glass-to-glass ms: min %.3f avg %.3f p50 %d p90 %d "
+				 "p99 %d max %.3f\n",
+				 ch,
+				 (now - st->start) / 1000000.0,
+				 st->frames,
+				 st->detected,
+				 st->matched,
+				 st->min / 1000.0,
+				 st->sum / 1000.0 / st->matched,
+				 probe_percentile(st, 0.5),
+				 probe_percentile(st, 0.9),
+				 probe_percentile(st, 0.99),
+				 st->max / 1000.0);
+	rtsperror("latency-probe: ch%d histogram [0,16) %u, [16,33) %u, [33,50) %u, [50,100) %u, [100,200) %u, [200,+) %u\n",
+				 ch,
+				 coarse[0],
+				 coarse[1],
+				 coarse[2],
+				 coarse[3],
+				 coarse[4],
+				 coarse[5]);
+}
+
+/*
+ * Initialize the latency probe.
+ *
+ * The probe is enabled by the latency-probe parameter and requires the same
+ * embed-colorcode parameter as the server. The server's code-timestamp log is
+ * given by latency-probe-server-log, and latency-probe-interval sets the
+ * report interval in seconds. The per-frame samples can be saved with
+ * save-latency-probe, e.g., for joining with a remote server's log offline.
+ */
+int latency_probe_init()
+{
+	char buf[256];
+	int ch, interval = LATENCY_PROBE_INTERVAL;
+	long long now = probe_now();
+	//
+	if(ga_conf_readbool("latency-probe", 0) == 0)
+		return 0;
+	if(vsource_detect_colorcode_init() < 0)
+	{
+		rtsperror("latency-probe: embed-colorcode is not configured, probe disabled.\n");
+		return -1;
+	}
+	if(ga_conf_readv("latency-probe-interval", buf, sizeof(buf)) != NULL)
+		interval = ga_conf_readint("latency-probe-interval");
+	if(interval <= 0)
+		interval = LATENCY_PROBE_INTERVAL;
+	probe_interval = interval * 1000000LL;
+	if(ga_conf_readv("latency-probe-server-log", buf, sizeof(buf)) != NULL)
+	{
+		if((probe_serverlog = fopen(buf, "rt")) == NULL)
+			rtsperror("latency-probe: cannot open server log '%s'.\n", buf);
+	}
+	if(ga_conf_readv("save-latency-probe", buf, sizeof(buf)) != NULL)
+	{
+		savefp_probe = ga_save_init_txt(buf);
+		rtsperror("*** SAVEFILE: latency probe saved to '%s'\n", savefp_probe ? buf : "NULL");
+	}
+	for(ch = 0; ch < VIDEO_SOURCE_CHANNEL_MAX; ch++)
+	{
+		probe_detected[ch] = false;
+		probe_reset(ch, now);
+	}
+	probe_enabled = 1;
+	rtsperror("latency-probe: enabled, report interval = %d s, server log %s\n",
+				 interval,
+				 probe_serverlog ? "opened" : "not available");
+	return 0;
+}
+
+int latency_probe_enabled() { return probe_enabled; }
+
+/*
+ * Read the color code of a frame that is about to be presented.
+ */
+void latency_probe_detect(int ch, unsigned char* planes[], int linesize[], int width, int height, int format)
+{
+	unsigned int code;
+	if(probe_enabled == 0)
+		return;
+	probe_detected[ch] = vsource_detect_colorcode(planes, linesize, width, height, format, &code) == 0;
+	if(probe_detected[ch])
+		probe_code[ch] = code;
+}
+
+/*
+ * Stamp the frame detected last on the channel as presented.
+ */
+void latency_probe_present(int ch)
+{
+	probe_stat_t* st = &probe_stat[ch];
+	std::unordered_map<unsigned int, long long>::iterator mi;
+	long long now, latency;
+	//
+	if(probe_enabled == 0)
+		return;
+	now = probe_now();
+	st->frames++;
+	if(probe_detected[ch])
+	{
+		probe_detected[ch] = false;
+		st->detected++;
+		if(savefp_probe != NULL)
+		{
+			ga_save_printf(
+			  savefp_probe, "LATENCY-PROBE: ch%d %08u -> %u.%06u\n", ch, probe_code[ch], (unsigned)(now / 1000000), (unsigned)(now % 1000000));
+		}
+		probe_read_serverlog();
+		if((mi = probe_capture.find(probe_code[ch])) != probe_capture.end())
+		{
+			latency = now - mi->second;
+			if(latency >= 0 && latency < LATENCY_PROBE_MAX_US)
+			{
+				st->hist[latency / 1000 < LATENCY_PROBE_BUCKETS ? latency / 1000 : LATENCY_PROBE_BUCKETS - 1]++;
+				if(st->matched == 0 || latency < st->min)
+					st->min = latency;
+				if(latency > st->max)
+					st->max = latency;
+				st->sum += latency;
+				st->matched++;
+			}
+			// each code is measured once, and a repeated frame does not match
+			probe_capture.erase(mi);
+		}
+	}
+	if(now - st->start >= probe_interval)
+	{
+		probe_report(ch, now);
+		probe_reset(ch, now);
+	}
+}
+
+void latency_probe_deinit()
+{
+	int ch;
+	long long now = probe_now();
+	if(probe_enabled == 0)
+		return;
+	for(ch = 0; ch < VIDEO_SOURCE_CHANNEL_MAX; ch++)
+		probe_report(ch, now);
+	if(probe_serverlog != NULL)
+	{
+		fclose(probe_serverlog);
+		probe_serverlog = NULL;
+	}
+	if(savefp_probe != NULL)
+	{
+		ga_save_close(savefp_probe);
+		savefp_probe = NULL;
+	}
+	probe_capture.clear();
+	probe_enabled = 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2013-2014 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GA_CLIENT_LATENCYPROBE_HPP
+#define GA_CLIENT_LATENCYPROBE_HPP
+
+#define LATENCY_PROBE_INTERVAL 10		 /* default report interval in seconds */
+#define LATENCY_PROBE_BUCKETS	 1000	 /* 1ms buckets, larger values are counted in the last one */
+#define LATENCY_PROBE_MAX_US	 10000000 /* samples above this are stale codes */
+
+int latency_probe_init();
+int latency_probe_enabled();
+void latency_probe_detect(int ch, unsigned char *planes[], int linesize[], int width, int height, int format);
+void latency_probe_present(int ch);
+void latency_probe_deinit();
+
+#endif
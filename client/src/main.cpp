@@ -30,6 +30,7 @@ extern "C"
 #include <libavcodec/avcodec.h>
 }
 
+#include "latency_probe.hpp"
 #include "rtsp_client.hpp"
 
 #include <ga/avcodec.hpp>
@@ -119,6 +120,7 @@ static void create_overlay(struct RTSPThreadParam* rtspParam, int ch)
 	struct SwsContext* swsctx	 = NULL;
 	dpipe_t* pipe					 = NULL;
 	dpipe_buffer_t* data			 = NULL;
+	Uint32 texfmt;
 	char windowTitle[64];
 	char pipename[64];
 	//
@@ -232,7 +234,11 @@ static void create_overlay(struct RTSPThreadParam* rtspParam, int ch)
 		exit(-1);
 	}
 	//
-	overlay = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING, w, h);
+	// decoded pictures are uploaded as-is when the texture can take them,
+	// otherwise they are converted to YUV420P through the pipe
+	if((texfmt = rtsp_texture_format(format)) == SDL_PIXELFORMAT_UNKNOWN)
+		texfmt = SDL_PIXELFORMAT_IYUV;
+	overlay = SDL_CreateTexture(renderer, texfmt, SDL_TEXTUREACCESS_STREAMING, w, h);
 	if(overlay == NULL)
 	{
 		rtsperror("ga-client: create overlay (textuer) failed.\n");
@@ -359,37 +365,71 @@ static void render_text(SDL_Renderer* renderer, SDL_Window* window, int x, int y
 
 static void render_image(struct RTSPThreadParam* rtspParam, int ch)
 {
-	dpipe_buffer_t* data;
+	dpipe_buffer_t *data, *newer;
 	AVPicture* vframe;
-	SDL_Rect rect;
-	unsigned char* pixels;
-	int pitch;
+	AVFrame* frame;
+	int err;
 	//
-	if((data = dpipe_load_nowait(rtspParam->pipe[ch])) == NULL)
+	// frames decoded from now on need a new request
+	rtspParam->renderPending[ch].store(false);
+	if((frame = rtspParam->pendingFrame[ch].exchange(NULL)) != NULL)
 	{
-		return;
-	}
-	vframe = (AVPicture*)data->pointer;
-	//
-	if(SDL_LockTexture(rtspParam->overlay[ch], NULL, (void**)&pixels, &pitch) == 0)
-	{
-		bcopy(vframe->data[0], pixels, rtspParam->width[ch] * rtspParam->height[ch]);
-		bcopy(
-		  vframe->data[1], pixels + ((pitch * rtspParam->height[ch] * 5) >> 2), rtspParam->width[ch] * rtspParam->height[ch] / 4);
-		bcopy(vframe->data[2], pixels + pitch * rtspParam->height[ch], rtspParam->width[ch] * rtspParam->height[ch] / 4);
-		SDL_UnlockTexture(rtspParam->overlay[ch]);
+		latency_probe_detect(ch, frame->data, frame->linesize, frame->width, frame->height, frame->format);
+		// decoded picture, uploaded from the decoder's own planes
+		if(frame->format == AV_PIX_FMT_NV12)
+		{
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+			err = SDL_UpdateNVTexture(
+			  rtspParam->overlay[ch], NULL, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1]);
+#else
+			err = -1;
+#endif
+		}
+		else
+		{
+			err = SDL_UpdateYUVTexture(rtspParam->overlay[ch],
+												NULL,
+												frame->data[0],
+												frame->linesize[0],
+												frame->data[1],
+												frame->linesize[1],
+												frame->data[2],
+												frame->linesize[2]);
+		}
+		av_frame_free(&frame);
 	}
 	else
 	{
-		rtsperror("ga-client: lock textture failed - %s\n", SDL_GetError());
+		// converted picture: only the newest one is shown
+		if((data = dpipe_load_nowait(rtspParam->pipe[ch])) == NULL)
+		{
+			return;
+		}
+		while((newer = dpipe_load_nowait(rtspParam->pipe[ch])) != NULL)
+		{
+			dpipe_put(rtspParam->pipe[ch], data);
+			data = newer;
+		}
+		vframe = (AVPicture*)data->pointer;
+		latency_probe_detect(
+		  ch, vframe->data, vframe->linesize, rtspParam->width[ch], rtspParam->height[ch], AV_PIX_FMT_YUV420P);
+		err	 = SDL_UpdateYUVTexture(rtspParam->overlay[ch],
+											NULL,
+											vframe->data[0],
+											vframe->linesize[0],
+											vframe->data[1],
+											vframe->linesize[1],
+											vframe->data[2],
+											vframe->linesize[2]);
+		dpipe_put(rtspParam->pipe[ch], data);
+	}
+	if(err != 0)
+	{
+		rtsperror("ga-client: update texture failed - %s\n", SDL_GetError());
 	}
-	dpipe_put(rtspParam->pipe[ch], data);
-	rect.x = 0;
-	rect.y = 0;
-	rect.w = rtspParam->width[ch];
-	rect.h = rtspParam->height[ch];
 	SDL_RenderCopy(rtspParam->renderer[ch], rtspParam->overlay[ch], NULL, NULL);
 	SDL_RenderPresent(rtspParam->renderer[ch]);
+	latency_probe_present(ch);
 	//
 	// image_rendered = 1;
 }
@@ -731,6 +771,7 @@ int main(int argc, char** argv)
 		savefp_keyts = ga_save_init_txt(savefile_keyts);
 		rtsperror("*** SAVEFILE: key timestamp saved fo '%s'\n", savefp_keyts ? savefile_keyts : "NULL");
 	}
+	latency_probe_init();
 	//
 	rtspconf = rtspconf_global();
 	if(rtspconf_parse(rtspconf) < 0)
@@ -836,6 +877,7 @@ int main(int argc, char** argv)
 		ga_save_close(savefp_keyts);
 		savefp_keyts = NULL;
 	}
+	latency_probe_deinit();
 	SDL_Quit();
 	ga_deinit();
 }
@@ -24,10 +24,22 @@
 #include <ga/common.hpp>
 #include <ga/conf.hpp>
 #include <ga/controller.hpp>
+#include <ga/rtpfec.hpp>
 
+#include <atomic>
 #include <list>
 #include <map>
 #include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
 
 #ifdef ANDROID
 #include "android-decoders.h"
@@ -80,6 +92,9 @@ static int cf_frame[VIDEO_SOURCE_CHANNEL_MAX];
 static struct timeval cf_tv0[VIDEO_SOURCE_CHANNEL_MAX];
 static struct timeval cf_tv1[VIDEO_SOURCE_CHANNEL_MAX];
 static long long cf_interval[VIDEO_SOURCE_CHANNEL_MAX];
+static long long cf_decode_us[VIDEO_SOURCE_CHANNEL_MAX];  // time spent in the decoder
+static long long cf_decode_max[VIDEO_SOURCE_CHANNEL_MAX]; // slowest frame in this round
+static int cf_inflight[VIDEO_SOURCE_CHANNEL_MAX];			 // packets sent but not yet out
 #endif
 
 // save files
@@ -117,35 +132,26 @@ struct PacketQueue
 
 static RTSPThreadParam* rtspParam = NULL;
 static AVCodecContext* vdecoder[VIDEO_SOURCE_CHANNEL_MAX];
+// time spent in the decoder since its last output picture
+static long long vdecode_us[VIDEO_SOURCE_CHANNEL_MAX];
 static map<unsigned short, int> port2channel;
 static AVFrame* vframe[VIDEO_SOURCE_CHANNEL_MAX];
 static AVCodecContext* adecoder = NULL;
 static AVFrame* aframe			  = NULL;
 
 static int packet_queue_initialized = 0;
-static int packet_queue_limit			= 5; // limit the queue size
-static int packet_queue_dropfactor	= 2; // default drop half
 static PacketQueue audioq;
 
+static int audio_decode_init();
+static void audio_decode_deinit();
+
 void packet_queue_init(PacketQueue* q)
 {
-	int val;
-	char buf[8];
+	std::lock_guard<std::mutex> lk{q->mutex};
 	packet_queue_initialized = 1;
 	q->queue.clear();
-	if(ga_conf_readv("audio-playback-queue-limit", buf, sizeof(buf)) != NULL)
-		// must ensure that we have configured audio-playback-queue-limit
-		if((val = ga_conf_readint("audio-playback-queue-limit")) >= 0)
-			packet_queue_limit = val;
-
-	if((val = ga_conf_readint("audio-playback-queue-dropfactor")) > 0)
-		packet_queue_dropfactor = val;
-
-	ga_error("packet queue: initialized - limit %d%s; dropfactor %d%s\n",
-				packet_queue_limit,
-				packet_queue_limit <= 0 ? " (unlimited)" : "",
-				packet_queue_dropfactor,
-				packet_queue_dropfactor <= 0 ? " (no drop)" : "");
+	q->size = 0;
+	ga_error("packet queue: initialized\n");
 }
 
 int packet_queue_put(PacketQueue* q, AVPacket* pkt)
@@ -197,37 +203,6 @@ int packet_queue_get(PacketQueue* q, AVPacket* pkt, int block)
 	return ret;
 }
 
-int packet_queue_drop(PacketQueue* q)
-{
-	int dropped, count = 0;
-	AVPacket pkt;
-	// dropping enabled?
-	if(packet_queue_limit <= 0 || packet_queue_dropfactor <= 0)
-		return 0;
-
-	std::lock_guard<std::mutex> lk{q->mutex};
-
-	// queue size exceeded?
-	if(q->queue.size() <= packet_queue_limit)
-		return 0;
-
-	// start dropping
-	dropped = q->queue.size() / packet_queue_dropfactor;
-	// keep at least one
-	if(dropped == q->queue.size())
-		dropped--;
-	while(dropped-- > 0)
-	{
-		if(q->queue.size() <= 0)
-			break;
-		pkt = q->queue.front();
-		q->queue.pop_front();
-		q->size -= pkt.size;
-		count++;
-	}
-	return count;
-}
-
 UsageEnvironment& operator<<(UsageEnvironment& env, const RTSPClient& rtspClient)
 {
 	return env << "[URL:\"" << rtspClient.url() << "\"]: ";
@@ -326,6 +301,8 @@ int init_vdecoder(int channel, const char* sprop)
 	AVCodecContext* ctx;
 	AVFrame* frame;
 	const char** names = NULL;
+	char tt[64];
+	int threads, thread_type = FF_THREAD_SLICE;
 	//
 	if(channel > VIDEO_SOURCE_CHANNEL_MAX)
 	{
@@ -362,7 +339,23 @@ int init_vdecoder(int channel, const char* sprop)
 		rtsperror("video decoder(%d): cannot allocate context\n", channel);
 		return -1;
 	}
-	if(codec->capabilities & AV_CODEC_CAP_TRUNCATED)
+	// decoder threading: slice threads add no delay,
+	// while frame threads delay the output by one frame per thread
+	threads = ga_conf_readint("video-decoder-threads");
+	if(ga_conf_readv("video-decoder-thread-type", tt, sizeof(tt)) != NULL)
+	{
+		if(strcasecmp(tt, "frame") == 0)
+			thread_type = FF_THREAD_FRAME;
+		else if(strcasecmp(tt, "auto") == 0 || strcasecmp(tt, "slice+frame") == 0)
+			thread_type = FF_THREAD_SLICE | FF_THREAD_FRAME;
+		else if(strcasecmp(tt, "slice") != 0)
+			rtsperror("video decoder(%d): unknown thread type '%s', use slice.\n", channel, tt);
+	}
+	ctx->thread_count = threads > 0 ? threads : 0 /* auto */;
+	ctx->thread_type	= thread_type;
+	// whole access units are fed to the decoder, and frame threading is
+	// not available on truncated input
+	if((codec->capabilities & AV_CODEC_CAP_TRUNCATED) && (thread_type & FF_THREAD_FRAME) == 0)
 	{
 		rtsperror("video decoder(%d): codec support truncated data\n", channel);
 		ctx->flags |= AV_CODEC_FLAG_TRUNCATED;
@@ -386,7 +379,15 @@ int init_vdecoder(int channel, const char* sprop)
 		rtsperror("video decoder(%d): cannot open decoder\n", channel);
 		return -1;
 	}
-	rtsperror("video decoder(%d): codec %s (%s)\n", channel, codec->name, codec->long_name);
+	if(ctx->active_thread_type == FF_THREAD_FRAME)
+		snprintf(tt, sizeof(tt), "frame");
+	else if(ctx->active_thread_type == FF_THREAD_SLICE)
+		snprintf(tt, sizeof(tt), "slice");
+	else
+		snprintf(tt, sizeof(tt), "no");
+	rtsperror("video decoder(%d): codec %s (%s), %d thread(s), %s threading\n",
+				 channel, codec->name, codec->long_name, ctx->thread_count, tt);
+	vdecode_us[channel] = 0;
 	//
 	vdecoder[channel] = ctx;
 	vframe[channel]	= frame;
@@ -463,6 +464,16 @@ int init_adecoder()
 	}
 	rtsperror("audio decoder: codec %s (%s)\n", codec->name, codec->long_name);
 	adecoder = ctx;
+	//
+#ifdef ANDROID
+	if(rtspconf->builtin_audio_decoder == 0)
+	{
+#endif
+		if(audio_decode_init() < 0)
+			return -1;
+#ifdef ANDROID
+	}
+#endif
 	return 0;
 }
 
@@ -473,9 +484,11 @@ struct pktloss_record_t
 	/* XXX: ssrc is 32-bit, and seqnum is 16-bit */
 	int reset;					/* 1 - this record should be reset */
 	int lost;					/* count of lost packets */
+	unsigned damaged;			/* lost packets not yet taken by the frame loss report */
 	unsigned int ssrc;		/* SSRC */
 	unsigned short initseq; /* the 1st seqnum in the observation */
 	unsigned short lastseq; /* the last seqnum in the observation */
+	unsigned short highseq; /* the highest seqnum received */
 };
 
 static map<unsigned int, pktloss_record_t> _pktmap;
@@ -489,18 +502,29 @@ int pktloss_monitor_init()
 void pktloss_monitor_update(unsigned int ssrc, unsigned short seqnum)
 {
 	auto mi =  _pktmap.find(ssrc);
+	unsigned short gap;
 	if(mi == _pktmap.end())
 	{
 		pktloss_record_t r;
 		r.reset		  = 0;
 		r.lost		  = 0;
+		r.damaged	  = 0;
 		r.ssrc		  = ssrc;
 		r.initseq	  = seqnum;
 		r.lastseq	  = seqnum;
+		r.highseq	  = seqnum;
 		_pktmap[ssrc] = r;
 		return;
 	}
 
+	// lost packets, also those right before a reset of the observation
+	gap = seqnum - mi->second.highseq - 1;
+	if(gap < 0x8000)
+	{
+		mi->second.damaged += gap;
+		mi->second.highseq = seqnum;
+	}
+
 	if(mi->second.reset != 0)
 	{
 		mi->second.reset	 = 0;
@@ -537,6 +561,444 @@ int pktloss_monitor_get(unsigned int ssrc, int* count = NULL, int reset = 0)
 	return mi->second.lost;
 }
 
+int pktloss_monitor_damaged(unsigned int ssrc)
+{
+	int damaged;
+	auto mi = _pktmap.find(ssrc);
+	if(mi == _pktmap.end())
+		return 0;
+	damaged				  = mi->second.damaged;
+	mi->second.damaged = 0;
+	return damaged;
+}
+
+/*
+ * A lost packet was recovered before its frame was reassembled, so the
+ * frame is not damaged by it. It still counts as lost on the network.
+ */
+void pktloss_monitor_recovered(unsigned int ssrc, unsigned short seqnum)
+{
+	unsigned short gap;
+	auto mi = _pktmap.find(ssrc);
+	if(mi == _pktmap.end())
+		return;
+	gap = seqnum - mi->second.highseq - 1;
+	if(gap >= 0x8000)
+	{
+		// behind the highest one: its loss is already counted
+		if(mi->second.damaged > 0)
+			mi->second.damaged--;
+		return;
+	}
+	// recovered before any later packet arrived: received, but lost
+	pktloss_monitor_update(ssrc, seqnum);
+	mi->second.lost++;
+}
+
+//// NACK retransmission
+
+#define NACK_MAX_GAP			(CTRL_NACK_FCI_MAX * 17) /* larger gaps are not requested */
+#define NACK_RING				1024							 /* requests kept per stream */
+#define NACK_WAIT_MIN_US	10000						 /* minimum reordering window */
+#define NACK_WAIT_MARGIN_US 5000						 /* added to twice the retransmission RTT */
+
+#define NACK_SETTLE			64								 /* received requests waiting for a possible duplicate */
+#define NACK_FEC_WAIT_US	35000						 /* longest wait for the FEC packet of a group */
+
+#define NACK_PENDING	 1 /* requested */
+#define NACK_RECEIVED 2 /* received once: the retransmission, or a reordered original */
+#define NACK_DONE		 3 /* received or recovered, later copies are duplicates */
+#define NACK_DEFERRED 4 /* lost, to be requested if FEC does not recover it */
+
+struct nack_request_t
+{
+	int state;
+	unsigned short seq;
+	struct timeval tv;	/* time requested */
+	struct timeval rcvd; /* time received, if NACK_RECEIVED */
+};
+
+struct nack_record_t
+{
+	unsigned short rtpport; /* port the stream is received on, or 0 */
+	unsigned short highseq;
+	long long srtt;	 /* smoothed retransmission RTT in microseconds, or 0 */
+	unsigned wait;	 /* reordering window in microseconds, or 0 if not set */
+	nack_request_t req[NACK_RING];
+	unsigned short settle[NACK_SETTLE]; /* NACK_RECEIVED requests, oldest first */
+	int settlehead, settlecount;
+	unsigned short deferbase; /* oldest NACK_DEFERRED packet, if defercount > 0 */
+	int defercount;
+	struct timeval defertv; /* time the oldest was deferred */
+};
+
+static int nack_enabled		 = 0;
+static unsigned nack_maxwait = 50000;
+static map<unsigned int, nack_record_t*> nack_streams;
+
+static bool fec_active(unsigned int ssrc);
+
+static void nack_init(int enabled, unsigned maxwait)
+{
+	for(auto mi = nack_streams.begin(); mi != nack_streams.end(); mi++)
+		delete mi->second;
+	nack_streams.clear();
+	nack_enabled = enabled;
+	nack_maxwait = maxwait < NACK_WAIT_MIN_US ? NACK_WAIT_MIN_US : maxwait;
+}
+
+/*
+ * Request the packets in seqs, in order. The requests go through the
+ * control channel, so they are not sent when it is disabled.
+ */
+static void nack_request(nack_record_t* r, unsigned int ssrc, const unsigned short* seqs, int count, struct timeval tv)
+{
+	unsigned short pid[CTRL_NACK_FCI_MAX], blp[CTRL_NACK_FCI_MAX];
+	unsigned short seq, off;
+	int i, nfci = 0;
+	ctrlmsg_t m;
+	//
+	if(count <= 0 || rtspconf == NULL || rtspconf->ctrlenable == 0)
+		return;
+	for(i = 0; i < count; i++)
+	{
+		seq = seqs[i];
+		off = nfci > 0 ? seq - pid[nfci - 1] : 0;
+		if(off > 0 && off <= 16)
+		{
+			blp[nfci - 1] |= 1 << (off - 1);
+		}
+		else
+		{
+			if(nfci == CTRL_NACK_FCI_MAX)
+				break;
+			pid[nfci] = seq;
+			blp[nfci] = 0;
+			nfci++;
+		}
+		r->req[seq % NACK_RING].state = NACK_PENDING;
+		r->req[seq % NACK_RING].seq	= seq;
+		r->req[seq % NACK_RING].tv		= tv;
+	}
+	ctrlsys_nack(&m, ssrc, r->rtpport, nfci, pid, blp);
+	ctrl_client_sendmsg(&m, CTRL_NACK_SIZE(nfci));
+}
+
+/*
+ * Request the lost packets that FEC did not recover. Called when the
+ * FEC packet of their group arrived, or did not arrive in time.
+ */
+static void nack_flush(nack_record_t* r, unsigned int ssrc, struct timeval tv)
+{
+	unsigned short seqs[NACK_MAX_GAP], seq;
+	unsigned short span = r->highseq - r->deferbase;
+	int i, count = 0;
+	//
+	if(r->defercount == 0)
+		return;
+	for(i = 0; i <= span && i < NACK_RING && count < NACK_MAX_GAP; i++)
+	{
+		seq = r->deferbase + i;
+		if(r->req[seq % NACK_RING].state == NACK_DEFERRED && r->req[seq % NACK_RING].seq == seq)
+			seqs[count++] = seq;
+	}
+	r->defercount = 0;
+	nack_request(r, ssrc, seqs, count, tv);
+}
+
+/*
+ * Request the packets from first to first + count - 1. When the server
+ * sends FEC, wait for the FEC packet of their group first.
+ */
+static void nack_lost(nack_record_t* r, unsigned int ssrc, unsigned short first, int count, struct timeval tv)
+{
+	unsigned short seqs[NACK_MAX_GAP], seq;
+	int i;
+	//
+	if(fec_active(ssrc) == false)
+	{
+		for(i = 0; i < count; i++)
+			seqs[i] = first + i;
+		nack_request(r, ssrc, seqs, count, tv);
+		return;
+	}
+	for(i = 0; i < count; i++)
+	{
+		seq									= first + i;
+		r->req[seq % NACK_RING].state = NACK_DEFERRED;
+		r->req[seq % NACK_RING].seq	= seq;
+		r->req[seq % NACK_RING].tv		= tv;
+	}
+	if(r->defercount == 0)
+	{
+		r->deferbase = first;
+		r->defertv	 = tv;
+	}
+	r->defercount += count;
+}
+
+/*
+ * Keep the reordering window just above the time a retransmission takes,
+ * so that frames do not wait longer for packets that are not coming.
+ */
+static void nack_adapt_wait(RTPSource* source, nack_record_t* r)
+{
+	long long wait = 2 * r->srtt + NACK_WAIT_MARGIN_US;
+	if(wait < NACK_WAIT_MIN_US)
+		wait = NACK_WAIT_MIN_US;
+	if(wait > nack_maxwait)
+		wait = nack_maxwait;
+	if(source == NULL || (r->wait != 0 && llabs(wait - (long long)r->wait) < 1000))
+		return;
+	source->setPacketReorderingThresholdTime(wait);
+	rtsperror("rtp-nack: retransmission rtt = %.1fms, reordering window = %.1fms\n", r->srtt / 1000.0, wait / 1000.0);
+	r->wait = wait;
+}
+
+/*
+ * Take the retransmission RTT of a request received at rcvd.
+ */
+static void nack_sample(RTPSource* source, nack_record_t* r, nack_request_t* q, struct timeval* rcvd)
+{
+	long long rtt = tvdiff_us(rcvd, &q->tv);
+	r->srtt		  = r->srtt == 0 ? rtt : (7 * r->srtt + rtt) / 8;
+	q->state		  = NACK_DONE;
+	nack_adapt_wait(source, r);
+}
+
+/*
+ * A requested packet received once may be a reordered original, with the
+ * retransmission still to come. Its RTT is taken only when no second copy
+ * arrived within the longest reordering window.
+ */
+static void nack_settle(RTPSource* source, nack_record_t* r, struct timeval tv)
+{
+	nack_request_t* q;
+	while(r->settlecount > 0)
+	{
+		q = &r->req[r->settle[r->settlehead] % NACK_RING];
+		if(q->state == NACK_RECEIVED && q->seq == r->settle[r->settlehead])
+		{
+			if(tvdiff_us(&tv, &q->rcvd) < nack_maxwait)
+				break;
+			nack_sample(source, r, q, &q->rcvd);
+		}
+		r->settlehead = (r->settlehead + 1) % NACK_SETTLE;
+		r->settlecount--;
+	}
+}
+
+/*
+ * Request the packets lost before a received one. A packet recovered by
+ * FEC takes no RTT sample, and its retransmission will be a duplicate.
+ * Returns 1 if the packet fills a reported loss, -1 if it is behind the
+ * highest sequence number otherwise (a duplicate, or a packet not
+ * requested), or 0 if it is a new packet. Only new packets are to be
+ * counted in the loss and bandwidth estimates.
+ */
+static int nack_update(RTPSource* source, unsigned int ssrc, unsigned short seq, struct timeval tv, int recovered = 0)
+{
+	nack_record_t* r;
+	nack_request_t* q;
+	unsigned short gap;
+	//
+	if(nack_enabled == 0)
+		return 0;
+	auto mi = nack_streams.find(ssrc);
+	if(mi == nack_streams.end())
+	{
+		r						 = new nack_record_t();
+		r->highseq			 = seq;
+		r->rtpport			 = source != NULL ? ntohs(source->RTPgs()->port().num()) : 0;
+		nack_streams[ssrc] = r;
+		return 0;
+	}
+	r = mi->second;
+	nack_settle(source, r, tv);
+	if(r->defercount > 0 && tvdiff_us(&tv, &r->defertv) >= NACK_FEC_WAIT_US)
+		nack_flush(r, ssrc, tv);
+	gap = seq - r->highseq - 1;
+	if(gap < 0x8000)
+	{
+		if(gap > 0 && gap <= NACK_MAX_GAP)
+			nack_lost(r, ssrc, r->highseq + 1, gap, tv);
+		r->highseq = seq;
+		return 0;
+	}
+	q = &r->req[seq % NACK_RING];
+	if(q->seq != seq || q->state == NACK_DONE || q->state == 0)
+		return -1;
+	if(q->state == NACK_DEFERRED)
+	{
+		// recovered, or reordered, before it was requested
+		q->state = NACK_DONE;
+		return 1;
+	}
+	if(q->state == NACK_RECEIVED)
+	{
+		// the first copy was the reordered original
+		if(recovered == 0)
+			nack_sample(source, r, q, &tv);
+		return -1;
+	}
+	if(recovered)
+	{
+		q->state = NACK_DONE;
+		return 1;
+	}
+	q->state = NACK_RECEIVED;
+	q->rcvd	= tv;
+	if(r->settlecount == NACK_SETTLE)
+	{
+		nack_request_t* oldest = &r->req[r->settle[r->settlehead] % NACK_RING];
+		if(oldest->state == NACK_RECEIVED && oldest->seq == r->settle[r->settlehead])
+			nack_sample(source, r, oldest, &oldest->rcvd);
+		r->settlehead = (r->settlehead + 1) % NACK_SETTLE;
+		r->settlecount--;
+	}
+	r->settle[(r->settlehead + r->settlecount) % NACK_SETTLE] = seq;
+	r->settlecount++;
+	return 1;
+}
+
+//// forward error correction
+
+static int fec_pt = -1; /* payload type of the FEC packets, -1 if disabled */
+static map<unsigned int, rtpfec_decoder_t*> fec_decoders;
+
+static void fec_init(int pt)
+{
+	for(auto mi = fec_decoders.begin(); mi != fec_decoders.end(); mi++)
+		rtpfec_decoder_destroy(mi->second);
+	fec_decoders.clear();
+	fec_pt = pt;
+}
+
+/*
+ * The server sends FEC packets for the stream.
+ */
+static bool fec_active(unsigned int ssrc) { return fec_decoders.find(ssrc) != fec_decoders.end(); }
+
+/*
+ * The FEC packet of a group arrived: request the lost packets it did not
+ * recover.
+ */
+static void fec_passed(unsigned int ssrc, struct timeval tv)
+{
+	auto mi = nack_streams.find(ssrc);
+	if(nack_enabled && mi != nack_streams.end())
+		nack_flush(mi->second, ssrc, tv);
+}
+
+/*
+ * Keep a media packet for recovery. The packets of a stream are kept only
+ * after its first FEC packet, i.e., if the server sends them.
+ */
+static void fec_keep(unsigned int ssrc, const unsigned char* packet, unsigned packetSize)
+{
+	auto mi = fec_decoders.find(ssrc);
+	if(mi != fec_decoders.end())
+		rtpfec_decoder_put(mi->second, packet, packetSize);
+}
+
+/*
+ * Recover the lost media packet of a FEC packet's group, in place.
+ * Returns true if the buffer now holds the recovered packet.
+ */
+static bool fec_recover(unsigned int ssrc, unsigned char* packet, unsigned& packetSize)
+{
+	rtpfec_decoder_t* d;
+	int len;
+	//
+	auto mi = fec_decoders.find(ssrc);
+	if(mi == fec_decoders.end())
+	{
+		if((d = rtpfec_decoder_create()) != NULL)
+			fec_decoders[ssrc] = d;
+		return false;
+	}
+	d = mi->second;
+	if((len = rtpfec_decoder_recover(d, packet, packetSize, packet, packetSize)) <= 0)
+		return false;
+	packetSize = len;
+	if(d->recovered % 100 == 1)
+		rtsperror("rtp-fec: ssrc %08x, %u packets recovered, %u unrecoverable groups\n", ssrc, d->recovered, d->unrecoverable);
+	return true;
+}
+
+//// frame loss report
+
+#define FRAMELOSS_REPEAT_US 100000 /* minimum interval between reports */
+#define FRAMELOSS_HOLD_US	 300000 /* frames after a reported loss may still reference the lost ones */
+
+struct frameloss_state_t
+{
+	bool damaged;					/* packets of the current frame are lost */
+	bool havegood;					/* lastgood is valid */
+	unsigned pktloss;				/* lost packets not yet reported */
+	unsigned reports;				/* reports sent */
+	struct timeval curframe;	/* presentation time of the current frame */
+	struct timeval lastgood;	/* presentation time of the last frame received intact */
+	struct timeval lossframe;	/* presentation time of the frame of the last report */
+	struct timeval reporttime; /* wall-clock time of the last report */
+};
+
+static int frameloss_report = 0;
+static frameloss_state_t frameloss_ctx[VIDEO_SOURCE_CHANNEL_MAX];
+
+static void frameloss_init(int enabled)
+{
+	bzero(frameloss_ctx, sizeof(frameloss_ctx));
+	frameloss_report = enabled;
+}
+
+/*
+ * Track the intact frames of a video channel, and report lost packets to
+ * the server, which then stops referencing the frames after the last intact
+ * one. Called for each received NAL unit.
+ */
+static void frameloss_update(int channel, unsigned int ssrc, struct timeval ptv, bool marker, bool synced)
+{
+	frameloss_state_t* f = &frameloss_ctx[channel];
+	int lost				  = pktloss_monitor_damaged(ssrc);
+	struct timeval now;
+	ctrlmsg_t m;
+	//
+	if(ptv.tv_sec != f->curframe.tv_sec || ptv.tv_usec != f->curframe.tv_usec)
+	{
+		f->curframe = ptv;
+		f->damaged	= false;
+	}
+	// the lost packets belong to this frame or to an incomplete previous one
+	if(lost > 0)
+	{
+		f->damaged = true;
+		f->pktloss += lost;
+	}
+	if(marker && !f->damaged && (f->reports == 0 || tvdiff_us(&ptv, &f->lossframe) >= FRAMELOSS_HOLD_US))
+	{
+		f->lastgood = ptv;
+		f->havegood = true;
+	}
+	if(f->pktloss == 0)
+		return;
+	gettimeofday(&now, NULL);
+	if(f->reports > 0 && tvdiff_us(&now, &f->reporttime) < FRAMELOSS_REPEAT_US)
+		return;
+	ctrlsys_frameloss(&m, channel, synced, f->pktloss, f->havegood ? &f->lastgood : NULL);
+	ctrl_client_sendmsg(&m, sizeof(ctrlmsg_system_frameloss_t));
+	rtsperror("frame-loss: ch%d %u packets lost, last intact frame %u.%06u%s\n",
+				 channel,
+				 f->pktloss,
+				 (unsigned)f->lastgood.tv_sec,
+				 (unsigned)f->lastgood.tv_usec,
+				 synced ? "" : " (not synchronized)");
+	f->lossframe  = ptv;
+	f->reporttime = now;
+	f->reports++;
+	f->pktloss = 0;
+}
+
 //// bandwidth estimator
 
 struct bwe_record_t
@@ -672,9 +1134,26 @@ void rtp_packet_handler(void* clientData, unsigned char* packet, unsigned& packe
 	unsigned short flags;
 	unsigned int timestamp;
 	struct timeval tv;
+	int late;
 
 	if(packet == NULL || packetSize < 12)
 		return;
+	// live555 drops the FEC packets for their payload type
+	if((packet[1] & 0x7f) == fec_pt)
+	{
+		ssrc = ntohl(rtp->ssrc);
+		gettimeofday(&tv, NULL);
+		if(fec_recover(ssrc, packet, packetSize))
+		{
+			// as if received, but not sampled for RTT or bandwidth
+			seqnum = ntohs(rtp->seqnum);
+			if(nack_update((RTPSource*)clientData, ssrc, seqnum, tv, 1) >= 0)
+				pktloss_monitor_recovered(ssrc, seqnum);
+		}
+		fec_passed(ssrc, tv);
+		return;
+	}
+	fec_keep(ntohl(rtp->ssrc), packet, packetSize);
 
 	gettimeofday(&tv, NULL);
 	ssrc		 = ntohl(rtp->ssrc);
@@ -697,11 +1176,42 @@ void rtp_packet_handler(void* clientData, unsigned char* packet, unsigned& packe
 		ga_log("log_rtp: flags %04x seq %u ts %u ssrc %u size %u\n", flags, seqnum, timestamp, ssrc, packetSize);
 #endif
 	}
+	// retransmissions are already counted as lost, and packets behind the
+	// highest sequence number would be counted as a wrap-around
+	if((late = nack_update((RTPSource*)clientData, ssrc, seqnum, tv)) != 0)
+	{
+		if(late > 0)
+			pktloss_monitor_recovered(ssrc, seqnum);
+		return;
+	}
 	//
 	bandwidth_estimator_update(ssrc, seqnum, tv, timestamp, packetSize);
 	pktloss_monitor_update(ssrc, seqnum);
 }
 
+/*
+ * Audio packets are only protected by FEC and retransmissions, and not
+ * counted in the network reports.
+ */
+void rtp_audio_packet_handler(void* clientData, unsigned char* packet, unsigned& packetSize)
+{
+	auto rtp = (rtp_pkt_minimum_t*)packet;
+	struct timeval tv;
+	unsigned int ssrc;
+	if(packet == NULL || packetSize < 12)
+		return;
+	ssrc = ntohl(rtp->ssrc);
+	gettimeofday(&tv, NULL);
+	if((packet[1] & 0x7f) == fec_pt)
+	{
+		if(fec_recover(ssrc, packet, packetSize))
+			nack_update((RTPSource*)clientData, ssrc, ntohs(rtp->seqnum), tv, 1);
+		return;
+	}
+	fec_keep(ssrc, packet, packetSize);
+	nack_update((RTPSource*)clientData, ssrc, ntohs(rtp->seqnum), tv);
+}
+
 //// drop frame feature
 
 struct drop_vframe_t
@@ -795,10 +1305,34 @@ static int drop_video_frame(int ch /*channel*/, unsigned char* buffer, int bufsi
 
 ////
 
-static int play_video_priv(int ch /*channel*/, unsigned char* buffer, int bufsize, struct timeval pts)
+#ifndef ANDROID
+/**
+ * Ask the renderer to show the newest picture of a channel.
+ * At most one request per channel is queued at any time.
+ */
+static void request_render(int ch /*channel*/)
+{
+	union SDL_Event evt;
+	//
+	if(rtspParam->renderPending[ch].exchange(true))
+		return;
+	bzero(&evt, sizeof(evt));
+	evt.user.type = SDL_USEREVENT;
+	evt.user.timestamp = time(0);
+	evt.user.code = SDL_USEREVENT_RENDER_IMAGE;
+	evt.user.data1 = rtspParam;
+	evt.user.data2 = (void*)ch;
+	SDL_PushEvent(&evt);
+}
+#endif
+
+/**
+ * Hand a decoded picture to the renderer: by reference when the texture
+ * can take it as-is, otherwise converted into the channel's pipe.
+ * Returns -1 on fatal error.
+ */
+static int render_video_frame(int ch /*channel*/)
 {
-	AVPacket avpkt;
-	int got_picture, len;
 #ifndef ANDROID
 	union SDL_Event evt;
 #endif
@@ -806,6 +1340,156 @@ static int play_video_priv(int ch /*channel*/, unsigned char* buffer, int bufsiz
 	AVPicture* dstframe	= NULL;
 	struct timeval ftv;
 	static unsigned fcount = 0;
+	//
+#ifdef COUNT_FRAME_RATE
+	cf_frame[ch]++;
+	if(cf_tv0[ch].tv_sec == 0)
+		gettimeofday(&cf_tv0[ch], NULL);
+
+	if(cf_frame[ch] == COUNT_FRAME_RATE)
+	{
+		gettimeofday(&cf_tv1[ch], NULL);
+		cf_interval[ch] = tvdiff_us(&cf_tv1[ch], &cf_tv0[ch]);
+		rtsperror("# %u.%06u player frame rate: decoder %d @ %.4f fps, decode %.3f ms/frame (max %.3f ms), %d frame(s) in flight\n",
+					 cf_tv1[ch].tv_sec,
+					 cf_tv1[ch].tv_usec,
+					 ch,
+					 1000000.0 * cf_frame[ch] / cf_interval[ch],
+					 cf_decode_us[ch] / 1000.0 / cf_frame[ch],
+					 cf_decode_max[ch] / 1000.0,
+					 cf_inflight[ch]);
+		cf_tv0[ch]		  = cf_tv1[ch];
+		cf_frame[ch]	  = 0;
+		cf_decode_us[ch]  = 0;
+		cf_decode_max[ch] = 0;
+	}
+#endif
+	// create surface & bitmap for the first time
+	std::lock_guard<std::mutex> lk{rtspParam->surfaceMutex[ch]};
+	if(rtspParam->swsctx[ch] == NULL)
+	{
+		rtspParam->width[ch]	 = vframe[ch]->width;
+		rtspParam->height[ch] = vframe[ch]->height;
+		rtspParam->format[ch] = (AVPixelFormat)vframe[ch]->format;
+#ifdef ANDROID
+		create_overlay(ch, vframe[0]->width, vframe[0]->height, (AVPixelFormat)vframe[0]->format);
+#else
+		bzero(&evt, sizeof(evt));
+		evt.user.type = SDL_USEREVENT;
+		evt.user.timestamp = time(0);
+		evt.user.code = SDL_USEREVENT_CREATE_OVERLAY;
+		evt.user.data1 = rtspParam;
+		evt.user.data2 = (void*)ch;
+		SDL_PushEvent(&evt);
+		// skip the initial frame:
+		// for event handler to create/setup surfaces
+		return 0;
+#endif
+	}
+#ifndef ANDROID
+	// no conversion needed: pass a new reference to the decoded picture,
+	// replacing the one the renderer has not picked up yet
+	if(vframe[ch]->width == rtspParam->width[ch] && vframe[ch]->height == rtspParam->height[ch] &&
+		vframe[ch]->format == rtspParam->format[ch] &&
+		rtsp_texture_format((AVPixelFormat)vframe[ch]->format) != SDL_PIXELFORMAT_UNKNOWN)
+	{
+		AVFrame* frame;
+		if((frame = av_frame_clone(vframe[ch])) != NULL)
+		{
+			if((frame = rtspParam->pendingFrame[ch].exchange(frame)) != NULL)
+				av_frame_free(&frame);
+			if(ch == 0 && savefp_yuv != NULL && vframe[0]->format != AV_PIX_FMT_NV12)
+			{
+				ga_save_yuv420p(savefp_yuv, vframe[0]->width, vframe[0]->height, vframe[0]->data, vframe[0]->linesize);
+				if(savefp_yuvts != NULL)
+				{
+					gettimeofday(&ftv, NULL);
+					ga_save_printf(savefp_yuvts, "Frame #%08d: %u.%06u\n", fcount++, ftv.tv_sec, ftv.tv_usec);
+				}
+			}
+			request_render(ch);
+			return 0;
+		}
+	}
+#endif
+	// copy into pool
+	data		= dpipe_get(rtspParam->pipe[ch]);
+	dstframe = (AVPicture*)data->pointer;
+	// do scaling
+	if(vframe[ch]->width == rtspParam->width[ch] && vframe[ch]->height == rtspParam->height[ch] &&
+		vframe[ch]->format == rtspParam->format[ch])
+	{
+		/* fast path? no lookup on converter */
+		sws_scale(rtspParam->swsctx[ch],
+					 // source: decoded frame
+					 vframe[ch]->data,
+					 vframe[ch]->linesize,
+					 0,
+					 vframe[ch]->height,
+					 // destination: texture
+					 dstframe->data,
+					 dstframe->linesize);
+	}
+	else
+	{
+		/* slower path - need to lookup converter */
+		SwsContext* swsctx;
+		if((swsctx = create_frame_converter(vframe[ch]->width,
+														vframe[ch]->height,
+														(AVPixelFormat)vframe[ch]->format,
+														rtspParam->width[ch],
+														rtspParam->height[ch],
+#ifdef ANDROID
+														PIX_FMT_RGB565
+#else
+														(AVPixelFormat)rtspParam->format[ch]
+#endif
+														)) == NULL)
+		{
+			ga_error("*** FATAL *** Create frame converter failed.\n");
+#ifdef ANDROID
+			rtspParam->quitLive555 = 1;
+			return -1;
+#else
+			exit(-1);
+#endif
+		}
+		sws_scale(swsctx,
+					 // source: decoded frame
+					 vframe[ch]->data,
+					 vframe[ch]->linesize,
+					 0,
+					 vframe[ch]->height,
+					 // destination: texture
+					 dstframe->data,
+					 dstframe->linesize);
+	}
+	if(ch == 0 && savefp_yuv != NULL)
+	{
+		ga_save_yuv420p(savefp_yuv, vframe[0]->width, vframe[0]->height, dstframe->data, dstframe->linesize);
+		if(savefp_yuvts != NULL)
+		{
+			gettimeofday(&ftv, NULL);
+			ga_save_printf(savefp_yuvts, "Frame #%08d: %u.%06u\n", fcount++, ftv.tv_sec, ftv.tv_usec);
+		}
+	}
+	dpipe_store(rtspParam->pipe[ch], data);
+	// request to render it
+#ifdef ANDROID
+	requestRender(rtspParam->jnienv);
+#else
+	request_render(ch);
+#endif
+	return 0;
+}
+
+static int play_video_priv(int ch /*channel*/, unsigned char* buffer, int bufsize, struct timeval pts)
+{
+	AVPacket avpkt;
+	AVCodecContext* ctx = vdecoder[ch];
+	struct timeval dtv0, dtv1;
+	int err, frames = 0;
+	bool sent = false;
 #ifdef PRINT_LATENCY
 	static struct timeval btv0 = {0, 0};
 	struct timeval ptv0, ptv1, btv1;
@@ -828,7 +1512,7 @@ static int play_video_priv(int ch /*channel*/, unsigned char* buffer, int bufsiz
 #endif
 	// drop the frame?
 	if(drop_video_frame(ch, buffer, bufsize, pts))
-		return bufsize;
+		return 0;
 
 #ifdef SAVE_ENC
 	if(fout != NULL)
@@ -838,143 +1522,51 @@ static int play_video_priv(int ch /*channel*/, unsigned char* buffer, int bufsiz
 	av_init_packet(&avpkt);
 	avpkt.size = bufsize;
 	avpkt.data = buffer;
-
-	while(avpkt.size > 0)
-	{
 #ifdef PRINT_LATENCY
-		gettimeofday(&ptv0, NULL);
+	gettimeofday(&ptv0, NULL);
+#endif
+	// the decoder may refuse a packet until pending pictures are drained
+	while(!sent)
+	{
+		gettimeofday(&dtv0, NULL);
+		if((err = avcodec_send_packet(ctx, &avpkt)) == 0)
+		{
+			sent = true;
+#ifdef COUNT_FRAME_RATE
+			cf_inflight[ch]++;
 #endif
-		if((len = avcodec_decode_video2(vdecoder[ch], vframe[ch], &got_picture, &avpkt)) < 0)
+		}
+		else if(err != AVERROR(EAGAIN))
 		{
 			// rtsperror("decode video frame %d error\n", frame);
-			break;
+			sent = true;
 		}
-		if(got_picture)
+		while((err = avcodec_receive_frame(ctx, vframe[ch])) == 0)
 		{
+			gettimeofday(&dtv1, NULL);
+			vdecode_us[ch] += tvdiff_us(&dtv1, &dtv0);
 #ifdef COUNT_FRAME_RATE
-			cf_frame[ch]++;
-			if(cf_tv0[ch].tv_sec == 0)
-				gettimeofday(&cf_tv0[ch], NULL);
-
-			if(cf_frame[ch] == COUNT_FRAME_RATE)
-			{
-				gettimeofday(&cf_tv1[ch], NULL);
-				cf_interval[ch] = tvdiff_us(&cf_tv1[ch], &cf_tv0[ch]);
-				rtsperror("# %u.%06u player frame rate: decoder %d @ %.4f fps\n",
-							 cf_tv1[ch].tv_sec,
-							 cf_tv1[ch].tv_usec,
-							 ch,
-							 1000000.0 * cf_frame[ch] / cf_interval[ch]);
-				cf_tv0[ch]	 = cf_tv1[ch];
-				cf_frame[ch] = 0;
-			}
-#endif
-			// create surface & bitmap for the first time
-			std::lock_guard<std::mutex> lk{rtspParam->surfaceMutex[ch]};
-			if(rtspParam->swsctx[ch] == NULL)
-			{
-				rtspParam->width[ch]	 = vframe[ch]->width;
-				rtspParam->height[ch] = vframe[ch]->height;
-				rtspParam->format[ch] = (AVPixelFormat)vframe[ch]->format;
-#ifdef ANDROID
-				create_overlay(ch, vframe[0]->width, vframe[0]->height, (AVPixelFormat)vframe[0]->format);
-#else
-				bzero(&evt, sizeof(evt));
-				evt.user.type = SDL_USEREVENT;
-				evt.user.timestamp = time(0);
-				evt.user.code = SDL_USEREVENT_CREATE_OVERLAY;
-				evt.user.data1 = rtspParam;
-				evt.user.data2 = (void*)ch;
-				SDL_PushEvent(&evt);
-				// skip the initial frame:
-				// for event handler to create/setup surfaces
-				goto skip_frame;
+			cf_inflight[ch]--;
+			cf_decode_us[ch] += vdecode_us[ch];
+			if(vdecode_us[ch] > cf_decode_max[ch])
+				cf_decode_max[ch] = vdecode_us[ch];
 #endif
-			}
-			// copy into pool
-			data		= dpipe_get(rtspParam->pipe[ch]);
-			dstframe = (AVPicture*)data->pointer;
-			// do scaling
-			if(vframe[ch]->width == rtspParam->width[ch] && vframe[ch]->height == rtspParam->height[ch] &&
-				vframe[ch]->format == rtspParam->format[ch])
-			{
-				/* fast path? no lookup on converter */
-				sws_scale(rtspParam->swsctx[ch],
-							 // source: decoded frame
-							 vframe[ch]->data,
-							 vframe[ch]->linesize,
-							 0,
-							 vframe[ch]->height,
-							 // destination: texture
-							 dstframe->data,
-							 dstframe->linesize);
-			}
-			else
-			{
-				/* slower path - need to lookup converter */
-				SwsContext* swsctx;
-				if((swsctx = create_frame_converter(vframe[ch]->width,
-																vframe[ch]->height,
-																(AVPixelFormat)vframe[ch]->format,
-																rtspParam->width[ch],
-																rtspParam->height[ch],
-#ifdef ANDROID
-																PIX_FMT_RGB565
-#else
-																(AVPixelFormat)rtspParam->format[ch]
-#endif
-																)) == NULL)
-				{
-					ga_error("*** FATAL *** Create frame converter failed.\n");
-#ifdef ANDROID
-					rtspParam->quitLive555 = 1;
-					return -1;
-#else
-					exit(-1);
-#endif
-				}
-				sws_scale(swsctx,
-							 // source: decoded frame
-							 vframe[ch]->data,
-							 vframe[ch]->linesize,
-							 0,
-							 vframe[ch]->height,
-							 // destination: texture
-							 dstframe->data,
-							 dstframe->linesize);
-			}
-			if(ch == 0 && savefp_yuv != NULL)
-			{
-				ga_save_yuv420p(savefp_yuv, vframe[0]->width, vframe[0]->height, dstframe->data, dstframe->linesize);
-				if(savefp_yuvts != NULL)
-				{
-					gettimeofday(&ftv, NULL);
-					ga_save_printf(savefp_yuvts, "Frame #%08d: %u.%06u\n", fcount++, ftv.tv_sec, ftv.tv_usec);
-				}
-			}
-			dpipe_store(rtspParam->pipe[ch], data);
-			// request to render it
+			vdecode_us[ch] = 0;
+			frames++;
+			if(render_video_frame(ch) < 0)
+				return -1;
 #ifdef PRINT_LATENCY
 			gettimeofday(&ptv1, NULL);
 			ga_aggregated_print(0x8001, 601, tvdiff_us(&ptv1, &ptv0));
 #endif
-#ifdef ANDROID
-			requestRender(rtspParam->jnienv);
-#else
-			bzero(&evt, sizeof(evt));
-			evt.user.type = SDL_USEREVENT;
-			evt.user.timestamp = time(0);
-			evt.user.code = SDL_USEREVENT_RENDER_IMAGE;
-			evt.user.data1 = rtspParam;
-			evt.user.data2 = (void*)ch;
-			SDL_PushEvent(&evt);
-#endif
+			gettimeofday(&dtv0, NULL);
 		}
-	skip_frame:
-		avpkt.size -= len;
-		avpkt.data += len;
+		gettimeofday(&dtv1, NULL);
+		vdecode_us[ch] += tvdiff_us(&dtv1, &dtv0);
+		if(err != AVERROR(EAGAIN))
+			break;
 	}
-	return avpkt.size;
+	return frames;
 }
 
 #define PRIVATE_BUFFER_SIZE 1048576
@@ -1024,10 +1616,195 @@ adb_failed:
 	return -1;
 }
 
+//// per-channel decode stage
+
+#define VIDEO_DECODE_QUEUE_DEFAULT 8
+#define VIDEO_DECODE_QUEUE_MAX	  64
+
+/**
+ * A reassembled access unit waiting to be decoded.
+ * The buffer is grown on demand and keeps AV_INPUT_BUFFER_PADDING_SIZE
+ * zeroed bytes at the end, as required by the decoders.
+ */
+struct video_au
+{
+	unsigned char* data;
+	unsigned int capacity;
+	unsigned int size;
+	struct timeval pts;
+};
+
+/**
+ * Bounded single-producer/single-consumer queue of access units.
+ * The live555 event loop is the only producer and the channel's decode
+ * thread the only consumer, so head/tail need no lock. The decode thread
+ * sleeps on \a seq when the queue is empty.
+ */
+struct video_decode_queue
+{
+	struct video_au au[VIDEO_DECODE_QUEUE_MAX];
+	unsigned int depth;
+	std::atomic<unsigned int> head; // next slot to pop, owned by the decoder
+	std::atomic<unsigned int> tail; // next slot to push, owned by the event loop
+	std::atomic<unsigned int> seq;  // push sequence, also the futex word
+	std::atomic<int> waiters;
+	std::atomic<bool> quit;
+#ifndef __linux__
+	std::mutex cond_mutex;
+	std::condition_variable cond;
+#endif
+	std::thread thread;
+	bool threaded;
+	unsigned long long dropped;
+};
+
+static struct video_decode_queue vdq[VIDEO_SOURCE_CHANNEL_MAX];
+static bool video_decode_threaded	 = true;
+static unsigned int video_decode_depth = VIDEO_DECODE_QUEUE_DEFAULT;
+
+static void video_decode_notify(struct video_decode_queue* q)
+{
+	q->seq.fetch_add(1, std::memory_order_seq_cst);
+	if(q->waiters.load(std::memory_order_seq_cst) == 0)
+		return;
+#ifdef __linux__
+	syscall(SYS_futex, (int*)&q->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	{
+		std::lock_guard<std::mutex> lk{q->cond_mutex};
+	}
+	q->cond.notify_one();
+#endif
+}
+
+static void video_decode_wait(struct video_decode_queue* q, unsigned int seq)
+{
+#ifdef __linux__
+	syscall(SYS_futex, (int*)&q->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+	std::unique_lock<std::mutex> lk{q->cond_mutex};
+	q->cond.wait(lk, [q, seq] { return q->seq.load(std::memory_order_seq_cst) != seq; });
+#endif
+}
+
+static void video_decode_threadproc(int ch)
+{
+	struct video_decode_queue* q = &vdq[ch];
+	unsigned int head			  = q->head.load(std::memory_order_relaxed);
+	//
+	rtsperror("video decoder thread started (channel %d, queue depth %u).\n", ch, q->depth);
+	while(true)
+	{
+		unsigned int seq = q->seq.load(std::memory_order_seq_cst);
+		if(head == q->tail.load(std::memory_order_acquire))
+		{
+			if(q->quit.load(std::memory_order_acquire))
+				break;
+			q->waiters.fetch_add(1, std::memory_order_seq_cst);
+			if(head == q->tail.load(std::memory_order_seq_cst) && !q->quit.load(std::memory_order_seq_cst))
+				video_decode_wait(q, seq);
+			q->waiters.fetch_sub(1, std::memory_order_seq_cst);
+			continue;
+		}
+		struct video_au* au = &q->au[head % q->depth];
+		play_video_priv(ch, au->data, au->size, au->pts);
+		q->head.store(++head, std::memory_order_release);
+	}
+	rtsperror("video decoder thread terminated (channel %d, %llu access units dropped).\n", ch, q->dropped);
+}
+
+/**
+ * Hand a reassembled access unit to the decode stage. Called only from
+ * the live555 event loop, which never waits for the decoder: when the
+ * queue is full the access unit is dropped.
+ */
+static void video_decode_enqueue(int ch, unsigned char* buffer, int bufsize, struct timeval pts)
+{
+	struct video_decode_queue* q = &vdq[ch];
+	unsigned int tail;
+	struct video_au* au;
+	//
+	if(!video_decode_threaded)
+	{
+		play_video_priv(ch, buffer, bufsize, pts);
+		return;
+	}
+	if(!q->threaded)
+	{
+		q->depth = video_decode_depth;
+		q->head.store(0);
+		q->tail.store(0);
+		q->seq.store(0);
+		q->waiters.store(0);
+		q->quit.store(false);
+		q->dropped = 0;
+		std::thread{video_decode_threadproc, ch}.swap(q->thread);
+		q->threaded = true;
+	}
+	tail = q->tail.load(std::memory_order_relaxed);
+	if(tail - q->head.load(std::memory_order_acquire) >= q->depth)
+	{
+		if((q->dropped++ % 100) == 0)
+			rtsperror("WARNING: video decode queue full (channel %d), %llu access units dropped.\n", ch, q->dropped);
+		return;
+	}
+	au = &q->au[tail % q->depth];
+	av_fast_padded_malloc(&au->data, &au->capacity, bufsize);
+	if(au->data == NULL)
+	{
+		rtsperror("FATAL: cannot allocate access unit buffer (%d:%d bytes).\n", ch, bufsize);
+		au->capacity = 0;
+		return;
+	}
+	bcopy(buffer, au->data, bufsize);
+	au->size = bufsize;
+	au->pts	= pts;
+	q->tail.store(tail + 1, std::memory_order_release);
+	video_decode_notify(q);
+}
+
+static void video_decode_init()
+{
+	int depth;
+	//
+	video_decode_threaded = ga_conf_readbool("video-decode-thread", 1) != 0;
+#ifdef ANDROID
+	// rendering requests are bound to the JNI environment of the live555 thread
+	video_decode_threaded = false;
+#endif
+	depth = ga_conf_readint("video-decode-queue");
+	if(depth <= 0)
+		depth = VIDEO_DECODE_QUEUE_DEFAULT;
+	if(depth > VIDEO_DECODE_QUEUE_MAX)
+		depth = VIDEO_DECODE_QUEUE_MAX;
+	video_decode_depth = depth;
+	rtsperror("video decode: %s, queue depth = %u\n",
+				 video_decode_threaded ? "threaded" : "inline", video_decode_depth);
+}
+
+static void video_decode_deinit()
+{
+	for(int i = 0; i < VIDEO_SOURCE_CHANNEL_MAX; i++)
+	{
+		struct video_decode_queue* q = &vdq[i];
+		if(q->threaded)
+		{
+			q->quit.store(true, std::memory_order_seq_cst);
+			video_decode_notify(q);
+			q->thread.join();
+			q->threaded = false;
+		}
+		for(int j = 0; j < VIDEO_DECODE_QUEUE_MAX; j++)
+		{
+			av_freep(&q->au[j].data);
+			q->au[j].capacity = q->au[j].size = 0;
+		}
+	}
+}
+
 static void play_video(int channel, unsigned char* buffer, int bufsize, struct timeval pts, bool marker)
 {
 	struct decoder_buffer* pdb = &db[channel];
-	int left;
 	//
 	if(bufsize <= 0 || buffer == NULL)
 	{
@@ -1060,47 +1837,26 @@ static void play_video(int channel, unsigned char* buffer, int bufsize, struct t
 			{
 				// fprintf(stderr, "DEBUG: video pts=%08ld.%06ld\n",
 				//	lastpts.tv_sec, lastpts.tv_usec);
-				left = play_video_priv(channel, pdb->privbuf, pdb->privbuflen, pdb->lastpts);
-				if(left > 0)
-				{
-					bcopy(pdb->privbuf + pdb->privbuflen - left, pdb->privbuf, left);
-					pdb->privbuflen = left;
-					rtsperror("decoder: %d bytes left, preserved for next round\n", left);
-				}
-				else
-					pdb->privbuflen = 0;
+				video_decode_enqueue(channel, pdb->privbuf, pdb->privbuflen, pdb->lastpts);
+				pdb->privbuflen = 0;
 			}
 			pdb->lastpts = pts;
 		}
-		if(pdb->privbuflen + bufsize <= PRIVATE_BUFFER_SIZE)
+		if(pdb->privbuflen + bufsize > PRIVATE_BUFFER_SIZE)
 		{
-			bcopy(buffer, &pdb->privbuf[pdb->privbuflen], bufsize);
-			pdb->privbuflen += bufsize;
-			if(marker && pdb->privbuflen > 0)
-			{
-				left = play_video_priv(channel, pdb->privbuf, pdb->privbuflen, pdb->lastpts);
-				if(left > 0)
-				{
-					bcopy(pdb->privbuf + pdb->privbuflen - left, pdb->privbuf, left);
-					pdb->privbuflen = left;
-					rtsperror("decoder: %d bytes left, leave for next round\n", left);
-				}
-				else
-					pdb->privbuflen = 0;
-			}
+			rtsperror("WARNING: video private buffer overflow.\n");
+			if(pdb->privbuflen > 0)
+				video_decode_enqueue(channel, pdb->privbuf, pdb->privbuflen, pdb->lastpts);
+			pdb->privbuflen = 0;
+			if(bufsize > PRIVATE_BUFFER_SIZE)
+				return;
 		}
-		else
+		bcopy(buffer, &pdb->privbuf[pdb->privbuflen], bufsize);
+		pdb->privbuflen += bufsize;
+		if(marker)
 		{
-			rtsperror("WARNING: video private buffer overflow.\n");
-			left = play_video_priv(channel, pdb->privbuf, pdb->privbuflen, pdb->lastpts);
-			if(left > 0)
-			{
-				bcopy(pdb->privbuf + pdb->privbuflen - left, pdb->privbuf, left);
-				pdb->privbuflen = left;
-				rtsperror("decoder: %d bytes left, leave for next round\n", left);
-			}
-			else
-				pdb->privbuflen = 0;
+			video_decode_enqueue(channel, pdb->privbuf, pdb->privbuflen, pdb->lastpts);
+			pdb->privbuflen = 0;
 		}
 #ifdef ANDROID
 	}
@@ -1109,23 +1865,148 @@ static void play_video(int channel, unsigned char* buffer, int bufsize, struct t
 
 static const int abmaxsize		 = AVCODEC_MAX_AUDIO_FRAME_SIZE * 4;
 static unsigned char* audiobuf = NULL;
-static unsigned int absize		 = 0;
-static unsigned int abpos		 = 0;
 // need a converter?
 static struct SwrContext* swrctx = NULL;
 static unsigned char* convbuf		= NULL;
 static int max_decoder_size		= 0;
-static int audio_start				= 0;
 
-unsigned char* audio_buffer_init()
+//// audio jitter buffer
+
+/**
+ * Decoded PCM waiting for the audio device.
+ * The audio decode thread is the only writer and the device callback the
+ * only reader. Positions are free-running byte counters, so the fill
+ * level is always wpos - rpos.
+ */
+struct pcm_ring
+{
+	unsigned char* buf;
+	unsigned int size; // power of two
+	std::atomic<unsigned long long> wpos;
+	std::atomic<unsigned long long> rpos;
+};
+
+static struct pcm_ring pcmring;
+static std::thread adecthread;
+static std::atomic<bool> adecquit{false};
+static bool adecstarted = false;
+
+static int ajb_min_delay_ms = 20;	// lower bound of the target delay
+static int ajb_max_delay_ms = 200; // upper bound, anything above is discarded
+static int ajb_stretch_max	 = 5;	  // max time-stretching, in percent
+static int ajb_bytes_per_sec = 0;
+static int ajb_frame_bytes	 = 0; // bytes per sample frame
+// RFC 3550 inter-arrival jitter, updated by the live555 thread
+static std::atomic<int> ajb_jitter_us{0};
+static struct timeval ajb_last_arrival;
+static struct timeval ajb_last_pts;
+// updated by the device callback
+static std::atomic<int> ajb_request{0};			 // bytes requested per callback
+static std::atomic<int> ajb_level{0};				 // lowest ring level at callback entry, last window
+static std::atomic<unsigned int> ajb_level_seq{0}; // bumped when ajb_level is refreshed
+static std::atomic<bool> ajb_primed{false};
+static int ajb_window_min	 = 0;
+static int ajb_window_bytes = 0;
+static std::atomic<unsigned int> ajb_underruns{0};
+static std::atomic<unsigned int> ajb_discarded{0};
+// updated by the decode thread
+static unsigned int ajb_stretched = 0;
+static unsigned int ajb_overflows = 0;
+
+static int audio_jitter_bytes(long long us)
+{
+	long long bytes = us * ajb_bytes_per_sec / 1000000;
+	return (int)(bytes - bytes % ajb_frame_bytes);
+}
+
+/**
+ * Lowest ring level the device callback should find on entry: one
+ * callback worth of data plus a margin of three times the measured
+ * jitter, the margin being kept within the configured bounds.
+ */
+static int audio_jitter_target()
 {
-	if(audiobuf == NULL)
+	int margin	= audio_jitter_bytes(3LL * ajb_jitter_us.load(std::memory_order_relaxed));
+	int minimum = audio_jitter_bytes(ajb_min_delay_ms * 1000LL);
+	int maximum = audio_jitter_bytes(ajb_max_delay_ms * 1000LL);
+	if(margin < minimum)
+		margin = minimum;
+	if(margin > maximum)
+		margin = maximum;
+	return ajb_request.load(std::memory_order_relaxed) + margin;
+}
+
+static void audio_jitter_update(struct timeval pts)
+{
+	struct timeval now;
+	long long d;
+	int jitter;
+	//
+	gettimeofday(&now, NULL);
+	if(ajb_last_arrival.tv_sec != 0)
+	{
+		d = tvdiff_us(&now, &ajb_last_arrival) - tvdiff_us(&pts, &ajb_last_pts);
+		if(d < 0)
+			d = -d;
+		if(d > 1000000)
+			d = 1000000;
+		jitter = ajb_jitter_us.load(std::memory_order_relaxed);
+		ajb_jitter_us.store(jitter + (int)((d - jitter) / 16), std::memory_order_relaxed);
+	}
+	ajb_last_arrival = now;
+	ajb_last_pts	  = pts;
+}
+
+/**
+ * Number of samples to add (positive) or remove (negative) while
+ * converting a frame of \a nb_samples, so that the lowest ring level
+ * converges to the target without audible jumps. Corrections already
+ * applied since the level was last measured are taken into account.
+ */
+static int audio_jitter_compensation(int nb_samples)
+{
+	static unsigned int seq = 0;
+	static int applied		= 0; // in bytes
+	int error, delta, limit;
+	//
+	if(ajb_stretch_max <= 0 || !ajb_primed.load(std::memory_order_acquire))
+		return 0;
+	if(seq != ajb_level_seq.load(std::memory_order_acquire))
 	{
-		audiobuf = (unsigned char*)malloc(abmaxsize);
-		if(audiobuf == NULL)
-			return NULL;
+		seq	  = ajb_level_seq.load(std::memory_order_acquire);
+		applied = 0;
 	}
-	return audiobuf;
+	error = ajb_level.load(std::memory_order_relaxed) + applied - audio_jitter_target();
+	// dead band: 5ms
+	if(error > -audio_jitter_bytes(5000) && error < audio_jitter_bytes(5000))
+		return 0;
+	delta = -error / ajb_frame_bytes;
+	limit = nb_samples * ajb_stretch_max / 100;
+	if(delta > limit)
+		delta = limit;
+	if(delta < -limit)
+		delta = -limit;
+	applied += delta * ajb_frame_bytes;
+	if(delta != 0)
+		ajb_stretched++;
+	return delta;
+}
+
+static int pcm_ring_write(const unsigned char* data, int size)
+{
+	unsigned long long w = pcmring.wpos.load(std::memory_order_relaxed);
+	unsigned int offset, first;
+	//
+	if(w - pcmring.rpos.load(std::memory_order_acquire) + size > pcmring.size)
+		return -1;
+	offset = (unsigned int)(w & (pcmring.size - 1));
+	first	 = pcmring.size - offset;
+	if(first > (unsigned int)size)
+		first = size;
+	bcopy(data, pcmring.buf + offset, first);
+	bcopy(data + first, pcmring.buf, size - first);
+	pcmring.wpos.store(w + size, std::memory_order_release);
+	return size;
 }
 
 int audio_buffer_decode(AVPacket* pkt, unsigned char* dstbuf, int dstlen)
@@ -1138,7 +2019,7 @@ int audio_buffer_decode(AVPacket* pkt, unsigned char* dstbuf, int dstlen)
 	saveptr = pkt->data;
 	while(pkt->size > 0)
 	{
-		int len, got_frame = 0;
+		int len, got_frame = 0, delta = 0, outsamples;
 		unsigned char* srcbuf = NULL;
 		int datalen				 = 0;
 		//
@@ -1156,7 +2037,8 @@ int audio_buffer_decode(AVPacket* pkt, unsigned char* dstbuf, int dstlen)
 			continue;
 		}
 
-		if(aframe->format == rtspconf->audio_device_format)
+		// time-stretching always goes through the resampler
+		if(aframe->format == rtspconf->audio_device_format && ajb_stretch_max <= 0)
 		{
 			datalen = av_samples_get_buffer_size(NULL,
 															 aframe->channels /*rtspconf->audio_channels*/,
@@ -1210,8 +2092,12 @@ int audio_buffer_decode(AVPacket* pkt, unsigned char* dstbuf, int dstlen)
 							 (int)rtspconf->audio_samplerate,
 							 av_get_sample_fmt_name(rtspconf->audio_device_format));
 			}
-			datalen = av_samples_get_buffer_size(
-			  NULL, rtspconf->audio_channels, aframe->nb_samples, rtspconf->audio_device_format, 1 /*no-alignment*/);
+			if((delta = audio_jitter_compensation(aframe->nb_samples)) != 0
+				&& swr_set_compensation(swrctx, delta, aframe->nb_samples + delta) < 0)
+				delta = 0;
+			outsamples = aframe->nb_samples + (delta > 0 ? delta : 0) + 32;
+			datalen	  = av_samples_get_buffer_size(
+				 NULL, rtspconf->audio_channels, outsamples, rtspconf->audio_device_format, 1 /*no-alignment*/);
 			if(datalen > max_decoder_size)
 			{
 				rtsperror("audio decoder: FATAL - conversion input too lengthy (%d > %d)\n", datalen, max_decoder_size);
@@ -1235,8 +2121,10 @@ int audio_buffer_decode(AVPacket* pkt, unsigned char* dstbuf, int dstlen)
 			dstplanes[0] = convbuf;
 			dstplanes[1] = NULL;
 			//
-			swr_convert(swrctx, dstplanes, aframe->nb_samples, srcplanes, aframe->nb_samples);
-			srcbuf = convbuf;
+			if((outsamples = swr_convert(swrctx, dstplanes, outsamples, srcplanes, aframe->nb_samples)) < 0)
+				outsamples = 0;
+			datalen = outsamples * ajb_frame_bytes;
+			srcbuf  = convbuf;
 		}
 		if(datalen > dstlen)
 		{
@@ -1260,60 +2148,170 @@ int audio_buffer_decode(AVPacket* pkt, unsigned char* dstbuf, int dstlen)
 
 int audio_buffer_fill(void* userdata, unsigned char* stream, int ssize)
 {
-	int filled = 0;
-	AVPacket avpkt;
-#ifdef ANDROID
-	// XXX: use global adecoder
-#else
-	AVCodecContext* adecoder = (AVCodecContext*)userdata;
-#endif
+	unsigned long long r, w;
+	unsigned int offset, first;
+	int level, target, size;
 	//
-	if(audio_buffer_init() == NULL)
+	if(pcmring.buf == NULL)
+		return 0;
+	ajb_request.store(ssize, std::memory_order_relaxed);
+	r		 = pcmring.rpos.load(std::memory_order_relaxed);
+	w		 = pcmring.wpos.load(std::memory_order_acquire);
+	level	 = (int)(w - r);
+	target = audio_jitter_target();
+	// (re)buffering
+	if(!ajb_primed.load(std::memory_order_relaxed))
+	{
+		if(level < target)
+			return 0;
+		if(ajb_level_seq.load(std::memory_order_relaxed) == 0)
+		{
+			ajb_level.store(level, std::memory_order_relaxed);
+			ajb_level_seq.fetch_add(1, std::memory_order_release);
+		}
+		ajb_window_min	  = level;
+		ajb_window_bytes = 0;
+		ajb_primed.store(true, std::memory_order_release);
+	}
+	// far too much audio queued: skip to the target
+	if(level > target + 2 * audio_jitter_bytes(ajb_max_delay_ms * 1000LL))
 	{
-		rtsperror("audio decoder: cannot allocate audio buffer\n");
-#ifdef ANDROID
-		rtspParam->quitLive555 = 1;
-		return -1;
-#else
-		exit(-1);
-#endif
+		r += level - target;
+		level = target;
+		ajb_discarded.fetch_add(1, std::memory_order_relaxed);
 	}
-	while(filled < ssize)
+	// publish the lowest level seen in every half second
+	if(level < ajb_window_min)
+		ajb_window_min = level;
+	if((ajb_window_bytes += ssize) >= ajb_bytes_per_sec / 2)
 	{
-		int dsize = 0, delta = 0;
-		// buffer has enough data
-		if(absize - abpos >= ssize - filled)
-		{
-			delta = ssize - filled;
-			bcopy(audiobuf + abpos, stream, delta);
-			abpos += delta;
-			filled += delta;
-			return ssize;
-		}
-		else if(absize - abpos > 0)
+		ajb_level.store(ajb_window_min, std::memory_order_relaxed);
+		ajb_level_seq.fetch_add(1, std::memory_order_release);
+		ajb_window_min	  = level;
+		ajb_window_bytes = 0;
+	}
+	//
+	size	 = level < ssize ? level : ssize;
+	offset = (unsigned int)(r & (pcmring.size - 1));
+	first	 = pcmring.size - offset;
+	if(first > (unsigned int)size)
+		first = size;
+	bcopy(pcmring.buf + offset, stream, first);
+	bcopy(pcmring.buf, stream + first, size - first);
+	pcmring.rpos.store(r + size, std::memory_order_release);
+	if(size < ssize)
+	{
+		// let the decoder start stretching right away
+		ajb_level.store(level, std::memory_order_relaxed);
+		ajb_level_seq.fetch_add(1, std::memory_order_release);
+		ajb_underruns.fetch_add(1, std::memory_order_relaxed);
+		ajb_primed.store(false, std::memory_order_release);
+	}
+	return size;
+}
+
+static void audio_decode_threadproc()
+{
+	AVPacket avpkt;
+	struct timeval tv0, tv1;
+	int dsize;
+	//
+	rtsperror("audio decoder thread started.\n");
+	gettimeofday(&tv0, NULL);
+	while(!adecquit.load(std::memory_order_acquire))
+	{
+		gettimeofday(&tv1, NULL);
+		if(tvdiff_us(&tv1, &tv0) >= 10000000LL)
 		{
-			delta = absize - abpos;
-			bcopy(audiobuf + abpos, stream, delta);
-			stream += delta;
-			filled += delta;
-			abpos = absize = 0;
+			rtsperror("audio jitter buffer: jitter %.1fms, target %.1fms, level %.1fms;"
+						 " %u underruns, %u stretched, %u overflows, %u discards\n",
+						 ajb_jitter_us.load(std::memory_order_relaxed) / 1000.0,
+						 1000.0 * audio_jitter_target() / ajb_bytes_per_sec,
+						 1000.0 * ajb_level.load(std::memory_order_relaxed) / ajb_bytes_per_sec,
+						 ajb_underruns.load(std::memory_order_relaxed),
+						 ajb_stretched,
+						 ajb_overflows,
+						 ajb_discarded.load(std::memory_order_relaxed));
+			tv0 = tv1;
 		}
-		// move data to head, leave more ab buffers
-		if(abpos != 0)
+		if(packet_queue_get(&audioq, &avpkt, 1) <= 0)
+			continue;
+		if((dsize = audio_buffer_decode(&avpkt, audiobuf, abmaxsize)) <= 0)
+			continue;
+		if(pcm_ring_write(audiobuf, dsize) < 0)
+			ajb_overflows++;
+	}
+	rtsperror("audio decoder thread terminated.\n");
+}
+
+static int audio_decode_init()
+{
+	char buf[8];
+	int val, bytes;
+	//
+	audio_decode_deinit();
+	if(ga_conf_readv("audio-jitter-min-delay", buf, sizeof(buf)) != NULL && (val = ga_conf_readint("audio-jitter-min-delay")) >= 0)
+		ajb_min_delay_ms = val;
+	if((val = ga_conf_readint("audio-jitter-max-delay")) > 0)
+		ajb_max_delay_ms = val;
+	if(ajb_max_delay_ms < ajb_min_delay_ms)
+		ajb_max_delay_ms = ajb_min_delay_ms;
+	if(ga_conf_readv("audio-time-stretch", buf, sizeof(buf)) != NULL && (val = ga_conf_readint("audio-time-stretch")) >= 0)
+		ajb_stretch_max = val > 50 ? 50 : val;
+	ajb_frame_bytes	= rtspconf->audio_channels * av_get_bytes_per_sample(rtspconf->audio_device_format);
+	ajb_bytes_per_sec = rtspconf->audio_samplerate * ajb_frame_bytes;
+	if(ajb_frame_bytes <= 0 || ajb_bytes_per_sec <= 0)
+	{
+		rtsperror("audio decoder: invalid device format.\n");
+		return -1;
+	}
+	// room for twice the max delay plus a second of slack
+	bytes = audio_jitter_bytes((2LL * ajb_max_delay_ms + 1000) * 1000);
+	if(pcmring.buf == NULL || pcmring.size < (unsigned int)bytes)
+	{
+		free(pcmring.buf);
+		for(pcmring.size = 1; pcmring.size < (unsigned int)bytes; pcmring.size <<= 1)
+			;
+		if((pcmring.buf = (unsigned char*)malloc(pcmring.size)) == NULL)
 		{
-			bcopy(audiobuf + abpos, audiobuf, absize - abpos);
-			absize -= abpos;
-			abpos = 0;
+			rtsperror("audio decoder: cannot allocate pcm ring (%u bytes).\n", pcmring.size);
+			return -1;
 		}
-		// decode more packets
-		if(packet_queue_get(&audioq, &avpkt, 0) <= 0)
-			break;
-		if((dsize = audio_buffer_decode(&avpkt, audiobuf + absize, abmaxsize - absize)) < 0)
-			break;
-		absize += dsize;
 	}
+	if(audiobuf == NULL && (audiobuf = (unsigned char*)malloc(abmaxsize)) == NULL)
+	{
+		rtsperror("audio decoder: cannot allocate audio buffer\n");
+		return -1;
+	}
+	pcmring.wpos.store(0);
+	pcmring.rpos.store(0);
+	ajb_jitter_us.store(0);
+	ajb_request.store(0);
+	ajb_level.store(0);
+	ajb_level_seq.store(0);
+	ajb_primed.store(false);
+	ajb_underruns.store(0);
+	ajb_discarded.store(0);
+	ajb_stretched = ajb_overflows = 0;
+	bzero(&ajb_last_arrival, sizeof(ajb_last_arrival));
+	bzero(&ajb_last_pts, sizeof(ajb_last_pts));
 	//
-	return filled;
+	adecquit.store(false);
+	std::thread{audio_decode_threadproc}.swap(adecthread);
+	adecstarted = true;
+	rtsperror("audio jitter buffer: delay %d-%dms, time-stretch up to %d%%, ring %u bytes\n",
+				 ajb_min_delay_ms, ajb_max_delay_ms, ajb_stretch_max, pcmring.size);
+	return 0;
+}
+
+static void audio_decode_deinit()
+{
+	if(adecstarted)
+	{
+		adecquit.store(true, std::memory_order_release);
+		adecthread.join();
+		adecstarted = false;
+	}
 }
 
 void audio_buffer_fill_sdl(void* userdata, unsigned char* stream, int ssize)
@@ -1350,8 +2348,8 @@ static void play_audio(unsigned char* buffer, int bufsize, struct timeval pts)
 		avpkt.size = bufsize;
 		if(avpkt.size > 0)
 		{
+			audio_jitter_update(pts);
 			packet_queue_put(&audioq, &avpkt);
-			packet_queue_drop(&audioq);
 		}
 #ifndef ANDROID
 		if(rtspParam->audioOpened == false)
@@ -1408,6 +2406,20 @@ void* rtsp_thread(void* param)
 	rtsperror("RTP reordering threshold = %d\n", rtp_packet_reordering_threshold);
 	//
 	pktloss_monitor_init();
+	frameloss_init(ga_conf_readbool("frame-loss-report", 1));
+	if(ga_conf_readbool("rtp-fec", 1) != 0)
+	{
+		rtpfec_init();
+		fec_init(rtpfec_payload_type());
+	}
+	else
+	{
+		fec_init(-1);
+	}
+	if(ga_conf_readint("rtp-nack-max-wait") > 0)
+		nack_init(ga_conf_readbool("rtp-nack", 1), ga_conf_readint("rtp-nack-max-wait") * 1000);
+	else
+		nack_init(ga_conf_readbool("rtp-nack", 1), 50000);
 	port2channel.clear();
 	video_sess_fmt = -1;
 	audio_sess_fmt = -1;
@@ -1430,6 +2442,7 @@ void* rtsp_thread(void* param)
 		rtsperror("init decode buffer failed.\n");
 		return NULL;
 	}
+	video_decode_init();
 	//
 	if(qos_init(env) < 0)
 	{
@@ -1462,10 +2475,16 @@ void* rtsp_thread(void* param)
 	}
 	//
 	shutdownStream(client);
+	video_decode_deinit();
+	audio_decode_deinit();
 	deinit_decoder_buffer();
 	// release resources in rtspThreadParam
 	for(int i = 0; i < VIDEO_SOURCE_CHANNEL_MAX; i++)
 	{
+#ifndef ANDROID
+		AVFrame* frame = rtspParam->pendingFrame[i].exchange(NULL);
+		av_frame_free(&frame);
+#endif
 		if(rtspParam->pipe[i] != NULL)
 		{
 			dpipe_destroy(rtspParam->pipe[i]);
@@ -1649,7 +2668,7 @@ void setupNextSubsession(RTSPClient* rtspClient)
 					video_sess_fmt		  = scs.subsession->rtpPayloadFormat();
 					video_codec_name	  = strdup(scs.subsession->codecName());
 					qos_add_source(video_codec_name, scs.subsession->rtpSource());
-					scs.subsession->rtpSource()->setAuxilliaryReadHandler(rtp_packet_handler, NULL);
+					scs.subsession->rtpSource()->setAuxilliaryReadHandler(rtp_packet_handler, scs.subsession->rtpSource());
 					if(rtp_packet_reordering_threshold > 0)
 						scs.subsession->rtpSource()->setPacketReorderingThresholdTime(rtp_packet_reordering_threshold);
 					if(port2channel.find(scs.subsession->clientPortNum()) == port2channel.end())
@@ -1708,6 +2727,7 @@ void setupNextSubsession(RTSPClient* rtspClient)
 					audio_sess_fmt	  = scs.subsession->rtpPayloadFormat();
 					audio_codec_name = strdup(scs.subsession->codecName());
 					qos_add_source(audio_codec_name, scs.subsession->rtpSource());
+					scs.subsession->rtpSource()->setAuxilliaryReadHandler(rtp_audio_packet_handler, scs.subsession->rtpSource());
 					if(rtp_packet_reordering_threshold > 0)
 						scs.subsession->rtpSource()->setPacketReorderingThresholdTime(rtp_packet_reordering_threshold);
 #ifdef ANDROID
@@ -2120,6 +3140,9 @@ void DummySink::afterGettingFrame(unsigned frameSize,
 		if(stats != NULL)
 			lost = pktloss_monitor_get(stats->SSRC(), &count, 1 /*reset*/);
 
+		if(frameloss_report && rtpsrc != NULL && stats != NULL)
+			frameloss_update(channel, stats->SSRC(), presentationTime, marker, rtpsrc->hasBeenSynchronizedUsingRTCP());
+
 		play_video(channel, fReceiveBuffer + MAX_FRAMING_SIZE - video_framing, frameSize + video_framing, presentationTime, marker);
 #ifdef ANDROID
 		if(rtspconf->builtin_video_decoder == 0 && rtspconf->builtin_audio_decoder == 0)
@@ -30,6 +30,7 @@
 #endif
 #include <ga/dpipe.hpp>
 
+#include <atomic>
 #include <mutex>
 
 #define	SDL_USEREVENT_CREATE_OVERLAY	0x0001
@@ -68,6 +69,10 @@ struct RTSPThreadParam
 	SDL_Window *surface[VIDEO_SOURCE_CHANNEL_MAX];
 	SDL_Renderer *renderer[VIDEO_SOURCE_CHANNEL_MAX];
 	SDL_Texture *overlay[VIDEO_SOURCE_CHANNEL_MAX];
+	// newest decoded picture, uploaded by render_image without conversion
+	std::atomic<AVFrame *> pendingFrame[VIDEO_SOURCE_CHANNEL_MAX];
+	// a render request is queued and has not been handled yet
+	std::atomic<bool> renderPending[VIDEO_SOURCE_CHANNEL_MAX];
 #endif
 	// audio
 	std::mutex audioMutex;
@@ -81,6 +86,29 @@ extern struct RTSPConf *rtspconf;
 void rtsperror(const char *fmt, ...);
 void * rtsp_thread(void *param);
 
+#ifndef ANDROID
+/**
+ * SDL texture format that decoded pictures in \a format can be uploaded
+ * to as-is, or SDL_PIXELFORMAT_UNKNOWN if they must be converted first.
+ */
+static inline Uint32 rtsp_texture_format(AVPixelFormat format)
+{
+	switch(format)
+	{
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+		return SDL_PIXELFORMAT_IYUV;
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+	case AV_PIX_FMT_NV12:
+		return SDL_PIXELFORMAT_NV12;
+#endif
+	default:
+		break;
+	}
+	return SDL_PIXELFORMAT_UNKNOWN;
+}
+#endif
+
 /* internal use only */
 int audio_buffer_fill(void *userdata, unsigned char *stream, int ssize);
 void audio_buffer_fill_sdl(void *userdata, unsigned char *stream, int ssize);
@@ -20,21 +20,21 @@
 #define ASOURCE_HPP
 
 #include <ga/common.hpp>
-#include <mutex>
-#include <condition_variable>
 
+/**
+ * Reader of the shared audio ring.
+ * Captured frames are written once into the ring, and each reader
+ * consumes them with its own cursor.
+ */
 struct audio_buffer_t {
-	std::mutex bufmutex;
-	std::condition_variable bufcond;
 	int64_t bufPts;
-	int frames, channels, bitspersample;
-	int bufsize, bufhead, buftail, bframes;
-	uint8_t* buffer;
+	int frames;			/**< Maximum backlog in frames, older frames are skipped */
+	int channels, bitspersample;
+	unsigned long long rpos;	/**< Frames consumed from the ring */
 };
 
 EXPORT audio_buffer_t * audio_source_buffer_init();
 EXPORT void audio_source_buffer_deinit(audio_buffer_t *ab);
-EXPORT void audio_source_buffer_fill_one(audio_buffer_t *ab, const unsigned char *data, int frames);
 EXPORT void audio_source_buffer_fill(const unsigned char *data, int frames);
 EXPORT int audio_source_buffer_read(audio_buffer_t *ab, unsigned char *buf, int frames);
 EXPORT void audio_source_buffer_purge(audio_buffer_t *ab);
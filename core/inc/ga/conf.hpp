@@ -29,6 +29,7 @@ EXPORT void ga_conf_clear();
 // operations with key/value pair
 EXPORT char * ga_conf_readv(const char *key, char *store, int slen);
 EXPORT int ga_conf_readint(const char *key);
+EXPORT int ga_conf_readint_default(const char *key, int defval);
 EXPORT double ga_conf_readdouble(const char *key);
 EXPORT int ga_conf_readbool(const char *key, int defval);
 EXPORT int ga_conf_boolval(const char *ptr, int defval);
@@ -57,6 +57,7 @@ EXPORT	int	ctrl_server_init(struct RTSPConf *conf, const char *ctrlid);
 EXPORT	msgfunc ctrl_server_setreplay(msgfunc);
 EXPORT	void	ctrl_server_thread(RTSPConf* rtspconf);
 EXPORT	int	crtl_server_readnext(void *msg, int msglen);
+EXPORT	int	ctrl_server_get_client(struct sockaddr_in *sin);
 
 EXPORT	void	ctrl_server_set_output_resolution(int width, int height);
 EXPORT	void	ctrl_server_get_output_resolution(int *width, int *height);
@@ -27,7 +27,11 @@
 #define	CTRL_MSGSYS_SUBTYPE_NULL	0	/* system control message: NULL */
 #define	CTRL_MSGSYS_SUBTYPE_SHUTDOWN	1	/* system control message: shutdown */
 #define	CTRL_MSGSYS_SUBTYPE_NETREPORT	2	/* system control message: report networking */
-#define	CTRL_MSGSYS_SUBTYPE_MAX		2	/* must equal to the last sub message type */
+#define	CTRL_MSGSYS_SUBTYPE_FRAMELOSS	3	/* system control message: report lost video frames */
+#define	CTRL_MSGSYS_SUBTYPE_NACK	4	/* system control message: request lost RTP packets */
+#define	CTRL_MSGSYS_SUBTYPE_MAX		4	/* must equal to the last sub message type */
+
+#define	CTRL_NACK_FCI_MAX		16	/* max generic NACK entries in a message */
 
 #if defined(WIN32) && !defined(MSYS)
 #define	BEGIN_CTRL_MESSAGE_STRUCT	__pragma(pack(push, 1))	/* equal to #pragma pack(push, 1) */
@@ -84,6 +88,47 @@ typedef struct ctrlmsg_system_netreport_s ctrlmsg_system_netreport_t;
 
 ////////////////////////////////////////////////////////////////////////////
 
+BEGIN_CTRL_MESSAGE_STRUCT
+struct ctrlmsg_system_frameloss_s {
+	unsigned short msgsize;		/*< size of this message, including this field */
+	unsigned char msgtype;		/*< must be CTRL_MSGTYPE_SYSTEM */
+	unsigned char subtype;		/*< must be CTRL_MSGSYS_SUBTYPE_FRAMELOSS */
+	unsigned char channel;		/*< video channel */
+	unsigned char synced;		/*< 1 if the presentation time is synchronized by RTCP */
+	unsigned short pktloss;		/*< number of lost packets */
+	unsigned int tv_sec;		/*< presentation time of the last frame received intact, */
+	unsigned int tv_usec;		/*< or zero if there is none */
+}
+END_CTRL_MESSAGE_STRUCT
+typedef struct ctrlmsg_system_frameloss_s ctrlmsg_system_frameloss_t;
+
+////////////////////////////////////////////////////////////////////////////
+
+BEGIN_CTRL_MESSAGE_STRUCT
+/**
+ * Generic NACK feedback (RFC 4585) for an RTP stream.
+ * Only the first \a nfci entries are sent.
+ */
+struct ctrlmsg_system_nack_s {
+	unsigned short msgsize;		/*< size of this message, including this field */
+	unsigned char msgtype;		/*< must be CTRL_MSGTYPE_SYSTEM */
+	unsigned char subtype;		/*< must be CTRL_MSGSYS_SUBTYPE_NACK */
+	unsigned char nfci;		/*< number of entries */
+	unsigned char reserved;
+	unsigned short rtpport;		/*< RTP port of the client, or zero if unknown */
+	unsigned int ssrc;		/*< SSRC of the media source */
+	struct {
+		unsigned short pid;	/*< sequence number of a lost packet */
+		unsigned short blp;	/*< bit i set: packet pid + i + 1 is lost too */
+	} fci[CTRL_NACK_FCI_MAX];
+}
+END_CTRL_MESSAGE_STRUCT
+typedef struct ctrlmsg_system_nack_s ctrlmsg_system_nack_t;
+
+#define	CTRL_NACK_SIZE(nfci)	(sizeof(ctrlmsg_system_nack_t) - 4 * (CTRL_NACK_FCI_MAX - (nfci)))
+
+////////////////////////////////////////////////////////////////////////////
+
 typedef void (*ctrlsys_handler_t)(ctrlmsg_system_t *);
 
 EXPORT int ctrlsys_handle_message(unsigned char *buf, unsigned int size);
@@ -91,5 +136,7 @@ EXPORT	ctrlsys_handler_t ctrlsys_set_handler(unsigned char subtype, ctrlsys_hand
 
 // functions for building message data structure
 EXPORT ctrlmsg_t * ctrlsys_netreport(ctrlmsg_t *msg, unsigned int duration, unsigned int framecount, unsigned int pktcount, unsigned int pktloss, unsigned int bytecount, unsigned int capacity);
+EXPORT ctrlmsg_t * ctrlsys_frameloss(ctrlmsg_t *msg, int channel, int synced, unsigned int pktloss, struct timeval *lastgood);
+EXPORT ctrlmsg_t * ctrlsys_nack(ctrlmsg_t *msg, unsigned int ssrc, unsigned short rtpport, int nfci, unsigned short *pid, unsigned short *blp);
 
 #endif	/* __CTRL_MSG_H__ */
@@ -20,9 +20,19 @@
 #define	GA_DPIPE_HPP
 
 #include <ga/common.hpp>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 
+/** dpipe creation flags, used with dpipe_create_ex() */
+#define	DPIPE_FLAG_NONE		0x00	/**< Default: mutex-protected buffer pools */
+#define	DPIPE_FLAG_LOCKFREE	0x01	/**< Lock-free rings instead of the mutex-protected pools, see dpipe_create_ex() */
+
+/** Number of spins before a lock-free pipe consumer falls back to a blocking wait */
+#define	DPIPE_LOCKFREE_SPINS	2048
+
+struct dpipe_s;
+
 /**
  * structure for buffering a frame
  */
@@ -31,8 +41,34 @@ typedef struct dpipe_buffer_s {
 	void *internal;		/**< internal pointer to the allocated buffer space. Used with malloc() and free(). */
 	int offset;		/**< data pointer offset from internal */
 	struct dpipe_buffer_s *next;	/**< pointer to the next dpipe frame buffer */
+	//
+	struct dpipe_s *owner;	/**< the pipe that allocated this buffer */
+	struct dpipe_buffer_s *shared;	/**< non-NULL if this buffer carries a frame owned by another pipe,
+					 * see dpipe_store_shared(). \a pointer then points to the shared frame. */
+	std::atomic<int> refcnt;	/**< number of pipes still referencing a shared frame, 0 if not shared */
 }	dpipe_buffer_t;
 
+/**
+ * A cell in a dpipe ring.
+ */
+typedef struct dpipe_cell_s {
+	std::atomic<unsigned int> seq;	/**< cell sequence, tells whether the cell is ready to push or pop */
+	dpipe_buffer_t *buffer;		/**< the buffer stored in this cell */
+}	dpipe_cell_t;
+
+/**
+ * Bounded multi-producer/multi-consumer ring of frame buffer pointers
+ * (lock-free mode only). Each cell carries a sequence number, so that more
+ * than one thread can push (e.g., releasing a shared frame from another
+ * pipe) or pop (e.g., dpipe_get() dropping the eldest frame) at the same time.
+ */
+typedef struct dpipe_ring_s {
+	dpipe_cell_t *cell;		/**< ring cells, size is \a mask + 1 */
+	unsigned int mask;		/**< ring size - 1, ring size is 2^n */
+	alignas(64) std::atomic<unsigned int> head;	/**< next cell to push */
+	alignas(64) std::atomic<unsigned int> tail;	/**< next cell to pop */
+}	dpipe_ring_t;
+
 typedef struct dpipe_s {
 	int channel_id;		/**< channel id for the dpipe */
 	char *name;		/**< name of the dpipe */
@@ -41,14 +77,22 @@ typedef struct dpipe_s {
 	std::condition_variable cond;		/**< pthread condition */
 	//
 	std::mutex io_mutex;	/**< dpipe i/o pool operation mutex */
-	dpipe_buffer_t *in;		/**< input pool: pointer to the first frame buffer in input pool (free frames) */
+	dpipe_buffer_t *in;		/**< input pool: pointer to the first frame buffer in input pool (free frames).
+					 * In lock-free mode it chains all the allocated buffers and is never modified. */
 	dpipe_buffer_t *out;		/**< output pool: pointer to the first frame buffer in output pool (occupied frames) */
 	dpipe_buffer_t *out_tail;	/**< output pool: pointer to the last frame buffer in output pool (occupied frames) */
 	int in_count;			/**< number of unused frame buffers */
 	int out_count;			/**< number of occupied frames */
+	//
+	int flags;			/**< creation flags, see DPIPE_FLAG_* */
+	dpipe_ring_t *free_ring;	/**< lock-free mode: free frame buffers */
+	dpipe_ring_t *out_ring;		/**< lock-free mode: occupied frame buffers */
+	std::atomic<unsigned int> seq;	/**< lock-free mode: store sequence, also the futex word */
+	std::atomic<int> waiters;	/**< lock-free mode: number of blocked consumers */
 }	dpipe_t;
 
 EXPORT dpipe_t *	dpipe_create(int id, const char *name, int nframe, int maxframesize);
+EXPORT dpipe_t *	dpipe_create_ex(int id, const char *name, int nframe, int maxframesize, int flags);
 EXPORT dpipe_t *	dpipe_lookup(const char *name);
 EXPORT int		dpipe_destroy(dpipe_t *dpipe);
 EXPORT dpipe_buffer_t *	dpipe_get(dpipe_t *dpipe);
@@ -56,5 +100,7 @@ EXPORT void		dpipe_put(dpipe_t *dpipe, dpipe_buffer_t *buffer);
 EXPORT dpipe_buffer_t *	dpipe_load(dpipe_t *dpipe, const struct timespec *abstime);
 EXPORT dpipe_buffer_t *	dpipe_load_nowait(dpipe_t *dpipe);
 EXPORT void		dpipe_store(dpipe_t *dpipe, dpipe_buffer_t *buffer);
+EXPORT dpipe_buffer_t *	dpipe_get_shared(dpipe_t **dpipe, int ndpipe);
+EXPORT int		dpipe_store_shared(dpipe_t **dpipe, int ndpipe, dpipe_buffer_t *buffer);
 
 #endif	/* __GA_DPIPE_H__ */
@@ -27,8 +27,17 @@
 #include <ga/common.hpp>
 #include <ga/avcodec.hpp>
 #include <ga/module.hpp>
+#include <ga/trace.hpp>
+#include <atomic>
 #include <mutex>
 
+#define ENCODER_PKTQUEUE_SLOTS 4096	/**< Number of packet descriptors per queue, must be a power of 2 */
+#define ENCODER_PKTQUEUE_READERS 8	/**< Maximum number of readers per queue */
+#define ENCODER_PKTQUEUE_CALLBACKS 8	/**< Maximum number of callbacks per queue */
+#define ENCODER_PKTQUEUE_DEFAULT_READER 0	/**< Reader used by the single-reader interfaces */
+#define ENCODER_PKT_FLAG_PARTIAL 0x8000	/**< AVPacket flag: more packets of the same frame follow */
+#define ENCODER_FRAMELOG_SIZE 256	/**< Sent video frames remembered per channel */
+
 /*
  * Packet format for encoder packet queue.
  *
@@ -39,17 +48,45 @@ struct encoder_packet_t {
 	unsigned size;		/**< Size of the buffer */
 	int64_t pts_int64;	/**< Packet timestamp in a 64-bit integer */
 	struct timeval pts_tv;	/**< Packet timestamp in \a timeval structure */
+	ga_trace_t trace;	/**< Latency trace record of the encoded frame */
 	// internal data structure - do not touch
-	int padding;		/**< Padding area: internal used */
+	uint64_t pos;		/**< Position in the queue buffer: internal used */
 };
 
+typedef void (*qcallback_t)(int);
+
+/*
+ * Per-reader state of an encoder packet queue.
+ *
+ * Only the reader thread modifies the state, except \a active.
+ */
+typedef struct encoder_packet_reader_s {
+	alignas(64) std::atomic<uint64_t> cursor;	/**< Index of the next packet to read */
+	std::atomic<int> active;	/**< The reader is opened */
+	unsigned skip;		/**< Bytes of the current packet already consumed */
+	unsigned limit;		/**< Size of the current split packet, 0 if not split */
+	unsigned resetseq;	/**< Last handled reset of the queue */
+}	encoder_packet_reader_t;
+
+/*
+ * Encoder packet queue: a byte ring for packet data and a ring of packet
+ * descriptors. There is one writer (the encoder) and multiple readers.
+ * The writer never waits for the readers, and a packet is dropped
+ * if the slowest reader has not released enough space.
+ */
 typedef struct encoder_packet_queue_s {
-	std::mutex mutex;	/**< Per-queue mutex */
+	std::mutex mutex;	/**< Per-queue mutex: reader and callback registration only */
 	char *buf;		/**< Pointer to the packet queue buffer */
 	int bufsize;		/**< Size of the queue buffer */
-	int datasize;		/**< Size of occupied data size */
-	int head;		/**< Position of queue head */
-	int tail;		/**< Position of queue tail */
+	encoder_packet_t *slot;	/**< Packet descriptors */
+	uint64_t tailpos;	/**< Writer position in the queue buffer, including padding */
+	int reserved;		/**< Size reserved by the writer, 0 if none */
+	alignas(64) std::atomic<uint64_t> tail;	/**< Number of appended packets */
+	std::atomic<uint64_t> datatail;	/**< Published \a tailpos */
+	std::atomic<unsigned> resetseq;	/**< Bumped on every reset */
+	std::atomic<qcallback_t> cb[ENCODER_PKTQUEUE_CALLBACKS];	/**< Callbacks */
+	std::atomic<int> cbinflight;	/**< Number of callback rounds running in the writer */
+	encoder_packet_reader_t reader[ENCODER_PKTQUEUE_READERS];	/**< Readers */
 }	encoder_packet_queue_t;
 
 typedef struct encoder_pts_s {
@@ -57,8 +94,6 @@ typedef struct encoder_pts_s {
 	struct timeval ptv;
 }	encoder_pts_t;
 
-typedef void (*qcallback_t)(int);
-
 EXPORT int encoder_pts_sync(int samplerate);
 EXPORT int encoder_running();
 EXPORT int encoder_register_vencoder(ga_module_t *m, void *param);
@@ -71,22 +106,39 @@ EXPORT int encoder_register_client(void *ctx);
 EXPORT int encoder_unregister_client(void *ctx);
 
 EXPORT int encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);
+EXPORT char * encoder_reserve_packet(int channelId, int size);
+EXPORT void encoder_set_trace(int channelId, ga_trace_t *trace);
+EXPORT ga_trace_t * encoder_get_trace(int channelId);
+EXPORT int encoder_commit_packet(const char *prefix, int channelId, int size, int64_t encoderPts, struct timeval *ptv);
 
 // encoder pts to ptv mapping function
 EXPORT int encoder_pts_clear(unsigned queueid);
 EXPORT int encoder_pts_put(unsigned queueid, long long pts, struct timeval *ptv);
 EXPORT struct timeval * encoder_ptv_get(unsigned queueid, long long pts, struct timeval *ptv, int interpolation);
+EXPORT void encoder_framelog_put(int channelId, long long pts, struct timeval *ptv);
+EXPORT long long encoder_framelog_lookup(int channelId, struct timeval *ptv, long long tolerance);
 
 // encoder packet queue - for async packet delivery
 EXPORT int encoder_pktqueue_init(int channels, int qsize);
 EXPORT int encoder_pktqueue_reset();
 EXPORT int encoder_pktqueue_reset_channel(int channelId);
 EXPORT int encoder_pktqueue_size(int channelId);
+EXPORT int encoder_pktqueue_frame_size(int channelId);
 EXPORT int encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);
+EXPORT char * encoder_pktqueue_reserve(int channelId, int size);
+EXPORT int encoder_pktqueue_commit(int channelId, int size, int64_t pts, struct timeval *ptv);
 EXPORT char * encoder_pktqueue_front(int channelId, encoder_packet_t *pkt);
 EXPORT void encoder_pktqueue_split_packet(int channelId, char *offset);
 EXPORT void encoder_pktqueue_pop_front(int channelId);
 EXPORT int encoder_pktqueue_register_callback(int channelId, qcallback_t cb);
 EXPORT int encoder_pktqueue_unregister_callback(int channelId, qcallback_t cb);
+// encoder packet queue - multiple readers
+EXPORT int encoder_pktqueue_reader_open(int channelId);
+EXPORT void encoder_pktqueue_reader_close(int channelId, int readerId);
+EXPORT int encoder_pktqueue_size_r(int channelId, int readerId);
+EXPORT int encoder_pktqueue_frame_size_r(int channelId, int readerId);
+EXPORT char * encoder_pktqueue_front_r(int channelId, int readerId, encoder_packet_t *pkt);
+EXPORT void encoder_pktqueue_split_packet_r(int channelId, int readerId, char *offset);
+EXPORT void encoder_pktqueue_pop_front_r(int channelId, int readerId);
 
 #endif
@@ -52,6 +52,8 @@ enum ga_module_types {
 enum ga_ioctl_commands {
 	GA_IOCTL_NULL = 0,		/**< Not used */
 	GA_IOCTL_RECONFIGURE,		/**< Reconfiguration */
+	GA_IOCTL_GETPIXFMTS,		/**< Get accepted input pixel formats: for encoders */
+	GA_IOCTL_INVALIDATE,		/**< Recover from frames lost by a client: for video encoders */
 	GA_IOCTL_GETSPS = 0x100,	/**< Get SPS: for H.264 and H.265 */
 	GA_IOCTL_GETPPS,		/**< Get PPS: for H.264 and H.265 */
 	GA_IOCTL_GETVPS,		/**< Get VPS: for H.265 */
@@ -83,6 +85,17 @@ typedef struct ga_ioctl_buffer_s {
 	int size;		/**< Size of the buffer */
 }	ga_ioctl_buffer_t;
 
+#define	GA_IOCTL_PIXFMTS_MAX		8	/**< Maximum number of pixel formats in \a ga_ioctl_pixfmts_t */
+
+/**
+ * Parameter for ioctl()'s GET PIXFMTS command.
+ */
+typedef struct ga_ioctl_pixfmts_s {
+	int id;
+	int count;		/**< Number of accepted pixel formats */
+	int pixfmts[GA_IOCTL_PIXFMTS_MAX];	/**< Accepted AVPixelFormat values, the preferred one first */
+}	ga_ioctl_pixfmts_t;
+
 /**
  * Parameter for ioctl()'s codec reconfiguration command.
  */
@@ -97,6 +110,17 @@ typedef struct ga_ioctl_reconfigure_s {
 	int height;		/**< Height */
 }	ga_ioctl_reconfigure_t;
 
+/**
+ * Parameter for ioctl()'s INVALIDATE command.
+ *
+ * The encoder stops referencing the frames after \a pts, or sends
+ * an intra frame if it cannot invalidate references.
+ */
+typedef struct ga_ioctl_invalidate_s {
+	int id;
+	int64_t pts;		/**< Encoder pts of the last frame received intact, or -1 if unknown */
+}	ga_ioctl_invalidate_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
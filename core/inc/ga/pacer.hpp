@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Send-side packet pacer: the header.
+ */
+
+#ifndef GA_PACER_HPP
+#define GA_PACER_HPP
+
+#include <ga/common.hpp>
+
+/**
+ * Pacing metrics of a stream, since its creation or the last reset.
+ */
+typedef struct pacer_stats_s {
+	unsigned long long packets;		/**< Packets sent */
+	unsigned long long bytes;		/**< Bytes sent */
+	unsigned long long late;		/**< Packets sent more than a frame interval after queued */
+	long long delay_sum;			/**< Sum of the queuing delays, in microseconds */
+	long long delay_max;			/**< Max queuing delay, in microseconds */
+	long long backlog_sum;			/**< Sum of the backlogs seen by each packet, in bytes */
+	long long backlog_max;			/**< Max backlog, in bytes */
+} pacer_stats_t;
+
+typedef struct pacer_s pacer_t;
+
+EXPORT int pacer_init();
+EXPORT int pacer_enabled();
+EXPORT long long pacer_interval();
+EXPORT pacer_t* pacer_create(const char* name);
+EXPORT long long pacer_delay(pacer_t* p, int bytes, long long backlog, long long deadline);
+EXPORT void pacer_sent(pacer_t* p, int bytes, long long backlog, long long queued);
+EXPORT void pacer_take(pacer_t* p, int bytes);
+EXPORT void pacer_stats(pacer_t* p, pacer_stats_t* stats, int reset);
+EXPORT void pacer_destroy(pacer_t* p);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Adaptive bitrate controller: the header.
+ */
+
+#ifndef GA_RATECTL_HPP
+#define GA_RATECTL_HPP
+
+#include <ga/common.hpp>
+#include <ga/module.hpp>
+
+EXPORT int ratectl_init(ga_module_t *vsource, ga_module_t *vencoder);
+EXPORT int ratectl_enabled();
+EXPORT int ratectl_bitrate();
+EXPORT void ratectl_netreport(unsigned int duration, unsigned int pktcount, unsigned int pktloss, unsigned int bytecount, unsigned int capacity);
+EXPORT void ratectl_rtcp(unsigned int ssrc, unsigned long long pktsent, unsigned long long pktlost, long long rtt);
+EXPORT void ratectl_deinit();
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * XOR forward error correction for RTP (RFC 5109): the header.
+ */
+
+#ifndef GA_RTPFEC_HPP
+#define GA_RTPFEC_HPP
+
+#include <ga/common.hpp>
+
+#define RTPFEC_PT_DEFAULT	  120	 /**< Default payload type of the FEC packets */
+#define RTPFEC_GROUP_MAX	  16	 /**< Max media packets protected by a FEC packet */
+#define RTPFEC_PACKET_MAX	  2048 /**< Max size of a protected packet */
+#define RTPFEC_HEADER_SIZE	  (12 + 10 + 4) /**< RTP, FEC, and level 0 headers */
+#define RTPFEC_HISTORY		  64	 /**< Media packets kept by a decoder */
+
+/**
+ * A FEC group being built by a sender: the XOR of its media packets so far.
+ */
+typedef struct rtpfec_group_s {
+	int count;								/**< Media packets in the group */
+	unsigned short snbase;				/**< Sequence number of the first one */
+	unsigned short fecseq;				/**< Sequence number of the next FEC packet */
+	unsigned short mask;					/**< Offsets of the media packets from snbase */
+	unsigned char bits[2];				/**< XOR of the first two bytes of the RTP headers */
+	unsigned int ts;						/**< XOR of the timestamps */
+	unsigned int lastts;					/**< Timestamp of the last media packet */
+	unsigned int ssrc;
+	unsigned short length;				/**< XOR of the lengths after the fixed RTP header */
+	int protlen;							/**< Longest length after the fixed RTP header */
+	unsigned char payload[RTPFEC_PACKET_MAX];
+} rtpfec_group_t;
+
+/**
+ * A media packet kept by a receiver.
+ */
+typedef struct rtpfec_slot_s {
+	int valid;
+	unsigned short seq;
+	int len;
+	unsigned char data[RTPFEC_PACKET_MAX];
+} rtpfec_slot_t;
+
+/**
+ * Receiver state of a stream (SSRC).
+ */
+typedef struct rtpfec_decoder_s {
+	unsigned int recovered;				/**< Packets recovered so far */
+	unsigned int unrecoverable;		/**< FEC packets that came too late or with two losses */
+	rtpfec_slot_t slot[RTPFEC_HISTORY];
+} rtpfec_decoder_t;
+
+EXPORT int rtpfec_init();
+EXPORT int rtpfec_enabled();
+EXPORT int rtpfec_payload_type();
+EXPORT int rtpfec_group_size();
+EXPORT void rtpfec_netreport(unsigned int pktcount, unsigned int pktloss);
+// sender
+EXPORT void rtpfec_group_init(rtpfec_group_t* g, unsigned short fecseq);
+EXPORT int rtpfec_group_add(rtpfec_group_t* g, const unsigned char* pkt, int len);
+EXPORT int rtpfec_group_flush(rtpfec_group_t* g, int pt, unsigned char* out, int outsize);
+// receiver
+EXPORT rtpfec_decoder_t* rtpfec_decoder_create();
+EXPORT void rtpfec_decoder_put(rtpfec_decoder_t* d, const unsigned char* pkt, int len);
+EXPORT int rtpfec_decoder_recover(rtpfec_decoder_t* d, const unsigned char* fec, int len, unsigned char* out, int outsize);
+EXPORT void rtpfec_decoder_destroy(rtpfec_decoder_t* d);
+
+#endif
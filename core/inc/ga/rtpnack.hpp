@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * History of sent RTP packets for NACK retransmission: the header.
+ */
+
+#ifndef GA_RTPNACK_HPP
+#define GA_RTPNACK_HPP
+
+#include <ga/common.hpp>
+
+#define RTPNACK_HISTORY_DEFAULT 1024 /**< Default packets kept per stream */
+#define RTPNACK_PACKET_MAX		  2048 /**< Max size of a kept packet */
+
+/**
+ * Send a packet again. Called with the history locked, from the thread
+ * that handles the NACK: the callback must not block.
+ * \a to is the client that reported the loss, or NULL if it is not known.
+ * A sender shared by several clients sends the packet to \a to only.
+ */
+typedef void (*rtpnack_send_t)(void* arg, const struct sockaddr_in* to, const unsigned char* pkt, int len);
+
+typedef struct rtpnack_history_s rtpnack_history_t;
+
+EXPORT int rtpnack_init();
+EXPORT int rtpnack_enabled();
+EXPORT rtpnack_history_t* rtpnack_history_create(rtpnack_send_t send, void* arg);
+EXPORT void rtpnack_history_put(rtpnack_history_t* h, const unsigned char* pkt, int len);
+EXPORT void rtpnack_history_destroy(rtpnack_history_t* h);
+EXPORT int rtpnack_retransmit(unsigned int ssrc, int nfci, const unsigned short* pid, const unsigned short* blp, const struct sockaddr_in* to);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Per-stage latency tracing: the header.
+ */
+
+#ifndef GA_TRACE_HPP
+#define GA_TRACE_HPP
+
+#include <ga/common.hpp>
+
+/**
+ * Pipeline stages of a traced video frame, in order.
+ */
+enum ga_trace_stage {
+	GA_TRACE_CAPTURE = 0,	/**< Frame captured */
+	GA_TRACE_STORE,		/**< Frame stored into the source pipe */
+	GA_TRACE_FILTER,	/**< Frame converted by the filter */
+	GA_TRACE_ENCODE,	/**< Frame encoded */
+	GA_TRACE_QUEUE,		/**< Packet appended to the packet queue */
+	GA_TRACE_SEND,		/**< Packet sent to the network */
+	GA_TRACE_STAGES		/**< Number of stages */
+};
+
+/**
+ * Trace record carried by a video frame and its encoded packet.
+ */
+typedef struct ga_trace_s {
+	unsigned int frameid;	/**< Frame id, 0 if the frame is not traced */
+	long long ts[GA_TRACE_STAGES];	/**< Monotonic timestamps in microseconds, 0 if not reached */
+}	ga_trace_t;
+
+EXPORT int ga_trace_enabled();
+EXPORT long long ga_trace_now();
+EXPORT void ga_trace_begin(ga_trace_t *trace);
+EXPORT void ga_trace_stamp(ga_trace_t *trace, int stage);
+EXPORT int ga_trace_report(char *buf, int bufsize, int reset);
+EXPORT void ga_trace_print();
+
+#endif
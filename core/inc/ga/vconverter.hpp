@@ -49,4 +49,17 @@ EXPORT struct SwsContext * create_frame_converter(
 		int srcw, int srch, AVPixelFormat srcfmt,
 		int dstw, int dsth, AVPixelFormat dstfmt);
 
+/**
+ * Built-in video frame converter.
+ *
+ * Converts a packed RGBA/BGRA frame of \a width x \a height pixels
+ * into the planes of a YUV420P or NV12 frame of the same size.
+ */
+typedef void (*native_converter_t)(const unsigned char *src, int srcstride,
+		int width, int height,
+		unsigned char *dst[], const int dststride[]);
+
+EXPORT native_converter_t lookup_native_converter(int srcw, int srch, AVPixelFormat srcfmt, int dstw, int dsth, AVPixelFormat dstfmt);
+EXPORT const char * native_converter_isa();
+
 #endif
@@ -22,6 +22,7 @@
 #include <ga/common.hpp>
 #include <ga/avcodec.hpp>
 #include <ga/dpipe.hpp>
+#include <ga/trace.hpp>
 
 /** Define the default width of the max resolution
  * (can be tuned by configuration).
@@ -40,6 +41,19 @@
 /** Define the default video source pipe pool size (frames in the pipe) */
 #define	VIDEO_SOURCE_POOLSIZE		8
 
+/** Define the maximum number of dirty rectangles carried by a video frame */
+#define	VIDEO_SOURCE_DIRTY_MAX		16
+
+/**
+ * Data structure to store a rectangle of a video frame.
+ */
+typedef struct vsource_rect_s {
+	int x;			/**< Left */
+	int y;			/**< Top */
+	int width;		/**< Width */
+	int height;		/**< Height */
+}	vsource_rect_t;
+
 /**
  * Data structure to store a video frame in RGBA or YUV420 format.
  */
@@ -59,6 +73,11 @@ typedef struct vsource_frame_s {
 	int realstride;		/**< stride for RGBA and BGRA video frame */
 	int realsize;		/**< Total size of the video frame data */
 	struct timeval timestamp;	/**< Captured timestamp */
+	ga_trace_t trace;	/**< Latency trace record */
+	int ndirty;		/**< Number of dirty rectangles,
+				 * 0 if the whole frame may have changed */
+	vsource_rect_t dirty[VIDEO_SOURCE_DIRTY_MAX];	/**< Regions changed
+				 * since the previous frame of the source */
 	// internal data - should not change after initialized
 	int maxstride;		/**< */
 	int imgbufsize;		/**< Allocated video frame buffer size */
@@ -122,6 +141,8 @@ EXPORT int vsource_embed_colorcode_init(int RGBmode);
 EXPORT void vsource_embed_colorcode_reset();
 EXPORT void vsource_embed_colorcode_inc(vsource_frame_t *frame);
 EXPORT void vsource_embed_colorcode(vsource_frame_t *frame, unsigned int value);
+EXPORT int vsource_detect_colorcode_init();
+EXPORT int vsource_detect_colorcode(unsigned char *planes[], int linesize[], int width, int height, int pixelformat, unsigned int *value);
 
 EXPORT int video_source_channels();
 EXPORT vsource_t * video_source(int channel);
@@ -16,10 +16,38 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+/**
+ * @file
+ * Audio source: captured frames are shared by all the readers.
+ *
+ * The capture thread is the only writer. It writes each frame once into
+ * a shared ring and never waits for the readers. Each reader consumes the
+ * ring with its own cursor. A reader that falls behind by more than its
+ * backlog skips the oldest frames. A read is validated after the copy,
+ * since the writer may have wrapped around over the frames being copied.
+ */
+
 #include "asource.hpp"
 
+#ifdef __linux__
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#endif
+
+#include <atomic>
+#include <limits.h>
+#include <mutex>
 #include <unordered_map>
 
+#define ASOURCE_RING_CHUNKS	16 /**< Size of the shared ring, in chunks */
+#define ASOURCE_BACKLOG_CHUNKS 4	/**< Maximum backlog of a reader, in chunks */
+#define ASOURCE_WAIT_MS			1000 /**< Maximum wait of a read */
+
 static std::mutex ccmutex;
 static std::unordered_map<long, audio_buffer_t*> gClients;
 
@@ -28,15 +56,65 @@ static int gSamplerate	  = 0;
 static int gBitspersample = 0;
 static int gChannels		  = 0;
 
+static unsigned char* gRing = NULL;
+static int gRingFrames		 = 0; /**< Ring size in frames */
+static int gFramesize		 = 0; /**< Frame size in bytes */
+static std::atomic<unsigned long long> gRingTail{0};	 /**< Frames written */
+static std::atomic<unsigned long long> gRingWriting{0}; /**< Frames written, including the ones being written */
+static std::atomic<unsigned int> gRingSeq{0};			 /**< Write sequence, also the futex word */
+static std::atomic<int> gRingWaiters{0};
+#ifndef __linux__
+static std::mutex gRingMutex;
+static std::condition_variable gRingCond;
+#endif
+
+/**
+ * Wake up the readers blocked in audio_source_ring_wait().
+ */
+static void audio_source_ring_notify()
+{
+	gRingSeq.fetch_add(1, std::memory_order_seq_cst);
+	if(gRingWaiters.load(std::memory_order_seq_cst) == 0)
+		return;
+#ifdef __linux__
+	syscall(SYS_futex, (int*)&gRingSeq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	{
+		std::lock_guard<std::mutex> lk{gRingMutex};
+	}
+	gRingCond.notify_all();
+#endif
+}
+
+/**
+ * Block until the write sequence differs from \a seq, or ASOURCE_WAIT_MS elapsed.
+ */
+static void audio_source_ring_wait(unsigned int seq)
+{
+	gRingWaiters.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+	struct timespec to;
+	to.tv_sec  = ASOURCE_WAIT_MS / 1000;
+	to.tv_nsec = (ASOURCE_WAIT_MS % 1000) * 1000000;
+	syscall(SYS_futex, (int*)&gRingSeq, FUTEX_WAIT_PRIVATE, seq, &to, NULL, 0);
+#else
+	std::unique_lock<std::mutex> lk{gRingMutex};
+	gRingCond.wait_for(lk, std::chrono::milliseconds{ASOURCE_WAIT_MS}, [seq] {
+		return gRingSeq.load(std::memory_order_seq_cst) != seq;
+	});
+#endif
+	gRingWaiters.fetch_sub(1, std::memory_order_seq_cst);
+}
+
 audio_buffer_t* audio_source_buffer_init()
 {
 	// XXX:	frames, chennels, and bitspersample should be the same as the
 	//	configuration -- since these are provided by encoders (clients)
 	audio_buffer_t* ab;
-	int frames			= gChunksize * 4;
+	int frames			= gChunksize * ASOURCE_BACKLOG_CHUNKS;
 	int channels		= gChannels;
 	int bitspersample = gBitspersample;
-	if(frames == 0 || channels == 0 || bitspersample == 0)
+	if(frames == 0 || channels == 0 || bitspersample == 0 || gRing == NULL)
 	{
 		ga_error("audio source: invalid argument (frames=%d, channels=%d, bitspersample=%d)\n", frames, channels, bitspersample);
 		return NULL;
@@ -49,12 +127,7 @@ audio_buffer_t* audio_source_buffer_init()
 	ab->frames			= frames;
 	ab->channels		= channels;
 	ab->bitspersample = bitspersample;
-	ab->bufsize			= frames * channels * bitspersample / 8;
-	if((ab->buffer = (unsigned char*)malloc(ab->bufsize)) == NULL)
-	{
-		free(ab);
-		return NULL;
-	}
+	ab->rpos				= gRingTail.load(std::memory_order_acquire);
 	return ab;
 }
 
@@ -62,120 +135,100 @@ void audio_source_buffer_deinit(audio_buffer_t* ab)
 {
 	if(ab == NULL)
 		return;
-	if(ab->buffer != NULL)
-		free(ab->buffer);
 	free(ab);
 }
 
-void audio_source_buffer_fill_one(audio_buffer_t* ab, const unsigned char* data, int frames)
+/**
+ * Write captured frames into the shared ring.
+ *
+ * @param data [in] Captured frames, or NULL for silence.
+ * @param frames [in] Number of frames.
+ *
+ * This function must be called from a single capture thread.
+ */
+void audio_source_buffer_fill(const unsigned char* data, int frames)
 {
-	int headspace, tailspace;
-	int framesize;
-	if(ab == NULL)
-		return;
-	if(frames <= 0)
+	unsigned long long tail;
+	int done, offset, n;
+	if(gRing == NULL || frames <= 0)
 		return;
-	framesize = frames * ab->channels * ab->bitspersample / 8;
-	std::lock_guard<std::mutex> lk{ab->bufmutex};
-retry:
-	headspace = ab->bufhead;
-	tailspace = ab->bufsize - ab->buftail;
-	if(framesize > headspace + tailspace)
+	// keep only the latest frames of an oversized chunk
+	if(frames > gRingFrames)
 	{
-		ga_error("Audio source: buffer overflow, packet dropped (%d frames)\n", frames);
-		ab->bufcond.notify_one();
-		return;
+		if(data != NULL)
+			data += (size_t)(frames - gRingFrames) * gFramesize;
+		frames = gRingFrames;
 	}
-	// we GUARANTEE that bufhead <= buftail
-	if(framesize <= tailspace)
+	tail = gRingTail.load(std::memory_order_relaxed);
+	// readers check this after copying, so it must be visible before the frames
+	gRingWriting.store(tail + frames, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	for(done = 0; done < frames; done += n)
 	{
-		// case #1: tailspace is sufficient, append at the end
+		offset = (int)((tail + done) % gRingFrames);
+		n		 = frames - done < gRingFrames - offset ? frames - done : gRingFrames - offset;
 		if(data == NULL)
-		{
-			memset(&ab->buffer[ab->buftail], 0, framesize);
-		}
+			memset(gRing + (size_t)offset * gFramesize, 0, (size_t)n * gFramesize);
 		else
-		{
-			std::copy(data, data + framesize, &ab->buffer[ab->buftail]);
-		}
-		ab->buftail += framesize;
-		ab->bframes += frames;
-		ab->bufcond.notify_one();
-		return;
-	}
-	// case #2: framesize > tailspace, but overall space is sufficient
-	std::copy(&ab->buffer[ab->bufhead], &ab->buffer[ab->bufhead] + ab->buftail - ab->bufhead, ab->buffer);
-	ab->buftail -= ab->bufhead;
-	ab->bufhead = 0;
-	goto retry;
-	// never reach here
-	return;
-}
-
-void audio_source_buffer_fill(const unsigned char* data, int frames)
-{
-	std::lock_guard<std::mutex> lk{ccmutex};
-	for(auto mi = gClients.begin(); mi != gClients.end(); mi++)
-	{
-		if(mi->second != NULL)
-		{
-			audio_source_buffer_fill_one(mi->second, data, frames);
-		}
+			memcpy(gRing + (size_t)offset * gFramesize, data + (size_t)done * gFramesize, (size_t)n * gFramesize);
 	}
+	gRingTail.store(tail + frames, std::memory_order_release);
+	audio_source_ring_notify();
 }
 
 int audio_source_buffer_read(audio_buffer_t* ab, unsigned char* buf, int frames)
 {
-	int copyframe = 0, copysize = 0;
-	struct timeval tv;
-	struct timespec to;
+	unsigned long long tail, writing;
+	unsigned int seq;
+	int copyframe, done, offset, n;
 
-	if(frames <= 0)
+	if(frames <= 0 || gRing == NULL)
 	{
 		return 0;
 	}
-
-	std::unique_lock<std::mutex> lk{ab->bufmutex};
-
-	if(ab->bframes == 0)
+	// load the sequence first, so that a write after the check wakes us up
+	seq  = gRingSeq.load(std::memory_order_seq_cst);
+	tail = gRingTail.load(std::memory_order_acquire);
+	if(tail == ab->rpos)
 	{
-		gettimeofday(&tv, NULL);
-		to.tv_sec  = tv.tv_sec + 1;
-		to.tv_nsec = tv.tv_usec * 1000;
-		ab->bufcond.wait_for(lk, std::chrono::seconds{to.tv_sec} + std::chrono::nanoseconds{to.tv_nsec});
+		audio_source_ring_wait(seq);
+		tail = gRingTail.load(std::memory_order_acquire);
 	}
-	if(ab->bframes >= frames)
+	while(tail != ab->rpos)
 	{
-		copyframe = frames;
-	}
-	else
-	{
-		copyframe = ab->bframes;
-	}
-	if(copyframe > 0)
-	{
-		copysize = copyframe * ab->channels * ab->bitspersample / 8;
-		//
-		bcopy(&ab->buffer[ab->bufhead], buf, copysize);
-		//
-		ab->bufhead += copysize;
-		ab->bframes -= copyframe;
-		ab->bufPts += copyframe;
-		if(ab->bframes == 0)
+		if(tail - ab->rpos > (unsigned long long)ab->frames)
+		{
+			ga_error("Audio source: reader overrun, %llu frames dropped\n", tail - ab->rpos - ab->frames);
+			ab->bufPts += tail - ab->rpos - ab->frames;
+			ab->rpos = tail - ab->frames;
+		}
+		copyframe = tail - ab->rpos < (unsigned long long)frames ? (int)(tail - ab->rpos) : frames;
+		for(done = 0; done < copyframe; done += n)
+		{
+			offset = (int)((ab->rpos + done) % gRingFrames);
+			n		 = copyframe - done < gRingFrames - offset ? copyframe - done : gRingFrames - offset;
+			memcpy(buf + (size_t)done * gFramesize, gRing + (size_t)offset * gFramesize, (size_t)n * gFramesize);
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		writing = gRingWriting.load(std::memory_order_relaxed);
+		// the copied frames are intact unless the writer has wrapped around over them
+		if(writing <= ab->rpos + gRingFrames)
 		{
-			ab->bufhead = ab->buftail = 0;
+			ab->rpos += copyframe;
+			ab->bufPts += copyframe;
+			return copyframe;
 		}
+		tail = gRingTail.load(std::memory_order_acquire);
 	}
-
-	return copyframe;
+	return 0;
 }
 
 void audio_source_buffer_purge(audio_buffer_t* ab)
 {
-	ga_error("audio: buffer purged (%d bytes / %d frames).\n", ab->buftail - ab->bufhead, ab->bframes);
-	std::lock_guard<std::mutex> lk{ab->bufmutex};
-	ab->bufPts	= 0LL;
-	ab->bufhead = ab->buftail = ab->bframes = 0;
+	unsigned long long tail = gRingTail.load(std::memory_order_acquire);
+	ga_error("audio: buffer purged (%llu frames).\n", tail - ab->rpos);
+	ab->bufPts = 0LL;
+	ab->rpos	  = tail;
 }
 
 void audio_source_client_register(long tid, audio_buffer_t* ab)
@@ -206,10 +259,29 @@ int audio_source_bitspersample() { return gBitspersample; }
 
 int audio_source_channels() { return gChannels; }
 
+/**
+ * Set up the audio parameters and the shared ring.
+ * This must be done before the readers are created.
+ */
 void audio_source_setup(int chunksize, int samplerate, int bitspersample, int channels)
 {
+	int frames	  = chunksize * ASOURCE_RING_CHUNKS;
+	int framesize = channels * bitspersample / 8;
 	gChunksize		= chunksize;
 	gSamplerate		= samplerate;
 	gBitspersample = bitspersample;
 	gChannels		= channels;
+	if(gRing != NULL && frames == gRingFrames && framesize == gFramesize)
+		return;
+	if(gRing != NULL)
+		free(gRing);
+	gRingFrames = gFramesize = 0;
+	if(frames <= 0 || framesize <= 0 || (gRing = (unsigned char*)malloc((size_t)frames * framesize)) == NULL)
+	{
+		gRing = NULL;
+		ga_error("audio source: cannot allocate ring (%d frames, %d bytes/frame)\n", frames, framesize);
+		return;
+	}
+	gRingFrames = frames;
+	gFramesize	= framesize;
 }
@@ -342,6 +342,22 @@ int ga_conf_readint(const char* key)
 	return strtol(ptr, NULL, 0);
 }
 
+/**
+ * Load the value of a parameter as an integer, with a default value.
+ *
+ * @param key [in] The parameter to be loaded.
+ * @param defval [in] The value returned when the parameter is not defined.
+ * @return The integer value of the parameter, or \a defval.
+ */
+int ga_conf_readint_default(const char* key, int defval)
+{
+	char buf[64];
+	char* ptr = ga_conf_readv(key, buf, sizeof(buf));
+	if(ptr == NULL)
+		return defval;
+	return strtol(ptr, NULL, 0);
+}
+
 /**
  * Load the value of a parameter as an double float number.
  *
@@ -39,6 +39,9 @@ static int qhead, qtail, qsize, qunit;
 static unsigned char* qbuffer = NULL;
 
 static msgfunc replay = NULL;
+// the client of the server thread
+static struct sockaddr_in ctrlclient;
+static int ctrlclient_valid = 0;
 
 #ifdef WIN32
 static unsigned long
@@ -379,6 +382,23 @@ error:
 	return -1;
 }
 
+/**
+ * Get the address of the client connected to the controller server.
+ *
+ * @param sin [out] The address of the client.
+ * @return 0 on success, or -1 if there is no client.
+ *
+ * This function is for the system message handlers, which run in the
+ * controller server thread.
+ */
+int ctrl_server_get_client(struct sockaddr_in* sin)
+{
+	if(ctrlclient_valid == 0)
+		return -1;
+	bcopy(&ctrlclient, sin, sizeof(ctrlclient));
+	return 0;
+}
+
 msgfunc ctrl_server_setreplay(msgfunc callback)
 {
 	msgfunc old = replay;
@@ -414,6 +434,7 @@ restart:
 	csinlen			 = sizeof(csin);
 	csin.sin_family = AF_INET;
 	clientaccepted	 = 0;
+	ctrlclient_valid = 0;
 	// handle only one client
 	if(conf->ctrlproto == IPPROTO_TCP)
 	{
@@ -447,6 +468,8 @@ restart:
 		}
 		ga_error("controller server-thread: receiving events ...\n");
 		clientaccepted = 1;
+		bcopy(&csin, &ctrlclient, sizeof(csin));
+		ctrlclient_valid = 1;
 	}
 
 	buflen = 0;
@@ -490,6 +513,8 @@ restart:
 				bcopy(&xsin, &csin, sizeof(csin));
 				// continue;
 			}
+			bcopy(&csin, &ctrlclient, sizeof(csin));
+			ctrlclient_valid = 1;
 		}
 	tcp_again:
 		if(buflen < 2)
@@ -23,7 +23,9 @@
 static ctrlsys_handler_t ctrlsys_handler_list[] = {
   NULL, /* 0 = CTRL_MSGSYS_SUBTYPE_NULL */
   NULL, /* 1 = CTRL_MSGSYS_SUBTYPE_SHUTDOWN */
-  NULL  /* 2 = CTRL_MSGSYS_SUBTYPE_NETREPORT */
+  NULL, /* 2 = CTRL_MSGSYS_SUBTYPE_NETREPORT */
+  NULL, /* 3 = CTRL_MSGSYS_SUBTYPE_FRAMELOSS */
+  NULL  /* 4 = CTRL_MSGSYS_SUBTYPE_NACK */
 };
 
 ctrlsys_handler_t ctrlsys_set_handler(unsigned char subtype, ctrlsys_handler_t handler)
@@ -49,6 +51,9 @@ ctrlsys_handler_t ctrlsys_set_handler(unsigned char subtype, ctrlsys_handler_t h
 static int ctrlsys_ntoh(ctrlmsg_system_t* msg)
 {
 	ctrlmsg_system_netreport_t* netreport;
+	ctrlmsg_system_frameloss_t* frameloss;
+	ctrlmsg_system_nack_t* nack;
+	int i;
 	msg->msgsize = ntohs(msg->msgsize);
 	switch(msg->subtype)
 	{
@@ -67,6 +72,26 @@ static int ctrlsys_ntoh(ctrlmsg_system_t* msg)
 			netreport->bytecount	 = htonl(netreport->bytecount);
 			netreport->capacity	 = htonl(netreport->capacity);
 			break;
+		case CTRL_MSGSYS_SUBTYPE_FRAMELOSS:
+			if(msg->msgsize != sizeof(ctrlmsg_system_frameloss_t))
+				return -1;
+			frameloss			  = (ctrlmsg_system_frameloss_t*)msg;
+			frameloss->pktloss  = ntohs(frameloss->pktloss);
+			frameloss->tv_sec	  = ntohl(frameloss->tv_sec);
+			frameloss->tv_usec  = ntohl(frameloss->tv_usec);
+			break;
+		case CTRL_MSGSYS_SUBTYPE_NACK:
+			nack = (ctrlmsg_system_nack_t*)msg;
+			if(msg->msgsize < CTRL_NACK_SIZE(0) || nack->nfci > CTRL_NACK_FCI_MAX || msg->msgsize != CTRL_NACK_SIZE(nack->nfci))
+				return -1;
+			nack->ssrc	  = ntohl(nack->ssrc);
+			nack->rtpport = ntohs(nack->rtpport);
+			for(i = 0; i < nack->nfci; i++)
+			{
+				nack->fci[i].pid = ntohs(nack->fci[i].pid);
+				nack->fci[i].blp = ntohs(nack->fci[i].blp);
+			}
+			break;
 		default:
 			return -1;
 	}
@@ -135,3 +160,68 @@ ctrlmsg_t* ctrlsys_netreport(ctrlmsg_t* msg,
 	msgn->capacity	  = htonl(capacity);
 	return msg;
 }
+
+/**
+ * Build a frame loss report message, which is sent from a client to a server
+ *
+ * @param msg [in]	The structure to store the built message.
+ *			The size of the structure must be at least \a sizeof(ctrlmsg_system_frameloss_t)
+ * @param channel [in] The video channel.
+ * @param synced [in] Whether the presentation time is synchronized with the server by RTCP.
+ * @param pktloss [in] Number of lost packets.
+ * @param lastgood [in] Presentation time of the last frame received intact, or NULL if there is none.
+ *
+ * The server recovers the stream without referencing the frames after \a lastgood.
+ */
+ctrlmsg_t* ctrlsys_frameloss(ctrlmsg_t* msg, int channel, int synced, unsigned int pktloss, struct timeval* lastgood)
+{
+	ctrlmsg_system_frameloss_t* msgf = (ctrlmsg_system_frameloss_t*)msg;
+	bzero(msg, sizeof(ctrlmsg_system_frameloss_t));
+	msgf->msgsize = htons(sizeof(ctrlmsg_system_frameloss_t));
+	msgf->msgtype = CTRL_MSGTYPE_SYSTEM;
+	msgf->subtype = CTRL_MSGSYS_SUBTYPE_FRAMELOSS;
+	msgf->channel = channel;
+	msgf->synced  = synced ? 1 : 0;
+	msgf->pktloss = htons(pktloss > 0xffff ? 0xffff : pktloss);
+	if(lastgood != NULL)
+	{
+		msgf->tv_sec  = htonl(lastgood->tv_sec);
+		msgf->tv_usec = htonl(lastgood->tv_usec);
+	}
+	return msg;
+}
+
+/**
+ * Build a generic NACK message, which is sent from a client to a server
+ *
+ * @param msg [in]	The structure to store the built message.
+ *			The size of the structure must be at least \a sizeof(ctrlmsg_system_nack_t)
+ * @param ssrc [in] SSRC of the RTP stream.
+ * @param rtpport [in] Port the client receives the stream on, or zero if unknown.
+ *			A server that sends a stream to several clients retransmits to this port only.
+ * @param nfci [in] Number of entries, at most CTRL_NACK_FCI_MAX.
+ * @param pid [in] Sequence number of the first lost packet of each entry.
+ * @param blp [in] Bitmask of the 16 packets following \a pid: bit i is set if packet pid + i + 1 is lost.
+ * @return The message, whose size is CTRL_NACK_SIZE(\a nfci).
+ */
+ctrlmsg_t* ctrlsys_nack(ctrlmsg_t* msg, unsigned int ssrc, unsigned short rtpport, int nfci, unsigned short* pid, unsigned short* blp)
+{
+	ctrlmsg_system_nack_t* msgn = (ctrlmsg_system_nack_t*)msg;
+	int i;
+	//
+	if(nfci > CTRL_NACK_FCI_MAX)
+		nfci = CTRL_NACK_FCI_MAX;
+	bzero(msg, sizeof(ctrlmsg_system_nack_t));
+	msgn->msgsize = htons(CTRL_NACK_SIZE(nfci));
+	msgn->msgtype = CTRL_MSGTYPE_SYSTEM;
+	msgn->subtype = CTRL_MSGSYS_SUBTYPE_NACK;
+	msgn->nfci	  = nfci;
+	msgn->rtpport = htons(rtpport);
+	msgn->ssrc	  = htonl(ssrc);
+	for(i = 0; i < nfci; i++)
+	{
+		msgn->fci[i].pid = htons(pid[i]);
+		msgn->fci[i].blp = htons(blp[i]);
+	}
+	return msg;
+}
@@ -22,6 +22,18 @@
  */
 #include "dpipe.hpp"
 
+#ifdef __linux__
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
 #include <map>
 #include <string>
 
@@ -31,6 +43,220 @@ using namespace std;
 static std::mutex dpipemap_mutex;
 static map<string, dpipe_t*> dpipemap;
 
+/**
+ * Hint the CPU that we are in a spin-wait loop.
+ */
+static inline void dpipe_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * Create a ring that is able to hold at least \a nslot buffers. This is an internal function.
+ *
+ * @param nslot [in] Minimum number of slots
+ * @return Pointer to the created ring
+ */
+static dpipe_ring_t* dpipe_ring_create(int nslot)
+{
+	unsigned int i, size = 1;
+	dpipe_ring_t* ring;
+	//
+	while(size < (unsigned int)nslot)
+		size <<= 1;
+	ring		 = new dpipe_ring_t();
+	ring->cell = new dpipe_cell_t[size];
+	for(i = 0; i < size; i++)
+	{
+		ring->cell[i].seq.store(i, std::memory_order_relaxed);
+		ring->cell[i].buffer = NULL;
+	}
+	ring->mask = size - 1;
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->tail.store(0, std::memory_order_relaxed);
+	return ring;
+}
+
+/**
+ * Release a ring. This is an internal function.
+ *
+ * @param ring [in] The ring to be released, can be NULL
+ */
+static void dpipe_ring_destroy(dpipe_ring_t* ring)
+{
+	if(ring == NULL)
+		return;
+	delete[] ring->cell;
+	delete ring;
+}
+
+/**
+ * Push a buffer into a ring. This is an internal function.
+ *
+ * @param ring [in] The ring
+ * @param buffer [in] The buffer to be pushed
+ *
+ * A push never fails because the ring is never smaller than
+ * the number of buffers owned by the pipe.
+ */
+static void dpipe_ring_push(dpipe_ring_t* ring, dpipe_buffer_t* buffer)
+{
+	dpipe_cell_t* cell;
+	unsigned int head = ring->head.load(std::memory_order_relaxed);
+	while(true)
+	{
+		cell = &ring->cell[head & ring->mask];
+		if((int)(cell->seq.load(std::memory_order_acquire) - head) == 0)
+		{
+			if(ring->head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed))
+				break;
+		}
+		else
+		{
+			head = ring->head.load(std::memory_order_relaxed);
+		}
+	}
+	cell->buffer = buffer;
+	cell->seq.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * Pop a buffer from a ring. This is an internal function.
+ *
+ * @param ring [in] The ring
+ * @return Pointer to the eldest buffer in the ring, or NULL if the ring is empty
+ *
+ * The tail is advanced with CAS, so the producer can safely
+ * drop the eldest frame in the output ring (see dpipe_get()).
+ */
+static dpipe_buffer_t* dpipe_ring_pop(dpipe_ring_t* ring)
+{
+	dpipe_cell_t* cell;
+	dpipe_buffer_t* buffer;
+	unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+	int diff;
+	while(true)
+	{
+		cell = &ring->cell[tail & ring->mask];
+		diff = (int)(cell->seq.load(std::memory_order_acquire) - (tail + 1));
+		if(diff == 0)
+		{
+			if(ring->tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if(diff < 0)
+		{
+			// empty
+			return NULL;
+		}
+		else
+		{
+			tail = ring->tail.load(std::memory_order_relaxed);
+		}
+	}
+	buffer = cell->buffer;
+	cell->seq.store(tail + ring->mask + 1, std::memory_order_release);
+	return buffer;
+}
+
+/**
+ * Wake up a consumer blocked in dpipe_lockfree_wait(). This is an internal function.
+ *
+ * @param dpipe [in] The involved pipe
+ *
+ * The store sequence is always bumped, but the syscall is only
+ * issued when a consumer has actually gone to sleep.
+ */
+static void dpipe_lockfree_notify(dpipe_t* dpipe)
+{
+	dpipe->seq.fetch_add(1, std::memory_order_seq_cst);
+	if(dpipe->waiters.load(std::memory_order_seq_cst) == 0)
+		return;
+#ifdef __linux__
+	syscall(SYS_futex, (int*)&dpipe->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	{
+		std::lock_guard<std::mutex> lk{dpipe->cond_mutex};
+	}
+	dpipe->cond.notify_one();
+#endif
+}
+
+/**
+ * Block until the store sequence differs from \a seq. This is an internal function.
+ *
+ * @param dpipe [in] The involved pipe
+ * @param seq [in] The last observed store sequence
+ * @param abstime [in] Absolute (wall-clock) timeout, or NULL to wait indefinitely
+ * @return 0 if woken up (possibly spuriously), or -1 on timed out
+ */
+static int dpipe_lockfree_wait(dpipe_t* dpipe, unsigned int seq, const struct timespec* abstime)
+{
+#ifdef __linux__
+	if(syscall(SYS_futex,
+				  (int*)&dpipe->seq,
+				  FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME,
+				  seq,
+				  abstime,
+				  NULL,
+				  FUTEX_BITSET_MATCH_ANY) < 0
+		&& errno == ETIMEDOUT)
+		return -1;
+	return 0;
+#else
+	std::unique_lock<std::mutex> lk{dpipe->cond_mutex};
+	auto changed = [dpipe, seq] { return dpipe->seq.load(std::memory_order_seq_cst) != seq; };
+	if(abstime == NULL)
+	{
+		dpipe->cond.wait(lk, changed);
+		return 0;
+	}
+	std::chrono::system_clock::time_point deadline{std::chrono::duration_cast<std::chrono::system_clock::duration>(
+	  std::chrono::seconds{abstime->tv_sec} + std::chrono::nanoseconds{abstime->tv_nsec})};
+	return dpipe->cond.wait_until(lk, deadline, changed) ? 0 : -1;
+#endif
+}
+
+/**
+ * Load a frame from a lock-free pipe. This is an internal function.
+ *
+ * @param dpipe [in] The involved pipe
+ * @param abstime [in] Absolute (wall-clock) timeout, or NULL to wait indefinitely
+ * @return Pointer to the loaded buffer, or NULL on timed out
+ *
+ * The consumer spins for \em DPIPE_LOCKFREE_SPINS rounds before going to sleep,
+ * so a frame stored shortly after the request is picked up without a syscall.
+ */
+static dpipe_buffer_t* dpipe_lockfree_load(dpipe_t* dpipe, const struct timespec* abstime)
+{
+	dpipe_buffer_t* vbuf;
+	unsigned int seq;
+	int i, timedout;
+	//
+	for(i = 0; i < DPIPE_LOCKFREE_SPINS; i++)
+	{
+		if((vbuf = dpipe_ring_pop(dpipe->out_ring)) != NULL)
+			return vbuf;
+		dpipe_cpu_relax();
+	}
+	while(true)
+	{
+		seq = dpipe->seq.load(std::memory_order_seq_cst);
+		if((vbuf = dpipe_ring_pop(dpipe->out_ring)) != NULL)
+			return vbuf;
+		dpipe->waiters.fetch_add(1, std::memory_order_seq_cst);
+		timedout = dpipe_lockfree_wait(dpipe, seq, abstime);
+		dpipe->waiters.fetch_sub(1, std::memory_order_seq_cst);
+		if(timedout)
+			return dpipe_ring_pop(dpipe->out_ring);
+	}
+	return NULL;
+}
+
 /**
  * Create and register a new video pipe.
  *
@@ -43,6 +269,30 @@ static map<string, dpipe_t*> dpipemap;
  * Note: dpipe_create() also returns NULL if the requesting name is existed.
  */
 dpipe_t* dpipe_create(int id, const char* name, int nframe, int maxframesize)
+{
+	return dpipe_create_ex(id, name, nframe, maxframesize, DPIPE_FLAG_NONE);
+}
+
+/**
+ * Create and register a new video pipe with creation flags.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe, must be unique
+ * @param nframe [in] Number of frame buffers in the pipe
+ * @param maxframesize [in] The maximum frame buffer size
+ * @param flags [in] Creation flags, see DPIPE_FLAG_*
+ * @return Pointer to a created dpipe, or NULL on failure
+ *
+ * With \em DPIPE_FLAG_LOCKFREE, the pipe is backed by two bounded lock-free rings
+ * (free and occupied buffers) instead of mutex-protected lists.
+ * The rings accept concurrent pushes and pops: the consumers of other pipes
+ * return shared frames to their owner (see dpipe_store_shared()), and
+ * dpipe_get() drops the eldest frame while a consumer loads. A stored frame
+ * wakes up a single blocked consumer, so the mode still suits one consumer
+ * per pipe best. dpipe_get() and dpipe_get_shared() may return NULL when
+ * the consumers hold all the frames.
+ */
+dpipe_t* dpipe_create_ex(int id, const char* name, int nframe, int maxframesize, int flags)
 {
 	int i;
 	dpipe_t* dpipe;
@@ -68,26 +318,39 @@ dpipe_t* dpipe_create(int id, const char* name, int nframe, int maxframesize)
 	for(i = 0; i < nframe; i++)
 	{
 		dpipe_buffer_t* dbuffer;
-		if((dbuffer = (dpipe_buffer_t*)malloc(sizeof(dpipe_buffer_t))) == NULL)
-		{
-			dpipe_destroy(dpipe);
-			return nullptr;
-		}
+		dbuffer = new dpipe_buffer_t();
 		if(ga_malloc(maxframesize, &dbuffer->internal, &dbuffer->offset) < 0)
 		{
-			free(dbuffer);
+			delete dbuffer;
 			dpipe_destroy(dpipe);
 			return nullptr;
 		}
 		dbuffer->pointer = (void*)(((char*)dbuffer->internal) + dbuffer->offset);
+		dbuffer->owner	  = dpipe;
 		dbuffer->next	  = dpipe->in;
 		dpipe->in		  = dbuffer;
 		dpipe->in_count++;
 	}
+	// lock-free rings: the 'in' list is kept untouched for buffer enumeration
+	dpipe->flags = flags;
+	if(flags & DPIPE_FLAG_LOCKFREE)
+	{
+		dpipe_buffer_t* dbuffer;
+		dpipe->free_ring = dpipe_ring_create(nframe);
+		dpipe->out_ring  = dpipe_ring_create(nframe);
+		for(dbuffer = dpipe->in; dbuffer != NULL; dbuffer = dbuffer->next)
+		{
+			dpipe_ring_push(dpipe->free_ring, dbuffer);
+		}
+	}
 	//
 	std::lock_guard<std::mutex> lk{dpipemap_mutex};
 	dpipemap[dpipe->name] = dpipe;
-	ga_error("dpipe: '%s' initialized, %d frames, framesize = %d\n", dpipe->name, dpipe->in_count, maxframesize);
+	ga_error("dpipe: '%s' initialized, %d frames, framesize = %d%s\n",
+				dpipe->name,
+				dpipe->in_count,
+				maxframesize,
+				(flags & DPIPE_FLAG_LOCKFREE) ? ", lock-free" : "");
 	return dpipe;
 }
 
@@ -130,36 +393,39 @@ int dpipe_destroy(dpipe_t* dpipe)
 	{
 		next = vbuf->next;
 		free(vbuf->internal);
-		free(vbuf);
+		delete vbuf;
 	}
 	for(vbuf = dpipe->out; vbuf != NULL; vbuf = next)
 	{
 		next = vbuf->next;
 		free(vbuf->internal);
-		free(vbuf);
+		delete vbuf;
 	}
+	dpipe_ring_destroy(dpipe->free_ring);
+	dpipe_ring_destroy(dpipe->out_ring);
 	//
 	delete dpipe;
 	return 0;
 }
 
 /**
- * Get a free frame buffer from the pipe
- *
- * @param dpipe [in] The pipe to get a free frame
- * @return Pointer to the frame buffer structure
- *
- * Note: Data should be stored in vbuf->pointer, with a maximum size
- * of \a maxframesize given when creating the pipe.
- * This function should always success.
- * In case there is no availabe free frame buffer, this function
- * returns the eldest frame buffer in the output pool.
+ * Take a buffer from the input pool, or the eldest one from the output pool.
+ * This is an internal function.
  *
+ * @param dpipe [in] The involved pipe
+ * @return Pointer to the frame buffer structure, or NULL if all buffers are in use
  */
-dpipe_buffer_t* dpipe_get(dpipe_t* dpipe)
+static dpipe_buffer_t* dpipe_get_internal(dpipe_t* dpipe)
 {
 	dpipe_buffer_t* vbuf = NULL;
 	//
+	if(dpipe->flags & DPIPE_FLAG_LOCKFREE)
+	{
+		if((vbuf = dpipe_ring_pop(dpipe->free_ring)) == NULL)
+			vbuf = dpipe_ring_pop(dpipe->out_ring);
+		return vbuf;
+	}
+	//
 	std::lock_guard<std::mutex> lk{dpipe->io_mutex};
 	if(dpipe->in != NULL)
 	{
@@ -190,19 +456,92 @@ dpipe_buffer_t* dpipe_get(dpipe_t* dpipe)
 }
 
 /**
- * Put a frame back to the free frame buffer (input pool)
+ * Return a buffer to the input pool. This is an internal function.
  *
  * @param dpipe [in] The involved pipe
  * @param buffer [in] Pointer to the buffer to be released
  */
-void dpipe_put(dpipe_t* dpipe, dpipe_buffer_t* buffer)
+static void dpipe_put_internal(dpipe_t* dpipe, dpipe_buffer_t* buffer)
 {
+	if(dpipe->flags & DPIPE_FLAG_LOCKFREE)
+	{
+		dpipe_ring_push(dpipe->free_ring, buffer);
+		return;
+	}
 	std::lock_guard<std::mutex> lk{dpipe->io_mutex};
 	buffer->next = dpipe->in;
 	dpipe->in	 = buffer;
 	dpipe->in_count++;
 }
 
+/**
+ * Drop a pipe's reference to a frame buffer. This is an internal function.
+ *
+ * @param buffer [in] The buffer that is leaving its pipe (released or dropped)
+ * @return 1 if the buffer can be reused by its pipe, or 0 if the frame is still
+ *	referenced by other pipes.
+ *
+ * If \a buffer carries a shared frame, the carrier is detached and
+ * the shared frame goes back to its owner when the last reference is dropped.
+ */
+static int dpipe_unref(dpipe_buffer_t* buffer)
+{
+	dpipe_buffer_t* shared;
+	if((shared = buffer->shared) != NULL)
+	{
+		buffer->shared	= NULL;
+		buffer->pointer = (void*)(((char*)buffer->internal) + buffer->offset);
+		if(dpipe_unref(shared))
+			dpipe_put_internal(shared->owner, shared);
+		return 1;
+	}
+	if(buffer->refcnt.load(std::memory_order_acquire) == 0)
+		return 1;
+	return buffer->refcnt.fetch_sub(1, std::memory_order_acq_rel) == 1 ? 1 : 0;
+}
+
+/**
+ * Get a free frame buffer from the pipe
+ *
+ * @param dpipe [in] The pipe to get a free frame
+ * @return Pointer to the frame buffer structure
+ *
+ * Note: Data should be stored in vbuf->pointer, with a maximum size
+ * of \a maxframesize given when creating the pipe.
+ * This function should always success.
+ * In case there is no availabe free frame buffer, this function
+ * returns the eldest frame buffer in the output pool.
+ * A dropped frame that is still referenced by other pipes is skipped,
+ * so this function may return NULL if all the frames are shared.
+ *
+ */
+dpipe_buffer_t* dpipe_get(dpipe_t* dpipe)
+{
+	dpipe_buffer_t* vbuf;
+	while((vbuf = dpipe_get_internal(dpipe)) != NULL)
+	{
+		if(dpipe_unref(vbuf))
+			break;
+	}
+	return vbuf;
+}
+
+/**
+ * Put a frame back to the free frame buffer (input pool)
+ *
+ * @param dpipe [in] The involved pipe
+ * @param buffer [in] Pointer to the buffer to be released
+ *
+ * For a shared frame, the buffer returns to the input pool of
+ * its owner only when the last reference is released.
+ */
+void dpipe_put(dpipe_t* dpipe, dpipe_buffer_t* buffer)
+{
+	if(dpipe_unref(buffer) == 0)
+		return;
+	dpipe_put_internal(dpipe, buffer);
+}
+
 /**
  * Load a frame from the output pool of the pipe
  *
@@ -220,6 +559,9 @@ dpipe_buffer_t* dpipe_load(dpipe_t* dpipe, const struct timespec* abstime)
 	dpipe_buffer_t* vbuf = NULL;
 	int failed				= 0;
 	//
+	if(dpipe->flags & DPIPE_FLAG_LOCKFREE)
+		return dpipe_lockfree_load(dpipe, abstime);
+	//
 	std::unique_lock<std::mutex> lk{dpipe->io_mutex};
 	while(true)
 	{
@@ -261,6 +603,9 @@ dpipe_buffer_t* dpipe_load_nowait(dpipe_t* dpipe)
 {
 	dpipe_buffer_t* vbuf = NULL;
 	//
+	if(dpipe->flags & DPIPE_FLAG_LOCKFREE)
+		return dpipe_ring_pop(dpipe->out_ring);
+	//
 	std::lock_guard<std::mutex> lk{dpipe->io_mutex};
 	if(dpipe->out != NULL)
 	{
@@ -283,6 +628,12 @@ dpipe_buffer_t* dpipe_load_nowait(dpipe_t* dpipe)
  */
 void dpipe_store(dpipe_t* dpipe, dpipe_buffer_t* buffer)
 {
+	if(dpipe->flags & DPIPE_FLAG_LOCKFREE)
+	{
+		dpipe_ring_push(dpipe->out_ring, buffer);
+		dpipe_lockfree_notify(dpipe);
+		return;
+	}
 	std::unique_lock<std::mutex> lk{dpipe->io_mutex};
 	// put at the end
 	if(dpipe->out_tail != NULL)
@@ -300,3 +651,76 @@ void dpipe_store(dpipe_t* dpipe, dpipe_buffer_t* buffer)
 	lk.unlock();
 	dpipe->cond.notify_one();
 }
+
+/**
+ * Get a free frame buffer for publishing with dpipe_store_shared().
+ *
+ * @param dpipe [in] Array of pipes, the buffer is obtained from dpipe[0]
+ * @param ndpipe [in] Number of pipes in the array
+ * @return Pointer to the frame buffer structure, or NULL if all frames are held by consumers
+ *
+ * If all the frames of dpipe[0] are still referenced by the other pipes,
+ * the eldest pending frame of each of the other pipes is dropped until a frame is released.
+ */
+dpipe_buffer_t* dpipe_get_shared(dpipe_t** dpipe, int ndpipe)
+{
+	dpipe_buffer_t *vbuf, *carrier;
+	int i, dropped;
+	//
+	while((vbuf = dpipe_get(dpipe[0])) == NULL)
+	{
+		for(i = 1, dropped = 0; i < ndpipe; i++)
+		{
+			if((carrier = dpipe_load_nowait(dpipe[i])) != NULL)
+			{
+				dpipe_put(dpipe[i], carrier);
+				dropped++;
+			}
+		}
+		if(dropped == 0)
+			break;
+	}
+	return vbuf;
+}
+
+/**
+ * Store a frame into several pipes without copying the frame data.
+ *
+ * @param dpipe [in] Array of pipes, \a buffer must be obtained from dpipe[0],
+ *	preferably with dpipe_get_shared()
+ * @param ndpipe [in] Number of pipes in the array
+ * @param buffer [in] Pointer to the buffer to be stored
+ * @return Number of pipes the frame has been stored into
+ *
+ * dpipe[1] .. dpipe[ndpipe-1] receive a carrier buffer whose \a pointer
+ * refers to the frame in \a buffer, so consumers read the frame as usual
+ * and release it with dpipe_put().
+ * The frame returns to dpipe[0] only after all the references are released.
+ * Consumers must not modify a shared frame.
+ */
+int dpipe_store_shared(dpipe_t** dpipe, int ndpipe, dpipe_buffer_t* buffer)
+{
+	int i, stored = 1;
+	//
+	if(ndpipe <= 1)
+	{
+		dpipe_store(dpipe[0], buffer);
+		return 1;
+	}
+	buffer->refcnt.store(ndpipe, std::memory_order_release);
+	for(i = 1; i < ndpipe; i++)
+	{
+		dpipe_buffer_t* carrier;
+		if((carrier = dpipe_get(dpipe[i])) == NULL)
+		{
+			buffer->refcnt.fetch_sub(1, std::memory_order_acq_rel);
+			continue;
+		}
+		carrier->shared  = buffer;
+		carrier->pointer = buffer->pointer;
+		dpipe_store(dpipe[i], carrier);
+		stored++;
+	}
+	dpipe_store(dpipe[0], buffer);
+	return stored;
+}
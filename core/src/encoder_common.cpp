@@ -23,11 +23,13 @@
 
 #include "encoder_common.hpp"
 
+#include "conf.hpp"
 #include "vsource.hpp"
 
 #include <list>
 #include <map>
 #include <shared_mutex>
+#include <thread>
 
 static std::shared_mutex encoder_lock;
 static std::map<void*, void*> encoder_clients; /**< Count for encoder clients */
@@ -305,6 +307,92 @@ int encoder_send_packet(const char* prefix, int channelId, AVPacket* pkt, int64_
 	return -1;
 }
 
+static int pktqueue_initchannels = -1;
+static int pktqueue_zerocopy		= 0;
+static ga_trace_t pkttrace[VIDEO_SOURCE_CHANNEL_MAX + 1]; /**< Trace of the packet being sent */
+
+/**
+ * Attach a latency trace record to the next packet sent on a channel.
+ *
+ * @param channelId [in] Channel id.
+ * @param trace [in] The trace record of the encoded frame, or NULL to clear.
+ *
+ * This function must be called from the thread that sends the packets
+ * of the channel, before encoder_send_packet() or encoder_commit_packet().
+ * The record is consumed by the next packet appended to the packet queue.
+ */
+void encoder_set_trace(int channelId, ga_trace_t* trace)
+{
+	if(channelId < 0 || channelId > VIDEO_SOURCE_CHANNEL_MAX)
+		return;
+	if(trace == NULL)
+		pkttrace[channelId].frameid = 0;
+	else
+		pkttrace[channelId] = *trace;
+}
+
+/**
+ * Get the latency trace record attached to the packet being sent on a channel.
+ *
+ * @param channelId [in] Channel id.
+ * @return Pointer to the trace record. Its frame id is 0 if there is no record.
+ *
+ * Sink servers that send packets directly in their \em send_packet interface
+ * use this function to stamp the GA_TRACE_QUEUE and GA_TRACE_SEND stages.
+ */
+ga_trace_t* encoder_get_trace(int channelId)
+{
+	if(channelId < 0 || channelId > VIDEO_SOURCE_CHANNEL_MAX)
+		return NULL;
+	return &pkttrace[channelId];
+}
+
+/**
+ * Reserve space for a packet in the sink server's packet queue.
+ *
+ * @param channelId [in] Channel id.
+ * @param size [in] Size of the packet.
+ * @return Pointer to the reserved space,
+ *	or NULL if the packet has to be sent with encoder_send_packet().
+ *
+ * An encoder can write its output straight into the returned space
+ * and publish it with encoder_commit_packet(), which saves copying the
+ * packet into a temporary buffer and then into the queue.
+ * This is only available if the sink server reads from the packet queue
+ * and the \em encoder-zerocopy parameter is not disabled.
+ */
+char* encoder_reserve_packet(int channelId, int size)
+{
+	if(pktqueue_zerocopy == 0 || channelId < 0 || channelId >= pktqueue_initchannels)
+		return NULL;
+	return encoder_pktqueue_reserve(channelId, size);
+}
+
+/**
+ * Send a packet written into the space returned by encoder_reserve_packet().
+ *
+ * @param prefix [in] Name to identify the sender. Can be any valid string.
+ * @param channelId [in] Channel id.
+ * @param size [in] Size of the packet, not larger than the reserved size.
+ * @param encoderPts [in] Encoder presentation timestamp in an integer.
+ * @param ptv [in] Encoder presentation timestamp in \a timeval structure.
+ * @return 0 on success, or -1 on error.
+ */
+int encoder_commit_packet(const char* prefix, int channelId, int size, int64_t encoderPts, struct timeval* ptv)
+{
+	if(pktqueue_zerocopy == 0 || channelId < 0 || channelId >= pktqueue_initchannels)
+	{
+		ga_error("%s: no packet reserved on channel %d.\n", prefix, channelId);
+		return -1;
+	}
+	if(encoder_pktqueue_commit(channelId, size, encoderPts, ptv) < 0)
+	{
+		ga_error("%s: packet of channel %d dropped.\n", prefix, channelId);
+		return -1;
+	}
+	return 0;
+}
+
 // encoder pts to ptv mapping function
 #define MAX_PTS_QUEUE 8
 static std::list<encoder_pts_t> pts_queue[MAX_PTS_QUEUE]; // up to 8 queues
@@ -396,12 +484,71 @@ struct timeval* encoder_ptv_get(unsigned queueid, long long pts, struct timeval*
 	return NULL;
 }
 
+// log of sent video frames, for mapping a client's feedback to encoder pts
+static std::mutex framelog_mutex[VIDEO_SOURCE_CHANNEL_MAX];
+static encoder_pts_t framelog[VIDEO_SOURCE_CHANNEL_MAX][ENCODER_FRAMELOG_SIZE];
+static unsigned framelog_count[VIDEO_SOURCE_CHANNEL_MAX];
+
+/**
+ * Record a video frame sent by the sink server.
+ *
+ * @param channelId [in] Channel id.
+ * @param pts [in] Encoder presentation timestamp of the frame.
+ * @param ptv [in] Presentation time of the frame seen by the clients.
+ *
+ * The packets of the same frame can be recorded repeatedly,
+ * only the first one is kept.
+ */
+void encoder_framelog_put(int channelId, long long pts, struct timeval* ptv)
+{
+	encoder_pts_t* last;
+	if(channelId < 0 || channelId >= VIDEO_SOURCE_CHANNEL_MAX || ptv == NULL)
+		return;
+	std::lock_guard<std::mutex> lk{framelog_mutex[channelId]};
+	if(framelog_count[channelId] > 0)
+	{
+		last = &framelog[channelId][(framelog_count[channelId] - 1) % ENCODER_FRAMELOG_SIZE];
+		if(last->pts == pts)
+			return;
+	}
+	last		 = &framelog[channelId][framelog_count[channelId]++ % ENCODER_FRAMELOG_SIZE];
+	last->pts = pts;
+	last->ptv = *ptv;
+}
+
+/**
+ * Find the encoder pts of a recently sent video frame.
+ *
+ * @param channelId [in] Channel id.
+ * @param ptv [in] Presentation time of the frame reported by a client.
+ * @param tolerance [in] Maximum difference of presentation times in microseconds.
+ * @return The encoder pts, or -1 if the frame is not found.
+ */
+long long encoder_framelog_lookup(int channelId, struct timeval* ptv, long long tolerance)
+{
+	long long best = -1LL, bestdiff = tolerance + 1, diff;
+	unsigned i, n;
+	if(channelId < 0 || channelId >= VIDEO_SOURCE_CHANNEL_MAX || ptv == NULL)
+		return -1LL;
+	std::lock_guard<std::mutex> lk{framelog_mutex[channelId]};
+	n = framelog_count[channelId] < ENCODER_FRAMELOG_SIZE ? framelog_count[channelId] : ENCODER_FRAMELOG_SIZE;
+	for(i = 0; i < n; i++)
+	{
+		diff = tvdiff_us(ptv, &framelog[channelId][i].ptv);
+		if(diff < 0)
+			diff = -diff;
+		if(diff < bestdiff)
+		{
+			bestdiff = diff;
+			best		= framelog[channelId][i].pts;
+		}
+	}
+	return best;
+}
+
 // encoder packet queue functions - for async packet delivery
-static int pktqueue_initqsize		= -1;
-static int pktqueue_initchannels = -1;
+static int pktqueue_initqsize = -1;
 static encoder_packet_queue_t pktqueue[VIDEO_SOURCE_CHANNEL_MAX + 1];
-static std::list<encoder_packet_t> pktlist[VIDEO_SOURCE_CHANNEL_MAX + 1];
-static std::map<qcallback_t, qcallback_t> queue_cb[VIDEO_SOURCE_CHANNEL_MAX + 1];
 
 /**
  * Initialize an encoder packet queue.
@@ -414,30 +561,53 @@ static std::map<qcallback_t, qcallback_t> queue_cb[VIDEO_SOURCE_CHANNEL_MAX + 1]
  * This functoin should be called only once.
  * If you have multiple channels, specify the number in the \a channels
  * parameter.
+ *
+ * The default reader (ENCODER_PKTQUEUE_DEFAULT_READER) of each queue
+ * is opened here. It is used by the single-reader interfaces.
  */
 int encoder_pktqueue_init(int channels, int qsize)
 {
-	int i;
+	int i, j;
 	for(i = 0; i < channels; i++)
 	{
-		if(pktqueue[i].buf != NULL)
-			free(pktqueue[i].buf);
+		encoder_packet_queue_t* q = &pktqueue[i];
+		if(q->buf != NULL)
+			free(q->buf);
+		if(q->slot != NULL)
+			free(q->slot);
 		//
-		bzero(&pktqueue[i], sizeof(encoder_packet_queue_t));
-		if((pktqueue[i].buf = (char*)malloc(qsize)) == NULL)
+		if((q->buf = (char*)malloc(qsize)) == NULL
+		   || (q->slot = (encoder_packet_t*)calloc(ENCODER_PKTQUEUE_SLOTS, sizeof(encoder_packet_t))) == NULL)
 		{
 			ga_error("encoder: initialized packet queue#%d failed (%d bytes)\n", i, qsize);
 			exit(-1);
 		}
-		pktqueue[i].bufsize	= qsize;
-		pktqueue[i].datasize = 0;
-		pktqueue[i].head		= 0;
-		pktqueue[i].tail		= 0;
-		pktlist[i].clear();
+		q->bufsize = qsize;
+		q->tailpos	= 0;
+		q->reserved = 0;
+		q->tail.store(0);
+		q->datatail.store(0);
+		q->resetseq.store(0);
+		for(j = 0; j < ENCODER_PKTQUEUE_CALLBACKS; j++)
+			q->cb[j].store(NULL);
+		q->cbinflight.store(0);
+		for(j = 0; j < ENCODER_PKTQUEUE_READERS; j++)
+		{
+			q->reader[j].cursor.store(0);
+			q->reader[j].skip	  = 0;
+			q->reader[j].limit	  = 0;
+			q->reader[j].resetseq = 0;
+			q->reader[j].active.store(j == ENCODER_PKTQUEUE_DEFAULT_READER ? 1 : 0);
+		}
 	}
 	pktqueue_initqsize	 = qsize;
 	pktqueue_initchannels = channels;
-	ga_error("encoder: packet queue initialized (%dx%d bytes)\n", channels, qsize);
+	pktqueue_zerocopy		 = ga_conf_readbool("encoder-zerocopy", 1);
+	ga_error("encoder: packet queue initialized (%dx%d bytes, %d slots, zerocopy=%d)\n",
+				channels,
+				qsize,
+				ENCODER_PKTQUEUE_SLOTS,
+				pktqueue_zerocopy);
 	return 0;
 }
 
@@ -460,24 +630,126 @@ int encoder_pktqueue_reset()
  * Empty packets stored in a single packet queue.
  *
  * @param channelId [in] Chennel id.
+ *
+ * The readers drop their pending packets on their next queue access.
  */
 int encoder_pktqueue_reset_channel(int channelId)
 {
-	std::lock_guard lk{pktqueue[channelId].mutex};
-	pktlist[channelId].clear();
-	pktqueue[channelId].head = pktqueue[channelId].tail = 0;
-	pktqueue[channelId].datasize								 = 0;
-	pktqueue[channelId].bufsize								 = pktqueue_initqsize;
+	pktqueue[channelId].resetseq.fetch_add(1, std::memory_order_release);
 	return 0;
 }
 
+/**
+ * Handle a pending reset for a reader. This is an internal function.
+ */
+static inline void pktqueue_reader_sync(encoder_packet_queue_t* q, encoder_packet_reader_t* r)
+{
+	unsigned seq = q->resetseq.load(std::memory_order_acquire);
+	if(seq == r->resetseq)
+		return;
+	r->resetseq = seq;
+	r->skip		= 0;
+	r->limit		= 0;
+	r->cursor.store(q->tail.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+/**
+ * Get the position of the oldest packet still needed by a reader.
+ * This is an internal function called by the writer.
+ *
+ * @param oldest [out] Index of the oldest packet still needed.
+ * @return The buffer position, or \a q->tailpos if all the readers are idle.
+ */
+static uint64_t pktqueue_oldest(encoder_packet_queue_t* q, uint64_t* oldest)
+{
+	uint64_t tail = q->tail.load(std::memory_order_relaxed);
+	uint64_t min  = tail;
+	int i;
+	for(i = 0; i < ENCODER_PKTQUEUE_READERS; i++)
+	{
+		uint64_t c;
+		if(q->reader[i].active.load(std::memory_order_acquire) == 0)
+			continue;
+		c = q->reader[i].cursor.load(std::memory_order_acquire);
+		if(c < min)
+			min = c;
+	}
+	*oldest = min;
+	return min == tail ? q->tailpos : q->slot[min & (ENCODER_PKTQUEUE_SLOTS - 1)].pos;
+}
+
 /**
  * Return the occupied size of a packet queue for a given channel.
  *
  * @param channelId [in] The channel id to be read.
  * @return The occupied size in bytes.
+ *
+ * This function is for the default reader.
  */
-int encoder_pktqueue_size(int channelId) { return pktqueue[channelId].datasize; }
+int encoder_pktqueue_size(int channelId) { return encoder_pktqueue_size_r(channelId, ENCODER_PKTQUEUE_DEFAULT_READER); }
+
+/**
+ * Return the size of data not yet read by a reader.
+ *
+ * @param channelId [in] The channel id to be read.
+ * @param readerId [in] The reader id.
+ * @return The unread size in bytes, including padding areas.
+ */
+int encoder_pktqueue_size_r(int channelId, int readerId)
+{
+	encoder_packet_queue_t* q	 = &pktqueue[channelId];
+	encoder_packet_reader_t* r = &q->reader[readerId];
+	uint64_t cursor;
+	//
+	pktqueue_reader_sync(q, r);
+	cursor = r->cursor.load(std::memory_order_relaxed);
+	if(cursor == q->tail.load(std::memory_order_acquire))
+		return 0;
+	return (int)(q->datatail.load(std::memory_order_acquire) - q->slot[cursor & (ENCODER_PKTQUEUE_SLOTS - 1)].pos - r->skip);
+}
+
+/**
+ * Return the unread size of the frame being read.
+ *
+ * This function is for the default reader.
+ */
+int encoder_pktqueue_frame_size(int channelId) { return encoder_pktqueue_frame_size_r(channelId, ENCODER_PKTQUEUE_DEFAULT_READER); }
+
+/**
+ * Return the unread size of the frame being read by a reader: the
+ * packets queued with the presentation time of its first unread packet.
+ *
+ * @param channelId [in] The channel id to be read.
+ * @param readerId [in] The reader id.
+ * @return The unread size in bytes, excluding padding areas.
+ *
+ * Packets of the frame not encoded yet are not counted.
+ */
+int encoder_pktqueue_frame_size_r(int channelId, int readerId)
+{
+	encoder_packet_queue_t* q	 = &pktqueue[channelId];
+	encoder_packet_reader_t* r = &q->reader[readerId];
+	encoder_packet_t* first;
+	encoder_packet_t* qp;
+	uint64_t cursor, tail;
+	int size;
+	//
+	pktqueue_reader_sync(q, r);
+	cursor = r->cursor.load(std::memory_order_relaxed);
+	tail	 = q->tail.load(std::memory_order_acquire);
+	if(cursor == tail)
+		return 0;
+	first = &q->slot[cursor & (ENCODER_PKTQUEUE_SLOTS - 1)];
+	size	= first->size - r->skip;
+	for(cursor++; cursor != tail; cursor++)
+	{
+		qp = &q->slot[cursor & (ENCODER_PKTQUEUE_SLOTS - 1)];
+		if(qp->pts_tv.tv_sec != first->pts_tv.tv_sec || qp->pts_tv.tv_usec != first->pts_tv.tv_usec)
+			break;
+		size += qp->size;
+	}
+	return size;
+}
 
 /**
  * Add a packet into a packet queue.
@@ -490,65 +762,117 @@ int encoder_pktqueue_size(int channelId) { return pktqueue[channelId].datasize;
  *
  * The content of \a pkt is copied into the queue buffer, so it can be released
  * after returing from the function.
+ * There must be only one writer per channel. The writer does not take a lock,
+ * and the callbacks are called after the packet is published.
  */
 int encoder_pktqueue_append(int channelId, AVPacket* pkt, int64_t encoderPts, struct timeval* ptv)
+{
+	char* data;
+	if((data = encoder_pktqueue_reserve(channelId, pkt->size)) == NULL)
+		return -1;
+	bcopy(pkt->data, data, pkt->size);
+	return encoder_pktqueue_commit(channelId, pkt->size, pkt->pts, ptv);
+}
+
+/**
+ * Reserve contiguous space for the next packet of a packet queue.
+ *
+ * @param channelId [in] The channel id.
+ * @param size [in] The maximum size of the packet.
+ * @return Pointer to the reserved space, or NULL if the queue is full.
+ *
+ * The packet is not visible to the readers until encoder_pktqueue_commit()
+ * is called. A new reservation replaces the previous uncommitted one.
+ * Only the writer of the queue can call this function.
+ */
+char* encoder_pktqueue_reserve(int channelId, int size)
 {
 	encoder_packet_queue_t* q = &pktqueue[channelId];
-	encoder_packet_t qp;
-	std::map<qcallback_t, qcallback_t>::iterator mi;
-	int padding = 0;
-	std::lock_guard lk{q->mutex};
-size_check:
+	uint64_t oldest, headpos, tail, pos;
+	unsigned padding = 0;
+	//
+	q->reserved = 0;
+	tail			= q->tail.load(std::memory_order_relaxed);
+	headpos		= pktqueue_oldest(q, &oldest);
+	// end-of-buffer space is not sufficient
+	pos = q->tailpos % q->bufsize;
+	if(q->bufsize - pos < (uint64_t)size)
+		padding = q->bufsize - pos;
+	// nothing to keep: restart from the beginning of the buffer
+	if(oldest == tail)
+		headpos = q->tailpos + padding;
 	// size checking
-	if(q->datasize + pkt->size > q->bufsize)
+	if(q->tailpos + padding + size - headpos > (uint64_t)q->bufsize || tail - oldest >= ENCODER_PKTQUEUE_SLOTS)
 	{
-		ga_error("encoder: packet queue #%d full, packet dropped (%d+%d)\n", channelId, q->datasize, pkt->size);
-		return -1;
+		ga_error("encoder: packet queue #%d full, packet dropped (%d+%d)\n", channelId, (int)(q->tailpos - headpos), size);
+		return NULL;
 	}
-	// end-of-buffer space is not sufficient
-	if(q->bufsize - q->tail < pkt->size)
+	q->tailpos += padding;
+	q->reserved = size;
+	return q->buf + (q->tailpos % q->bufsize);
+}
+
+/**
+ * Publish a packet written into the space returned by encoder_pktqueue_reserve().
+ *
+ * @param channelId [in] The channel id.
+ * @param size [in] The size of the packet, not larger than the reserved size.
+ * @param pts [in] The presentation timestamp in an integer.
+ * @param ptv [in] The presentation timestamp in a \timeval structure.
+ * @return 0 on success, or -1 on error.
+ */
+int encoder_pktqueue_commit(int channelId, int size, int64_t pts, struct timeval* ptv)
+{
+	encoder_packet_queue_t* q = &pktqueue[channelId];
+	encoder_packet_t* qp;
+	uint64_t tail;
+	qcallback_t cb;
+	int i;
+	//
+	if(size <= 0 || size > q->reserved)
 	{
-		if(pktlist[channelId].size() == 0)
-		{
-			q->datasize = q->tail = q->head = 0;
-		}
-		else
-		{
-			padding									 = q->bufsize - q->tail;
-			pktlist[channelId].back().padding = padding;
-			q->datasize += padding;
-			q->tail = 0;
-		}
-		goto size_check;
+		ga_error("encoder: packet queue #%d commits %d bytes, but %d reserved\n", channelId, size, q->reserved);
+		q->reserved = 0;
+		return -1;
 	}
-	bcopy(pkt->data, q->buf + q->tail, pkt->size);
-	//
-	qp.data		 = q->buf + q->tail;
-	qp.size		 = pkt->size;
-	qp.pts_int64 = pkt->pts;
+	tail		 = q->tail.load(std::memory_order_relaxed);
+	qp			 = &q->slot[tail & (ENCODER_PKTQUEUE_SLOTS - 1)];
+	qp->data	 = q->buf + (q->tailpos % q->bufsize);
+	qp->size	 = size;
+	qp->pts_int64 = pts;
 	if(ptv != NULL)
 	{
-		qp.pts_tv = *ptv;
+		qp->pts_tv = *ptv;
 	}
 	else
 	{
-		gettimeofday(&qp.pts_tv, NULL);
+		gettimeofday(&qp->pts_tv, NULL);
+	}
+	qp->pos = q->tailpos;
+	if(channelId <= VIDEO_SOURCE_CHANNEL_MAX && pkttrace[channelId].frameid != 0)
+	{
+		qp->trace = pkttrace[channelId];
+		ga_trace_stamp(&qp->trace, GA_TRACE_QUEUE);
+		pkttrace[channelId].frameid = 0;
+	}
+	else
+	{
+		qp->trace.frameid = 0;
 	}
-	// qp.pos = q->tail;
-	qp.padding = 0;
-	//
-	q->tail += pkt->size;
-	q->datasize += pkt->size;
-	pktlist[channelId].push_back(qp);
 	//
-	if(q->tail == q->bufsize)
-		q->tail = 0;
+	q->reserved = 0;
+	q->tailpos += size;
+	q->datatail.store(q->tailpos, std::memory_order_release);
+	q->tail.store(tail + 1, std::memory_order_release);
 	//
-	// notify client
-	for(mi = queue_cb[channelId].begin(); mi != queue_cb[channelId].end(); mi++)
+	// notify client: the counter lets unregister wait for a running callback
+	q->cbinflight.fetch_add(1);
+	for(i = 0; i < ENCODER_PKTQUEUE_CALLBACKS; i++)
 	{
-		mi->second(channelId);
+		if((cb = q->cb[i].load()) != NULL)
+			cb(channelId);
 	}
+	q->cbinflight.fetch_sub(1, std::memory_order_release);
 	//
 	return 0;
 }
@@ -562,16 +886,38 @@ size_check:
  *
  * This funcion ONLY reads the first packet.
  * It DOES NOT remove the packet from the queue.
+ * This function is for the default reader.
  */
 char* encoder_pktqueue_front(int channelId, encoder_packet_t* pkt)
 {
-	auto* q = &pktqueue[channelId];
-	std::lock_guard lk{q->mutex};
-	if(pktlist[channelId].size() == 0)
+	return encoder_pktqueue_front_r(channelId, ENCODER_PKTQUEUE_DEFAULT_READER, pkt);
+}
+
+/**
+ * Read the first unread packet of a reader.
+ *
+ * @param channelId [in] The channel id.
+ * @param readerId [in] The reader id.
+ * @param pkt [out] The pointer to stored a retrieved packet.
+ * @return Pointer equal to \a pkt->data, or NULL or error.
+ *
+ * The packet data stays valid until the reader pops the packet.
+ */
+char* encoder_pktqueue_front_r(int channelId, int readerId, encoder_packet_t* pkt)
+{
+	encoder_packet_queue_t* q	 = &pktqueue[channelId];
+	encoder_packet_reader_t* r = &q->reader[readerId];
+	uint64_t cursor;
+	//
+	pktqueue_reader_sync(q, r);
+	cursor = r->cursor.load(std::memory_order_relaxed);
+	if(cursor == q->tail.load(std::memory_order_acquire))
 	{
 		return NULL;
 	}
-	*pkt = pktlist[channelId].front();
+	*pkt = q->slot[cursor & (ENCODER_PKTQUEUE_SLOTS - 1)];
+	pkt->data += r->skip;
+	pkt->size = r->limit != 0 ? r->limit : pkt->size - r->skip;
 	return pkt->data;
 }
 
@@ -591,28 +937,36 @@ char* encoder_pktqueue_front(int channelId, encoder_packet_t* pkt)
  * When this function returns, the first packet in the queue would hold
  * exact \a N bytes and the rest \a (M-N) bytes would be helded
  * in the second packet.
+ *
+ * This function is for the default reader.
  */
 void encoder_pktqueue_split_packet(int channelId, char* offset)
 {
-	auto* q = &pktqueue[channelId];
-	encoder_packet_t *pkt, newpkt;
-	std::lock_guard lk{q->mutex};
+	encoder_pktqueue_split_packet_r(channelId, ENCODER_PKTQUEUE_DEFAULT_READER, offset);
+}
+
+/**
+ * Split the first unread packet of a reader into two packets.
+ *
+ * @param channelId [in] The channel id.
+ * @param readerId [in] The reader id.
+ * @param offset [in] The point to split the packet data.
+ *
+ * The split only affects the view of the reader: other readers
+ * still see the original packet.
+ */
+void encoder_pktqueue_split_packet_r(int channelId, int readerId, char* offset)
+{
+	encoder_packet_queue_t* q	 = &pktqueue[channelId];
+	encoder_packet_reader_t* r = &q->reader[readerId];
+	encoder_packet_t pkt;
 	// has packet?
-	if(pktlist[channelId].size() == 0)
+	if(encoder_pktqueue_front_r(channelId, readerId, &pkt) == NULL)
 		return;
-	pkt = &pktlist[channelId].front();
 	// offset must be in the middle
-	if(offset <= pkt->data || offset >= pkt->data + pkt->size)
+	if(offset <= pkt.data || offset >= pkt.data + pkt.size)
 		return;
-	// split the packet: the new one
-	newpkt			= *pkt;
-	newpkt.size		= offset - pkt->data;
-	newpkt.padding = 0;
-	//
-	pkt->data = offset;
-	pkt->size -= newpkt.size;
-	//
-	pktlist[channelId].push_front(newpkt);
+	r->limit = offset - pkt.data;
 	//
 	return;
 }
@@ -621,32 +975,95 @@ void encoder_pktqueue_split_packet(int channelId, char* offset)
  * Remove the first packet from the queue.
  *
  * @parm channelId [in] The channel id.
+ *
+ * This function is for the default reader.
+ */
+void encoder_pktqueue_pop_front(int channelId) { encoder_pktqueue_pop_front_r(channelId, ENCODER_PKTQUEUE_DEFAULT_READER); }
+
+/**
+ * Remove the first unread packet of a reader.
+ *
+ * @parm channelId [in] The channel id.
+ * @param readerId [in] The reader id.
+ *
+ * The space of a packet is released when all the readers have popped it.
  */
-void encoder_pktqueue_pop_front(int channelId)
+void encoder_pktqueue_pop_front_r(int channelId, int readerId)
 {
-	auto* q = &pktqueue[channelId];
-	encoder_packet_t qp;
-	std::lock_guard lk{q->mutex};
-	if(pktlist[channelId].size() == 0)
+	encoder_packet_queue_t* q	 = &pktqueue[channelId];
+	encoder_packet_reader_t* r = &q->reader[readerId];
+	uint64_t cursor;
+	unsigned size;
+	//
+	pktqueue_reader_sync(q, r);
+	cursor = r->cursor.load(std::memory_order_relaxed);
+	if(cursor == q->tail.load(std::memory_order_acquire))
 	{
 		return;
 	}
-	qp = pktlist[channelId].front();
-	pktlist[channelId].pop_front();
-	// update the packet queue
-	q->head += qp.size;
-	q->head += qp.padding;
-	q->datasize -= qp.size;
-	q->datasize -= qp.padding;
-	if(q->head == q->bufsize)
+	// the rest of a split packet
+	size = q->slot[cursor & (ENCODER_PKTQUEUE_SLOTS - 1)].size;
+	if(r->limit != 0 && r->skip + r->limit < size)
 	{
-		q->head = 0;
+		r->skip += r->limit;
+		r->limit = 0;
+		return;
 	}
-	if(q->head == q->tail)
+	r->skip	= 0;
+	r->limit = 0;
+	r->cursor.store(cursor + 1, std::memory_order_release);
+	//
+	return;
+}
+
+/**
+ * Open a new reader for a packet queue.
+ *
+ * @param channelId [in] The channel id.
+ * @return The reader id, or -1 if there are too many readers.
+ *
+ * A new reader starts from the next appended packet.
+ * Each reader must be used by only one thread.
+ * Note that the writer drops packets if a reader does not keep up,
+ * so a reader must be closed once it is no longer used.
+ */
+int encoder_pktqueue_reader_open(int channelId)
+{
+	encoder_packet_queue_t* q = &pktqueue[channelId];
+	encoder_packet_reader_t* r;
+	int i;
+	std::lock_guard lk{q->mutex};
+	for(i = 0; i < ENCODER_PKTQUEUE_READERS; i++)
 	{
-		q->head = q->tail = 0;
+		r = &q->reader[i];
+		if(r->active.load(std::memory_order_relaxed) != 0)
+			continue;
+		r->skip		= 0;
+		r->limit		= 0;
+		r->resetseq = q->resetseq.load(std::memory_order_acquire);
+		r->cursor.store(q->tail.load(std::memory_order_acquire), std::memory_order_relaxed);
+		r->active.store(1, std::memory_order_release);
+		ga_error("encoder: pktqueue #%d reader #%d opened\n", channelId, i);
+		return i;
 	}
-	//
+	ga_error("encoder: pktqueue #%d has too many readers\n", channelId);
+	return -1;
+}
+
+/**
+ * Close a reader of a packet queue.
+ *
+ * @param channelId [in] The channel id.
+ * @param readerId [in] The reader id.
+ */
+void encoder_pktqueue_reader_close(int channelId, int readerId)
+{
+	encoder_packet_queue_t* q = &pktqueue[channelId];
+	std::lock_guard lk{q->mutex};
+	if(readerId < 0 || readerId >= ENCODER_PKTQUEUE_READERS || readerId == ENCODER_PKTQUEUE_DEFAULT_READER)
+		return;
+	q->reader[readerId].active.store(0, std::memory_order_release);
+	ga_error("encoder: pktqueue #%d reader #%d closed\n", channelId, readerId);
 	return;
 }
 
@@ -655,7 +1072,7 @@ void encoder_pktqueue_pop_front(int channelId)
  *
  * @param channelId [in] The channel id.
  * @param cb [in] Pointer to the callback function.
- * @return This function alywas return 0.
+ * @return 0 on success, or -1 if there are too many callbacks.
  *
  * The callback function \a cb is called when a packet is appended into the
  * queue. The callback function must be in the form of:\n
@@ -666,7 +1083,23 @@ void encoder_pktqueue_pop_front(int channelId)
  */
 int encoder_pktqueue_register_callback(int channelId, qcallback_t cb)
 {
-	queue_cb[channelId][cb] = cb;
+	encoder_packet_queue_t* q = &pktqueue[channelId];
+	int i, slot = -1;
+	std::lock_guard lk{q->mutex};
+	for(i = 0; i < ENCODER_PKTQUEUE_CALLBACKS; i++)
+	{
+		qcallback_t curr = q->cb[i].load(std::memory_order_relaxed);
+		if(curr == cb)
+			return 0;
+		if(curr == NULL && slot < 0)
+			slot = i;
+	}
+	if(slot < 0)
+	{
+		ga_error("encoder: pktqueue #%d has too many callbacks (%p)\n", channelId, cb);
+		return -1;
+	}
+	q->cb[slot].store(cb, std::memory_order_release);
 	ga_error("encoder: pktqueue #%d callback registered (%p)\n", channelId, cb);
 	return 0;
 }
@@ -677,9 +1110,25 @@ int encoder_pktqueue_register_callback(int channelId, qcallback_t cb)
  * @param channelId [in] The channel id.
  * @param cb [in] The callback function to be removed.
  * @return This functon always returns 0.
+ *
+ * The function returns after a call to \a cb running in the writer
+ * has finished, so the data used by \a cb can be released afterwards.
+ * It must not be called from a callback.
  */
 int encoder_pktqueue_unregister_callback(int channelId, qcallback_t cb)
 {
-	queue_cb[channelId].erase(cb);
+	encoder_packet_queue_t* q = &pktqueue[channelId];
+	int i;
+	{
+		std::lock_guard lk{q->mutex};
+		for(i = 0; i < ENCODER_PKTQUEUE_CALLBACKS; i++)
+		{
+			if(q->cb[i].load(std::memory_order_relaxed) == cb)
+				q->cb[i].store(NULL);
+		}
+	}
+	// wait for the writer to leave a callback round that may have seen cb
+	while(q->cbinflight.load() != 0)
+		std::this_thread::yield();
 	return 0;
 }
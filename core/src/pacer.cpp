@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Send-side packet pacer: the implementation.
+ *
+ * A key frame can be ten times the size of a P-frame. Sent at line rate,
+ * it fills the bottleneck queue at once and the tail of the burst is
+ * dropped. The pacer spreads the packets of a frame with a token bucket
+ * instead.
+ *
+ * The tokens fill at the larger of two rates: the bitrate target times
+ * \em rtp-pacing-factor, and the rate that sends the backlog of the frame
+ * before its deadline, one frame interval after it was queued. A small
+ * P-frame then leaves at the target rate, while a key frame is spread over
+ * the frame interval. The bucket holds at most \em rtp-pacing-burst bytes,
+ * the largest burst sent at line rate. Packets past their deadline are sent
+ * at once.
+ *
+ * The queuing delay of each packet, from the time its frame was queued to
+ * the time it was sent, and the backlog are kept as metrics and logged
+ * every few seconds.
+ */
+
+#include "pacer.hpp"
+
+#include "common.hpp"
+#include "conf.hpp"
+#include "ratectl.hpp"
+#include "rtsp_conf.hpp"
+#include "trace.hpp"
+
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACER_REPORT_INTERVAL 10000000LL	/**< Interval between metric logs, in microseconds */
+
+struct pacer_s {
+	char name[32];
+	std::mutex mutex;			/**< Protects the tokens and the metrics */
+	double rate;				/**< Current fill rate, in bytes per microsecond */
+	double tokens;				/**< Bytes that can be sent now */
+	long long last;			/**< Time the tokens were last updated */
+	pacer_stats_t stats;
+	pacer_stats_t logged;	/**< Metrics since the last log */
+	long long lastlog;
+};
+
+static int pacer_on			  = 0;
+static double pacer_factor	  = 1.5;
+static int pacer_burst		  = 6000;
+static int pacer_kbps		  = 3000;  /**< Bitrate target when ratectl is disabled */
+static long long pacer_frame = 16667; /**< Frame interval, in microseconds */
+
+/**
+ * Initialize the pacing parameters.
+ *
+ * @return 0 if the senders pace their packets, or -1 otherwise.
+ *
+ * Pacing is enabled by \em rtp-pacing. The tokens fill at least at
+ * \em rtp-pacing-factor percent of the bitrate target, which is the rate
+ * applied by ratectl, or \em video-specific[b]. The bucket holds at most
+ * \em rtp-pacing-burst bytes.
+ */
+int pacer_init()
+{
+	char buf[64];
+	int fps = rtspconf_global()->video_fps;
+	//
+	pacer_factor = ga_conf_readint_default("rtp-pacing-factor", 150) / 100.0;
+	if(pacer_factor < 1.0)
+		pacer_factor = 1.0;
+	pacer_burst = ga_conf_readint_default("rtp-pacing-burst", 6000);
+	if(pacer_burst < 1500)
+		pacer_burst = 1500;
+	pacer_kbps = 0;
+	if(ga_conf_mapreadv("video-specific", "b", buf, sizeof(buf)) != NULL)
+		pacer_kbps = (int)(strtoll(buf, NULL, 10) / 1000);
+	if(pacer_kbps <= 0)
+		pacer_kbps = 3000;
+	pacer_frame = 1000000LL / (fps > 0 ? fps : 60);
+	pacer_on		= ga_conf_readbool("rtp-pacing", 0);
+	if(pacer_on == 0)
+		return -1;
+	ga_error("rtp-pacing: enabled, factor = %.0f%%, burst = %d bytes, frame interval = %lldus\n",
+				pacer_factor * 100,
+				pacer_burst,
+				pacer_frame);
+	return 0;
+}
+
+int pacer_enabled() { return pacer_on; }
+
+/**
+ * Get the frame interval: the time a frame may take to be sent.
+ */
+long long pacer_interval() { return pacer_frame; }
+
+/**
+ * Create the pacer of a stream.
+ *
+ * @param name [in] Name of the stream in the logs.
+ * @return The pacer, or NULL if pacing is disabled.
+ */
+pacer_t* pacer_create(const char* name)
+{
+	pacer_t* p;
+	//
+	if(pacer_on == 0)
+		return NULL;
+	p = new pacer_t();
+	snprintf(p->name, sizeof(p->name), "%s", name ? name : "");
+	p->tokens = pacer_burst;
+	p->last = p->lastlog = ga_trace_now();
+	return p;
+}
+
+/**
+ * Add the tokens filled since the last update. This is an internal function.
+ */
+static void pacer_fill(pacer_t* p, long long now)
+{
+	p->tokens += (now - p->last) * p->rate;
+	if(p->tokens > pacer_burst)
+		p->tokens = pacer_burst;
+	p->last = now;
+	return;
+}
+
+/**
+ * Get the time to wait before sending a packet.
+ *
+ * @param p [in] The pacer.
+ * @param bytes [in] Size of the packet.
+ * @param backlog [in] Bytes of the frame not sent yet, including the packet.
+ * @param deadline [in] Time the frame should be sent by, from ga_trace_now(),
+ *		or 0 to send at the bitrate target only.
+ * @return The time to wait in microseconds, or 0 to send the packet now.
+ */
+long long pacer_delay(pacer_t* p, int bytes, long long backlog, long long deadline)
+{
+	long long now = ga_trace_now();
+	int kbps;
+	//
+	if(p == NULL || (deadline != 0 && deadline <= now))
+		return 0;
+	std::lock_guard<std::mutex> lock(p->mutex);
+	pacer_fill(p, now);
+	if((kbps = ratectl_bitrate()) <= 0)
+		kbps = pacer_kbps;
+	p->rate = kbps * pacer_factor / 8000.0;
+	if(deadline > now && backlog > p->rate * (deadline - now))
+		p->rate = backlog / (double)(deadline - now);
+	if(p->tokens >= bytes)
+		return 0;
+	return (long long)((bytes - p->tokens) / p->rate) + 1;
+}
+
+/**
+ * Take the tokens of a packet. This is an internal function.
+ */
+static void pacer_consume(pacer_t* p, int bytes, long long now)
+{
+	pacer_fill(p, now);
+	p->tokens -= bytes;
+	// late frames are sent at once: do not let them hold back the next ones
+	if(p->tokens < -pacer_burst)
+		p->tokens = -pacer_burst;
+	return;
+}
+
+/**
+ * Add a sent packet to the metrics. This is an internal function.
+ */
+static void pacer_account(pacer_stats_t* s, int bytes, long long backlog, long long delay)
+{
+	s->packets++;
+	s->bytes += bytes;
+	s->delay_sum += delay;
+	s->backlog_sum += backlog;
+	if(delay > s->delay_max)
+		s->delay_max = delay;
+	if(backlog > s->backlog_max)
+		s->backlog_max = backlog;
+	if(delay > pacer_frame)
+		s->late++;
+	return;
+}
+
+/**
+ * Take the tokens of a sent packet.
+ *
+ * @param p [in] The pacer.
+ * @param bytes [in] Size of the packet.
+ * @param backlog [in] Bytes of the frame not sent yet, including the packet.
+ * @param queued [in] Time the frame was queued, from ga_trace_now(), or 0.
+ *
+ * Packets sent without waiting, like audio, take tokens as well.
+ * They may be sent by another thread than the paced ones.
+ */
+void pacer_sent(pacer_t* p, int bytes, long long backlog, long long queued)
+{
+	long long now	= ga_trace_now();
+	long long delay = queued > 0 && now > queued ? now - queued : 0;
+	pacer_stats_t* s;
+	//
+	if(p == NULL)
+		return;
+	std::lock_guard<std::mutex> lock(p->mutex);
+	pacer_consume(p, bytes, now);
+	//
+	pacer_account(&p->stats, bytes, backlog, delay);
+	pacer_account(&p->logged, bytes, backlog, delay);
+	if(now - p->lastlog < PACER_REPORT_INTERVAL)
+		return;
+	s = &p->logged;
+	ga_error("rtp-pacing: %s, %llu pkts, %.0fKbps, queuing delay avg %lldus max %lldus, "
+				"backlog avg %lld max %lld bytes, %llu pkts late\n",
+				p->name,
+				s->packets,
+				s->bytes * 8000.0 / (now - p->lastlog),
+				s->delay_sum / (long long)s->packets,
+				s->delay_max,
+				s->backlog_sum / (long long)s->packets,
+				s->backlog_max,
+				s->late);
+	bzero(s, sizeof(pacer_stats_t));
+	p->lastlog = now;
+	return;
+}
+
+/**
+ * Take the tokens of a packet sent outside of the frames.
+ *
+ * @param p [in] The pacer.
+ * @param bytes [in] Size of the packet.
+ *
+ * This is for retransmissions: they leave room in the bucket for
+ * themselves, but have no frame to measure a queuing delay from,
+ * so they are not part of the metrics.
+ */
+void pacer_take(pacer_t* p, int bytes)
+{
+	if(p == NULL)
+		return;
+	std::lock_guard<std::mutex> lock(p->mutex);
+	pacer_consume(p, bytes, ga_trace_now());
+	return;
+}
+
+/**
+ * Get the pacing metrics of a stream.
+ *
+ * @param p [in] The pacer.
+ * @param stats [out] The metrics.
+ * @param reset [in] Reset the metrics after reading them.
+ */
+void pacer_stats(pacer_t* p, pacer_stats_t* stats, int reset)
+{
+	if(p == NULL)
+	{
+		bzero(stats, sizeof(pacer_stats_t));
+		return;
+	}
+	std::lock_guard<std::mutex> lock(p->mutex);
+	*stats = p->stats;
+	if(reset)
+		bzero(&p->stats, sizeof(pacer_stats_t));
+	return;
+}
+
+void pacer_destroy(pacer_t* p)
+{
+	if(p == NULL)
+		return;
+	delete p;
+	return;
+}
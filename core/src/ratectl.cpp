@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Adaptive bitrate controller: the implementation.
+ *
+ * The controller follows the loss-based and delay-based rules of Google
+ * congestion control. The loss rate comes from the RTCP receiver reports
+ * and the client's network reports. The queuing delay is estimated as the
+ * smoothed RTT above the minimum RTT seen in the last 20 to 30 seconds.
+ *
+ * - Loss above 10%: rate *= (1 - loss / 2)
+ * - Queuing delay above the threshold and not draining: rate = 0.85 times
+ *   the rate received by the client, or the current rate if lower
+ * - Loss below 2% and no queuing: rate grows by 8% per second
+ *
+ * The rate is also capped by the capacity measured by the client. Decreases
+ * are applied to the encoder at once, increases at most once per interval,
+ * and changes smaller than 5% are not applied at all, since reconfiguring
+ * some encoders restarts them.
+ */
+
+#include "ratectl.hpp"
+
+#include "common.hpp"
+#include "conf.hpp"
+#include "encoder_common.hpp"
+#include "rtsp_conf.hpp"
+#include "trace.hpp"
+#include "vsource.hpp"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATECTL_INCREASE		0.08				 /**< Increase per second when the path is underused */
+#define RATECTL_DELAY_BACKOFF 0.85				 /**< Decrease factor when queuing delay builds up */
+#define RATECTL_LOSS_HIGH		0.10				 /**< Decrease when the loss rate is above this */
+#define RATECTL_LOSS_LOW		0.02				 /**< Increase only when the loss rate is below this */
+#define RATECTL_CAPACITY_USE	0.90				 /**< Fraction of the measured capacity used at most */
+#define RATECTL_MIN_CHANGE		0.05				 /**< Minimum relative change applied to the encoder */
+#define RATECTL_DECREASE_HOLD 500000LL			 /**< Minimum interval between decreases, plus 2 RTTs */
+#define RATECTL_RTT_WINDOW		(10 * 1000000LL) /**< The minimum RTT is taken over 2 to 3 windows */
+
+/**
+ * Counters at the last RTCP report of a stream.
+ */
+typedef struct ratectl_ssrc_s {
+	unsigned long long pktsent;
+	unsigned long long pktlost;
+} ratectl_ssrc_t;
+
+static std::mutex ratectl_mutex;
+static std::atomic<int> ratectl_on{0};
+static ga_module_t* ratectl_vsource	  = NULL;
+static ga_module_t* ratectl_vencoder  = NULL;
+static std::map<unsigned int, ratectl_ssrc_t> ratectl_streams;
+
+static int rc_min, rc_max;				  /**< Bitrate bounds, in Kbps */
+static int rc_vbv;						  /**< VBV buffer size, in milliseconds at the target rate */
+static long long rc_interval;			  /**< Minimum interval between increases, in microseconds */
+static long long rc_delay;				  /**< Queuing delay threshold, in microseconds */
+static int rc_fps, rc_lowfps, rc_lowfps_kbps; /**< Frame rate used below rc_lowfps_kbps */
+static double rc_rate;					  /**< Target bitrate, in Kbps */
+static double rc_delivered;			  /**< Rate received by the client in its last report, in Kbps */
+static std::atomic<int> rc_applied{0};  /**< Encoder bitrate, read by the senders without the lock */
+static int rc_fps_applied;				  /**< Encoder frame rate */
+static long long rc_lastupdate, rc_lastdecrease, rc_lastapply;
+static long long rc_srtt, rc_queue;	  /**< In microseconds */
+static int rc_queue_draining;			  /**< Queuing delay decreased since the last RTT sample */
+static long long rc_minrtt[3], rc_minrtt_start; /**< Minimum RTT of the recent windows, the current one first */
+
+/**
+ * Initialize the bitrate controller.
+ *
+ * @param vsource [in] The video source module, to reconfigure the frame rate. Can be NULL.
+ * @param vencoder [in] The video encoder module. NULL for the registered encoder.
+ * @return 0 on success, or -1 if the controller is disabled.
+ *
+ * The controller is enabled by the \em ratectl parameter. It starts from
+ * the bitrate of \em video-specific[b] and works between \em ratectl-min-kbps
+ * and \em ratectl-max-kbps. The VBV buffer is set to \em ratectl-vbv-ms of
+ * the target bitrate. \em ratectl-interval sets the minimum interval between
+ * increases in milliseconds, and \em ratectl-queue-delay the tolerated
+ * queuing delay in milliseconds. Below \em ratectl-lowfps-kbps, the frame
+ * rate is reduced to \em ratectl-lowfps.
+ */
+int ratectl_init(ga_module_t* vsource, ga_module_t* vencoder)
+{
+	char buf[64];
+	int start = 0;
+	long long now = ga_trace_now();
+	std::lock_guard<std::mutex> lock(ratectl_mutex);
+	//
+	ratectl_on = 0;
+	if(ga_conf_readbool("ratectl", 0) == 0)
+		return -1;
+	if(vencoder == NULL)
+		vencoder = encoder_get_vencoder();
+	if(vencoder == NULL || vencoder->ioctl == NULL)
+	{
+		ga_error("ratectl: video encoder cannot be reconfigured, disabled.\n");
+		return -1;
+	}
+	if(ga_conf_mapreadv("video-specific", "b", buf, sizeof(buf)) != NULL)
+		start = (int)(strtoll(buf, NULL, 10) / 1000);
+	if(start <= 0)
+		start = 3000;
+	rc_max = ga_conf_readint_default("ratectl-max-kbps", start);
+	rc_min = ga_conf_readint_default("ratectl-min-kbps", 300);
+	if(rc_min <= 0)
+		rc_min = 1;
+	if(rc_max < rc_min)
+		rc_max = rc_min;
+	rc_vbv		 = ga_conf_readint_default("ratectl-vbv-ms", 200);
+	rc_interval = ga_conf_readint_default("ratectl-interval", 1000) * 1000LL;
+	rc_delay		 = ga_conf_readint_default("ratectl-queue-delay", 30) * 1000LL;
+	rc_fps		 = rtspconf_global()->video_fps;
+	rc_lowfps_kbps = ga_conf_readint_default("ratectl-lowfps-kbps", 0);
+	rc_lowfps		= ga_conf_readint_default("ratectl-lowfps", rc_fps / 2);
+	if(rc_lowfps <= 0 || rc_lowfps > rc_fps)
+		rc_lowfps_kbps = 0;
+	//
+	rc_rate			 = start < rc_min ? rc_min : start > rc_max ? rc_max : start;
+	rc_applied		 = start;
+	rc_delivered	 = 0;
+	rc_fps_applied	 = rc_fps;
+	rc_lastupdate	 = now;
+	rc_lastdecrease = now;
+	rc_lastapply	 = now;
+	rc_srtt = rc_queue = rc_minrtt_start = 0;
+	rc_queue_draining = 0;
+	bzero(rc_minrtt, sizeof(rc_minrtt));
+	ratectl_streams.clear();
+	ratectl_vsource  = vsource;
+	ratectl_vencoder = vencoder;
+	ratectl_on		  = 1;
+	ga_error("ratectl: enabled, start=%dKbps, range=%d-%dKbps, vbv=%dms, queue-delay=%lldms, low-fps=%d below %dKbps\n",
+				start,
+				rc_min,
+				rc_max,
+				rc_vbv,
+				rc_delay / 1000,
+				rc_lowfps,
+				rc_lowfps_kbps);
+	return 0;
+}
+
+int ratectl_enabled() { return ratectl_on; }
+
+/**
+ * Get the bitrate currently applied to the encoder.
+ *
+ * @return The bitrate in Kbps, or 0 if the controller is disabled.
+ */
+int ratectl_bitrate()
+{
+	// called for every packet: must not wait for an encoder being reconfigured
+	return ratectl_on ? rc_applied.load() : 0;
+}
+
+/**
+ * Apply the target bitrate to the encoder. This is an internal function.
+ * The caller must hold ratectl_mutex.
+ */
+static void ratectl_apply(long long now, double loss)
+{
+	ga_ioctl_reconfigure_t reconf;
+	int i, err, target = (int)rc_rate, fps = rc_fps_applied;
+	// step the frame rate down and back up, with some hysteresis
+	if(rc_lowfps_kbps > 0)
+	{
+		if(target < rc_lowfps_kbps)
+			fps = rc_lowfps;
+		else if(target > rc_lowfps_kbps * 5 / 4)
+			fps = rc_fps;
+	}
+	if(fps == rc_fps_applied)
+	{
+		if(abs(target - rc_applied) < rc_applied * RATECTL_MIN_CHANGE)
+			return;
+		if(target > rc_applied && now - rc_lastapply < rc_interval)
+			return;
+	}
+	//
+	bzero(&reconf, sizeof(reconf));
+	reconf.bitrateKbps = target;
+	reconf.bufsize		 = target * rc_vbv / 1000;
+	if(reconf.bufsize <= 0)
+		reconf.bufsize = 1;
+	if(fps != rc_fps_applied)
+	{
+		reconf.framerate_n = fps;
+		reconf.framerate_d = 1;
+		if(ratectl_vsource != NULL && ratectl_vsource->ioctl != NULL)
+			ratectl_vsource->ioctl(GA_IOCTL_RECONFIGURE, sizeof(reconf), &reconf);
+	}
+	for(i = 0; i < video_source_channels(); i++)
+	{
+		reconf.id = i;
+		if((err = ratectl_vencoder->ioctl(GA_IOCTL_RECONFIGURE, sizeof(reconf), &reconf)) < 0)
+		{
+			ga_error("ratectl: reconfigure encoder #%d failed, err = %d.\n", i, err);
+			return;
+		}
+	}
+	ga_error("ratectl: bitrate %d -> %dKbps; bufsize=%dKbit; framerate=%d; loss=%.2f%%; rtt=%.1fms; queuing=%.1fms\n",
+				rc_applied.load(),
+				target,
+				reconf.bufsize,
+				fps,
+				100.0 * loss,
+				rc_srtt / 1000.0,
+				rc_queue / 1000.0);
+	rc_applied		= target;
+	rc_fps_applied = fps;
+	rc_lastapply	= now;
+	return;
+}
+
+/**
+ * Update the target bitrate with a new report. This is an internal function.
+ * The caller must hold ratectl_mutex.
+ *
+ * @param loss [in] Loss rate since the last report of the same source.
+ * @param capacity [in] Measured capacity in Kbps, or 0 if unknown.
+ */
+static void ratectl_update(long long now, double loss, double capacity)
+{
+	double rate = rc_rate, base, dt;
+	//
+	int overuse = rc_queue > rc_delay && rc_queue_draining == 0;
+	//
+	if(loss > RATECTL_LOSS_HIGH || overuse)
+	{
+		// the following reports may still carry the signal of the same episode
+		if(now - rc_lastdecrease >= RATECTL_DECREASE_HOLD + 2 * rc_srtt)
+		{
+			if(loss > RATECTL_LOSS_HIGH)
+				rate = rc_rate * (1.0 - 0.5 * loss);
+			// back off from what the path actually delivered
+			base = rc_delivered > 0 && rc_delivered < rc_rate ? rc_delivered : rc_rate;
+			if(overuse && base * RATECTL_DELAY_BACKOFF < rate)
+				rate = base * RATECTL_DELAY_BACKOFF;
+			rc_lastdecrease = now;
+		}
+	}
+	else if(loss < RATECTL_LOSS_LOW && rc_queue < rc_delay / 2 && now - rc_lastdecrease >= rc_interval)
+	{
+		dt = (now - rc_lastupdate) / 1000000.0;
+		rate = rc_rate * (1.0 + RATECTL_INCREASE * (dt < 1.0 ? dt : 1.0));
+	}
+	if(capacity > 0 && rate > capacity * RATECTL_CAPACITY_USE)
+		rate = capacity * RATECTL_CAPACITY_USE;
+	if(rate < rc_min)
+		rate = rc_min;
+	if(rate > rc_max)
+		rate = rc_max;
+	rc_rate		  = rate;
+	rc_lastupdate = now;
+	ratectl_apply(now, loss);
+	return;
+}
+
+/**
+ * Feed a network report of the client.
+ *
+ * @param duration [in] Report duration in microseconds.
+ * @param pktcount [in] Packets expected, including the lost ones.
+ * @param pktloss [in] Packets lost.
+ * @param bytecount [in] Bytes received.
+ * @param capacity [in] Measured capacity in bits per second.
+ */
+void ratectl_netreport(unsigned int duration, unsigned int pktcount, unsigned int pktloss, unsigned int bytecount, unsigned int capacity)
+{
+	std::lock_guard<std::mutex> lock(ratectl_mutex);
+	if(ratectl_on == 0 || pktcount == 0)
+		return;
+	if(duration > 0)
+		rc_delivered = bytecount * 8000.0 / duration;
+	ratectl_update(ga_trace_now(), 1.0 * pktloss / pktcount, capacity / 1000.0);
+	return;
+}
+
+/**
+ * Feed the transmission statistics of an RTP stream, updated by RTCP
+ * receiver reports.
+ *
+ * @param ssrc [in] SSRC of the stream.
+ * @param pktsent [in] Total packets sent.
+ * @param pktlost [in] Total packets lost, as reported by the receiver.
+ * @param rtt [in] Round-trip time in microseconds, or 0 if unknown.
+ */
+void ratectl_rtcp(unsigned int ssrc, unsigned long long pktsent, unsigned long long pktlost, long long rtt)
+{
+	std::map<unsigned int, ratectl_ssrc_t>::iterator mi;
+	unsigned long long dsent, dlost;
+	long long minrtt, now = ga_trace_now();
+	std::lock_guard<std::mutex> lock(ratectl_mutex);
+	//
+	if(ratectl_on == 0)
+		return;
+	if((mi = ratectl_streams.find(ssrc)) == ratectl_streams.end())
+	{
+		ratectl_streams[ssrc] = {pktsent, pktlost};
+		return;
+	}
+	if(pktsent <= mi->second.pktsent)
+		return;
+	dsent = pktsent - mi->second.pktsent;
+	dlost = pktlost > mi->second.pktlost ? pktlost - mi->second.pktlost : 0;
+	if(dlost > dsent)
+		dlost = dsent;
+	mi->second.pktsent = pktsent;
+	mi->second.pktlost = pktlost;
+	//
+	if(rtt > 0)
+	{
+		rc_srtt = rc_srtt == 0 ? rtt : (7 * rc_srtt + rtt) / 8;
+		if(now - rc_minrtt_start >= RATECTL_RTT_WINDOW)
+		{
+			rc_minrtt[2]	 = rc_minrtt[1];
+			rc_minrtt[1]	 = rc_minrtt[0];
+			rc_minrtt[0]	 = 0;
+			rc_minrtt_start = now;
+		}
+		if(rc_minrtt[0] == 0 || rtt < rc_minrtt[0])
+			rc_minrtt[0] = rtt;
+		minrtt = rc_minrtt[0];
+		if(rc_minrtt[1] > 0 && rc_minrtt[1] < minrtt)
+			minrtt = rc_minrtt[1];
+		if(rc_minrtt[2] > 0 && rc_minrtt[2] < minrtt)
+			minrtt = rc_minrtt[2];
+		minrtt				= rc_srtt > minrtt ? rc_srtt - minrtt : 0;
+		rc_queue_draining = minrtt < rc_queue;
+		rc_queue			= minrtt;
+	}
+	ratectl_update(now, 1.0 * dlost / dsent, 0);
+	return;
+}
+
+void ratectl_deinit()
+{
+	std::lock_guard<std::mutex> lock(ratectl_mutex);
+	ratectl_on		  = 0;
+	ratectl_vsource  = NULL;
+	ratectl_vencoder = NULL;
+	ratectl_streams.clear();
+	return;
+}
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * XOR forward error correction for RTP (RFC 5109): the implementation.
+ *
+ * The sender protects each group of consecutive media packets with one FEC
+ * packet, the XOR of the group, using the level 0 ULP header with a 16-bit
+ * mask. The FEC packets carry the media SSRC and a payload type of their
+ * own, and have their own sequence numbers. A receiver that does not know
+ * the payload type drops them.
+ *
+ * A group of k packets survives one loss among its k + 1 packets, so the
+ * residual loss rate is about k(k + 1)/2 * p^2 for a loss rate p. The group
+ * size is the largest one that keeps the residual loss below
+ * RTPFEC_RESIDUAL for the smoothed loss rate of the client's reports.
+ */
+
+#include "rtpfec.hpp"
+
+#include "common.hpp"
+#include "conf.hpp"
+
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+
+#define RTPFEC_RESIDUAL 0.001 /**< Target loss rate after recovery */
+#define RTPFEC_SMOOTH	0.3	  /**< Weight of a new loss report */
+
+static int fec_on				= 0;
+static int fec_pt				= RTPFEC_PT_DEFAULT;
+static int fec_mingroup		= 2;
+static int fec_maxgroup		= RTPFEC_GROUP_MAX;
+static double fec_loss		= 0.0; /**< Smoothed loss rate, updated by the control thread only */
+static std::atomic<int> fec_group(RTPFEC_GROUP_MAX);
+
+static inline unsigned int rd16(const unsigned char* p) { return (p[0] << 8) | p[1]; }
+
+static inline unsigned int rd32(const unsigned char* p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+static inline void wr16(unsigned char* p, unsigned int v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static inline void wr32(unsigned char* p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/**
+ * Initialize the FEC parameters.
+ *
+ * @return 0 if the sender generates FEC packets, or -1 otherwise.
+ *
+ * FEC packets are generated if \em rtp-fec is set. They use the payload
+ * type \em rtp-fec-pt, which must be the same at the client. The group
+ * size adapts to the loss rate between \em rtp-fec-min-group and
+ * \em rtp-fec-max-group, i.e., between 1/min and 1/max of overhead.
+ */
+int rtpfec_init()
+{
+	fec_pt = ga_conf_readint_default("rtp-fec-pt", RTPFEC_PT_DEFAULT);
+	// 64-95 collide with RTCP when RTP and RTCP are multiplexed
+	if(fec_pt < 96 || fec_pt > 127)
+	{
+		ga_error("rtp-fec: invalid payload type %d, use %d.\n", fec_pt, RTPFEC_PT_DEFAULT);
+		fec_pt = RTPFEC_PT_DEFAULT;
+	}
+	fec_maxgroup = ga_conf_readint_default("rtp-fec-max-group", RTPFEC_GROUP_MAX);
+	if(fec_maxgroup < 1 || fec_maxgroup > RTPFEC_GROUP_MAX)
+		fec_maxgroup = RTPFEC_GROUP_MAX;
+	fec_mingroup = ga_conf_readint_default("rtp-fec-min-group", 2);
+	if(fec_mingroup < 1 || fec_mingroup > fec_maxgroup)
+		fec_mingroup = fec_maxgroup;
+	fec_loss = 0.0;
+	fec_group.store(fec_maxgroup);
+	fec_on = ga_conf_readbool("rtp-fec", 0);
+	if(fec_on == 0)
+		return -1;
+	ga_error("rtp-fec: enabled, payload type %d, group size %d-%d\n", fec_pt, fec_mingroup, fec_maxgroup);
+	return 0;
+}
+
+int rtpfec_enabled() { return fec_on; }
+
+int rtpfec_payload_type() { return fec_pt; }
+
+/**
+ * Get the current group size: media packets per FEC packet.
+ */
+int rtpfec_group_size() { return fec_group.load(std::memory_order_relaxed); }
+
+/**
+ * Adapt the group size to a client's network report.
+ *
+ * @param pktcount [in] Media packets expected in the report.
+ * @param pktloss [in] Media packets lost, before recovery.
+ */
+void rtpfec_netreport(unsigned int pktcount, unsigned int pktloss)
+{
+	int k, old;
+	double p;
+	//
+	if(fec_on == 0 || pktcount == 0)
+		return;
+	fec_loss = (1.0 - RTPFEC_SMOOTH) * fec_loss + RTPFEC_SMOOTH * pktloss / pktcount;
+	p		 = fec_loss;
+	for(k = fec_maxgroup; k > fec_mingroup; k--)
+	{
+		if(k * (k + 1) / 2.0 * p * p <= RTPFEC_RESIDUAL)
+			break;
+	}
+	old = fec_group.exchange(k);
+	if(old != k)
+		ga_error("rtp-fec: loss-rate=%.2f%%, group size %d -> %d\n", 100.0 * p, old, k);
+	return;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static void rtpfec_group_reset(rtpfec_group_t* g)
+{
+	bzero(g->payload, g->protlen);
+	g->count	  = 0;
+	g->mask	  = 0;
+	g->bits[0] = g->bits[1] = 0;
+	g->ts		  = 0;
+	g->length  = 0;
+	g->protlen = 0;
+	return;
+}
+
+void rtpfec_group_init(rtpfec_group_t* g, unsigned short fecseq)
+{
+	bzero(g, sizeof(rtpfec_group_t));
+	g->fecseq = fecseq;
+	return;
+}
+
+/**
+ * Add a media packet to a FEC group.
+ *
+ * @return The number of packets in the group, or -1 if the packet does not
+ *		fit in the group. The caller flushes the group and adds it again.
+ */
+int rtpfec_group_add(rtpfec_group_t* g, const unsigned char* pkt, int len)
+{
+	unsigned short seq, off;
+	int i;
+	//
+	if(len < 12 || len - 12 > RTPFEC_PACKET_MAX)
+		return -1;
+	seq = rd16(&pkt[2]);
+	if(g->count == 0)
+	{
+		g->snbase = seq;
+		g->ssrc	 = rd32(&pkt[8]);
+	}
+	off = seq - g->snbase;
+	if(off >= 16 || (g->mask & (0x8000 >> off)) != 0 || rd32(&pkt[8]) != g->ssrc)
+		return -1;
+	g->mask |= 0x8000 >> off;
+	g->bits[0] ^= pkt[0];
+	g->bits[1] ^= pkt[1];
+	g->ts ^= rd32(&pkt[4]);
+	g->lastts = rd32(&pkt[4]);
+	g->length ^= len - 12;
+	for(i = 12; i < len; i++)
+		g->payload[i - 12] ^= pkt[i];
+	if(len - 12 > g->protlen)
+		g->protlen = len - 12;
+	return ++g->count;
+}
+
+/**
+ * Build the FEC packet of a group and start a new group.
+ *
+ * @return The size of the FEC packet, 0 if the group is empty, or -1 if
+ *		\a out is too small.
+ */
+int rtpfec_group_flush(rtpfec_group_t* g, int pt, unsigned char* out, int outsize)
+{
+	int len = RTPFEC_HEADER_SIZE + g->protlen;
+	//
+	if(g->count == 0)
+		return 0;
+	if(outsize < len)
+		return -1;
+	// RTP header
+	out[0] = 0x80;
+	out[1] = pt & 0x7f;
+	wr16(&out[2], g->fecseq++);
+	wr32(&out[4], g->lastts);
+	wr32(&out[8], g->ssrc);
+	// FEC header: E = 0, L = 0
+	out[12] = g->bits[0] & 0x3f;
+	out[13] = g->bits[1];
+	wr16(&out[14], g->snbase);
+	wr32(&out[16], g->ts);
+	wr16(&out[20], g->length);
+	// level 0 header
+	wr16(&out[22], g->protlen);
+	wr16(&out[24], g->mask);
+	bcopy(g->payload, &out[RTPFEC_HEADER_SIZE], g->protlen);
+	rtpfec_group_reset(g);
+	return len;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+rtpfec_decoder_t* rtpfec_decoder_create() { return (rtpfec_decoder_t*)calloc(1, sizeof(rtpfec_decoder_t)); }
+
+/**
+ * Keep a media packet for the recovery of its group.
+ */
+void rtpfec_decoder_put(rtpfec_decoder_t* d, const unsigned char* pkt, int len)
+{
+	rtpfec_slot_t* s;
+	unsigned short seq;
+	//
+	if(len < 12 || len > RTPFEC_PACKET_MAX)
+		return;
+	seq	  = rd16(&pkt[2]);
+	s		  = &d->slot[seq % RTPFEC_HISTORY];
+	s->valid = 1;
+	s->seq	  = seq;
+	s->len	  = len;
+	bcopy(pkt, s->data, len);
+	return;
+}
+
+/**
+ * Recover the media packet lost in a FEC packet's group.
+ *
+ * @param d [in] The decoder of the stream.
+ * @param fec [in] The FEC packet.
+ * @param len [in] Size of the FEC packet.
+ * @param out [out] The recovered packet. Can be the same buffer as \a fec.
+ * @param outsize [in] Size of \a out.
+ * @return The size of the recovered packet, or 0 if nothing is recovered:
+ *		no packet of the group is lost, or more than one is.
+ */
+int rtpfec_decoder_recover(rtpfec_decoder_t* d, const unsigned char* fec, int len, unsigned char* out, int outsize)
+{
+	rtpfec_slot_t* present[48];
+	unsigned long long mask;
+	unsigned short snbase, seq, length, lost = 0;
+	unsigned char bits[2];
+	unsigned int ts, ssrc;
+	int i, j, n, hdrlen, protlen, missing = 0;
+	//
+	if(len < RTPFEC_HEADER_SIZE || (fec[12] & 0x80) != 0)
+		return 0;
+	// L = 1: 48-bit mask
+	hdrlen = (fec[12] & 0x40) ? RTPFEC_HEADER_SIZE + 4 : RTPFEC_HEADER_SIZE;
+	if(len < hdrlen)
+		return 0;
+	protlen = rd16(&fec[22]);
+	if(hdrlen + protlen > len || 12 + protlen > outsize)
+		return 0;
+	snbase = rd16(&fec[14]);
+	mask	 = (unsigned long long)rd16(&fec[24]) << 32;
+	if(hdrlen > RTPFEC_HEADER_SIZE)
+		mask |= rd32(&fec[26]);
+	for(i = 0, n = 0; i < 48; i++)
+	{
+		if((mask & (1ULL << (47 - i))) == 0)
+			continue;
+		seq = snbase + i;
+		if(d->slot[seq % RTPFEC_HISTORY].valid && d->slot[seq % RTPFEC_HISTORY].seq == seq)
+		{
+			present[n++] = &d->slot[seq % RTPFEC_HISTORY];
+		}
+		else
+		{
+			lost = seq;
+			missing++;
+		}
+	}
+	if(missing != 1)
+	{
+		if(missing > 1)
+			d->unrecoverable++;
+		return 0;
+	}
+	bits[0] = fec[12];
+	bits[1] = fec[13];
+	ts		  = rd32(&fec[16]);
+	length  = rd16(&fec[20]);
+	ssrc	  = rd32(&fec[8]);
+	memmove(&out[12], &fec[hdrlen], protlen);
+	for(i = 0; i < n; i++)
+	{
+		const unsigned char* p = present[i]->data;
+		int plen					  = present[i]->len - 12;
+		bits[0] ^= p[0];
+		bits[1] ^= p[1];
+		ts ^= rd32(&p[4]);
+		length ^= plen;
+		for(j = 0; j < plen && j < protlen; j++)
+			out[12 + j] ^= p[12 + j];
+	}
+	if(length > protlen)
+	{
+		d->unrecoverable++;
+		return 0;
+	}
+	out[0] = 0x80 | (bits[0] & 0x3f);
+	out[1] = bits[1];
+	wr16(&out[2], lost);
+	wr32(&out[4], ts);
+	wr32(&out[8], ssrc);
+	d->recovered++;
+	rtpfec_decoder_put(d, out, 12 + length);
+	return 12 + length;
+}
+
+void rtpfec_decoder_destroy(rtpfec_decoder_t* d)
+{
+	free(d);
+	return;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * History of sent RTP packets for NACK retransmission: the implementation.
+ *
+ * Each RTP sink keeps the packets it sent last in a history, indexed by
+ * sequence number. The histories are looked up by SSRC when a client
+ * reports lost packets with generic NACK entries (RFC 4585): a packet ID
+ * and a bitmask of the 16 following packets.
+ *
+ * A lost packet is sent again as is, with its original sequence number,
+ * so that the client's reordering buffer puts it back in place. Packets
+ * older than the client is likely to wait for are not sent again, and
+ * the retransmitted bytes are limited to a share of the sent bytes.
+ */
+
+#include "rtpnack.hpp"
+
+#include "common.hpp"
+#include "conf.hpp"
+#include "trace.hpp"
+
+#include <map>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+
+#define RTPNACK_BURST	  65536	/**< Max bytes retransmitted at once */
+#define RTPNACK_REPEAT_US 100000 /**< Minimum interval between retransmissions of a packet */
+
+typedef struct rtpnack_slot_s {
+	unsigned short seq;
+	int len;
+	long long sent;		/**< Time sent, in microseconds */
+	long long resent;		/**< Time sent again, or 0 */
+	unsigned char data[RTPNACK_PACKET_MAX];
+} rtpnack_slot_t;
+
+struct rtpnack_history_s {
+	std::mutex mutex;		/**< Protects the slots, the tokens, and the counters */
+	unsigned int ssrc;	/**< SSRC of the kept packets, changed by the writer only */
+	int keyed;				/**< Registered with ssrc */
+	rtpnack_send_t send;
+	void* arg;
+	double tokens;			/**< Bytes that can be retransmitted now */
+	unsigned int resent;
+	unsigned int limited;
+	rtpnack_slot_t* slot;
+};
+
+static std::mutex nack_mutex; /**< Protects nack_streams only */
+static std::map<unsigned int, rtpnack_history_t*> nack_streams;
+static int nack_on			 = 0;
+static int nack_size			 = RTPNACK_HISTORY_DEFAULT;
+static double nack_ratio	 = 0.2;
+static long long nack_maxage = 200000;
+
+static inline unsigned int rd32(const unsigned char* p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+/**
+ * Initialize the retransmission parameters.
+ *
+ * @return 0 if the senders keep a history, or -1 otherwise.
+ *
+ * Retransmission is enabled by \em rtp-nack. Each stream keeps the last
+ * \em rtp-nack-history packets, and sends again those not older than
+ * \em rtp-nack-max-age milliseconds. The retransmitted bytes are at most
+ * \em rtp-nack-max-ratio percent of the sent bytes.
+ */
+int rtpnack_init()
+{
+	nack_size = ga_conf_readint_default("rtp-nack-history", RTPNACK_HISTORY_DEFAULT);
+	if(nack_size < 16)
+		nack_size = RTPNACK_HISTORY_DEFAULT;
+	nack_ratio = ga_conf_readint_default("rtp-nack-max-ratio", 20) / 100.0;
+	if(nack_ratio <= 0.0 || nack_ratio > 1.0)
+		nack_ratio = 0.2;
+	nack_maxage = ga_conf_readint_default("rtp-nack-max-age", 200) * 1000LL;
+	if(nack_maxage <= 0)
+		nack_maxage = 200000;
+	nack_on = ga_conf_readbool("rtp-nack", 0);
+	if(nack_on == 0)
+		return -1;
+	ga_error("rtp-nack: enabled, history = %d packets, max-age = %lldms, max-ratio = %.0f%%\n",
+				nack_size,
+				nack_maxage / 1000,
+				nack_ratio * 100);
+	return 0;
+}
+
+int rtpnack_enabled() { return nack_on; }
+
+/**
+ * Create the history of a stream.
+ *
+ * @param send [in] Sends a packet of the stream again.
+ * @param arg [in] The first argument of \a send.
+ * @return The history, or NULL if retransmission is disabled.
+ *
+ * The history is looked up by the SSRC of the packets put in it.
+ */
+rtpnack_history_t* rtpnack_history_create(rtpnack_send_t send, void* arg)
+{
+	rtpnack_history_t* h;
+	//
+	if(nack_on == 0)
+		return NULL;
+	h = new rtpnack_history_t();
+	if((h->slot = (rtpnack_slot_t*)calloc(nack_size, sizeof(rtpnack_slot_t))) == NULL)
+	{
+		delete h;
+		return NULL;
+	}
+	h->send	= send;
+	h->arg	= arg;
+	h->tokens = RTPNACK_BURST;
+	return h;
+}
+
+/**
+ * Keep a sent RTP packet.
+ *
+ * A history has a single writer. The stream lookup table is locked only
+ * when the SSRC of the stream changes.
+ */
+void rtpnack_history_put(rtpnack_history_t* h, const unsigned char* pkt, int len)
+{
+	rtpnack_slot_t* s;
+	unsigned short seq;
+	unsigned int ssrc;
+	//
+	if(h == NULL || len < 12 || len > RTPNACK_PACKET_MAX)
+		return;
+	seq  = (pkt[2] << 8) | pkt[3];
+	ssrc = rd32(&pkt[8]);
+	if(h->keyed == 0 || h->ssrc != ssrc)
+	{
+		std::lock_guard<std::mutex> lock(nack_mutex);
+		if(h->keyed)
+			nack_streams.erase(h->ssrc);
+		h->ssrc					 = ssrc;
+		h->keyed					 = 1;
+		nack_streams[ssrc]	 = h;
+	}
+	std::lock_guard<std::mutex> lock(h->mutex);
+	s			 = &h->slot[seq % nack_size];
+	s->seq	 = seq;
+	s->len	 = len;
+	s->sent	 = ga_trace_now();
+	s->resent = 0;
+	bcopy(pkt, s->data, len);
+	h->tokens += len * nack_ratio;
+	if(h->tokens > RTPNACK_BURST)
+		h->tokens = RTPNACK_BURST;
+	return;
+}
+
+void rtpnack_history_destroy(rtpnack_history_t* h)
+{
+	if(h == NULL)
+		return;
+	do
+	{
+		std::lock_guard<std::mutex> lock(nack_mutex);
+		if(h->keyed)
+			nack_streams.erase(h->ssrc);
+	} while(0);
+	// wait for a retransmission that found the history before it was removed
+	h->mutex.lock();
+	h->mutex.unlock();
+	free(h->slot);
+	delete h;
+	return;
+}
+
+/**
+ * Send the packets reported lost by a client again.
+ *
+ * @param ssrc [in] SSRC of the stream.
+ * @param nfci [in] Number of generic NACK entries.
+ * @param pid [in] Sequence number of the first lost packet of each entry.
+ * @param blp [in] Bitmask of the following lost packets of each entry:
+ *		bit i is set if packet pid + i + 1 is lost.
+ * @param to [in] The client that reported the loss, or NULL if not known.
+ * @return The number of packets sent again, or -1 if the stream is unknown.
+ *
+ * The stream lookup table is locked for the lookup only. The history is
+ * locked while its packets are sent, which holds back its writer only.
+ */
+int rtpnack_retransmit(unsigned int ssrc, int nfci, const unsigned short* pid, const unsigned short* blp, const struct sockaddr_in* to)
+{
+	std::map<unsigned int, rtpnack_history_t*>::iterator mi;
+	rtpnack_history_t* h;
+	rtpnack_slot_t* s;
+	unsigned short seq;
+	long long now = ga_trace_now();
+	int i, j, count = 0;
+	//
+	std::unique_lock<std::mutex> maplock(nack_mutex);
+	if((mi = nack_streams.find(ssrc)) == nack_streams.end())
+		return -1;
+	h = mi->second;
+	// lock the history before releasing the table, so that it is not destroyed
+	std::lock_guard<std::mutex> lock(h->mutex);
+	maplock.unlock();
+	for(i = 0; i < nfci; i++)
+	{
+		for(j = -1; j < 16; j++)
+		{
+			if(j >= 0 && (blp[i] & (1 << j)) == 0)
+				continue;
+			seq = pid[i] + j + 1;
+			s	 = &h->slot[seq % nack_size];
+			if(s->len == 0 || s->seq != seq || now - s->sent > nack_maxage)
+				continue;
+			if(s->resent != 0 && now - s->resent < RTPNACK_REPEAT_US)
+				continue;
+			if(h->tokens < s->len)
+			{
+				h->limited++;
+				continue;
+			}
+			h->tokens -= s->len;
+			s->resent = now;
+			h->send(h->arg, to, s->data, s->len);
+			if((h->resent++ % 100) == 0)
+				ga_error("rtp-nack: ssrc %08x, %u packets sent again, %u rate-limited\n", ssrc, h->resent, h->limited);
+			count++;
+		}
+	}
+	return count;
+}
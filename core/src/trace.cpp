@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Per-stage latency tracing: the implementation.
+ *
+ * Each thread that stamps a trace owns a histogram buffer, so recording
+ * a sample never takes a lock. The buffers are chained in a global list
+ * and merged when a report is generated.
+ *
+ * The histogram row of GA_TRACE_CAPTURE holds the end-to-end latency,
+ * from capture to send. The other rows hold the latency from the previous
+ * stamped stage.
+ */
+
+#include "trace.hpp"
+
+#include "common.hpp"
+#include "conf.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_SUB_BITS	5									 /**< Sub-buckets per power of 2: 2^TRACE_SUB_BITS */
+#define TRACE_SUB_COUNT (1 << TRACE_SUB_BITS)
+#define TRACE_LINEAR	(2 << TRACE_SUB_BITS)					 /**< Values below this are counted exactly */
+#define TRACE_MAX_BITS	31										 /**< Larger values are clamped */
+#define TRACE_BUCKETS	(TRACE_LINEAR + (TRACE_MAX_BITS - TRACE_SUB_BITS - 1) * TRACE_SUB_COUNT)
+
+/**
+ * Histogram buffer of a thread.
+ */
+typedef struct trace_hist_s {
+	std::atomic<unsigned long long> count[GA_TRACE_STAGES][TRACE_BUCKETS]; /**< Written by the owner only */
+	std::atomic<int> inuse;																/**< Owned by a running thread */
+	struct trace_hist_s* next;															/**< Next buffer, never changes once linked */
+} trace_hist_t;
+
+static std::once_flag trace_once;
+static int trace_enabled = 0;
+static long long trace_interval = 0;			  /**< Report interval in microseconds, 0 to disable */
+static std::atomic<long long> trace_next_report{0};
+static std::atomic<unsigned int> trace_frameid{0};
+static std::atomic<trace_hist_t*> trace_hists{NULL}; /**< List of histogram buffers */
+static std::atomic<int> trace_reporting{0};
+static unsigned long long trace_last[GA_TRACE_STAGES][TRACE_BUCKETS]; /**< Counts at the last reset */
+
+static const char* trace_stage_name[] = {"total", "store", "filter", "encode", "queue", "send"};
+
+/**
+ * Release the histogram buffer of a terminated thread, so it can be reused.
+ */
+struct trace_hist_holder {
+	trace_hist_t* hist = NULL;
+	~trace_hist_holder()
+	{
+		if(hist != NULL)
+			hist->inuse.store(0, std::memory_order_release);
+	}
+};
+
+static thread_local trace_hist_holder trace_local;
+
+/**
+ * Read the tracing parameters. This is an internal function.
+ *
+ * Tracing is enabled by the \em latency-trace parameter.
+ * The \em latency-trace-interval parameter sets the report interval in seconds
+ * (default 10). Set it to 0 to disable the periodic report.
+ */
+static void trace_init()
+{
+	char buf[64];
+	int interval = 10;
+	if(ga_conf_readbool("latency-trace", 0) == 0)
+	{
+		trace_enabled = 0;
+		return;
+	}
+	if(ga_conf_readv("latency-trace-interval", buf, sizeof(buf)) != NULL)
+		interval = ga_conf_readint("latency-trace-interval");
+	if(interval < 0)
+		interval = 0;
+	trace_interval = interval * 1000000LL;
+	trace_next_report.store(ga_trace_now() + trace_interval);
+	trace_enabled = 1;
+	ga_error("latency trace: enabled, report interval = %d s\n", interval);
+}
+
+/**
+ * Check if latency tracing is enabled.
+ *
+ * @return 1 if enabled, or 0 if disabled.
+ */
+int ga_trace_enabled()
+{
+	std::call_once(trace_once, trace_init);
+	return trace_enabled;
+}
+
+/**
+ * Get the monotonic time used by the traces.
+ *
+ * @return Current time in microseconds.
+ */
+long long ga_trace_now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+	  .count();
+}
+
+/**
+ * Map a latency value to a histogram bucket.
+ */
+static int trace_bucket(long long us)
+{
+	int msb;
+	if(us < 0)
+		us = 0;
+	if(us < TRACE_LINEAR)
+		return (int)us;
+	if(us >= (1LL << TRACE_MAX_BITS))
+		return TRACE_BUCKETS - 1;
+	for(msb = TRACE_SUB_BITS + 1; (us >> (msb + 1)) != 0; msb++)
+		;
+	return TRACE_LINEAR + (msb - TRACE_SUB_BITS - 1) * TRACE_SUB_COUNT
+			 + (int)((us >> (msb - TRACE_SUB_BITS)) - TRACE_SUB_COUNT);
+}
+
+/**
+ * Map a histogram bucket to the middle of its value range.
+ */
+static long long trace_bucket_value(int bucket)
+{
+	int octave, shift;
+	if(bucket < TRACE_LINEAR)
+		return bucket;
+	octave = (bucket - TRACE_LINEAR) / TRACE_SUB_COUNT;
+	shift	 = octave + 1;
+	return ((long long)(TRACE_SUB_COUNT + (bucket - TRACE_LINEAR) % TRACE_SUB_COUNT) << shift) + (1LL << (shift - 1));
+}
+
+/**
+ * Get the histogram buffer of the calling thread.
+ */
+static trace_hist_t* trace_get_hist()
+{
+	trace_hist_t* h;
+	int expected;
+	//
+	if(trace_local.hist != NULL)
+		return trace_local.hist;
+	// reuse the buffer of a terminated thread
+	for(h = trace_hists.load(std::memory_order_acquire); h != NULL; h = h->next)
+	{
+		expected = 0;
+		if(h->inuse.compare_exchange_strong(expected, 1))
+			return trace_local.hist = h;
+	}
+	h = new trace_hist_t();
+	h->inuse.store(1);
+	h->next = trace_hists.load(std::memory_order_relaxed);
+	while(trace_hists.compare_exchange_weak(h->next, h, std::memory_order_release, std::memory_order_relaxed) == false)
+		;
+	return trace_local.hist = h;
+}
+
+/**
+ * Record a latency sample into the calling thread's histogram.
+ */
+static inline void trace_record(int row, long long us)
+{
+	std::atomic<unsigned long long>* c = &trace_get_hist()->count[row][trace_bucket(us)];
+	// only the owner thread writes
+	c->store(c->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+/**
+ * Start tracing a newly captured frame.
+ *
+ * @param trace [out] The trace record of the frame.
+ *
+ * This function assigns a new frame id and stamps GA_TRACE_CAPTURE.
+ * If tracing is disabled, the frame id is set to 0 and
+ * all the other trace functions ignore the record.
+ */
+void ga_trace_begin(ga_trace_t* trace)
+{
+	bzero(trace, sizeof(ga_trace_t));
+	if(ga_trace_enabled() == 0)
+		return;
+	// frame id 0 is reserved for untraced frames
+	while((trace->frameid = trace_frameid.fetch_add(1, std::memory_order_relaxed) + 1) == 0)
+		;
+	trace->ts[GA_TRACE_CAPTURE] = ga_trace_now();
+}
+
+/**
+ * Stamp a pipeline stage of a traced frame.
+ *
+ * @param trace [in,out] The trace record of the frame.
+ * @param stage [in] The stage, one of \a ga_trace_stage.
+ *
+ * The latency from the previous stamped stage is recorded.
+ * A stage is only stamped once, and stamping GA_TRACE_SEND also records
+ * the end-to-end latency and may trigger the periodic report.
+ */
+void ga_trace_stamp(ga_trace_t* trace, int stage)
+{
+	long long now;
+	int prev;
+	//
+	if(trace == NULL || trace->frameid == 0 || stage <= GA_TRACE_CAPTURE || stage >= GA_TRACE_STAGES)
+		return;
+	if(trace->ts[stage] != 0)
+		return;
+	now					= ga_trace_now();
+	trace->ts[stage] = now;
+	for(prev = stage - 1; prev > GA_TRACE_CAPTURE && trace->ts[prev] == 0; prev--)
+		;
+	trace_record(stage, now - trace->ts[prev]);
+	if(stage != GA_TRACE_SEND)
+		return;
+	trace_record(GA_TRACE_CAPTURE, now - trace->ts[GA_TRACE_CAPTURE]);
+	// periodic report
+	if(trace_interval > 0)
+	{
+		long long next = trace_next_report.load(std::memory_order_relaxed);
+		if(now >= next && trace_next_report.compare_exchange_strong(next, now + trace_interval))
+			ga_trace_print();
+	}
+}
+
+/**
+ * Format the latency percentiles of all the stages.
+ *
+ * @param buf [out] Buffer to store the report.
+ * @param bufsize [in] Size of \a buf.
+ * @param reset [in] Non-zero to start a new measurement window after the report.
+ * @return Length of the report, or -1 if another report is in progress.
+ *
+ * The report contains the sample count and the p50/p99/p999 latencies
+ * in microseconds of each stage since the last reset.
+ */
+int ga_trace_report(char* buf, int bufsize, int reset)
+{
+	static unsigned long long sum[GA_TRACE_STAGES][TRACE_BUCKETS];
+	trace_hist_t* h;
+	int i, j, k, len = 0;
+	//
+	if(bufsize <= 0)
+		return -1;
+	buf[0] = '\0';
+	if(trace_reporting.exchange(1, std::memory_order_acquire) != 0)
+		return -1;
+	bzero(sum, sizeof(sum));
+	for(h = trace_hists.load(std::memory_order_acquire); h != NULL; h = h->next)
+	{
+		for(i = 0; i < GA_TRACE_STAGES; i++)
+			for(j = 0; j < TRACE_BUCKETS; j++)
+				sum[i][j] += h->count[i][j].load(std::memory_order_relaxed);
+	}
+	for(i = 0; i < GA_TRACE_STAGES && len < bufsize; i++)
+	{
+		static const double pct[] = {0.5, 0.99, 0.999};
+		long long value[3] = {0, 0, 0};
+		unsigned long long n = 0, acc = 0;
+		for(j = 0; j < TRACE_BUCKETS; j++)
+			n += sum[i][j] - trace_last[i][j];
+		for(j = 0, k = 0; j < TRACE_BUCKETS && k < 3 && n > 0; j++)
+		{
+			acc += sum[i][j] - trace_last[i][j];
+			while(k < 3 && acc >= (unsigned long long)(pct[k] * n + 0.5) && acc > 0)
+				value[k++] = trace_bucket_value(j);
+		}
+		len += snprintf(buf + len,
+							 bufsize - len,
+							 "%s%s: n=%llu p50=%lld p99=%lld p999=%lld",
+							 i == 0 ? "" : "; ",
+							 trace_stage_name[i],
+							 n,
+							 value[0],
+							 value[1],
+							 value[2]);
+	}
+	if(reset)
+		bcopy(sum, trace_last, sizeof(trace_last));
+	trace_reporting.store(0, std::memory_order_release);
+	return len < bufsize ? len : bufsize - 1;
+}
+
+/**
+ * Print the latency report and start a new measurement window.
+ */
+void ga_trace_print()
+{
+	char buf[1024];
+	if(ga_trace_report(buf, sizeof(buf), 1) > 0)
+		ga_error("latency trace (us): %s\n", buf);
+}
@@ -0,0 +1,612 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * video frame converter: built-in RGBA/BGRA to YUV420P/NV12 kernels
+ *
+ * The kernels implement the BT.601 limited-range conversion used by swscale.
+ * Chroma samples are computed from the rounded average of each 2x2 block.
+ * All the SIMD kernels produce exactly the same output as the C kernel.
+ */
+
+#include "vconverter.hpp"
+
+#include "common.hpp"
+#include "conf.hpp"
+
+#include <mutex>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define VCONV_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define VCONV_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VCONV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define VCONV_TARGET_AVX2
+#endif
+
+/** Instruction sets of the built-in kernels */
+enum vconv_isa {
+	VCONV_ISA_NONE = 0, /**< Built-in kernels are disabled */
+	VCONV_ISA_C,		  /**< Portable C */
+	VCONV_ISA_SSE2,	  /**< x86 SSE2 */
+	VCONV_ISA_AVX2,	  /**< x86 AVX2 */
+	VCONV_ISA_NEON		  /**< ARM NEON */
+};
+
+static const char* vconv_isa_name[] = {"none", "c", "sse2", "avx2", "neon"};
+
+static int vconv_isa = -1; /**< Selected instruction set, -1 if not initialized */
+static std::once_flag vconv_once;
+
+// BT.601 limited range, 8-bit fixed point
+#define VCONV_YR 66
+#define VCONV_YG 129
+#define VCONV_YB 25
+#define VCONV_UR -38
+#define VCONV_UG -74
+#define VCONV_UB 112
+#define VCONV_VR 112
+#define VCONV_VG -94
+#define VCONV_VB -18
+#define VCONV_YBIAS 4224	/**< (16 << 8) + 128 */
+#define VCONV_UVBIAS 32896 /**< (128 << 8) + 128 */
+
+/**
+ * Convert two source rows to two luma rows and one chroma row with C code.
+ *
+ * @param s0 [in] First source row.
+ * @param s1 [in] Second source row, can be equal to \a s0 for the last odd row.
+ * @param y0 [in] First luma row.
+ * @param y1 [in] Second luma row, can be equal to \a y0 for the last odd row.
+ * @param u [in] Chroma U row.
+ * @param v [in] Chroma V row.
+ * @param uvstep [in] Distance between chroma samples: 1 for YUV420P, 2 for NV12.
+ * @param x [in] First pixel to convert, must be even.
+ * @param width [in] Frame width.
+ *
+ * \a RI and \a BI are the byte offsets of R and B in a source pixel.
+ */
+template <int RI, int BI>
+static void vconv_rows_c(const uint8_t* s0,
+								 const uint8_t* s1,
+								 uint8_t* y0,
+								 uint8_t* y1,
+								 uint8_t* u,
+								 uint8_t* v,
+								 int uvstep,
+								 int x,
+								 int width)
+{
+	for(; x < width; x += 2)
+	{
+		int x1					= (x + 1 < width) ? x + 1 : x;
+		const uint8_t* p00 = s0 + x * 4;
+		const uint8_t* p01 = s0 + x1 * 4;
+		const uint8_t* p10 = s1 + x * 4;
+		const uint8_t* p11 = s1 + x1 * 4;
+		int r, g, b;
+		//
+		y0[x]	= (VCONV_YR * p00[RI] + VCONV_YG * p00[1] + VCONV_YB * p00[BI] + VCONV_YBIAS) >> 8;
+		y0[x1] = (VCONV_YR * p01[RI] + VCONV_YG * p01[1] + VCONV_YB * p01[BI] + VCONV_YBIAS) >> 8;
+		y1[x]	= (VCONV_YR * p10[RI] + VCONV_YG * p10[1] + VCONV_YB * p10[BI] + VCONV_YBIAS) >> 8;
+		y1[x1] = (VCONV_YR * p11[RI] + VCONV_YG * p11[1] + VCONV_YB * p11[BI] + VCONV_YBIAS) >> 8;
+		//
+		r = (p00[RI] + p01[RI] + p10[RI] + p11[RI] + 2) >> 2;
+		g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+		b = (p00[BI] + p01[BI] + p10[BI] + p11[BI] + 2) >> 2;
+		u[(x >> 1) * uvstep] = (VCONV_UR * r + VCONV_UG * g + VCONV_UB * b + VCONV_UVBIAS) >> 8;
+		v[(x >> 1) * uvstep] = (VCONV_VR * r + VCONV_VG * g + VCONV_VB * b + VCONV_UVBIAS) >> 8;
+	}
+}
+
+#ifdef VCONV_X86
+/**
+ * SSE2: dot products of 4 pixels, given as two vectors of 2 pixels in 16-bit lanes.
+ */
+static inline __m128i vconv_dot4_sse2(__m128i p01, __m128i p23, __m128i coef)
+{
+	__m128 m0	 = _mm_castsi128_ps(_mm_madd_epi16(p01, coef));
+	__m128 m1	 = _mm_castsi128_ps(_mm_madd_epi16(p23, coef));
+	__m128i even = _mm_castps_si128(_mm_shuffle_ps(m0, m1, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i odd	 = _mm_castps_si128(_mm_shuffle_ps(m0, m1, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_add_epi32(even, odd);
+}
+
+/**
+ * SSE2: luma of 16 pixels.
+ */
+static inline __m128i vconv_luma16_sse2(const uint8_t* s, __m128i coef)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi32(VCONV_YBIAS);
+	__m128i y[4];
+	int i;
+	for(i = 0; i < 4; i++)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(s + i * 16));
+		y[i] = vconv_dot4_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero), coef);
+		y[i] = _mm_srai_epi32(_mm_add_epi32(y[i], bias), 8);
+	}
+	return _mm_packus_epi16(_mm_packs_epi32(y[0], y[1]), _mm_packs_epi32(y[2], y[3]));
+}
+
+/**
+ * SSE2: 2x2 averages of 4 pixels from two rows, as 2 pixels in 16-bit lanes.
+ */
+static inline __m128i vconv_avg2x2_sse2(const uint8_t* s0, const uint8_t* s1)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two	 = _mm_set1_epi16(2);
+	__m128i a			 = _mm_loadu_si128((const __m128i*)s0);
+	__m128i b			 = _mm_loadu_si128((const __m128i*)s1);
+	__m128i lo			 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i hi			 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	lo						 = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+	hi						 = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+	return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+}
+
+/**
+ * SSE2 kernel: same as vconv_rows_c(), for 16 pixels per iteration.
+ *
+ * @return Number of converted pixels.
+ */
+template <int RI, int BI, int NV12>
+static int vconv_rows_sse2(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, int width)
+{
+	const __m128i cy = RI == 0 ? _mm_setr_epi16(VCONV_YR, VCONV_YG, VCONV_YB, 0, VCONV_YR, VCONV_YG, VCONV_YB, 0)
+										: _mm_setr_epi16(VCONV_YB, VCONV_YG, VCONV_YR, 0, VCONV_YB, VCONV_YG, VCONV_YR, 0);
+	const __m128i cu = RI == 0 ? _mm_setr_epi16(VCONV_UR, VCONV_UG, VCONV_UB, 0, VCONV_UR, VCONV_UG, VCONV_UB, 0)
+										: _mm_setr_epi16(VCONV_UB, VCONV_UG, VCONV_UR, 0, VCONV_UB, VCONV_UG, VCONV_UR, 0);
+	const __m128i cv = RI == 0 ? _mm_setr_epi16(VCONV_VR, VCONV_VG, VCONV_VB, 0, VCONV_VR, VCONV_VG, VCONV_VB, 0)
+										: _mm_setr_epi16(VCONV_VB, VCONV_VG, VCONV_VR, 0, VCONV_VB, VCONV_VG, VCONV_VR, 0);
+	const __m128i bias = _mm_set1_epi32(VCONV_UVBIAS);
+	int x;
+	//
+	for(x = 0; x + 16 <= width; x += 16)
+	{
+		const uint8_t* p0 = s0 + x * 4;
+		const uint8_t* p1 = s1 + x * 4;
+		__m128i c0, c1, c2, c3, cu0, cu1, cv0, cv1, uu, vv;
+		//
+		_mm_storeu_si128((__m128i*)(y0 + x), vconv_luma16_sse2(p0, cy));
+		_mm_storeu_si128((__m128i*)(y1 + x), vconv_luma16_sse2(p1, cy));
+		//
+		c0	 = vconv_avg2x2_sse2(p0, p1);
+		c1	 = vconv_avg2x2_sse2(p0 + 16, p1 + 16);
+		c2	 = vconv_avg2x2_sse2(p0 + 32, p1 + 32);
+		c3	 = vconv_avg2x2_sse2(p0 + 48, p1 + 48);
+		cu0 = _mm_srai_epi32(_mm_add_epi32(vconv_dot4_sse2(c0, c1, cu), bias), 8);
+		cu1 = _mm_srai_epi32(_mm_add_epi32(vconv_dot4_sse2(c2, c3, cu), bias), 8);
+		cv0 = _mm_srai_epi32(_mm_add_epi32(vconv_dot4_sse2(c0, c1, cv), bias), 8);
+		cv1 = _mm_srai_epi32(_mm_add_epi32(vconv_dot4_sse2(c2, c3, cv), bias), 8);
+		uu	 = _mm_packus_epi16(_mm_packs_epi32(cu0, cu1), _mm_setzero_si128());
+		vv	 = _mm_packus_epi16(_mm_packs_epi32(cv0, cv1), _mm_setzero_si128());
+		if(NV12)
+		{
+			_mm_storeu_si128((__m128i*)(u + x), _mm_unpacklo_epi8(uu, vv));
+		}
+		else
+		{
+			_mm_storel_epi64((__m128i*)(u + (x >> 1)), uu);
+			_mm_storel_epi64((__m128i*)(v + (x >> 1)), vv);
+		}
+	}
+	return x;
+}
+
+/**
+ * AVX2: dot products of 8 pixels, in order.
+ */
+VCONV_TARGET_AVX2
+static inline __m256i vconv_dot8_avx2(__m256i p0, __m256i p1, __m256i coef)
+{
+	__m256 m0	 = _mm256_castsi256_ps(_mm256_madd_epi16(p0, coef));
+	__m256 m1	 = _mm256_castsi256_ps(_mm256_madd_epi16(p1, coef));
+	__m256i even = _mm256_castps_si256(_mm256_shuffle_ps(m0, m1, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m256i odd	 = _mm256_castps_si256(_mm256_shuffle_ps(m0, m1, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm256_add_epi32(even, odd);
+}
+
+/**
+ * AVX2: luma of 32 pixels.
+ */
+VCONV_TARGET_AVX2
+static inline __m256i vconv_luma32_avx2(const uint8_t* s, __m256i coef)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i bias = _mm256_set1_epi32(VCONV_YBIAS);
+	__m256i y[4], lo, hi;
+	int i;
+	for(i = 0; i < 4; i++)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(s + i * 32));
+		// per 128-bit lane: [px0,px1 | px4,px5] and [px2,px3 | px6,px7] gives pixels in order
+		y[i] = vconv_dot8_avx2(_mm256_unpacklo_epi8(a, zero), _mm256_unpackhi_epi8(a, zero), coef);
+		y[i] = _mm256_srai_epi32(_mm256_add_epi32(y[i], bias), 8);
+	}
+	lo = _mm256_permute4x64_epi64(_mm256_packs_epi32(y[0], y[1]), _MM_SHUFFLE(3, 1, 2, 0));
+	hi = _mm256_permute4x64_epi64(_mm256_packs_epi32(y[2], y[3]), _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+/**
+ * AVX2: 2x2 averages of 8 pixels from two rows, as 4 pixels in 16-bit lanes, in order.
+ */
+VCONV_TARGET_AVX2
+static inline __m256i vconv_avg2x2_avx2(const uint8_t* s0, const uint8_t* s1)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i two	 = _mm256_set1_epi16(2);
+	__m256i a			 = _mm256_loadu_si256((const __m256i*)s0);
+	__m256i b			 = _mm256_loadu_si256((const __m256i*)s1);
+	__m256i lo			 = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+	__m256i hi			 = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+	lo						 = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+	hi						 = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+	return _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), two), 2);
+}
+
+/**
+ * AVX2: chroma of 16 2x2 blocks, given as four vectors from vconv_avg2x2_avx2().
+ */
+VCONV_TARGET_AVX2
+static inline __m128i vconv_chroma16_avx2(__m256i c0, __m256i c1, __m256i c2, __m256i c3, __m256i coef)
+{
+	const __m256i bias = _mm256_set1_epi32(VCONV_UVBIAS);
+	__m256i a, b, p;
+	a = vconv_dot8_avx2(_mm256_permute2x128_si256(c0, c1, 0x20), _mm256_permute2x128_si256(c0, c1, 0x31), coef);
+	b = vconv_dot8_avx2(_mm256_permute2x128_si256(c2, c3, 0x20), _mm256_permute2x128_si256(c2, c3, 0x31), coef);
+	a = _mm256_srai_epi32(_mm256_add_epi32(a, bias), 8);
+	b = _mm256_srai_epi32(_mm256_add_epi32(b, bias), 8);
+	p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+	p = _mm256_permute4x64_epi64(_mm256_packus_epi16(p, p), _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm256_castsi256_si128(p);
+}
+
+/**
+ * AVX2 kernel: same as vconv_rows_c(), for 32 pixels per iteration.
+ *
+ * @return Number of converted pixels.
+ */
+template <int RI, int BI, int NV12>
+VCONV_TARGET_AVX2 static int
+  vconv_rows_avx2(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, int width)
+{
+	const __m256i cy = RI == 0
+							 ? _mm256_setr_epi16(VCONV_YR, VCONV_YG, VCONV_YB, 0, VCONV_YR, VCONV_YG, VCONV_YB, 0, VCONV_YR, VCONV_YG, VCONV_YB, 0, VCONV_YR, VCONV_YG, VCONV_YB, 0)
+							 : _mm256_setr_epi16(VCONV_YB, VCONV_YG, VCONV_YR, 0, VCONV_YB, VCONV_YG, VCONV_YR, 0, VCONV_YB, VCONV_YG, VCONV_YR, 0, VCONV_YB, VCONV_YG, VCONV_YR, 0);
+	const __m256i cu = RI == 0
+							 ? _mm256_setr_epi16(VCONV_UR, VCONV_UG, VCONV_UB, 0, VCONV_UR, VCONV_UG, VCONV_UB, 0, VCONV_UR, VCONV_UG, VCONV_UB, 0, VCONV_UR, VCONV_UG, VCONV_UB, 0)
+							 : _mm256_setr_epi16(VCONV_UB, VCONV_UG, VCONV_UR, 0, VCONV_UB, VCONV_UG, VCONV_UR, 0, VCONV_UB, VCONV_UG, VCONV_UR, 0, VCONV_UB, VCONV_UG, VCONV_UR, 0);
+	const __m256i cv = RI == 0
+							 ? _mm256_setr_epi16(VCONV_VR, VCONV_VG, VCONV_VB, 0, VCONV_VR, VCONV_VG, VCONV_VB, 0, VCONV_VR, VCONV_VG, VCONV_VB, 0, VCONV_VR, VCONV_VG, VCONV_VB, 0)
+							 : _mm256_setr_epi16(VCONV_VB, VCONV_VG, VCONV_VR, 0, VCONV_VB, VCONV_VG, VCONV_VR, 0, VCONV_VB, VCONV_VG, VCONV_VR, 0, VCONV_VB, VCONV_VG, VCONV_VR, 0);
+	int x;
+	//
+	for(x = 0; x + 32 <= width; x += 32)
+	{
+		const uint8_t* p0 = s0 + x * 4;
+		const uint8_t* p1 = s1 + x * 4;
+		__m256i c0, c1, c2, c3;
+		__m128i uu, vv;
+		//
+		_mm256_storeu_si256((__m256i*)(y0 + x), vconv_luma32_avx2(p0, cy));
+		_mm256_storeu_si256((__m256i*)(y1 + x), vconv_luma32_avx2(p1, cy));
+		//
+		c0 = vconv_avg2x2_avx2(p0, p1);
+		c1 = vconv_avg2x2_avx2(p0 + 32, p1 + 32);
+		c2 = vconv_avg2x2_avx2(p0 + 64, p1 + 64);
+		c3 = vconv_avg2x2_avx2(p0 + 96, p1 + 96);
+		uu = vconv_chroma16_avx2(c0, c1, c2, c3, cu);
+		vv = vconv_chroma16_avx2(c0, c1, c2, c3, cv);
+		if(NV12)
+		{
+			_mm_storeu_si128((__m128i*)(u + x), _mm_unpacklo_epi8(uu, vv));
+			_mm_storeu_si128((__m128i*)(u + x + 16), _mm_unpackhi_epi8(uu, vv));
+		}
+		else
+		{
+			_mm_storeu_si128((__m128i*)(u + (x >> 1)), uu);
+			_mm_storeu_si128((__m128i*)(v + (x >> 1)), vv);
+		}
+	}
+	return x;
+}
+#endif /* VCONV_X86 */
+
+#ifdef VCONV_NEON
+/**
+ * NEON: luma of 16 pixels, given as deinterleaved channels.
+ */
+static inline uint8x16_t vconv_luma16_neon(uint8x16_t r, uint8x16_t g, uint8x16_t b)
+{
+	uint16x8_t lo = vdupq_n_u16(VCONV_YBIAS);
+	uint16x8_t hi = vdupq_n_u16(VCONV_YBIAS);
+	lo				  = vmlal_u8(lo, vget_low_u8(r), vdup_n_u8(VCONV_YR));
+	lo				  = vmlal_u8(lo, vget_low_u8(g), vdup_n_u8(VCONV_YG));
+	lo				  = vmlal_u8(lo, vget_low_u8(b), vdup_n_u8(VCONV_YB));
+	hi				  = vmlal_u8(hi, vget_high_u8(r), vdup_n_u8(VCONV_YR));
+	hi				  = vmlal_u8(hi, vget_high_u8(g), vdup_n_u8(VCONV_YG));
+	hi				  = vmlal_u8(hi, vget_high_u8(b), vdup_n_u8(VCONV_YB));
+	return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+/**
+ * NEON kernel: same as vconv_rows_c(), for 16 pixels per iteration.
+ *
+ * All the intermediate values stay in [4336, 61456], so unsigned 16-bit lanes never wrap.
+ *
+ * @return Number of converted pixels.
+ */
+template <int RI, int BI, int NV12>
+static int vconv_rows_neon(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, int width)
+{
+	int x;
+	for(x = 0; x + 16 <= width; x += 16)
+	{
+		uint8x16x4_t a = vld4q_u8(s0 + x * 4);
+		uint8x16x4_t b = vld4q_u8(s1 + x * 4);
+		uint16x8_t r, g, bl, t;
+		uint8x8_t uu, vv;
+		//
+		vst1q_u8(y0 + x, vconv_luma16_neon(a.val[RI], a.val[1], a.val[BI]));
+		vst1q_u8(y1 + x, vconv_luma16_neon(b.val[RI], b.val[1], b.val[BI]));
+		// rounded 2x2 averages
+		r	= vrshrq_n_u16(vaddq_u16(vpaddlq_u8(a.val[RI]), vpaddlq_u8(b.val[RI])), 2);
+		g	= vrshrq_n_u16(vaddq_u16(vpaddlq_u8(a.val[1]), vpaddlq_u8(b.val[1])), 2);
+		bl = vrshrq_n_u16(vaddq_u16(vpaddlq_u8(a.val[BI]), vpaddlq_u8(b.val[BI])), 2);
+		//
+		t	= vmlaq_n_u16(vdupq_n_u16(VCONV_UVBIAS), bl, VCONV_UB);
+		t	= vmlsq_n_u16(t, r, -VCONV_UR);
+		t	= vmlsq_n_u16(t, g, -VCONV_UG);
+		uu = vshrn_n_u16(t, 8);
+		t	= vmlaq_n_u16(vdupq_n_u16(VCONV_UVBIAS), r, VCONV_VR);
+		t	= vmlsq_n_u16(t, g, -VCONV_VG);
+		t	= vmlsq_n_u16(t, bl, -VCONV_VB);
+		vv = vshrn_n_u16(t, 8);
+		if(NV12)
+		{
+			uint8x8x2_t uv = {{uu, vv}};
+			vst2_u8(u + x, uv);
+		}
+		else
+		{
+			vst1_u8(u + (x >> 1), uu);
+			vst1_u8(v + (x >> 1), vv);
+		}
+	}
+	return x;
+}
+#endif /* VCONV_NEON */
+
+/**
+ * Convert a frame with the built-in kernels.
+ *
+ * \a ISA selects the SIMD kernel; pixels left over by the SIMD kernel
+ * (and the whole frame for VCONV_ISA_C) are converted by vconv_rows_c().
+ */
+template <int ISA, int RI, int BI, int NV12>
+static void vconv_frame(const unsigned char* src, int srcstride, int width, int height, unsigned char* dst[], const int dststride[])
+{
+	int y, x;
+	for(y = 0; y < height; y += 2)
+	{
+		const uint8_t* s0 = src + y * srcstride;
+		const uint8_t* s1 = (y + 1 < height) ? s0 + srcstride : s0;
+		uint8_t* y0			= dst[0] + y * dststride[0];
+		uint8_t* y1			= (y + 1 < height) ? y0 + dststride[0] : y0;
+		uint8_t* u			= dst[1] + (y >> 1) * dststride[1];
+		uint8_t* v			= NV12 ? u + 1 : dst[2] + (y >> 1) * dststride[2];
+		//
+		x = 0;
+#ifdef VCONV_X86
+		if(ISA == VCONV_ISA_SSE2)
+			x = vconv_rows_sse2<RI, BI, NV12>(s0, s1, y0, y1, u, v, width);
+		if(ISA == VCONV_ISA_AVX2)
+			x = vconv_rows_avx2<RI, BI, NV12>(s0, s1, y0, y1, u, v, width);
+#endif
+#ifdef VCONV_NEON
+		if(ISA == VCONV_ISA_NEON)
+			x = vconv_rows_neon<RI, BI, NV12>(s0, s1, y0, y1, u, v, width);
+#endif
+		vconv_rows_c<RI, BI>(s0, s1, y0, y1, u, v, NV12 ? 2 : 1, x, width);
+	}
+}
+
+/** Converters of an instruction set: [RGBA, BGRA][YUV420P, NV12] */
+#define VCONV_TABLE(isa)                                                                 \
+	{                                                                                     \
+		{vconv_frame<isa, 0, 2, 0>, vconv_frame<isa, 0, 2, 1>},                          \
+		  {vconv_frame<isa, 2, 0, 0>, vconv_frame<isa, 2, 0, 1>},                        \
+	}
+
+static native_converter_t vconv_table_c[2][2] = VCONV_TABLE(VCONV_ISA_C);
+#ifdef VCONV_X86
+static native_converter_t vconv_table_sse2[2][2] = VCONV_TABLE(VCONV_ISA_SSE2);
+static native_converter_t vconv_table_avx2[2][2] = VCONV_TABLE(VCONV_ISA_AVX2);
+#endif
+#ifdef VCONV_NEON
+static native_converter_t vconv_table_neon[2][2] = VCONV_TABLE(VCONV_ISA_NEON);
+#endif
+
+/**
+ * Detect the best instruction set supported by the running CPU.
+ */
+static int vconv_detect_isa()
+{
+#ifdef VCONV_X86
+	unsigned int regs[4] = {0, 0, 0, 0};
+	int avx2 = 0, sse2 = 0;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] >= 1)
+	{
+		__cpuid(info, 1);
+		regs[2] = info[2];
+		regs[3] = info[3];
+	}
+#else
+	if(__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]) == 0)
+		return VCONV_ISA_C;
+#endif
+	sse2 = (regs[3] >> 26) & 1;
+	// AVX2 requires OS support of the YMM state (OSXSAVE + XCR0 bits 1 and 2)
+	if(((regs[2] >> 27) & 1) && ((regs[2] >> 28) & 1))
+	{
+		unsigned int xcr0;
+#ifdef _MSC_VER
+		xcr0 = (unsigned int)_xgetbv(0);
+		__cpuidex(info, 7, 0);
+		regs[1] = info[1];
+#else
+		unsigned int edx;
+		__asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+		regs[1] = 0;
+		if(__get_cpuid_max(0, NULL) >= 7)
+		{
+			__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+		}
+#endif
+		avx2 = ((xcr0 & 0x06) == 0x06) && ((regs[1] >> 5) & 1);
+	}
+	if(avx2)
+		return VCONV_ISA_AVX2;
+	if(sse2)
+		return VCONV_ISA_SSE2;
+#endif
+#ifdef VCONV_NEON
+	return VCONV_ISA_NEON;
+#endif
+	return VCONV_ISA_C;
+}
+
+/**
+ * Select the instruction set of the built-in kernels. This is an internal function.
+ *
+ * The \em native-converter parameter can be \em auto (default),
+ * \em off to always use swscale, or an instruction set name (c, sse2, avx2, neon)
+ * to force a kernel supported by the running CPU.
+ * Called once, through std::call_once(), by the first converter lookup.
+ */
+static void vconv_init()
+{
+	char buf[64];
+	int best = vconv_detect_isa();
+	int i;
+	//
+	vconv_isa = best;
+	if(ga_conf_readv("native-converter", buf, sizeof(buf)) != NULL)
+	{
+		if(ga_conf_boolval(buf, 1) == 0 || strcasecmp(buf, "off") == 0)
+		{
+			vconv_isa = VCONV_ISA_NONE;
+		}
+		for(i = VCONV_ISA_C; i <= VCONV_ISA_NEON; i++)
+		{
+			if(strcasecmp(buf, vconv_isa_name[i]) == 0)
+			{
+				if(i > best || (best == VCONV_ISA_NEON && i != VCONV_ISA_C && i != best))
+					ga_error("Frame converter: %s is not supported, use %s.\n", buf, vconv_isa_name[best]);
+				else
+					vconv_isa = i;
+			}
+		}
+	}
+	ga_error("Frame converter: built-in kernels = %s\n", vconv_isa_name[vconv_isa]);
+}
+
+/**
+ * Get the instruction set used by the built-in converters.
+ *
+ * @return Name of the instruction set, or "none" if built-in converters are disabled.
+ */
+const char* native_converter_isa()
+{
+	std::call_once(vconv_once, vconv_init);
+	return vconv_isa_name[vconv_isa];
+}
+
+/**
+ * Look up a built-in video frame converter.
+ *
+ * @param srcw [in] Video source frame width.
+ * @param srch [in] Video source frame height.
+ * @param srcfmt [in] Video source frame pixel format.
+ * @param dstw [in] Video destination frame width.
+ * @param dsth [in] Video destination frame height.
+ * @param dstfmt [in] Video destination frame pixel format.
+ * @return Pointer to the converter function,
+ *	or NULL if the conversion requires scaling or is not supported.
+ *
+ * Supported conversions are RGBA/BGRA to YUV420P/NV12 without scaling.
+ * A built-in converter is stateless, so it can be called from several
+ * threads at the same time, e.g., for different bands of a frame.
+ * Bands must start at an even row.
+ */
+native_converter_t lookup_native_converter(int srcw, int srch, AVPixelFormat srcfmt, int dstw, int dsth, AVPixelFormat dstfmt)
+{
+	native_converter_t(*table)[2] = vconv_table_c;
+	int s, d;
+	//
+	std::call_once(vconv_once, vconv_init);
+	if(vconv_isa == VCONV_ISA_NONE)
+		return NULL;
+	if(srcw != dstw || srch != dsth)
+		return NULL;
+	if(srcfmt == AV_PIX_FMT_RGBA)
+		s = 0;
+	else if(srcfmt == AV_PIX_FMT_BGRA)
+		s = 1;
+	else
+		return NULL;
+	if(dstfmt == AV_PIX_FMT_YUV420P)
+		d = 0;
+	else if(dstfmt == AV_PIX_FMT_NV12)
+		d = 1;
+	else
+		return NULL;
+	//
+#ifdef VCONV_X86
+	if(vconv_isa == VCONV_ISA_SSE2)
+		table = vconv_table_sse2;
+	if(vconv_isa == VCONV_ISA_AVX2)
+		table = vconv_table_avx2;
+#endif
+#ifdef VCONV_NEON
+	if(vconv_isa == VCONV_ISA_NEON)
+		table = vconv_table_neon;
+#endif
+	return table[s][d];
+}
@@ -41,6 +41,7 @@
 #define COLORCODE_SUFFIX                      \
 	(COLORCODE_CRC + COLORCODE_ID) /**< Digits \
 											  * appended to the embedded color code sequence */
+#define COLORCODE_MATCH_DISTANCE (3 * 48 * 48) /**< Largest squared YUV distance of a detected digit to its color */
 
 // golbal image structure
 static int gChannels;										  /**< Total number of video channels */
@@ -117,6 +118,9 @@ void vsource_dup_frame(vsource_frame_t* src, vsource_frame_t* dst)
 	dst->realheight = src->realheight;
 	dst->realstride = src->realstride;
 	dst->realsize	 = src->realsize;
+	dst->trace		 = src->trace;
+	dst->ndirty		 = src->ndirty;
+	bcopy(src->dirty, dst->dirty, sizeof(src->dirty));
 	bcopy(src->imgbuf, dst->imgbuf, src->realstride * src->realheight /*dst->imgbufsize*/);
 	return;
 }
@@ -160,6 +164,7 @@ static unsigned char yuv_colorV[8] =					 /**< For YUV plane V */
 
 // global configuratoin for embedding color code feature (CC)
 static int vsource_colorcode_initialized				= 0;							/**< CC has been initialized */
+static int vsource_colorcode_detecting					= 0;							/**< CC detector has been initialized */
 static unsigned int vsource_colorcode_counter		= 0;							/**< CC's current sequence number */
 static unsigned int vsource_colorcode_counter_mask = 0;							/**< CC's mask used to rotate sequence number */
 static int vsource_colorcode_digits						= COLORCODE_DEF_DIGIT;	/**< CC's number of digits */
@@ -176,21 +181,18 @@ static unsigned char
 static FILE* savefp_ccodets = NULL; /**< FILE pointer used to store color code sequence and timestamp */
 
 /**
- * Initialize the color code feature.
+ * Read and check the color code geometry. This is an internal function.
  *
- * @param RGBmode [in] Specify to generate RGB or YUV color codes.
- *	Values can be zero (YUV) or non-zero (RGB).
  * @return 0 on success, or -1 on error.
+ *
+ * The geometry is given by the \em embed-colorcode parameter:
+ * the number of digits, the per-digit width, and the height.
  */
-int vsource_embed_colorcode_init(int RGBmode)
+static int vsource_colorcode_config()
 {
 	int i, param[3];
-	char savefile_ccodets[128];
-	// read param
 	if(ga_conf_readints("embed-colorcode", param, 3) != 3)
 		return -1;
-	if(ga_conf_readv("save-colorcode-timestamp", savefile_ccodets, sizeof(savefile_ccodets)) != NULL)
-		savefp_ccodets = ga_save_init_txt(savefile_ccodets);
 	vsource_colorcode_digits = param[0];
 	vsource_colorcode_width	 = param[1];
 	vsource_colorcode_height = param[2];
@@ -211,6 +213,50 @@ int vsource_embed_colorcode_init(int RGBmode)
 		vsource_colorcode_counter_mask <<= 3;
 		vsource_colorcode_counter_mask |= 0x07;
 	}
+	return 0;
+}
+
+/**
+ * Compute the suffix digits of a color code. This is an internal function.
+ *
+ * @param value [in] The sequence number part of the color code.
+ * @param suffix [out] The CRC and ID digits.
+ */
+static void vsource_colorcode_suffix(unsigned int value, unsigned char suffix[COLORCODE_SUFFIX])
+{
+	suffix[0] = 0;
+	suffix[1] = 0;
+	suffix[2] = 3;
+	suffix[3] = 7;
+#if 0
+	unsigned int crcin = htonl(value);
+	suffix[0] = 0x07 & vsource_crc5_ccitt((unsigned char*) &crcin, sizeof(crcin));
+	suffix[1] = 0x07 & vsource_crc5_usb((unsigned char*) &crcin, sizeof(crcin));
+#else
+	if(value != 0)
+	{
+		suffix[0] = (43 * (((value * 32) / 43) + 1) - 32 * value) & 0x07;
+		suffix[1] = (37 * (((value * 32) / 37) + 1) - 32 * value) & 0x07;
+	}
+#endif
+	return;
+}
+
+/**
+ * Initialize the color code feature.
+ *
+ * @param RGBmode [in] Specify to generate RGB or YUV color codes.
+ *	Values can be zero (YUV) or non-zero (RGB).
+ * @return 0 on success, or -1 on error.
+ */
+int vsource_embed_colorcode_init(int RGBmode)
+{
+	char savefile_ccodets[128];
+	// read param
+	if(vsource_colorcode_config() < 0)
+		return -1;
+	if(ga_conf_readv("save-colorcode-timestamp", savefile_ccodets, sizeof(savefile_ccodets)) != NULL)
+		savefp_ccodets = ga_save_init_txt(savefile_ccodets);
 	//
 	ga_error(
 	  "video source: color code initialized - %dx%d, %d digits, shift=%d, initmask=%08x, totalwidth=%d, counter-mask=%08x\n",
@@ -290,7 +336,7 @@ static void vsource_embed_yuv_code(vsource_frame_t* frame, unsigned int value)
 {
 	int i, j, width, height;
 	/* CRC * 2 + ID * 2 */
-	unsigned char suffix[COLORCODE_SUFFIX] = {0, 0, 3, 7};
+	unsigned char suffix[COLORCODE_SUFFIX];
 	unsigned int shift							= vsource_colorcode_initshift;
 	unsigned int mask								= vsource_colorcode_initmask;
 	unsigned int digit;
@@ -307,17 +353,7 @@ static void vsource_embed_yuv_code(vsource_frame_t* frame, unsigned int value)
 	}
 	//// make the color code line
 	// compute crc
-#if 0
-	unsigned int crcin = htonl(value);
-	suffix[0] = 0x07 & vsource_crc5_ccitt((unsigned char*) &crcin, sizeof(crcin));
-	suffix[1] = 0x07 & vsource_crc5_usb((unsigned char*) &crcin, sizeof(crcin));
-#else
-	if(value != 0)
-	{
-		suffix[0] = (43 * (((value * 32) / 43) + 1) - 32 * value) & 0x07;
-		suffix[1] = (37 * (((value * 32) / 37) + 1) - 32 * value) & 0x07;
-	}
-#endif
+	vsource_colorcode_suffix(value, suffix);
 	// value part
 	while(mask != 0)
 	{
@@ -387,7 +423,7 @@ static void vsource_embed_rgba_code(vsource_frame_t* frame, unsigned int value,
 {
 	int i, j, height;
 	/* CRC * 2 + ID * 2 */
-	unsigned char suffix[COLORCODE_SUFFIX] = {0, 0, 3, 7};
+	unsigned char suffix[COLORCODE_SUFFIX];
 	unsigned int shift							= vsource_colorcode_initshift;
 	unsigned int mask								= vsource_colorcode_initmask;
 	unsigned int digit;
@@ -401,17 +437,7 @@ static void vsource_embed_rgba_code(vsource_frame_t* frame, unsigned int value,
 	}
 	//// make the color code line
 	// compute crc
-#if 0
-	unsigned int crcin = htonl(value);
-	suffix[0] = 0x07 & vsource_crc5_ccitt((unsigned char*) &crcin, sizeof(crcin));
-	suffix[1] = 0x07 & vsource_crc5_usb((unsigned char*) &crcin, sizeof(crcin));
-#else
-	if(value != 0)
-	{
-		suffix[0] = (43 * (((value * 32) / 43) + 1) - 32 * value) & 0x07;
-		suffix[1] = (37 * (((value * 32) / 37) + 1) - 32 * value) & 0x07;
-	}
-#endif
+	vsource_colorcode_suffix(value, suffix);
 	// value part
 	while(mask != 0)
 	{
@@ -497,6 +523,142 @@ void vsource_embed_colorcode(vsource_frame_t* frame, unsigned int value)
 	return;
 }
 
+/**
+ * Initialize the color code detector.
+ *
+ * @return 0 on success, or -1 on error.
+ *
+ * The detector reads the same \em embed-colorcode parameter as the embedder,
+ * so both ends must be configured with the same geometry.
+ */
+int vsource_detect_colorcode_init()
+{
+	if(vsource_colorcode_config() < 0)
+		return -1;
+	ga_error("video source: color code detector initialized - %dx%d, %d digits, totalwidth=%d\n",
+				vsource_colorcode_width,
+				vsource_colorcode_height,
+				vsource_colorcode_digits,
+				vsource_colorcode_total_width);
+	vsource_colorcode_detecting = 1;
+	return 0;
+}
+
+/**
+ * Read a digit of a color code in a YUV image. This is an internal function.
+ *
+ * @param planes [in] The image planes.
+ * @param linesize [in] The line sizes of the image planes.
+ * @param pixelformat [in] The pixel format, YUV420P, YUVJ420P, or NV12.
+ * @param index [in] Index of the digit, counted from the left-most digit.
+ * @param height [in] Height of the color code in the image.
+ * @return The digit, or -1 if the color does not match any code color.
+ *
+ * Only the middle half of the digit is sampled, so that the blurred
+ * edges between two digits do not affect the result.
+ */
+static int vsource_detect_yuv_digit(unsigned char* planes[], int linesize[], int pixelformat, int index, int height)
+{
+	int x, y, x0, x1, y0, y1, xstep, ystep, n = 0;
+	int i, best = -1, dist, bestdist = COLORCODE_MATCH_DISTANCE + 1;
+	int sum[3] = {0, 0, 0}, c[3];
+	//
+	x0 = index * vsource_colorcode_width + (vsource_colorcode_width >> 2);
+	x1 = index * vsource_colorcode_width + ((3 * vsource_colorcode_width) >> 2);
+	y0 = height >> 2;
+	y1 = (3 * height) >> 2;
+	if(x1 <= x0)
+		x1 = x0 + 1;
+	if(y1 <= y0)
+		y1 = y0 + 1;
+	xstep = (x1 - x0) >> 3 ? (x1 - x0) >> 3 : 1;
+	ystep = (y1 - y0) >> 3 ? (y1 - y0) >> 3 : 1;
+	for(y = y0; y < y1; y += ystep)
+	{
+		unsigned char* srcY = planes[0] + y * linesize[0];
+		for(x = x0; x < x1; x += xstep)
+		{
+			sum[0] += srcY[x];
+			if(pixelformat == AV_PIX_FMT_NV12)
+			{
+				unsigned char* srcUV = planes[1] + (y >> 1) * linesize[1] + (x & ~1);
+				sum[1] += srcUV[0];
+				sum[2] += srcUV[1];
+			}
+			else
+			{
+				sum[1] += planes[1][(y >> 1) * linesize[1] + (x >> 1)];
+				sum[2] += planes[2][(y >> 1) * linesize[2] + (x >> 1)];
+			}
+			n++;
+		}
+	}
+	c[0] = sum[0] / n;
+	c[1] = sum[1] / n;
+	c[2] = sum[2] / n;
+	// the nearest code color
+	for(i = 0; i < 8; i++)
+	{
+		dist = (c[0] - yuv_colorY[i]) * (c[0] - yuv_colorY[i]) + (c[1] - yuv_colorU[i]) * (c[1] - yuv_colorU[i])
+				 + (c[2] - yuv_colorV[i]) * (c[2] - yuv_colorV[i]);
+		if(dist < bestdist)
+		{
+			best		= i;
+			bestdist = dist;
+		}
+	}
+	return best;
+}
+
+/**
+ * Detect the color code embedded in a decoded image.
+ *
+ * @param planes [in] The image planes.
+ * @param linesize [in] The line sizes of the image planes.
+ * @param width [in] The image width.
+ * @param height [in] The image height.
+ * @param pixelformat [in] The pixel format.
+ *	Only YUV420P, YUVJ420P, and NV12 images are supported.
+ * @param value [out] The sequence number part of the detected color code.
+ * @return 0 on success, or -1 if no valid color code is found.
+ *
+ * A color code is valid only if both its CRC and ID digits match.
+ */
+int vsource_detect_colorcode(
+  unsigned char* planes[], int linesize[], int width, int height, int pixelformat, unsigned int* value)
+{
+	unsigned char suffix[COLORCODE_SUFFIX];
+	unsigned int code = 0;
+	int i, digit;
+	//
+	if(vsource_colorcode_detecting == 0)
+		return -1;
+	if(planes == NULL || linesize == NULL || value == NULL)
+		return -1;
+	if(width < vsource_colorcode_total_width || height <= 0)
+		return -1;
+	if(pixelformat != AV_PIX_FMT_YUV420P && pixelformat != AV_PIX_FMT_YUVJ420P && pixelformat != AV_PIX_FMT_NV12)
+		return -1;
+	if(height > vsource_colorcode_height)
+		height = vsource_colorcode_height;
+	// value part
+	for(i = 0; i < vsource_colorcode_digits; i++)
+	{
+		if((digit = vsource_detect_yuv_digit(planes, linesize, pixelformat, i, height)) < 0)
+			return -1;
+		code = (code << 3) | digit;
+	}
+	// suffix part: crc + id
+	vsource_colorcode_suffix(code, suffix);
+	for(i = 0; i < COLORCODE_SUFFIX; i++)
+	{
+		if(vsource_detect_yuv_digit(planes, linesize, pixelformat, vsource_colorcode_digits + i, height) != suffix[i])
+			return -1;
+	}
+	*value = code;
+	return 0;
+}
+
 /**
  * Get the number of channels of the video source.
  *
@@ -708,12 +870,14 @@ int video_source_mem_size(int channel)
  * - The pipeline name is automatically generated based on the index of
  *   each video configuration.
  * - The corresponding video pipeline is created as well.
+ *   It is a lock-free pipe unless \em video-pipe-lockfree is set to false.
  */
 int video_source_setup_ex(vsource_config_t* config, int nConfig)
 {
 	int idx;
 	int maxres[2] = {0, 0};
 	int outres[2] = {0, 0};
+	int pipeflags;
 	//
 	if(config == NULL || nConfig <= 0 || nConfig > VIDEO_SOURCE_CHANNEL_MAX)
 	{
@@ -732,6 +896,8 @@ int video_source_setup_ex(vsource_config_t* config, int nConfig)
 	{
 		outres[0] = outres[1] = 0;
 	}
+	// video pipes have exactly one capture thread and one filter/encoder thread
+	pipeflags = ga_conf_readbool("video-pipe-lockfree", 1) ? DPIPE_FLAG_LOCKFREE : DPIPE_FLAG_NONE;
 	//
 	for(idx = 0; idx < nConfig; idx++)
 	{
@@ -766,8 +932,11 @@ int video_source_setup_ex(vsource_config_t* config, int nConfig)
 			vs->out_stride = vs->curr_stride;
 		}
 		// create pipe
-		gPipe[idx] = dpipe_create(
-		  idx, pipename, VIDEO_SOURCE_POOLSIZE, sizeof(vsource_frame_t) + vs->max_height * vs->max_stride + VSOURCE_ALIGNMENT);
+		gPipe[idx] = dpipe_create_ex(idx,
+											  pipename,
+											  VIDEO_SOURCE_POOLSIZE,
+											  sizeof(vsource_frame_t) + vs->max_height * vs->max_stride + VSOURCE_ALIGNMENT,
+											  pipeflags);
 		if(gPipe[idx] == NULL)
 		{
 			ga_error("video source: init pipeline failed.\n");
@@ -30,6 +30,8 @@
 //// Prevent use of GLOBAL_HEADER to pass parameters, disabled by default
 //#define STANDALONE_SDP	1
 
+#define VENCODER_TRACE_MAX 64 /**< Traced frames in the encoder, must exceed the encoder delay */
+
 static struct RTSPConf* rtspconf = NULL;
 
 static int vencoder_initialized = 0;
@@ -40,6 +42,8 @@ static AVCodecContext* vencoder[VIDEO_SOURCE_CHANNEL_MAX];
 // Mutex for reconfiguration settings
 static pthread_mutex_t vencoder_reconf_mutex[VIDEO_SOURCE_CHANNEL_MAX];
 static ga_ioctl_reconfigure_t vencoder_reconf[VIDEO_SOURCE_CHANNEL_MAX];
+// A client lost frames: send a keyframe, protected by the reconf mutex
+static int vencoder_recover[VIDEO_SOURCE_CHANNEL_MAX];
 #ifdef STANDALONE_SDP
 //// encoders for generating SDP
 /* separate encoder and encoder_sdp because some ffmpeg codecs
@@ -110,6 +114,7 @@ static int vencoder_init(void* arg)
 		_spslen[iid] = _ppslen[iid] = 0;
 		pthread_mutex_init(&vencoder_reconf_mutex[iid], NULL);
 		vencoder_reconf[iid].id = -1;
+		vencoder_recover[iid]	= 0;
 		snprintf(pipename, sizeof(pipename), pipefmt, iid);
 		outputW = video_source_out_width(iid);
 		outputH = video_source_out_height(iid);
@@ -236,6 +241,9 @@ static void* vencoder_threadproc(void* arg)
 	pthread_cond_t cond		  = PTHREAD_COND_INITIALIZER;
 	//
 	int video_written = 0;
+	// traces of the frames in the encoder, indexed by pts
+	ga_trace_t trace[VENCODER_TRACE_MAX];
+	ga_trace_t frametrace;
 	//
 	if(pipe == NULL)
 	{
@@ -334,7 +342,8 @@ static void* vencoder_threadproc(void* arg)
 			dpipe_put(pipe, data);
 			goto video_quit;
 		}
-		tv = frame->timestamp;
+		tv			  = frame->timestamp;
+		frametrace = frame->trace;
 		dpipe_put(pipe, data);
 		// pts must be monotonically increasing
 		if(newpts > pts)
@@ -348,6 +357,12 @@ static void* vencoder_threadproc(void* arg)
 		// encode
 		encoder_pts_put(iid, pts, &tv);
 		pic_in->pts = pts;
+		trace[pts % VENCODER_TRACE_MAX] = frametrace;
+		// libavcodec cannot invalidate references, recover with a keyframe
+		pthread_mutex_lock(&vencoder_reconf_mutex[iid]);
+		pic_in->pict_type		  = vencoder_recover[iid] ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+		vencoder_recover[iid] = 0;
+		pthread_mutex_unlock(&vencoder_reconf_mutex[iid]);
 		av_init_packet(&pkt);
 		pkt.data = nalbuf_a;
 		pkt.size = nalbuf_size;
@@ -389,6 +404,11 @@ static void* vencoder_threadproc(void* arg)
 			{
 				gettimeofday(&tv, NULL);
 			}
+			if(pkt.pts >= 0)
+			{
+				ga_trace_stamp(&trace[pkt.pts % VENCODER_TRACE_MAX], GA_TRACE_ENCODE);
+				encoder_set_trace(iid, &trace[pkt.pts % VENCODER_TRACE_MAX]);
+			}
 			// send the packet
 			if(encoder_send_packet("video-encoder", iid /*rtspconf->video_id*/, &pkt, pkt.pts, &tv) < 0)
 			{
@@ -638,6 +658,15 @@ static int vencoder_ioctl(int command, int argsize, void* arg)
 			bcopy(arg, &vencoder_reconf[((ga_ioctl_reconfigure_t*)arg)->id], sizeof(ga_ioctl_reconfigure_t));
 			pthread_mutex_unlock(&vencoder_reconf_mutex[((ga_ioctl_reconfigure_t*)arg)->id]);
 			return ret; // 0
+		case GA_IOCTL_INVALIDATE:
+			if(argsize != sizeof(ga_ioctl_invalidate_t))
+				return GA_IOCTL_ERR_INVALID_ARGUMENT;
+			if(((ga_ioctl_invalidate_t*)arg)->id < 0 || ((ga_ioctl_invalidate_t*)arg)->id >= video_source_channels())
+				return GA_IOCTL_ERR_BADID;
+			pthread_mutex_lock(&vencoder_reconf_mutex[((ga_ioctl_invalidate_t*)arg)->id]);
+			vencoder_recover[((ga_ioctl_invalidate_t*)arg)->id] = 1;
+			pthread_mutex_unlock(&vencoder_reconf_mutex[((ga_ioctl_invalidate_t*)arg)->id]);
+			return ret; // 0
 		case GA_IOCTL_GETSPS:
 		case GA_IOCTL_GETPPS:
 		case GA_IOCTL_GETVPS:
@@ -677,6 +706,13 @@ static int vencoder_ioctl(int command, int argsize, void* arg)
 				bcopy(_vps[buf->id], buf->ptr, buf->size);
 			}
 			break;
+		case GA_IOCTL_GETPIXFMTS:
+			if(argsize != sizeof(ga_ioctl_pixfmts_t))
+				return GA_IOCTL_ERR_INVALID_ARGUMENT;
+			// frames are copied into a YUV420P picture
+			((ga_ioctl_pixfmts_t*)arg)->count		 = 1;
+			((ga_ioctl_pixfmts_t*)arg)->pixfmts[0] = AV_PIX_FMT_YUV420P;
+			break;
 		default:
 			ret = GA_IOCTL_ERR_NOTSUPPORTED;
 			break;
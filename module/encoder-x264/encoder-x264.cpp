@@ -23,8 +23,10 @@
 #include "ga-conf.h"
 #include "ga-module.h"
 #include "rtspconf.h"
+#include "vconverter.h"
 #include "vsource.h"
 
+#include <atomic>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -36,6 +38,47 @@ extern "C"
 }
 #endif
 
+#define VENCODER_TRACE_MAX 64 /**< Traced frames in the encoder, must exceed the encoder delay */
+#define VENCODER_SLICE_MAX 256 /**< Slices of a frame waiting for the preceding ones */
+
+/**
+ * A frame in the encoder, passed to x264 as the opaque pointer of the picture.
+ */
+typedef struct vencoder_frame_s {
+	int iid;
+	int64_t pts;		/**< x264 pts of the frame */
+	ga_trace_t trace;
+} vencoder_frame_t;
+
+/**
+ * An encoded slice that cannot be sent before the preceding slices.
+ */
+typedef struct vencoder_slice_s {
+	int first_mb, last_mb;
+	unsigned char* data;
+	int size;
+} vencoder_slice_t;
+
+/**
+ * Per-channel state of slice streaming.
+ *
+ * x264 calls vencoder_nalu_process() for each NAL as soon as it is encoded,
+ * from the slice threads if sliced threads are enabled. The slices of a frame
+ * are sent in macroblock order, and all but the last one are marked partial.
+ */
+typedef struct vencoder_slicer_s {
+	pthread_mutex_t mutex;
+	unsigned char* buf;	/**< Encoded NALs of the frame */
+	int bufsize;
+	std::atomic<int> used;	/**< Bytes of \a buf used by the frame */
+	int mbs;		/**< Macroblocks per frame */
+	int nextmb;		/**< First macroblock of the next slice to send */
+	int sent;		/**< Packets sent for the frame */
+	int error;		/**< Sending failed */
+	int npending;
+	vencoder_slice_t pending[VENCODER_SLICE_MAX];
+} vencoder_slicer_t;
+
 static struct RTSPConf* rtspconf = NULL;
 
 static int vencoder_initialized = 0;
@@ -43,6 +86,10 @@ static int vencoder_started	  = 0;
 static pthread_t vencoder_tid[VIDEO_SOURCE_CHANNEL_MAX];
 static pthread_mutex_t vencoder_reconf_mutex[VIDEO_SOURCE_CHANNEL_MAX];
 static ga_ioctl_reconfigure_t vencoder_reconf[VIDEO_SOURCE_CHANNEL_MAX];
+static int vencoder_recover[VIDEO_SOURCE_CHANNEL_MAX];		  /**< A client lost frames, protected by the reconf mutex */
+static int64_t vencoder_lastgood[VIDEO_SOURCE_CHANNEL_MAX]; /**< pts of the last frame received intact, or -1 */
+static int vencoder_slicing = 0;
+static vencoder_slicer_t vencoder_slicer[VIDEO_SOURCE_CHANNEL_MAX];
 //// encoders for encoding
 static x264_t* vencoder[VIDEO_SOURCE_CHANNEL_MAX];
 
@@ -76,6 +123,7 @@ static int vencoder_deinit(void* arg)
 		if(vencoder[iid] != NULL)
 			x264_encoder_close(vencoder[iid]);
 		pthread_mutex_destroy(&vencoder_reconf_mutex[iid]);
+		pthread_mutex_destroy(&vencoder_slicer[iid].mutex);
 		vencoder[iid] = NULL;
 	}
 	bzero(_sps, sizeof(_sps));
@@ -96,6 +144,161 @@ ga_x264_param_parse_bit(x264_param_t* params, const char* name, const char* bitv
 	return x264_param_parse(params, name, kbit);
 }
 
+/**
+ * Send an encoded NAL of a frame in slice streaming mode.
+ * Called with the slicer's mutex held.
+ *
+ * @param partial [in] More NALs of the frame follow.
+ */
+static void vencoder_slice_send(vencoder_slicer_t* s, vencoder_frame_t* frame, unsigned char* data, int size, int partial)
+{
+	AVPacket pkt;
+	char* ptr;
+	int ret;
+	// the trace follows the first packet of the frame
+	if(s->sent++ == 0)
+	{
+		ga_trace_stamp(&frame->trace, GA_TRACE_ENCODE);
+		encoder_set_trace(frame->iid, &frame->trace);
+	}
+	if((ptr = encoder_reserve_packet(frame->iid, size)) != NULL)
+	{
+		bcopy(data, ptr, size);
+		ret = encoder_commit_packet("video-encoder", frame->iid, size, frame->pts, NULL);
+	}
+	else
+	{
+		av_init_packet(&pkt);
+		pkt.pts			  = frame->pts;
+		pkt.stream_index = 0;
+		pkt.size			  = size;
+		pkt.data			  = data;
+		if(partial)
+			pkt.flags |= ENCODER_PKT_FLAG_PARTIAL;
+		ret = encoder_send_packet("video-encoder", frame->iid, &pkt, pkt.pts, NULL);
+		// free unused side-data
+		if(pkt.side_data_elems > 0)
+		{
+			int i;
+			for(i = 0; i < pkt.side_data_elems; i++)
+				av_free(pkt.side_data[i].data);
+			av_freep(&pkt.side_data);
+			pkt.side_data_elems = 0;
+		}
+	}
+	if(ret < 0)
+		s->error = 1;
+#ifdef SAVEENC
+	if(fsaveenc != NULL)
+		fwrite(data, sizeof(char), size, fsaveenc);
+#endif
+}
+
+/**
+ * x264 per-NAL callback of slice streaming.
+ *
+ * SPS, PPS, and SEI are written by the encoding thread before the slices,
+ * and are sent at once. The slices may complete out of order with sliced
+ * threads, so a slice is held until all the preceding slices are sent.
+ */
+static void vencoder_nalu_process(x264_t* h, x264_nal_t* nal, void* opaque)
+{
+	vencoder_frame_t* frame = (vencoder_frame_t*)opaque;
+	vencoder_slicer_t* s		= &vencoder_slicer[frame->iid];
+	int size						= nal->i_payload * 3 / 2 + 5 + 64;
+	int offset					= s->used.fetch_add(size);
+	int i;
+	//
+	if(offset + size > s->bufsize)
+	{
+		ga_error("video encoder: nal dropped, slice buffer full (%d bytes).\n", s->bufsize);
+		return;
+	}
+	x264_nal_encode(h, s->buf + offset, nal);
+	//
+	pthread_mutex_lock(&s->mutex);
+	if(nal->i_type != NAL_SLICE && nal->i_type != NAL_SLICE_IDR)
+	{
+		vencoder_slice_send(s, frame, nal->p_payload, nal->i_payload, 1);
+	}
+	else if(nal->i_first_mb != s->nextmb)
+	{
+		if(s->npending < VENCODER_SLICE_MAX)
+		{
+			vencoder_slice_t* slice = &s->pending[s->npending++];
+			slice->first_mb			= nal->i_first_mb;
+			slice->last_mb				= nal->i_last_mb;
+			slice->data					= nal->p_payload;
+			slice->size					= nal->i_payload;
+		}
+		else
+		{
+			ga_error("video encoder: slice dropped, too many pending slices.\n");
+		}
+	}
+	else
+	{
+		vencoder_slice_send(s, frame, nal->p_payload, nal->i_payload, nal->i_last_mb < s->mbs - 1);
+		s->nextmb = nal->i_last_mb + 1;
+		// send the pending slices that follow
+		for(i = 0; i < s->npending; i++)
+		{
+			if(s->pending[i].first_mb != s->nextmb)
+				continue;
+			vencoder_slice_send(s, frame, s->pending[i].data, s->pending[i].size, s->pending[i].last_mb < s->mbs - 1);
+			s->nextmb	  = s->pending[i].last_mb + 1;
+			s->pending[i] = s->pending[--s->npending];
+			i				  = -1;
+		}
+	}
+	pthread_mutex_unlock(&s->mutex);
+}
+
+/**
+ * Prepare slice streaming for the next x264_encoder_encode call.
+ */
+static void vencoder_slice_begin(int iid)
+{
+	vencoder_slicer_t* s = &vencoder_slicer[iid];
+	s->used.store(0);
+	s->nextmb	= 0;
+	s->sent		= 0;
+	s->npending = 0;
+}
+
+/**
+ * Finish a frame in slice streaming mode.
+ *
+ * The slices still pending follow a dropped slice. They are sent in
+ * macroblock order, so that the decoder can conceal the missing part.
+ *
+ * @return 0 on success, or -1 if sending failed.
+ */
+static int vencoder_slice_end(vencoder_frame_t* frame)
+{
+	vencoder_slicer_t* s = &vencoder_slicer[frame->iid];
+	vencoder_slice_t tmp;
+	int i, j;
+	//
+	pthread_mutex_lock(&s->mutex);
+	for(i = 0; i < s->npending; i++)
+	{
+		for(j = i + 1; j < s->npending; j++)
+		{
+			if(s->pending[j].first_mb < s->pending[i].first_mb)
+			{
+				tmp			  = s->pending[i];
+				s->pending[i] = s->pending[j];
+				s->pending[j] = tmp;
+			}
+		}
+		vencoder_slice_send(s, frame, s->pending[i].data, s->pending[i].size, i < s->npending - 1);
+	}
+	s->npending = 0;
+	pthread_mutex_unlock(&s->mutex);
+	return s->error ? -1 : 0;
+}
+
 static int vencoder_init(void* arg)
 {
 	int iid;
@@ -112,6 +315,7 @@ static int vencoder_init(void* arg)
 	}
 	if(vencoder_initialized != 0)
 		return 0;
+	vencoder_slicing = ga_conf_readbool("encoder-slice-streaming", 0);
 	//
 	for(iid = 0; iid < video_source_channels(); iid++)
 	{
@@ -123,7 +327,9 @@ static int vencoder_init(void* arg)
 		_sps[iid] = _pps[iid] = NULL;
 		_spslen[iid] = _ppslen[iid] = 0;
 		pthread_mutex_init(&vencoder_reconf_mutex[iid], NULL);
+		pthread_mutex_init(&vencoder_slicer[iid].mutex, NULL);
 		vencoder_reconf[iid].id = -1;
+		vencoder_recover[iid]	= 0;
 		//
 		snprintf(pipename, sizeof(pipename), pipefmt, iid);
 		outputW = video_source_out_width(iid);
@@ -197,6 +403,8 @@ static int vencoder_init(void* arg)
 			x264_param_parse(&params, "threads", tmpbuf);
 		if(ga_conf_mapreadv("video-specific", "slices", tmpbuf, sizeof(tmpbuf)) != NULL)
 			x264_param_parse(&params, "slices", tmpbuf);
+		if(ga_conf_mapreadv("video-specific", "slice-max-size", tmpbuf, sizeof(tmpbuf)) != NULL)
+			x264_param_parse(&params, "slice-max-size", tmpbuf);
 		//
 		params.i_log_level = X264_LOG_INFO;
 		params.i_csp		 = X264_CSP_I420;
@@ -223,12 +431,21 @@ static int vencoder_init(void* arg)
 				name = strtok_r(NULL, ":", &saveptr);
 			}
 		}
+		// nalu_process does not work with frame threads, and the buffering
+		// period SEI of HRD is not available until the frame is finished
+		if(vencoder_slicing)
+		{
+			params.nalu_process = vencoder_nalu_process;
+			params.i_nal_hrd	  = X264_NAL_HRD_NONE;
+			if(params.i_threads != 1)
+				params.b_sliced_threads = 1;
+		}
 		//
 		vencoder[iid] = x264_encoder_open(&params);
 		if(vencoder[iid] == NULL)
 			goto init_failed;
 		ga_error("video encoder: opened! bitrate=%dKbps; me_method=%d; me_range=%d; refs=%d; g=%d; intra-refresh=%d; width=%d; "
-					"height=%d; crop=%d,%d,%d,%d; threads=%d; slices=%d; repeat-hdr=%d; annexb=%d\n",
+					"height=%d; crop=%d,%d,%d,%d; threads=%d; slices=%d; slice-max-size=%d; slice-streaming=%d; repeat-hdr=%d; annexb=%d\n",
 					params.rc.i_bitrate,
 					params.analyse.i_me_method,
 					params.analyse.i_me_range,
@@ -243,6 +460,8 @@ static int vencoder_init(void* arg)
 					params.crop_rect.i_bottom,
 					params.i_threads,
 					params.i_slice_count,
+					params.i_slice_max_size,
+					vencoder_slicing,
 					params.b_repeat_headers,
 					params.b_annexb);
 	}
@@ -324,6 +543,39 @@ static int vencoder_reconfigure(int iid)
 	return ret;
 }
 
+/**
+ * Recover from frames lost by a client before encoding the next frame.
+ *
+ * The encoder stops referencing the frames after the last one received
+ * intact. If that is not possible, e.g., with intra refresh or an unknown
+ * frame, a new intra refresh cycle or an IDR frame is started instead.
+ */
+static void vencoder_recover_loss(int iid, x264_picture_t* pic)
+{
+	x264_param_t params;
+	int64_t lastgood;
+	//
+	pthread_mutex_lock(&vencoder_reconf_mutex[iid]);
+	if(vencoder_recover[iid] == 0)
+	{
+		pthread_mutex_unlock(&vencoder_reconf_mutex[iid]);
+		return;
+	}
+	vencoder_recover[iid] = 0;
+	lastgood					 = vencoder_lastgood[iid];
+	pthread_mutex_unlock(&vencoder_reconf_mutex[iid]);
+	//
+	if(lastgood >= 0 && x264_encoder_invalidate_reference(vencoder[iid], lastgood + 1) == 0)
+		return;
+	x264_encoder_parameters(vencoder[iid], &params);
+	if(params.b_intra_refresh)
+	{
+		x264_encoder_intra_refresh(vencoder[iid]);
+		return;
+	}
+	pic->i_type = X264_TYPE_IDR;
+}
+
 static void* vencoder_threadproc(void* arg)
 {
 	// arg is pointer to source pipename
@@ -342,6 +594,12 @@ static void* vencoder_threadproc(void* arg)
 	int pktbufsize = 0, pktbufmax = 0;
 	int video_written = 0;
 	int64_t x264_pts	= 0;
+	// frames in the encoder, indexed by x264 pts
+	vencoder_frame_t frames[VENCODER_TRACE_MAX];
+	// conversion of RGBA/BGRA frames read directly from the video source
+	x264_picture_t pic_conv;
+	native_converter_t convert = NULL;
+	int convfmt = AV_PIX_FMT_NONE, convalloc = 0;
 	//
 	if(pipe == NULL)
 	{
@@ -362,6 +620,14 @@ static void* vencoder_threadproc(void* arg)
 		ga_error("video encoder: allocate memory failed.\n");
 		goto video_quit;
 	}
+	// slices are encoded into pktbuf
+	if(vencoder_slicing)
+	{
+		vencoder_slicer[iid].buf	  = pktbuf;
+		vencoder_slicer[iid].bufsize = pktbufmax;
+		vencoder_slicer[iid].mbs	  = ((outputW + 15) / 16) * ((outputH + 15) / 16);
+		vencoder_slicer[iid].error	  = 0;
+	}
 	// start encoding
 	ga_error("video encoding started: tid=%ld %dx%d@%dfps.\n", ga_gettid(), outputW, outputH, rtspconf->video_fps);
 	//
@@ -399,14 +665,69 @@ static void* vencoder_threadproc(void* arg)
 		//
 		x264_picture_init(&pic_in);
 		//
-		pic_in.img.i_csp		  = X264_CSP_I420;
-		pic_in.img.i_plane	  = 3;
-		pic_in.img.i_stride[0] = frame->linesize[0];
-		pic_in.img.i_stride[1] = frame->linesize[1];
-		pic_in.img.i_stride[2] = frame->linesize[2];
-		pic_in.img.plane[0]	  = frame->imgbuf;
-		pic_in.img.plane[1]	  = pic_in.img.plane[0] + outputW * outputH;
-		pic_in.img.plane[2]	  = pic_in.img.plane[1] + ((outputW * outputH) >> 2);
+		if(frame->pixelformat == AV_PIX_FMT_YUV420P)
+		{
+			pic_in.img.i_csp		  = X264_CSP_I420;
+			pic_in.img.i_plane	  = 3;
+			pic_in.img.i_stride[0] = frame->linesize[0];
+			pic_in.img.i_stride[1] = frame->linesize[1];
+			pic_in.img.i_stride[2] = frame->linesize[2];
+			pic_in.img.plane[0]	  = frame->imgbuf;
+			pic_in.img.plane[1]	  = pic_in.img.plane[0] + outputW * outputH;
+			pic_in.img.plane[2]	  = pic_in.img.plane[1] + ((outputW * outputH) >> 2);
+		}
+		else if(frame->pixelformat == AV_PIX_FMT_NV12)
+		{
+			pic_in.img.i_csp		  = X264_CSP_NV12;
+			pic_in.img.i_plane	  = 2;
+			pic_in.img.i_stride[0] = frame->linesize[0];
+			pic_in.img.i_stride[1] = frame->linesize[1];
+			pic_in.img.plane[0]	  = frame->imgbuf;
+			pic_in.img.plane[1]	  = pic_in.img.plane[0] + outputW * outputH;
+		}
+		else if((frame->pixelformat == AV_PIX_FMT_RGBA || frame->pixelformat == AV_PIX_FMT_BGRA)
+				  && frame->realwidth == outputW && frame->realheight == outputH)
+		{
+			// convert into NV12, the internal format of x264
+			if(convert == NULL || convfmt != frame->pixelformat)
+			{
+				convfmt = frame->pixelformat;
+				convert = lookup_native_converter(
+				  outputW, outputH, (AVPixelFormat)convfmt, outputW, outputH, AV_PIX_FMT_NV12);
+			}
+			if(convalloc == 0)
+			{
+				if(x264_picture_alloc(&pic_conv, X264_CSP_NV12, outputW, outputH) < 0)
+				{
+					ga_error("video encoder: allocate conversion picture failed.\n");
+					dpipe_put(pipe, data);
+					break;
+				}
+				convalloc = 1;
+			}
+			if(convert == NULL)
+			{
+				ga_error("video encoder: no converter for pixel format (%d)\n", frame->pixelformat);
+				dpipe_put(pipe, data);
+				break;
+			}
+			convert(frame->imgbuf,
+					  frame->realstride,
+					  outputW,
+					  outputH,
+					  pic_conv.img.plane,
+					  pic_conv.img.i_stride);
+			pic_in.img = pic_conv.img;
+		}
+		else
+		{
+			ga_error("video encoder: unsupported pixel format (%d) or size (%dx%d)\n",
+						frame->pixelformat,
+						frame->realwidth,
+						frame->realheight);
+			dpipe_put(pipe, data);
+			break;
+		}
 		// pts must be monotonically increasing
 		if(newpts > pts)
 		{
@@ -418,6 +739,13 @@ static void* vencoder_threadproc(void* arg)
 		}
 		// pic_in.i_pts = pts;
 		pic_in.i_pts = x264_pts++;
+		pic_in.opaque = &frames[pic_in.i_pts % VENCODER_TRACE_MAX];
+		frames[pic_in.i_pts % VENCODER_TRACE_MAX].iid	= iid;
+		frames[pic_in.i_pts % VENCODER_TRACE_MAX].pts	= pic_in.i_pts;
+		frames[pic_in.i_pts % VENCODER_TRACE_MAX].trace = frame->trace;
+		if(vencoder_slicing)
+			vencoder_slice_begin(iid);
+		vencoder_recover_loss(iid, &pic_in);
 		// encode
 		if((size = x264_encoder_encode(encoder, &nal, &nnal, &pic_in, &pic_out)) < 0)
 		{
@@ -426,51 +754,86 @@ static void* vencoder_threadproc(void* arg)
 			break;
 		}
 		dpipe_put(pipe, data);
+		// slices have been sent by vencoder_nalu_process
+		if(vencoder_slicing)
+		{
+			if(size > 0 && vencoder_slice_end((vencoder_frame_t*)pic_out.opaque) < 0)
+				goto video_quit;
+			if(size > 0 && video_written == 0)
+			{
+				video_written = 1;
+				ga_error("first video frame written in slices (pts=%lld)\n", pic_out.i_pts);
+			}
+			continue;
+		}
 		// encode
 		if(size > 0)
 		{
 			AVPacket pkt;
+			ga_trace_stamp(&frames[pic_out.i_pts % VENCODER_TRACE_MAX].trace, GA_TRACE_ENCODE);
+			encoder_set_trace(iid, &frames[pic_out.i_pts % VENCODER_TRACE_MAX].trace);
 #if 1
 			av_init_packet(&pkt);
 			pkt.pts			  = pic_in.i_pts;
 			pkt.stream_index = 0;
-			// concatenate nals
-			pktbufsize = 0;
-			for(i = 0; i < nnal; i++)
+			// concatenate nals straight into the sink's packet queue, if possible
+			if((pkt.data = (uint8_t*)encoder_reserve_packet(iid, size)) != NULL)
 			{
-				if(pktbufsize + nal[i].i_payload > pktbufmax)
+				for(i = 0, pktbufsize = 0; i < nnal; i++)
 				{
-					ga_error("video encoder: nal dropped (%d < %d).\n", i + 1, nnal);
-					break;
+					bcopy(nal[i].p_payload, pkt.data + pktbufsize, nal[i].i_payload);
+					pktbufsize += nal[i].i_payload;
+				}
+				pkt.size = pktbufsize;
+#ifdef SAVEENC
+				if(fsaveenc != NULL)
+					fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
+#endif
+				if(encoder_commit_packet("video-encoder", iid, pkt.size, pkt.pts, NULL) < 0)
+				{
+					goto video_quit;
 				}
-				bcopy(nal[i].p_payload, pktbuf + pktbufsize, nal[i].i_payload);
-				pktbufsize += nal[i].i_payload;
 			}
-			pkt.size = pktbufsize;
-			pkt.data = pktbuf;
-#if 0 // XXX: dump naltype
-			do {
-				int codelen;
-				unsigned char *ptr;
-				fprintf(stderr, "[XXX-naldump]");
-				for(	ptr = ga_find_startcode(pkt.data, pkt.data+pkt.size, &codelen);
-					ptr != NULL;
-					ptr = ga_find_startcode(ptr+codelen, pkt.data+pkt.size, &codelen)) {
-					//
-					fprintf(stderr, " (+%d|%d)-%02x", ptr-pkt.data, codelen, ptr[codelen] & 0x1f);
+			else
+			{
+				// concatenate nals
+				pktbufsize = 0;
+				for(i = 0; i < nnal; i++)
+				{
+					if(pktbufsize + nal[i].i_payload > pktbufmax)
+					{
+						ga_error("video encoder: nal dropped (%d < %d).\n", i + 1, nnal);
+						break;
+					}
+					bcopy(nal[i].p_payload, pktbuf + pktbufsize, nal[i].i_payload);
+					pktbufsize += nal[i].i_payload;
 				}
-				fprintf(stderr, "\n");
-			} while(0);
+				pkt.size = pktbufsize;
+				pkt.data = pktbuf;
+#if 0 // XXX: dump naltype
+				do {
+					int codelen;
+					unsigned char *ptr;
+					fprintf(stderr, "[XXX-naldump]");
+					for(	ptr = ga_find_startcode(pkt.data, pkt.data+pkt.size, &codelen);
+						ptr != NULL;
+						ptr = ga_find_startcode(ptr+codelen, pkt.data+pkt.size, &codelen)) {
+						//
+						fprintf(stderr, " (+%d|%d)-%02x", ptr-pkt.data, codelen, ptr[codelen] & 0x1f);
+					}
+					fprintf(stderr, "\n");
+				} while(0);
 #endif
-			// send the packet
-			if(encoder_send_packet("video-encoder", iid /*rtspconf->video_id*/, &pkt, pkt.pts, NULL) < 0)
-			{
-				goto video_quit;
-			}
+				// send the packet
+				if(encoder_send_packet("video-encoder", iid /*rtspconf->video_id*/, &pkt, pkt.pts, NULL) < 0)
+				{
+					goto video_quit;
+				}
 #ifdef SAVEENC
-			if(fsaveenc != NULL)
-				fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
+				if(fsaveenc != NULL)
+					fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
 #endif
+			}
 #else
 			// handling special nals (type > 5)
 			for(i = 0; i < nnal; i++)
@@ -555,6 +918,10 @@ video_quit:
 		free(pktbuf);
 	}
 	pktbuf = NULL;
+	if(convalloc != 0)
+	{
+		x264_picture_clean(&pic_conv);
+	}
 	//
 	ga_error("video encoder: thread terminated (tid=%ld).\n", ga_gettid());
 	//
@@ -629,6 +996,19 @@ static int x264_reconfigure(ga_ioctl_reconfigure_t* reconf)
 	return 0;
 }
 
+static int x264_invalidate(ga_ioctl_invalidate_t* inv)
+{
+	if(inv->id < 0 || inv->id >= video_source_channels())
+		return GA_IOCTL_ERR_BADID;
+	pthread_mutex_lock(&vencoder_reconf_mutex[inv->id]);
+	// the earliest frame wins if reports pile up
+	if(vencoder_recover[inv->id] == 0 || inv->pts < vencoder_lastgood[inv->id])
+		vencoder_lastgood[inv->id] = inv->pts;
+	vencoder_recover[inv->id] = 1;
+	pthread_mutex_unlock(&vencoder_reconf_mutex[inv->id]);
+	return 0;
+}
+
 static int x264_get_sps_pps(int iid)
 {
 	x264_nal_t* p_nal;
@@ -682,10 +1062,34 @@ static int x264_get_sps_pps(int iid)
 	return ret;
 }
 
+/*
+ * x264 takes YUV420P and NV12 directly. RGBA and BGRA frames of the
+ * output size are converted into NV12 by the built-in converter,
+ * so that the filter is not required for unscaled desktop frames.
+ */
+static int x264_get_pixfmts(ga_ioctl_pixfmts_t* fmts)
+{
+	fmts->count = 0;
+	fmts->pixfmts[fmts->count++] = AV_PIX_FMT_YUV420P;
+	fmts->pixfmts[fmts->count++] = AV_PIX_FMT_NV12;
+	if(lookup_native_converter(64, 64, AV_PIX_FMT_BGRA, 64, 64, AV_PIX_FMT_NV12) != NULL)
+		fmts->pixfmts[fmts->count++] = AV_PIX_FMT_BGRA;
+	if(lookup_native_converter(64, 64, AV_PIX_FMT_RGBA, 64, 64, AV_PIX_FMT_NV12) != NULL)
+		fmts->pixfmts[fmts->count++] = AV_PIX_FMT_RGBA;
+	return 0;
+}
+
 static int vencoder_ioctl(int command, int argsize, void* arg)
 {
 	int ret					  = 0;
 	ga_ioctl_buffer_t* buf = (ga_ioctl_buffer_t*)arg;
+	// formats are queried before the pipeline is set up
+	if(command == GA_IOCTL_GETPIXFMTS)
+	{
+		if(argsize != sizeof(ga_ioctl_pixfmts_t))
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		return x264_get_pixfmts((ga_ioctl_pixfmts_t*)arg);
+	}
 	//
 	if(vencoder_initialized == 0)
 		return GA_IOCTL_ERR_NOTINITIALIZED;
@@ -697,6 +1101,11 @@ static int vencoder_ioctl(int command, int argsize, void* arg)
 				return GA_IOCTL_ERR_INVALID_ARGUMENT;
 			x264_reconfigure((ga_ioctl_reconfigure_t*)arg);
 			break;
+		case GA_IOCTL_INVALIDATE:
+			if(argsize != sizeof(ga_ioctl_invalidate_t))
+				return GA_IOCTL_ERR_INVALID_ARGUMENT;
+			ret = x264_invalidate((ga_ioctl_invalidate_t*)arg);
+			break;
 		case GA_IOCTL_GETSPS:
 			if(argsize != sizeof(ga_ioctl_buffer_t))
 				return GA_IOCTL_ERR_INVALID_ARGUMENT;
@@ -33,14 +33,274 @@
 
 #define POOLSIZE					 8
 #define ENABLE_EMBED_COLORCODE 1
+#define MAX_FILTER_THREADS		 16 /**< Maximum number of bands per frame */
+#define MIN_FILTER_BAND_HEIGHT 16 /**< Do not split a frame into bands lower than this */
 
 using namespace std;
 
+struct filter_pool_s;
+
+/**
+ * A horizontal band of a frame, converted by one worker.
+ */
+typedef struct filter_band_s {
+	struct filter_pool_s* pool; /**< The pool this band belongs to */
+	pthread_t tid;					 /**< Worker thread, not used for band 0 */
+	int y, height;					 /**< First row and number of rows of this band */
+	struct SwsContext* swsctx;	 /**< Private converter: swscale contexts are not reentrant */
+	int swswidth;					 /**< Width \a swsctx is created for */
+	AVPixelFormat swsfmt;		 /**< Source pixel format \a swsctx is created for */
+} filter_band_t;
+
+/**
+ * Worker pool that converts a frame in parallel horizontal bands.
+ * Band 0 is converted by the filter thread itself.
+ */
+typedef struct filter_pool_s {
+	int nband;									  /**< Number of bands (threads) */
+	filter_band_t band[MAX_FILTER_THREADS]; /**< Bands */
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond;	  /**< Signaled when a new frame is ready */
+	pthread_cond_t done_cond;	  /**< Signaled when all the bands are done */
+	unsigned int generation;	  /**< Frame sequence, bumped for every frame */
+	int pending;					  /**< Number of bands that are not done */
+	int failed;						  /**< Number of bands that could not be converted */
+	int quit;						  /**< Set to stop the workers */
+	// current frame
+	int width;						  /**< Frame width, both source and destination */
+	AVPixelFormat srcfmt;		  /**< Source pixel format */
+	native_converter_t native;	  /**< Built-in converter, or NULL to use swscale */
+	unsigned char* src[4];
+	int srcstride[4];
+	unsigned char* dst[4];
+	int dststride[4];
+} filter_pool_t;
+
 static int filter_initialized = 0;
 static int filter_started		= 0;
 static pthread_t filter_tid[VIDEO_SOURCE_CHANNEL_MAX];
 static FILE* savefp = NULL;
 
+/**
+ * Convert one band of the current frame. Source and destination have the same size.
+ *
+ * @return 0 on success, or -1 if the band has no converter.
+ */
+static int filter_band_convert(filter_band_t* band)
+{
+	filter_pool_t* pool	= band->pool;
+	unsigned char* src[] = {NULL, NULL, NULL, NULL};
+	unsigned char* dst[] = {NULL, NULL, NULL, NULL};
+	int i;
+	//
+	if(pool->native != NULL)
+	{
+		// built-in converters are stateless and can run on several bands at the same time
+		for(i = 0; i < 3; i++)
+		{
+			dst[i] = pool->dst[i] + (i == 0 ? band->y : (band->y >> 1)) * pool->dststride[i];
+		}
+		pool->native(pool->src[0] + band->y * pool->srcstride[0], pool->srcstride[0], pool->width, band->height, dst, pool->dststride);
+		return 0;
+	}
+	if(band->swsctx == NULL || band->swswidth != pool->width || band->swsfmt != pool->srcfmt)
+	{
+		if(band->swsctx != NULL)
+			sws_freeContext(band->swsctx);
+		band->swsctx	= sws_getContext(pool->width,
+											band->height,
+											pool->srcfmt,
+											pool->width,
+											band->height,
+											AV_PIX_FMT_YUV420P,
+											SWS_BICUBIC,
+											NULL,
+											NULL,
+											NULL);
+		band->swswidth = pool->width;
+		band->swsfmt	= pool->srcfmt;
+		if(band->swsctx == NULL)
+		{
+			ga_error("RGB2YUV filter: cannot create converter for band at row %d.\n", band->y);
+			return -1;
+		}
+	}
+	// band rows are always even, so chroma rows are y/2
+	if(pool->srcfmt == AV_PIX_FMT_YUV420P)
+	{
+		src[0] = pool->src[0] + band->y * pool->srcstride[0];
+		src[1] = pool->src[1] + (band->y >> 1) * pool->srcstride[1];
+		src[2] = pool->src[2] + (band->y >> 1) * pool->srcstride[2];
+	}
+	else
+	{
+		src[0] = pool->src[0] + band->y * pool->srcstride[0];
+	}
+	for(i = 0; i < 3; i++)
+	{
+		dst[i] = pool->dst[i] + (i == 0 ? band->y : (band->y >> 1)) * pool->dststride[i];
+	}
+	sws_scale(band->swsctx, src, pool->srcstride, 0, band->height, dst, pool->dststride);
+	return 0;
+}
+
+/**
+ * Worker thread of a band pool.
+ */
+static void* filter_band_threadproc(void* arg)
+{
+	filter_band_t* band	= (filter_band_t*)arg;
+	filter_pool_t* pool	= band->pool;
+	unsigned int generation = 0;
+	int err;
+	//
+	while(true)
+	{
+		pthread_mutex_lock(&pool->mutex);
+		while(pool->generation == generation && pool->quit == 0)
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+		generation = pool->generation;
+		if(pool->quit != 0)
+		{
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+		//
+		err = filter_band_convert(band);
+		//
+		pthread_mutex_lock(&pool->mutex);
+		if(err < 0)
+			pool->failed++;
+		if(--pool->pending == 0)
+			pthread_cond_signal(&pool->done_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return NULL;
+}
+
+/**
+ * Stop the workers and release a band pool.
+ */
+static void filter_pool_destroy(filter_pool_t* pool)
+{
+	int i;
+	if(pool == NULL)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for(i = 1; i < pool->nband; i++)
+	{
+		pthread_join(pool->band[i].tid, NULL);
+	}
+	for(i = 0; i < pool->nband; i++)
+	{
+		if(pool->band[i].swsctx != NULL)
+			sws_freeContext(pool->band[i].swsctx);
+	}
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+/**
+ * Create a band pool for frames of the given height.
+ *
+ * @param nthreads [in] Requested number of threads, including the filter thread.
+ * @param height [in] Frame height.
+ * @return Pointer to the pool, or NULL if the frame is not split.
+ */
+static filter_pool_t* filter_pool_create(int nthreads, int height)
+{
+	filter_pool_t* pool;
+	int i, bandh;
+	//
+	if(nthreads > MAX_FILTER_THREADS)
+		nthreads = MAX_FILTER_THREADS;
+	if(nthreads > height / MIN_FILTER_BAND_HEIGHT)
+		nthreads = height / MIN_FILTER_BAND_HEIGHT;
+	if(nthreads <= 1)
+		return NULL;
+	if((pool = (filter_pool_t*)malloc(sizeof(filter_pool_t))) == NULL)
+		return NULL;
+	bzero(pool, sizeof(filter_pool_t));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	// even band heights, the last band takes the remaining rows
+	bandh = (height / nthreads) & ~1;
+	for(i = 0; i < nthreads; i++)
+	{
+		pool->band[i].pool	= pool;
+		pool->band[i].y		= i * bandh;
+		pool->band[i].height = (i == nthreads - 1) ? (height - i * bandh) : bandh;
+	}
+	pool->nband = nthreads;
+	for(i = 1; i < nthreads; i++)
+	{
+		if(pthread_create(&pool->band[i].tid, NULL, filter_band_threadproc, &pool->band[i]) != 0)
+		{
+			ga_error("RGB2YUV filter: create band thread failed, use %d threads.\n", i);
+			pool->nband = i;
+			break;
+		}
+	}
+	if(pool->nband <= 1)
+	{
+		filter_pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+
+/**
+ * Convert a frame with all the bands, and wait until all of them are done.
+ *
+ * @return 0 on success, or -1 if a band could not be converted.
+ */
+static int filter_pool_convert(filter_pool_t* pool,
+										  int width,
+										  AVPixelFormat srcfmt,
+										  native_converter_t native,
+										  unsigned char** src,
+										  int* srcstride,
+										  unsigned char** dst,
+										  int* dststride)
+{
+	int i, err;
+	//
+	pthread_mutex_lock(&pool->mutex);
+	pool->width	 = width;
+	pool->srcfmt = srcfmt;
+	pool->native = native;
+	for(i = 0; i < 4; i++)
+	{
+		pool->src[i]		 = src[i];
+		pool->srcstride[i] = srcstride[i];
+		pool->dst[i]		 = dst[i];
+		pool->dststride[i] = dststride[i];
+	}
+	pool->pending = pool->nband - 1;
+	pool->failed  = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	// band 0 is done in the calling thread
+	err = filter_band_convert(&pool->band[0]);
+	//
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->pending > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	if(pool->failed > 0)
+		err = -1;
+	pthread_mutex_unlock(&pool->mutex);
+	return err;
+}
+
 /* filter_RGB2YUV_init: arg is two pointers to pipeline format string */
 /*	1st ptr: source pipeline */
 /*	2nd ptr: destination pipeline */
@@ -121,7 +381,11 @@ static int filter_RGB2YUV_init(void* arg)
 			goto init_failed;
 		}
 		//
-		dstpipe[iid] = dpipe_create(iid, dstpipename, POOLSIZE, sizeof(vsource_frame_t) + video_source_mem_size(iid));
+		dstpipe[iid] = dpipe_create_ex(iid,
+												 dstpipename,
+												 POOLSIZE,
+												 sizeof(vsource_frame_t) + video_source_mem_size(iid),
+												 ga_conf_readbool("video-pipe-lockfree", 1) ? DPIPE_FLAG_LOCKFREE : DPIPE_FLAG_NONE);
 		if(dstpipe[iid] == NULL)
 		{
 			ga_error("RGB2YUV filter: create dst-pipeline failed (%s).\n", dstpipename);
@@ -190,8 +454,11 @@ static void* filter_RGB2YUV_threadproc(void* arg)
 	int dststride[]		= {0, 0, 0, 0};
 	int iid;
 	int outputW, outputH;
+	int nthreads, usepool;
 	//
 	struct SwsContext* swsctx = NULL;
+	native_converter_t native = NULL;
+	filter_pool_t* pool		  = NULL;
 	//
 	pthread_mutex_t condMutex = PTHREAD_MUTEX_INITIALIZER;
 	pthread_cond_t cond		  = PTHREAD_COND_INITIALIZER;
@@ -216,6 +483,15 @@ static void* filter_RGB2YUV_threadproc(void* arg)
 				dstpipe->name,
 				outputW /*iwidth*/,
 				outputH /*iheight*/);
+	// slice-parallel conversion: only when the frame is not scaled
+	if((nthreads = ga_conf_readint("filter-threads")) > 1)
+	{
+		if(video_source_curr_width(iid) == outputW && video_source_curr_height(iid) == outputH)
+		{
+			pool = filter_pool_create(nthreads, outputH);
+		}
+		ga_error("RGB2YUV filter: pipe#%d converts with %d thread(s).\n", iid, pool ? pool->nband : 1);
+	}
 	// start filtering
 	while(filter_started != 0)
 	{
@@ -233,24 +509,41 @@ static void* filter_RGB2YUV_threadproc(void* arg)
 		}
 		srcframe = (vsource_frame_t*)srcdata->pointer;
 		//
-		dstdata	= dpipe_get(dstpipe);
+		// the encoders hold all the frames: skip this one
+		if((dstdata = dpipe_get(dstpipe)) == NULL)
+		{
+			dpipe_put(srcpipe, srcdata);
+			continue;
+		}
 		dstframe = (vsource_frame_t*)dstdata->pointer;
 		// basic info
 		dstframe->imgpts		 = srcframe->imgpts;
 		dstframe->timestamp	 = srcframe->timestamp;
+		dstframe->trace		 = srcframe->trace;
+		// dirty rectangles are kept only if the frame is not scaled
+		dstframe->ndirty		 = 0;
+		if(srcframe->realwidth == outputW && srcframe->realheight == outputH)
+		{
+			dstframe->ndirty = srcframe->ndirty;
+			bcopy(srcframe->dirty, dstframe->dirty, sizeof(srcframe->dirty));
+		}
 		dstframe->pixelformat = AV_PIX_FMT_YUV420P; // yuv420p;
 		dstframe->realwidth	 = outputW;
 		dstframe->realheight	 = outputH;
 		dstframe->realstride	 = outputW;
 		dstframe->realsize	 = outputW * outputH * 3 / 2;
+		// convert without scaling with the built-in converters, otherwise use swscale
+		native = lookup_native_converter(srcframe->realwidth,
+													srcframe->realheight,
+													srcframe->pixelformat,
+													dstframe->realwidth,
+													dstframe->realheight,
+													dstframe->pixelformat);
+		// the bands have their own converters
+		usepool = pool != NULL && srcframe->realwidth == outputW && srcframe->realheight == outputH;
 		// scale image: RGBA, BGRA, or YUV
-		swsctx = lookup_frame_converter(srcframe->realwidth,
-												  srcframe->realheight,
-												  srcframe->pixelformat,
-												  dstframe->realwidth,
-												  dstframe->realheight,
-												  dstframe->pixelformat);
-		if(swsctx == NULL)
+		swsctx = NULL;
+		if(native == NULL && usepool == 0)
 		{
 			swsctx = create_frame_converter(srcframe->realwidth,
 													  srcframe->realheight,
@@ -259,7 +552,7 @@ static void* filter_RGB2YUV_threadproc(void* arg)
 													  dstframe->realheight,
 													  dstframe->pixelformat);
 		}
-		if(swsctx == NULL)
+		if(swsctx == NULL && native == NULL && usepool == 0)
 		{
 			ga_error("RGB2YUV filter: fatal - cannot create frame converter (%d,%d,%d)->(%x,%d,%d)\n",
 						srcframe->realwidth,
@@ -268,6 +561,9 @@ static void* filter_RGB2YUV_threadproc(void* arg)
 						dstframe->realwidth,
 						dstframe->realheight,
 						dstframe->pixelformat);
+			dpipe_put(srcpipe, srcdata);
+			dpipe_put(dstpipe, dstdata);
+			continue;
 		}
 		//
 		if(srcframe->pixelformat == AV_PIX_FMT_RGBA || srcframe->pixelformat == AV_PIX_FMT_BGRA /*rgba*/)
@@ -303,7 +599,25 @@ static void* filter_RGB2YUV_threadproc(void* arg)
 		dstframe->linesize[2] = dststride[2] = outputW >> 1;
 		dstframe->linesize[3] = dststride[3] = 0;
 		//
-		sws_scale(swsctx, src, srcstride, 0, srcframe->realheight, dst, dstframe->linesize);
+		if(usepool)
+		{
+			// do not store a frame with stale bands
+			if(filter_pool_convert(pool, outputW, srcframe->pixelformat, native, src, srcstride, dst, dststride) < 0)
+			{
+				ga_error("RGB2YUV filter: pipe#%d frame dropped.\n", iid);
+				dpipe_put(srcpipe, srcdata);
+				dpipe_put(dstpipe, dstdata);
+				continue;
+			}
+		}
+		else if(native != NULL)
+		{
+			native(src[0], srcstride[0], outputW, outputH, dst, dststride);
+		}
+		else
+		{
+			sws_scale(swsctx, src, srcstride, 0, srcframe->realheight, dst, dstframe->linesize);
+		}
 		// embed first, and then save
 #ifdef ENABLE_EMBED_COLORCODE
 		vsource_embed_colorcode_inc(dstframe);
@@ -315,6 +629,7 @@ static void* filter_RGB2YUV_threadproc(void* arg)
 		}
 		//
 		dpipe_put(srcpipe, srcdata);
+		ga_trace_stamp(&dstframe->trace, GA_TRACE_FILTER);
 		dpipe_store(dstpipe, dstdata);
 		//
 	}
@@ -332,6 +647,8 @@ filter_quit:
 	//
 	if(swsctx)
 		sws_freeContext(swsctx);
+	if(pool)
+		filter_pool_destroy(pool);
 	//
 	ga_error("RGB2YUV filter: thread terminated.\n");
 	//
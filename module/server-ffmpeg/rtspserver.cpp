@@ -26,12 +26,23 @@
 #include <time.h>
 #ifndef WIN32
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include <atomic>
 #endif /* ifndef WIN32 */
 
 #include "asource.h"
@@ -45,6 +56,27 @@
 
 #define RTSP_STREAM_FORMAT			 "streamid=%d"
 #define RTSP_STREAM_FORMAT_MAXLEN 64
+#define RTSP_WRITE_BATCH			 64 /**< Max interleaved RTP packets per sendmsg() */
+#define RTSP_WBUF_MAX				 65536 /**< Max pending output of a non-blocking connection */
+#define RTSP_WRITE_TIMEOUT			 1000 /**< Max wait for a non-blocking connection to be writable, in milliseconds */
+
+#ifdef __linux__
+#define RTSP_REACTOR
+#define RTSP_REACTOR_MAX	  16 /**< Max reactor threads */
+#define RTSP_REACTOR_DEFAULT 2	/**< Default reactor threads */
+#define RTSP_REACTOR_EVENTS  64 /**< Max events handled per epoll_wait() */
+#define RTP_SENDMMSG
+#define RTP_WRITE_BATCH	  64	 /**< Max UDP messages per sendmmsg() */
+#define RTP_WRITE_IOV	  1024 /**< Max RTP packets per sendmmsg() */
+#define RTP_GSO_MAX_SEGS  64	 /**< Max RTP packets per GSO message, the kernel's UDP_MAX_SEGMENTS */
+#define RTP_GSO_MAX_BYTES 65000 /**< Max payload bytes per GSO message */
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 /* kernel >= 4.18, may be missing in old headers */
+#endif
+#endif
 
 static struct RTSPConf* rtspconf = NULL;
 
@@ -63,7 +95,163 @@ void rtsp_cleanup(RTSPContext* rtsp, int retcode)
 	return;
 }
 
-static int rtsp_write(RTSPContext* ctx, const void* buf, size_t count) { return write(ctx->fd, buf, count); }
+/**
+ * Connection setup and teardown latency statistics.
+ */
+static pthread_mutex_t rtsp_stat_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	unsigned int count;
+	long long sum, max; /**< In microseconds */
+} rtsp_stat[2];			/**< 0: setup, from accept() to the PLAY reply; 1: teardown */
+static int rtsp_sessions = 0; /**< Sessions active */
+
+static void rtsp_stat_record(int which, const char* name, long long us)
+{
+	unsigned int count;
+	long long sum, max;
+	int active;
+	//
+	pthread_mutex_lock(&rtsp_stat_mutex);
+	rtsp_stat[which].count++;
+	rtsp_stat[which].sum += us;
+	if(us > rtsp_stat[which].max)
+		rtsp_stat[which].max = us;
+	count	 = rtsp_stat[which].count;
+	sum	 = rtsp_stat[which].sum;
+	max	 = rtsp_stat[which].max;
+	active = rtsp_sessions;
+	pthread_mutex_unlock(&rtsp_stat_mutex);
+	ga_error("RTSP: %s took %.3f ms (avg %.3f ms, max %.3f ms over %u sessions), %d session(s) active\n",
+				name,
+				us / 1000.0,
+				sum / 1000.0 / count,
+				max / 1000.0,
+				count,
+				active);
+	return;
+}
+
+static void rtsp_stat_setup(RTSPContext* ctx)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	rtsp_stat_record(0, "setup", tvdiff_us(&tv, &ctx->acceptTime));
+}
+
+static void rtsp_stat_teardown(struct timeval* start)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	rtsp_stat_record(1, "teardown", tvdiff_us(&tv, start));
+}
+
+#ifndef WIN32
+/**
+ * Wait until a non-blocking connection can be written.
+ *
+ * @return 0 if it is writable, or -1 on error or timeout.
+ */
+static int rtsp_wait_writable(RTSPContext* ctx)
+{
+	struct pollfd pfd;
+	int n;
+	//
+	pfd.fd		= ctx->fd;
+	pfd.events	= POLLOUT;
+	pfd.revents = 0;
+	while((n = poll(&pfd, 1, RTSP_WRITE_TIMEOUT)) < 0)
+	{
+		if(errno != EINTR)
+			return -1;
+	}
+	return n > 0 && (pfd.revents & POLLOUT) != 0 ? 0 : -1;
+}
+
+/**
+ * Send the pending output of a non-blocking connection, without waiting.
+ * The caller must hold rtsp_writer_mutex.
+ *
+ * @return The number of bytes left pending, or -1 on error.
+ */
+static int rtsp_wbuf_flush(RTSPContext* ctx)
+{
+	ssize_t wlen;
+	int left;
+	//
+	pthread_mutex_lock(&ctx->wbuf_mutex);
+	while(ctx->wbuflen > 0)
+	{
+		if((wlen = send(ctx->fd, ctx->wbuffer, ctx->wbuflen, MSG_NOSIGNAL)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			pthread_mutex_unlock(&ctx->wbuf_mutex);
+			return -1;
+		}
+		bcopy(ctx->wbuffer + wlen, ctx->wbuffer, ctx->wbuflen - wlen);
+		ctx->wbuflen -= wlen;
+	}
+	left = ctx->wbuflen;
+	pthread_mutex_unlock(&ctx->wbuf_mutex);
+	return left;
+}
+
+/**
+ * Queue the output of a non-blocking connection, and send it at once
+ * unless a sender thread is writing. The sender, or the reactor once the
+ * connection is writable, sends it otherwise.
+ *
+ * A client that does not read its replies is disconnected when more than
+ * RTSP_WBUF_MAX bytes are pending.
+ */
+static int rtsp_wbuf_write(RTSPContext* ctx, const void* buf, size_t count)
+{
+	char* wbuffer;
+	int wbufsize;
+	//
+	pthread_mutex_lock(&ctx->wbuf_mutex);
+	if(ctx->wbuflen + count > RTSP_WBUF_MAX)
+	{
+		pthread_mutex_unlock(&ctx->wbuf_mutex);
+		ga_error("RTSP: too much pending output, client disconnected.\n");
+		shutdown(ctx->fd, SHUT_RDWR);
+		return -1;
+	}
+	if(ctx->wbuflen + count > (size_t)ctx->wbufsize)
+	{
+		for(wbufsize = ctx->wbufsize > 0 ? ctx->wbufsize : 8192; (size_t)wbufsize < ctx->wbuflen + count; wbufsize <<= 1)
+			;
+		if((wbuffer = (char*)realloc(ctx->wbuffer, wbufsize)) == NULL)
+		{
+			pthread_mutex_unlock(&ctx->wbuf_mutex);
+			return -1;
+		}
+		ctx->wbuffer	= wbuffer;
+		ctx->wbufsize = wbufsize;
+	}
+	bcopy(buf, ctx->wbuffer + ctx->wbuflen, count);
+	ctx->wbuflen += count;
+	pthread_mutex_unlock(&ctx->wbuf_mutex);
+	//
+	if(pthread_mutex_trylock(&ctx->rtsp_writer_mutex) == 0)
+	{
+		rtsp_wbuf_flush(ctx);
+		pthread_mutex_unlock(&ctx->rtsp_writer_mutex);
+	}
+	return count;
+}
+#endif
+
+static int rtsp_write(RTSPContext* ctx, const void* buf, size_t count)
+{
+#ifndef WIN32
+	if(ctx->nonblock)
+		return rtsp_wbuf_write(ctx, buf, count);
+#endif
+	return write(ctx->fd, buf, count);
+}
 
 static int rtsp_printf(RTSPContext* ctx, const char* fmt, ...)
 {
@@ -77,10 +265,98 @@ static int rtsp_printf(RTSPContext* ctx, const char* fmt, ...)
 	return rtsp_write(ctx, buf, buflen);
 }
 
+#ifndef WIN32
+/**
+ * Write all the data described by an iovec array, resuming partial writes.
+ *
+ * @return 0 on success, or -1 on error.
+ */
+static int rtsp_writev_all(RTSPContext* ctx, struct iovec* iov, int iovcnt)
+{
+	struct msghdr msg;
+	ssize_t wlen;
+	//
+	while(iovcnt > 0)
+	{
+		bzero(&msg, sizeof(msg));
+		msg.msg_iov		= iov;
+		msg.msg_iovlen = iovcnt;
+		if((wlen = sendmsg(ctx->fd, &msg, MSG_NOSIGNAL)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if((errno == EAGAIN || errno == EWOULDBLOCK) && rtsp_wait_writable(ctx) == 0)
+				continue;
+			return -1;
+		}
+		// skip the written parts
+		while(iovcnt > 0 && (size_t)wlen >= iov->iov_len)
+		{
+			wlen -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + wlen;
+			iov->iov_len -= wlen;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Send all the pending output of a non-blocking connection, waiting
+ * for the connection to be writable if necessary.
+ * The caller must hold rtsp_writer_mutex.
+ *
+ * @return 0 on success, or -1 on error or timeout.
+ */
+static int rtsp_wbuf_drain(RTSPContext* ctx)
+{
+	int left;
+	//
+	while((left = rtsp_wbuf_flush(ctx)) > 0)
+	{
+		if(rtsp_wait_writable(ctx) < 0)
+			return -1;
+	}
+	return left;
+}
+
+/**
+ * Write a batch of interleaved packets at once, so that the packets of
+ * other streams are not inserted in between.
+ *
+ * The pending RTSP replies of a non-blocking connection are sent first,
+ * and those queued meanwhile are sent after the batch.
+ */
+static int rtsp_write_batch(RTSPContext* ctx, struct iovec* iov, int npkt)
+{
+	int err;
+	pthread_mutex_lock(&ctx->rtsp_writer_mutex);
+	if(ctx->nonblock && rtsp_wbuf_drain(ctx) < 0)
+		err = -1;
+	else
+		err = rtsp_writev_all(ctx, iov, npkt * 2);
+	if(err == 0 && ctx->nonblock)
+		rtsp_wbuf_flush(ctx);
+	pthread_mutex_unlock(&ctx->rtsp_writer_mutex);
+	return err;
+}
+#endif
+
 int rtsp_write_bindata(RTSPContext* ctx, int streamid, uint8_t* buf, int buflen)
 {
 	int i, pktlen;
+#ifdef WIN32
 	char header[4];
+#else
+	// interleaved headers and payloads are sent in batches, without copying the payloads
+	char header[RTSP_WRITE_BATCH][4];
+	struct iovec iov[RTSP_WRITE_BATCH * 2];
+	int npkt = 0, committed = 0;
+#endif
 	//
 	if(buflen < 4)
 	{
@@ -101,6 +377,7 @@ int rtsp_write_bindata(RTSPContext* ctx, int streamid, uint8_t* buf, int buflen)
 			i += 4;
 			continue;
 		}
+#ifdef WIN32
 		//
 		header[0] = '$';
 		header[1] = (streamid << 1) & 0x0ff;
@@ -114,16 +391,185 @@ int rtsp_write_bindata(RTSPContext* ctx, int streamid, uint8_t* buf, int buflen)
 		}
 		if(rtsp_write(ctx, &buf[i + 4], pktlen) != pktlen)
 		{
+			pthread_mutex_unlock(&ctx->rtsp_writer_mutex);
 			return i;
 		}
 		pthread_mutex_unlock(&ctx->rtsp_writer_mutex);
+#else
+		header[npkt][0]				 = '$';
+		header[npkt][1]				 = (streamid << 1) & 0x0ff;
+		header[npkt][2]				 = pktlen >> 8;
+		header[npkt][3]				 = pktlen & 0x0ff;
+		iov[npkt * 2].iov_base		 = header[npkt];
+		iov[npkt * 2].iov_len		 = 4;
+		iov[npkt * 2 + 1].iov_base = &buf[i + 4];
+		iov[npkt * 2 + 1].iov_len	 = pktlen;
+		npkt++;
+#endif
 		//
 		i += (4 + pktlen);
+#ifndef WIN32
+		if(npkt == RTSP_WRITE_BATCH)
+		{
+			if(rtsp_write_batch(ctx, iov, npkt) < 0)
+				return committed;
+			committed = i;
+			npkt		 = 0;
+		}
+#endif
 	}
+#ifndef WIN32
+	// the last entries may be empty packets, which are not queued
+	if(npkt > 0 && rtsp_write_batch(ctx, iov, npkt) < 0)
+		return committed;
+#endif
 	return i;
 }
 
 #ifdef HOLE_PUNCHING
+#ifdef RTP_SENDMMSG
+static std::atomic<int> rtp_batch(-1); /**< -1 = not decided yet, 0 = sendto(), 1 = sendmmsg(), 2 = sendmmsg() with UDP GSO */
+
+/**
+ * Decide how RTP packets are sent. This is an internal function.
+ *
+ * Packets are sent with sendmmsg() unless \em rtp-send-batch is disabled.
+ * Runs of equal-sized packets are further merged into UDP GSO messages
+ * if the kernel accepts the UDP_SEGMENT option and \em rtp-gso is not disabled.
+ * Clients opening their ports at the same time may all probe, but only
+ * the first decision is kept.
+ */
+static void rtp_batch_init(int s)
+{
+	int segsize = 0, batch, undecided = -1;
+	if(rtp_batch.load() >= 0)
+		return;
+	if(ga_conf_readbool("rtp-send-batch", 1) == 0)
+	{
+		batch = 0;
+	}
+	else if(ga_conf_readbool("rtp-gso", 1) != 0
+			  && setsockopt(s, SOL_UDP, UDP_SEGMENT, &segsize, sizeof(segsize)) == 0)
+	{
+		batch = 2;
+	}
+	else
+	{
+		batch = 1;
+	}
+	if(rtp_batch.compare_exchange_strong(undecided, batch) == false)
+		return;
+	ga_error("RTP: send packets with %s\n",
+				batch == 0 ? "sendto()" : (batch == 1 ? "sendmmsg()" : "sendmmsg() and UDP GSO"));
+	return;
+}
+
+/**
+ * Send the RTP packets of a buffer in batches. This is an internal function.
+ *
+ * @param s [in] The RTP socket.
+ * @param sin [in] The peer address.
+ * @param buf [in] The buffer from avio_open_dyn_buf.
+ * @param buflen [in] Length of \a buf.
+ * @return The number of bytes consumed.
+ *
+ * Each sendmmsg() call carries up to RTP_WRITE_BATCH messages. With GSO,
+ * a message carries a run of equal-sized packets, optionally ended by
+ * a shorter one, and the kernel splits it back into datagrams.
+ * If a GSO message is rejected, GSO is disabled and the rest is resent
+ * without it. Other errors drop the message, as sendto() would.
+ */
+static int rtp_sendmmsg(int s, struct sockaddr_in* sin, uint8_t* buf, int buflen)
+{
+	struct mmsghdr msg[RTP_WRITE_BATCH];
+	struct iovec iov[RTP_WRITE_IOV];
+	union {
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		struct cmsghdr align;
+	} ctrl[RTP_WRITE_BATCH];
+	int end[RTP_WRITE_BATCH]; /* buffer offset right after each message */
+	int i = 0, begin, pktlen, seglen, bytes, nmsg, niov, k, sent, gso;
+	struct msghdr* hdr;
+	struct cmsghdr* cm;
+	//
+	while(i < buflen)
+	{
+		begin = i;
+		nmsg = niov = 0;
+		gso			= rtp_batch.load() > 1;
+		while(i < buflen && nmsg < RTP_WRITE_BATCH && niov < RTP_WRITE_IOV)
+		{
+			pktlen = (buf[i] << 24) | (buf[i + 1] << 16) | (buf[i + 2] << 8) | buf[i + 3];
+			if(pktlen == 0)
+			{
+				i += 4;
+				continue;
+			}
+			hdr = &msg[nmsg].msg_hdr;
+			bzero(hdr, sizeof(struct msghdr));
+			hdr->msg_name		= sin;
+			hdr->msg_namelen	= sizeof(struct sockaddr_in);
+			hdr->msg_iov		= &iov[niov];
+			hdr->msg_iovlen	= 1;
+			iov[niov].iov_base = &buf[i + 4];
+			iov[niov].iov_len	 = pktlen;
+			niov++;
+			i += (4 + pktlen);
+			// merge the following packets into a GSO message
+			seglen = bytes = pktlen;
+			while(gso && i < buflen && niov < RTP_WRITE_IOV && hdr->msg_iovlen < RTP_GSO_MAX_SEGS)
+			{
+				pktlen = (buf[i] << 24) | (buf[i + 1] << 16) | (buf[i + 2] << 8) | buf[i + 3];
+				if(pktlen == 0 || pktlen > seglen || bytes + pktlen > RTP_GSO_MAX_BYTES)
+					break;
+				iov[niov].iov_base = &buf[i + 4];
+				iov[niov].iov_len	 = pktlen;
+				niov++;
+				hdr->msg_iovlen++;
+				bytes += pktlen;
+				i += (4 + pktlen);
+				// only the last segment can be shorter
+				if(pktlen < seglen)
+					break;
+			}
+			if(hdr->msg_iovlen > 1)
+			{
+				hdr->msg_control	  = ctrl[nmsg].buf;
+				hdr->msg_controllen = sizeof(ctrl[nmsg].buf);
+				cm						  = CMSG_FIRSTHDR(hdr);
+				cm->cmsg_level		  = SOL_UDP;
+				cm->cmsg_type		  = UDP_SEGMENT;
+				cm->cmsg_len		  = CMSG_LEN(sizeof(uint16_t));
+				*(uint16_t*)CMSG_DATA(cm) = seglen;
+			}
+			end[nmsg++] = i;
+		}
+		for(k = 0; k < nmsg; k += sent)
+		{
+			if((sent = sendmmsg(s, &msg[k], nmsg - k, 0)) > 0)
+				continue;
+			if(sent < 0 && errno == EINTR)
+			{
+				sent = 0;
+				continue;
+			}
+			if(sent < 0 && msg[k].msg_hdr.msg_controllen != 0
+				&& (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP))
+			{
+				// e.g., no checksum offload on the outgoing device
+				ga_error("RTP: UDP GSO failed (%s), fall back to sendmmsg()\n", strerror(errno));
+				rtp_batch.store(1);
+				i			 = (k == 0 ? begin : end[k - 1]);
+				break;
+			}
+			// drop the message
+			sent = 1;
+		}
+	}
+	return i;
+}
+#endif
+
 static int rtp_open_internal(unsigned short* port)
 {
 #ifdef WIN32
@@ -176,6 +622,9 @@ int rtp_open_ports(RTSPContext* ctx, int streamid)
 		close(ctx->rtpSocket[streamid]);
 		return -1;
 	}
+#ifdef RTP_SENDMMSG
+	rtp_batch_init(ctx->rtpSocket[streamid]);
+#endif
 	ga_error("RTP: port opened for stream %d, min=%d (fd=%d), max=%d (fd=%d)\n",
 				streamid / 2,
 				(unsigned int)ctx->rtpLocalPort[streamid],
@@ -209,6 +658,10 @@ int rtp_write_bindata(RTSPContext* ctx, int streamid, uint8_t* buf, int buflen)
 		return buflen;
 	bcopy(&ctx->client, &sin, sizeof(sin));
 	sin.sin_port = ctx->rtpPeerPort[streamid * 2];
+#ifdef RTP_SENDMMSG
+	if(rtp_batch.load() > 0)
+		return rtp_sendmmsg(ctx->rtpSocket[streamid * 2], &sin, buf, buflen);
+#endif
 	// XXX: buffer is the reuslt from avio_open_dyn_buf.
 	// Multiple RTP packets can be placed in a single buffer.
 	// Format == 4-bytes (big-endian) packet size + packet-data
@@ -243,6 +696,9 @@ static int rtsp_read_internal(RTSPContext* ctx)
 	int rlen;
 	if((rlen = read(ctx->fd, ctx->rbuffer + ctx->rbuftail, ctx->rbufsize - ctx->rbuftail)) <= 0)
 	{
+		// spurious wake-up of a non-blocking connection
+		if(rlen < 0 && ctx->nonblock && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return ctx->rbuftail - ctx->rbufhead;
 		return -1;
 	}
 	ctx->rbuftail += rlen;
@@ -326,20 +782,56 @@ readmore:
 	return -1;
 }
 
-static int rtsp_getnext(RTSPContext* ctx, char* buf, size_t count)
+static int rtsp_buffer_init(RTSPContext* ctx)
 {
-	// initialize if necessary
-	if(ctx->rbuffer == NULL)
+	if(ctx->rbuffer != NULL)
+		return 0;
+	ctx->rbufsize = 65536;
+	if((ctx->rbuffer = (char*)malloc(ctx->rbufsize)) == NULL)
 	{
-		ctx->rbufsize = 65536;
-		if((ctx->rbuffer = (char*)malloc(ctx->rbufsize)) == NULL)
-		{
-			ctx->rbufsize = 0;
-			return -1;
-		}
-		ctx->rbufhead = 0;
-		ctx->rbuftail = 0;
+		ctx->rbufsize = 0;
+		return -1;
+	}
+	ctx->rbufhead = 0;
+	ctx->rbuftail = 0;
+	return 0;
+}
+
+/**
+ * Check if a complete message is buffered: an interleaved packet, or
+ * a request line with its headers, ended by an empty line.
+ *
+ * @return 1 if a message can be handled without reading, or 0 otherwise.
+ */
+static int rtsp_message_ready(RTSPContext* ctx)
+{
+	int i, line;
+	//
+	if(ctx->rbuffer == NULL || ctx->rbufhead == ctx->rbuftail)
+		return 0;
+	if(ctx->rbuffer[ctx->rbufhead] == '$')
+	{
+		if(ctx->rbuftail - ctx->rbufhead < 4)
+			return 0;
+		i = ((unsigned char)ctx->rbuffer[ctx->rbufhead + 2] << 8) | (unsigned char)ctx->rbuffer[ctx->rbufhead + 3];
+		return 4 + i <= ctx->rbuftail - ctx->rbufhead;
+	}
+	for(i = line = ctx->rbufhead; i < ctx->rbuftail; i++)
+	{
+		if(ctx->rbuffer[i] != '\n')
+			continue;
+		if(i == line || (i == line + 1 && ctx->rbuffer[line] == '\r'))
+			return 1;
+		line = i + 1;
 	}
+	return 0;
+}
+
+static int rtsp_getnext(RTSPContext* ctx, char* buf, size_t count)
+{
+	// initialize if necessary
+	if(rtsp_buffer_init(ctx) < 0)
+		return -1;
 	// buffer is empty, force read
 	if(ctx->rbuftail == ctx->rbufhead)
 	{
@@ -982,6 +1474,11 @@ static void rtsp_cmd_play(RTSPContext* ctx, const char* url, RTSPMessageHeader*
 	rtsp_reply_header(ctx, RTSP_STATUS_OK);
 	rtsp_printf(ctx, "Session: %s\r\n", ctx->session_id);
 	rtsp_printf(ctx, "\r\n");
+	if(ctx->playStarted == 0)
+	{
+		ctx->playStarted = 1;
+		rtsp_stat_setup(ctx);
+	}
 	return;
 }
 
@@ -1108,51 +1605,255 @@ static void get_word(char* buf, int buf_size, const char** pp)
 	*pp = p;
 }
 
-void* rtspserver(void* arg)
+/**
+ * Set up the state of a newly accepted RTSP connection.
+ *
+ * @return 0 on success, or -1 on error.
+ */
+static int rtsp_session_init(RTSPContext* ctx, int s)
 {
+	struct sockaddr_in sin;
 #ifdef WIN32
-	SOCKET s	  = *((SOCKET*)arg);
 	int sinlen = sizeof(struct sockaddr_in);
 #else
-	int s = *((int*)arg);
 	socklen_t sinlen = sizeof(struct sockaddr_in);
 #endif
-	const char* p;
-	char buf[8192];
-	char cmd[32], url[1024], protocol[32];
-	int rlen;
-	struct sockaddr_in sin;
-	RTSPContext ctx;
-	RTSPMessageHeader header1, *header = &header1;
-	// int thread_ret;
-	// image info
-	// int iwidth = video_source_maxwidth(0);
-	// int iheight = video_source_maxheight(0);
 	//
 	rtspconf = rtspconf_global();
 	sinlen	= sizeof(sin);
 	getpeername(s, (struct sockaddr*)&sin, &sinlen);
 	//
-	bzero(&ctx, sizeof(ctx));
-	if(per_client_init(&ctx) < 0)
+	bzero(ctx, sizeof(RTSPContext));
+	gettimeofday(&ctx->acceptTime, NULL);
+	if(per_client_init(ctx) < 0)
 	{
 		ga_error("server initialization failed.\n");
-		return NULL;
+		return -1;
 	}
-	bcopy(&sin, &ctx.client, sizeof(ctx.client));
-	ctx.state = SERVER_STATE_IDLE;
+	bcopy(&sin, &ctx->client, sizeof(ctx->client));
+	ctx->state = SERVER_STATE_IDLE;
 	// XXX: hasVideo is used to sync audio/video
 	// This value is increased by 1 for each captured frame until it is gerater than zero
 	// when this value is greater than zero, audio encoding then starts ...
-	// ctx.hasVideo = -(rtspconf->video_fps>>1);	// for slow encoders?
-	ctx.hasVideo = 0; // with 'zerolatency'
-	pthread_mutex_init(&ctx.rtsp_writer_mutex, NULL);
+	// ctx->hasVideo = -(rtspconf->video_fps>>1);	// for slow encoders?
+	ctx->hasVideo = 0; // with 'zerolatency'
+	pthread_mutex_init(&ctx->rtsp_writer_mutex, NULL);
+	pthread_mutex_init(&ctx->wbuf_mutex, NULL);
 	//
 	ga_error("[tid %ld] client connected from %s:%d\n", ga_gettid(), inet_ntoa(sin.sin_addr), htons(sin.sin_port));
 	//
-	ctx.fd = s;
+	ctx->fd = s;
+	pthread_mutex_lock(&rtsp_stat_mutex);
+	rtsp_sessions++;
+	pthread_mutex_unlock(&rtsp_stat_mutex);
+	return 0;
+}
+
+/**
+ * Release the state of an RTSP connection and close it.
+ */
+static void rtsp_session_deinit(RTSPContext* ctx)
+{
+	struct timeval tv;
+	//
+	gettimeofday(&tv, NULL);
+	ctx->state = SERVER_STATE_TEARDOWN;
+	// 2014-05-20: support only share-encoder model
+	// the client's sender is stopped before the socket is closed
+	ff_server_unregister_client(ctx);
+	close(ctx->fd);
+	//
+	per_client_deinit(ctx);
+	pthread_mutex_destroy(&ctx->rtsp_writer_mutex);
+	pthread_mutex_destroy(&ctx->wbuf_mutex);
+	if(ctx->wbuffer != NULL)
+		free(ctx->wbuffer);
+	pthread_mutex_lock(&rtsp_stat_mutex);
+	rtsp_sessions--;
+	pthread_mutex_unlock(&rtsp_stat_mutex);
+	rtsp_stat_teardown(&tv);
+	return;
+}
+
+#ifdef HOLE_PUNCHING
+/**
+ * Read a hole-punching probe from an RTP/RTCP socket and
+ * learn the client's NATed port from it.
+ */
+static void rtp_handle_probe(RTSPContext* ctx, int i, char* buf, int bufsize)
+{
+	struct sockaddr_in xsin;
+#ifdef WIN32
+	int xsinlen = sizeof(xsin);
+#else
+	socklen_t xsinlen = sizeof(xsin);
+#endif
+	recvfrom(ctx->rtpSocket[i], buf, bufsize, 0, (struct sockaddr*)&xsin, &xsinlen);
+	if(ctx->rtpPortChecked[i] != 0)
+		return;
+	// XXX: port should not flip-flop, so check only once
+	if(xsin.sin_addr.s_addr != ctx->client.sin_addr.s_addr)
+	{
+		ga_error("RTP: client address mismatched? %u.%u.%u.%u != %u.%u.%u.%u\n",
+					NIPQUAD(ctx->client.sin_addr.s_addr),
+					NIPQUAD(xsin.sin_addr.s_addr));
+		return;
+	}
+	if(xsin.sin_port != ctx->rtpPeerPort[i])
+	{
+		ga_error("RTP: client port reconfigured: %u -> %u\n",
+					(unsigned int)ntohs(ctx->rtpPeerPort[i]),
+					(unsigned int)ntohs(xsin.sin_port));
+		ctx->rtpPeerPort[i] = xsin.sin_port;
+	}
+	else
+	{
+		ga_error("RTP: client is not under an NAT, port %d confirmed\n", (int)ntohs(ctx->rtpPeerPort[i]));
+	}
+	ctx->rtpPortChecked[i] = 1;
+	return;
+}
+#endif
+
+/**
+ * Handle an RTSP request or an interleaved packet.
+ *
+ * @return 0 to continue, 1 if the session is torn down, or -1 on error.
+ *
+ * The function reads from the connection if the message is not buffered yet.
+ */
+static int rtsp_handle_message(RTSPContext* ctx, char* buf, int bufsize)
+{
+	const char* p;
+	char cmd[32], url[1024], protocol[32];
+	int rlen;
+	RTSPMessageHeader header1, *header = &header1;
 	//
+	// read commands
+	if((rlen = rtsp_getnext(ctx, buf, bufsize)) < 0)
+	{
+		return -1;
+	}
+	// Interleaved binary data?
+	if(buf[0] == '$')
+	{
+		handle_rtcp(ctx, buf, rlen);
+		return 0;
+	}
+	// REQUEST line
+	ga_error("%s", buf);
+	p = buf;
+	get_word(cmd, sizeof(cmd), &p);
+	get_word(url, sizeof(url), &p);
+	get_word(protocol, sizeof(protocol), &p);
+	// check protocol
+	if(strcmp(protocol, "RTSP/1.0") != 0)
+	{
+		rtsp_reply_error(ctx, RTSP_STATUS_VERSION);
+		return -1;
+	}
+	// read headers
+	bzero(header, sizeof(*header));
 	do
+	{
+		int myseq											 = -1;
+		char mysession[sizeof(header->session_id)] = "";
+		if((rlen = rtsp_getnext(ctx, buf, bufsize)) < 0)
+			return -1;
+		if(buf[0] == '\n' || (buf[0] == '\r' && buf[1] == '\n'))
+			break;
+#if 0
+		ga_error("HEADER: %s", buf);
+#endif
+		// Special handling to CSeq & Session header
+		// ff_rtsp_parse_line cannot handle CSeq & Session properly on Windows
+		// any more?
+		if(strncasecmp("CSeq: ", buf, 6) == 0)
+		{
+			myseq = strtol(buf + 6, NULL, 10);
+		}
+		if(strncasecmp("Session: ", buf, 9) == 0)
+		{
+			strcpy(mysession, buf + 9);
+		}
+		//
+		ff_rtsp_parse_line(header, buf, NULL, NULL);
+		//
+		if(myseq > 0 && header->seq <= 0)
+		{
+			ga_error("WARNING: CSeq fixes applied (%d->%d).\n", header->seq, myseq);
+			header->seq = myseq;
+		}
+		if(mysession[0] != '\0' && header->session_id[0] == '\0')
+		{
+			unsigned i;
+			for(i = 0; i < sizeof(header->session_id) - 1; i++)
+			{
+				if(mysession[i] == '\0' || isspace(mysession[i]) || mysession[i] == ';')
+					break;
+				header->session_id[i] = mysession[i];
+			}
+			header->session_id[i + 1] = '\0';
+			ga_error("WARNING: Session fixes applied (%s)\n", header->session_id);
+		}
+	} while(1);
+	// special handle to session_id
+	if(header->session_id != NULL)
+	{
+		char* p = header->session_id;
+		while(*p != '\0')
+		{
+			if(*p == '\r' || *p == '\n')
+			{
+				*p = '\0';
+				break;
+			}
+			p++;
+		}
+	}
+	// handle commands
+	ctx->seq = header->seq;
+	if(!strcmp(cmd, "DESCRIBE"))
+		rtsp_cmd_describe(ctx, url);
+	else if(!strcmp(cmd, "OPTIONS"))
+		rtsp_cmd_options(ctx, url);
+	else if(!strcmp(cmd, "SETUP"))
+		rtsp_cmd_setup(ctx, url, header);
+	else if(!strcmp(cmd, "PLAY"))
+		rtsp_cmd_play(ctx, url, header);
+	else if(!strcmp(cmd, "PAUSE"))
+		rtsp_cmd_pause(ctx, url, header);
+	else if(!strcmp(cmd, "TEARDOWN"))
+		rtsp_cmd_teardown(ctx, url, header, 1);
+	else
+		rtsp_reply_error(ctx, RTSP_STATUS_METHOD);
+	if(ctx->state == SERVER_STATE_TEARDOWN)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Service thread of an RTSP connection, used if the reactor is not available.
+ */
+void* rtspserver(void* arg)
+{
+#ifdef WIN32
+	SOCKET s = *((SOCKET*)arg);
+#else
+	int s = *((int*)arg);
+#endif
+	char buf[8192];
+	RTSPContext ctx;
+	//
+	if(rtsp_session_init(&ctx, s) < 0)
+	{
+		close(s);
+		return NULL;
+	}
+	//
+	while(true)
 	{
 		int i, fdmax, active;
 		fd_set rfds;
@@ -1173,7 +1874,7 @@ void* rtspserver(void* arg)
 		if((active = select(fdmax + 1, &rfds, NULL, NULL, &to)) < 0)
 		{
 			ga_error("select() failed: %s\n", strerror(errno));
-			goto quit;
+			break;
 		}
 		if(active == 0)
 		{
@@ -1183,156 +1884,383 @@ void* rtspserver(void* arg)
 #ifdef HOLE_PUNCHING
 		for(i = 0; i < 2 * ctx.streamCount; i++)
 		{
-			struct sockaddr_in xsin;
-#ifdef WIN32
-			int xsinlen = sizeof(xsin);
-#else
-			socklen_t xsinlen = sizeof(xsin);
-#endif
-			if(FD_ISSET(ctx.rtpSocket[i], &rfds) == 0)
-				continue;
-			recvfrom(ctx.rtpSocket[i], buf, sizeof(buf), 0, (struct sockaddr*)&xsin, &xsinlen);
-			if(ctx.rtpPortChecked[i] != 0)
-				continue;
-			// XXX: port should not flip-flop, so check only once
-			if(xsin.sin_addr.s_addr != ctx.client.sin_addr.s_addr)
-			{
-				ga_error("RTP: client address mismatched? %u.%u.%u.%u != %u.%u.%u.%u\n",
-							NIPQUAD(ctx.client.sin_addr.s_addr),
-							NIPQUAD(xsin.sin_addr.s_addr));
-				continue;
-			}
-			if(xsin.sin_port != ctx.rtpPeerPort[i])
-			{
-				ga_error("RTP: client port reconfigured: %u -> %u\n",
-							(unsigned int)ntohs(ctx.rtpPeerPort[i]),
-							(unsigned int)ntohs(xsin.sin_port));
-				ctx.rtpPeerPort[i] = xsin.sin_port;
-			}
-			else
-			{
-				ga_error("RTP: client is not under an NAT, port %d confirmed\n", (int)ntohs(ctx.rtpPeerPort[i]));
-			}
-			ctx.rtpPortChecked[i] = 1;
+			if(FD_ISSET(ctx.rtpSocket[i], &rfds) != 0)
+				rtp_handle_probe(&ctx, i, buf, sizeof(buf));
 		}
 		// is RTSP connection?
 		if(FD_ISSET(ctx.fd, &rfds) == 0)
 			continue;
 #endif
-		// read commands
-		if((rlen = rtsp_getnext(&ctx, buf, sizeof(buf))) < 0)
-		{
-			goto quit;
-		}
-		// Interleaved binary data?
-		if(buf[0] == '$')
-		{
-			handle_rtcp(&ctx, buf, rlen);
+		if(rtsp_handle_message(&ctx, buf, sizeof(buf)) != 0)
+			break;
+	}
+	//
+	rtsp_session_deinit(&ctx);
+	// ga_error("RTSP client thread terminated (%d/%d clients left).\n",
+	//	video_source_client_count(), audio_source_client_count());
+	ga_error("RTSP client thread terminated.\n");
+	//
+	return NULL;
+}
+
+#ifdef RTSP_REACTOR
+typedef struct rtsp_session_s rtsp_session_t;
+
+/**
+ * A file descriptor watched by a reactor.
+ */
+typedef struct rtsp_watch_s {
+	rtsp_session_t* session;
+	int index; /**< -1 for the RTSP connection, or the index of the RTP socket */
+} rtsp_watch_t;
+
+/**
+ * A reactor thread and the sessions it serves.
+ */
+typedef struct rtsp_reactor_s {
+	pthread_t thread;
+	int epfd;
+	int wakeup;					/**< eventfd written to stop the thread */
+	pthread_mutex_t mutex;	  /**< Protects sessions */
+	rtsp_session_t* sessions; /**< Sessions closed when the thread stops */
+} rtsp_reactor_t;
+
+/**
+ * An RTSP connection served by a reactor.
+ */
+struct rtsp_session_s {
+	RTSPContext ctx;
+	rtsp_reactor_t* reactor;
+	int closed;
+	int writing; /**< EPOLLOUT is watched for the pending output */
+	rtsp_watch_t conn;
+	rtsp_watch_t rtp[RTSP_CHANNEL_MAXx2]; /**< Watched if session is not NULL */
+	rtsp_session_t* next;					 /**< Sessions to be closed */
+	rtsp_session_t *lprev, *lnext;		 /**< Sessions of the reactor */
+};
+
+static int rtsp_reactors = 0;
+static rtsp_reactor_t rtsp_reactor_ctx[RTSP_REACTOR_MAX];
+static std::atomic<unsigned int> rtsp_reactor_next{0};
+static std::atomic<int> rtsp_reactor_quit{0};
+
+static int rtsp_reactor_watch(rtsp_session_t* se, rtsp_watch_t* w, int fd, int index)
+{
+	struct epoll_event ev;
+	bzero(&ev, sizeof(ev));
+	w->session	= se;
+	w->index		= index;
+	ev.events	= EPOLLIN;
+	ev.data.ptr = w;
+	return epoll_ctl(se->reactor->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * Watch EPOLLOUT on the RTSP connection while output is pending.
+ */
+static void rtsp_reactor_watch_output(rtsp_session_t* se, int pending)
+{
+	struct epoll_event ev;
+	//
+	if((pending > 0) == (se->writing != 0))
+		return;
+	bzero(&ev, sizeof(ev));
+	ev.events	= pending > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	ev.data.ptr = &se->conn;
+	if(epoll_ctl(se->reactor->epfd, EPOLL_CTL_MOD, se->ctx.fd, &ev) == 0)
+		se->writing = pending > 0;
+	return;
+}
+
+/**
+ * Send the pending output of a session without blocking, unless a sender
+ * thread is writing: it sends the output after its packets.
+ *
+ * @return 0 on success, or -1 if the session should be closed.
+ */
+static int rtsp_reactor_write(rtsp_session_t* se)
+{
+	int pending = 1;
+	//
+	if(pthread_mutex_trylock(&se->ctx.rtsp_writer_mutex) == 0)
+	{
+		pending = rtsp_wbuf_flush(&se->ctx);
+		pthread_mutex_unlock(&se->ctx.rtsp_writer_mutex);
+		if(pending < 0)
+			return -1;
+	}
+	rtsp_reactor_watch_output(se, pending);
+	return 0;
+}
+
+/**
+ * Watch the RTP sockets opened by SETUP requests for hole-punching probes.
+ */
+static void rtsp_reactor_watch_rtp(rtsp_session_t* se)
+{
+#ifdef HOLE_PUNCHING
+	int i;
+	for(i = 0; i < 2 * se->ctx.streamCount; i++)
+	{
+		if(se->ctx.rtpSocket[i] == 0 || se->rtp[i].session != NULL)
 			continue;
-		}
-		// REQUEST line
-		ga_error("%s", buf);
-		p = buf;
-		get_word(cmd, sizeof(cmd), &p);
-		get_word(url, sizeof(url), &p);
-		get_word(protocol, sizeof(protocol), &p);
-		// check protocol
-		if(strcmp(protocol, "RTSP/1.0") != 0)
+		if(rtsp_reactor_watch(se, &se->rtp[i], se->ctx.rtpSocket[i], i) < 0)
+			ga_error("RTSP: cannot watch RTP socket %d - %s\n", se->ctx.rtpSocket[i], strerror(errno));
+	}
+#endif
+	return;
+}
+
+/**
+ * Read from an RTSP connection and handle all the complete messages.
+ *
+ * @return 0 on success, or -1 if the session should be closed.
+ */
+static int rtsp_reactor_read(rtsp_session_t* se, char* buf, int bufsize)
+{
+	RTSPContext* ctx = &se->ctx;
+	//
+	if(rtsp_buffer_init(ctx) < 0)
+		return -1;
+	if(ctx->rbufhead > 0)
+	{
+		bcopy(ctx->rbuffer + ctx->rbufhead, ctx->rbuffer, ctx->rbuftail - ctx->rbufhead);
+		ctx->rbuftail -= ctx->rbufhead;
+		ctx->rbufhead = 0;
+	}
+	if(ctx->rbuftail == ctx->rbufsize)
+	{
+		ga_error("Buffer full: Extremely long text data encountered?\n");
+		return -1;
+	}
+	// the connection is readable, so this does not block
+	if(rtsp_read_internal(ctx) < 0)
+		return -1;
+	while(rtsp_message_ready(ctx))
+	{
+		if(rtsp_handle_message(ctx, buf, bufsize) != 0)
+			return -1;
+	}
+	rtsp_reactor_watch_rtp(se);
+	// replies not sent at once are sent once the connection is writable
+	return rtsp_reactor_write(se);
+}
+
+static void rtsp_reactor_close(rtsp_session_t* se)
+{
+	rtsp_reactor_t* r = se->reactor;
+	int i;
+	//
+	pthread_mutex_lock(&r->mutex);
+	if(se->lprev != NULL)
+		se->lprev->lnext = se->lnext;
+	else
+		r->sessions = se->lnext;
+	if(se->lnext != NULL)
+		se->lnext->lprev = se->lprev;
+	pthread_mutex_unlock(&r->mutex);
+	//
+	epoll_ctl(r->epfd, EPOLL_CTL_DEL, se->ctx.fd, NULL);
+	for(i = 0; i < RTSP_CHANNEL_MAXx2; i++)
+	{
+		if(se->rtp[i].session != NULL)
+			epoll_ctl(r->epfd, EPOLL_CTL_DEL, se->ctx.rtpSocket[i], NULL);
+	}
+	rtsp_session_deinit(&se->ctx);
+	ga_error("RTSP client session terminated.\n");
+	free(se);
+	return;
+}
+
+/**
+ * Reactor thread: serves the RTSP connections, RTCP, and hole-punching
+ * probes of all the sessions assigned to its epoll instance.
+ * Sessions are closed after all the events of a round are handled,
+ * and all of them when the thread is stopped by rtsp_reactor_deinit().
+ */
+static void* rtsp_reactor(void* arg)
+{
+	rtsp_reactor_t* r = (rtsp_reactor_t*)arg;
+	struct epoll_event ev[RTSP_REACTOR_EVENTS];
+	char buf[8192];
+	rtsp_session_t *se, *closing;
+	rtsp_watch_t* w;
+	int i, n;
+	//
+	while(rtsp_reactor_quit == 0)
+	{
+		if((n = epoll_wait(r->epfd, ev, RTSP_REACTOR_EVENTS, -1)) < 0)
 		{
-			rtsp_reply_error(&ctx, RTSP_STATUS_VERSION);
-			goto quit;
+			if(errno == EINTR)
+				continue;
+			ga_error("RTSP: epoll_wait() failed - %s\n", strerror(errno));
+			break;
 		}
-		// read headers
-		bzero(header, sizeof(*header));
-		do
+		closing = NULL;
+		for(i = 0; i < n; i++)
 		{
-			int myseq											 = -1;
-			char mysession[sizeof(header->session_id)] = "";
-			if((rlen = rtsp_getnext(&ctx, buf, sizeof(buf))) < 0)
-				goto quit;
-			if(buf[0] == '\n' || (buf[0] == '\r' && buf[1] == '\n'))
-				break;
-#if 0
-			ga_error("HEADER: %s", buf);
-#endif
-			// Special handling to CSeq & Session header
-			// ff_rtsp_parse_line cannot handle CSeq & Session properly on Windows
-			// any more?
-			if(strncasecmp("CSeq: ", buf, 6) == 0)
-			{
-				myseq = strtol(buf + 6, NULL, 10);
-			}
-			if(strncasecmp("Session: ", buf, 9) == 0)
-			{
-				strcpy(mysession, buf + 9);
-			}
-			//
-			ff_rtsp_parse_line(header, buf, NULL, NULL);
-			//
-			if(myseq > 0 && header->seq <= 0)
+			// the wake-up event
+			if((w = (rtsp_watch_t*)ev[i].data.ptr) == NULL)
+				continue;
+			se = w->session;
+			if(se->closed)
+				continue;
+#ifdef HOLE_PUNCHING
+			if(w->index >= 0)
 			{
-				ga_error("WARNING: CSeq fixes applied (%d->%d).\n", header->seq, myseq);
-				header->seq = myseq;
+				rtp_handle_probe(&se->ctx, w->index, buf, sizeof(buf));
+				continue;
 			}
-			if(mysession[0] != '\0' && header->session_id[0] == '\0')
+#endif
+			if((ev[i].events & EPOLLOUT) != 0 && rtsp_reactor_write(se) < 0)
+				se->closed = 1;
+			else if((ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0 && rtsp_reactor_read(se, buf, sizeof(buf)) < 0)
+				se->closed = 1;
+			if(se->closed)
 			{
-				unsigned i;
-				for(i = 0; i < sizeof(header->session_id) - 1; i++)
-				{
-					if(mysession[i] == '\0' || isspace(mysession[i]) || mysession[i] == ';')
-						break;
-					header->session_id[i] = mysession[i];
-				}
-				header->session_id[i + 1] = '\0';
-				ga_error("WARNING: Session fixes applied (%s)\n", header->session_id);
+				se->next = closing;
+				closing	= se;
 			}
-		} while(1);
-		// special handle to session_id
-		if(header->session_id != NULL)
+		}
+		while((se = closing) != NULL)
 		{
-			char* p = header->session_id;
-			while(*p != '\0')
-			{
-				if(*p == '\r' || *p == '\n')
-				{
-					*p = '\0';
-					break;
-				}
-				p++;
-			}
+			closing = se->next;
+			rtsp_reactor_close(se);
 		}
-		// handle commands
-		ctx.seq = header->seq;
-		if(!strcmp(cmd, "DESCRIBE"))
-			rtsp_cmd_describe(&ctx, url);
-		else if(!strcmp(cmd, "OPTIONS"))
-			rtsp_cmd_options(&ctx, url);
-		else if(!strcmp(cmd, "SETUP"))
-			rtsp_cmd_setup(&ctx, url, header);
-		else if(!strcmp(cmd, "PLAY"))
-			rtsp_cmd_play(&ctx, url, header);
-		else if(!strcmp(cmd, "PAUSE"))
-			rtsp_cmd_pause(&ctx, url, header);
-		else if(!strcmp(cmd, "TEARDOWN"))
-			rtsp_cmd_teardown(&ctx, url, header, 1);
-		else
-			rtsp_reply_error(&ctx, RTSP_STATUS_METHOD);
-		if(ctx.state == SERVER_STATE_TEARDOWN)
+	}
+	while((se = r->sessions) != NULL)
+		rtsp_reactor_close(se);
+	return NULL;
+}
+#endif
+
+/**
+ * Start the reactor threads that serve RTSP connections.
+ *
+ * @return 0 on success, or -1 if connections should be served by
+ *	their own threads.
+ *
+ * The number of threads is set by \em rtsp-reactor-threads (default 2).
+ * Set it to 0 to serve each connection with its own thread.
+ */
+int rtsp_reactor_init()
+{
+#ifdef RTSP_REACTOR
+	int i, n = RTSP_REACTOR_DEFAULT;
+	char buf[64];
+	rtsp_reactor_t* r;
+	struct epoll_event ev;
+	//
+	if(rtsp_reactors > 0)
+		return 0;
+	if(ga_conf_readv("rtsp-reactor-threads", buf, sizeof(buf)) != NULL)
+		n = ga_conf_readint("rtsp-reactor-threads");
+	if(n > RTSP_REACTOR_MAX)
+		n = RTSP_REACTOR_MAX;
+	rtsp_reactor_quit = 0;
+	for(i = 0; i < n; i++)
+	{
+		r = &rtsp_reactor_ctx[i];
+		bzero(r, sizeof(rtsp_reactor_t));
+		if((r->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+			break;
+		if((r->wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
 		{
+			close(r->epfd);
 			break;
 		}
-	} while(1);
-quit:
-	ctx.state = SERVER_STATE_TEARDOWN;
-	//
-	close(ctx.fd);
-	// 2014-05-20: support only share-encoder model
-	ff_server_unregister_client(&ctx);
+		bzero(&ev, sizeof(ev));
+		ev.events	= EPOLLIN;
+		ev.data.ptr = NULL;
+		pthread_mutex_init(&r->mutex, NULL);
+		if(epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakeup, &ev) < 0
+			|| pthread_create(&r->thread, NULL, rtsp_reactor, r) != 0)
+		{
+			pthread_mutex_destroy(&r->mutex);
+			close(r->wakeup);
+			close(r->epfd);
+			break;
+		}
+	}
+	if((rtsp_reactors = i) > 0)
+	{
+		ga_error("RTSP: %d reactor thread(s) started.\n", rtsp_reactors);
+		return 0;
+	}
+#endif
+	ga_error("RTSP: serve each connection with its own thread.\n");
+	return -1;
+}
+
+/**
+ * Stop the reactor threads and close the sessions they serve.
+ * No connection may be added meanwhile.
+ */
+void rtsp_reactor_deinit()
+{
+#ifdef RTSP_REACTOR
+	uint64_t one = 1;
+	int i;
 	//
-	per_client_deinit(&ctx);
-	// ga_error("RTSP client thread terminated (%d/%d clients left).\n",
-	//	video_source_client_count(), audio_source_client_count());
-	ga_error("RTSP client thread terminated.\n");
+	if(rtsp_reactors == 0)
+		return;
+	rtsp_reactor_quit = 1;
+	for(i = 0; i < rtsp_reactors; i++)
+	{
+		if(write(rtsp_reactor_ctx[i].wakeup, &one, sizeof(one)) < 0)
+			ga_error("RTSP: cannot wake up reactor %d - %s\n", i, strerror(errno));
+	}
+	for(i = 0; i < rtsp_reactors; i++)
+	{
+		pthread_join(rtsp_reactor_ctx[i].thread, NULL);
+		pthread_mutex_destroy(&rtsp_reactor_ctx[i].mutex);
+		close(rtsp_reactor_ctx[i].wakeup);
+		close(rtsp_reactor_ctx[i].epfd);
+	}
+	ga_error("RTSP: %d reactor thread(s) stopped.\n", rtsp_reactors);
+	rtsp_reactors = 0;
+#endif
+	return;
+}
+
+/**
+ * Hand over a newly accepted RTSP connection to a reactor thread.
+ * The connection is made non-blocking: the replies that cannot be sent
+ * at once are sent when it is writable.
+ *
+ * @return 0 on success, or -1 on error. The connection is closed on error.
+ */
+int rtsp_reactor_add(int s)
+{
+#ifdef RTSP_REACTOR
+	rtsp_session_t* se;
+	rtsp_reactor_t* r;
 	//
-	return NULL;
+	if(rtsp_reactors > 0 && (se = (rtsp_session_t*)calloc(1, sizeof(rtsp_session_t))) != NULL)
+	{
+		if(rtsp_session_init(&se->ctx, s) < 0)
+		{
+			free(se);
+			close(s);
+			return -1;
+		}
+		if(fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) == 0)
+			se->ctx.nonblock = 1;
+		r				 = &rtsp_reactor_ctx[rtsp_reactor_next.fetch_add(1) % rtsp_reactors];
+		se->reactor = r;
+		// linked before watched, so that the reactor can close it at once
+		pthread_mutex_lock(&r->mutex);
+		if((se->lnext = r->sessions) != NULL)
+			se->lnext->lprev = se;
+		r->sessions = se;
+		pthread_mutex_unlock(&r->mutex);
+		if(rtsp_reactor_watch(se, &se->conn, s, -1) == 0)
+			return 0;
+		ga_error("RTSP: cannot watch connection - %s\n", strerror(errno));
+		rtsp_reactor_close(se);
+		return -1;
+	}
+#endif
+	close(s);
+	return -1;
 }
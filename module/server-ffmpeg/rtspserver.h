@@ -92,6 +92,12 @@ struct RTSPContext
 	int mtu;
 	URLContext* rtp[RTSP_CHANNEL_MAX]; // RTP over UDP
 	pthread_mutex_t rtsp_writer_mutex; // RTP over RTSP/TCP
+	// pending output of a non-blocking connection
+	int nonblock;
+	pthread_mutex_t wbuf_mutex; // never held while blocking
+	char* wbuffer;
+	int wbuflen;
+	int wbufsize;
 #ifdef HOLE_PUNCHING
 	int streamCount;
 #ifdef WIN32
@@ -103,11 +109,17 @@ struct RTSPContext
 	unsigned short rtpPeerPort[RTSP_CHANNEL_MAXx2];
 	char rtpPortChecked[RTSP_CHANNEL_MAXx2];
 #endif
+	// statistics
+	struct timeval acceptTime; // connection accepted
+	int playStarted;				// setup latency has been reported
 };
 
 void rtsp_cleanup(RTSPContext* rtsp, int retcode);
 int rtsp_write_bindata(RTSPContext* ctx, int streamid, uint8_t* buf, int buflen);
 void* rtspserver(void* arg);
+int rtsp_reactor_init();
+int rtsp_reactor_add(int s);
+void rtsp_reactor_deinit();
 #ifdef HOLE_PUNCHING
 int rtp_open_ports(RTSPContext* ctx, int streamid);
 int rtp_write_bindata(RTSPContext* ctx, int streamid, uint8_t* buf, int buflen);
@@ -31,14 +31,99 @@
 
 #include "encoder-common.h"
 #include "ga-common.h"
+#include "ga-conf.h"
 #include "ga-module.h"
+#include "pacer.h"
+#include "rtpfec.h"
+#include "rtpnack.h"
 #include "rtspconf.h"
 #include "rtspserver.h"
 #include "server-ffmpeg.h"
 
+extern "C"
+{
+#include <libavutil/random_seed.h>
+#include <libavutil/time.h>
+}
+
+#include <atomic>
 #include <map>
 using namespace std;
 
+#define FF_SEND_QUEUE_DEFAULT 64	  /**< Default length of a client's sender queue, in frames */
+#define FF_SEND_QUEUE_MAX		 1024 /**< Max length of a client's sender queue */
+#define FF_FEC_AUDIO_GROUP	 3		/**< Max audio frames protected by a FEC packet */
+
+/**
+ * A frame packetized by the shared packetizer of a channel.
+ * The RTP packets are shared by all the clients and freed by the last one.
+ */
+typedef struct ff_rtp_au_s {
+	int channelId;
+	uint8_t* buf; /**< Output of avio_close_dyn_buf */
+	int buflen;
+	long long queued;				/**< Time the frame was packetized, from ga_trace_now() */
+	long long deadline;			/**< Time the frame should be sent by, 0 to send at once */
+	ga_trace_t trace;				/**< Trace of the frame, stamped by the first sender */
+	std::atomic<int> traced;
+	std::atomic<int> refcnt;
+} ff_rtp_au_t;
+
+/**
+ * The shared packetizer of a channel, cloned from the stream setup of
+ * the first client. Only the channel's encoder thread uses it.
+ */
+typedef struct ff_packetizer_s {
+	AVFormatContext* fmtctx;
+	AVStream* stream;
+	AVRational encoder_tb;
+	int mtu;
+	int64_t starttime; /**< Wall-clock time of RTP timestamp zero, in microseconds */
+	int partial;		 /**< The last slice packetized is not the last of its frame */
+	long long framestart; /**< Time the first slice of the current frame was packetized */
+} ff_packetizer_t;
+
+struct ff_client_s;
+
+/**
+ * Argument of the retransmission of a client's channel.
+ */
+typedef struct ff_client_rtx_s {
+	struct ff_client_s* c;
+	int ch;
+} ff_client_rtx_t;
+
+/**
+ * A client and its sender thread.
+ */
+typedef struct ff_client_s {
+	RTSPContext* rtsp;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	ff_rtp_au_t** queue;
+	int qsize, qhead, qcount;
+	int quit;
+	unsigned int dropped;
+	// per-client RTP header fields
+	unsigned int ssrc[RTSP_CHANNEL_MAX];
+	unsigned short seqoff[RTSP_CHANNEL_MAX];
+	unsigned int tsoff[RTSP_CHANNEL_MAX];
+	unsigned int packets[RTSP_CHANNEL_MAX];
+	unsigned int octets[RTSP_CHANNEL_MAX];
+	uint8_t* scratch;
+	int scratchsize;
+	// forward error correction
+	rtpfec_group_t fec[RTSP_CHANNEL_MAX];
+	uint8_t* fecbuf;
+	int fecbufsize;
+	// NACK retransmission
+	rtpnack_history_t* history[RTSP_CHANNEL_MAX];
+	ff_client_rtx_t rtx[RTSP_CHANNEL_MAX];
+	// send-side pacing, shared by the UDP channels
+	pacer_t* pacer;
+} ff_client_t;
+
 #ifdef WIN32
 static SOCKET server_socket = INVALID_SOCKET; /**< The server socket */
 #else
@@ -47,27 +132,533 @@ static int server_socket = -1; /**< The server socket */
 static pthread_t server_tid;
 static int server_started		 = 0;
 static pthread_rwlock_t cclock = PTHREAD_RWLOCK_INITIALIZER;
-static map<void*, void*> client_context;
+static map<void*, ff_client_t*> client_context;
+static ff_packetizer_t packetizer[RTSP_CHANNEL_MAX];
+static int send_queue_size = 0;
+
+/**
+ * Drop the shared packetizers, so that they are set up again from the
+ * streams of the next client. Called with \a cclock write-locked.
+ */
+static void ff_packetizer_reset()
+{
+	int i;
+	for(i = 0; i < RTSP_CHANNEL_MAX; i++)
+	{
+		if(packetizer[i].fmtctx != NULL)
+			avformat_free_context(packetizer[i].fmtctx);
+		bzero(&packetizer[i], sizeof(ff_packetizer_t));
+	}
+	return;
+}
+
+static void ff_rtp_au_release(ff_rtp_au_t* au)
+{
+	if(au->refcnt.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+	av_free(au->buf);
+	delete au;
+}
+
+static inline unsigned int rd32(const uint8_t* p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+static inline void wr32(uint8_t* p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/**
+ * Rewrite the RTP and RTCP headers of a packetized frame for a client.
+ *
+ * The shared packetizer's sequence numbers and timestamps are shifted by
+ * the client's random offsets, and its SSRC is replaced, so that each
+ * client still sees an independent RTP session. The sender report counts
+ * are replaced with the client's own counts.
+ */
+static void ff_client_rewrite(ff_client_t* c, int ch, uint8_t* buf, int buflen)
+{
+	int i, pktlen, off, len;
+	uint8_t* pkt;
+	unsigned short seq;
+	//
+	for(i = 0; i + 4 <= buflen; i += 4 + pktlen)
+	{
+		pktlen = rd32(&buf[i]);
+		pkt	 = &buf[i + 4];
+		if(i + 4 + pktlen > buflen)
+			break;
+		if(pktlen < 8 || (pkt[0] >> 6) != 2)
+			continue;
+		if(pkt[1] >= 200 && pkt[1] <= 204)
+		{
+			// RTCP compound packet: SR, SDES, BYE all start with the sender's SSRC
+			for(off = 0; off + 8 <= pktlen; off += len)
+			{
+				len = (((pkt[off + 2] << 8) | pkt[off + 3]) + 1) * 4;
+				if(off + len > pktlen)
+					break;
+				wr32(&pkt[off + 4], c->ssrc[ch]);
+				if(pkt[off + 1] == 200 && len >= 28)
+				{
+					wr32(&pkt[off + 16], rd32(&pkt[off + 16]) + c->tsoff[ch]);
+					wr32(&pkt[off + 20], c->packets[ch]);
+					wr32(&pkt[off + 24], c->octets[ch]);
+				}
+			}
+			continue;
+		}
+		if(pktlen < 12)
+			continue;
+		seq = ((pkt[2] << 8) | pkt[3]) + c->seqoff[ch];
+		pkt[2] = seq >> 8;
+		pkt[3] = seq & 0x0ff;
+		wr32(&pkt[4], rd32(&pkt[4]) + c->tsoff[ch]);
+		wr32(&pkt[8], c->ssrc[ch]);
+		c->packets[ch]++;
+		c->octets[ch] += pktlen - 12 - 4 * (pkt[0] & 0x0f);
+	}
+	return;
+}
+
+/**
+ * Clear the marker bit of the RTP packets of a packetized frame.
+ *
+ * The RTP muxer marks the last packet of each AVPacket, which ends the
+ * access unit only if the AVPacket holds the whole frame, not a slice.
+ */
+static void ff_rtp_clear_marker(uint8_t* buf, int buflen)
+{
+	int i, pktlen;
+	uint8_t* pkt;
+	//
+	for(i = 0; i + 4 <= buflen; i += 4 + pktlen)
+	{
+		pktlen = rd32(&buf[i]);
+		pkt	 = &buf[i + 4];
+		if(i + 4 + pktlen > buflen)
+			break;
+		if(pktlen < 12 || (pkt[0] >> 6) != 2)
+			continue;
+		if(pkt[1] >= 200 && pkt[1] <= 204)
+			continue;
+		pkt[1] &= 0x7f;
+	}
+	return;
+}
+
+/**
+ * Keep the RTP packets of a rewritten frame for retransmission.
+ */
+static void ff_client_keep(ff_client_t* c, int ch, const uint8_t* buf, int buflen)
+{
+	int i, pktlen;
+	const uint8_t* pkt;
+	//
+	for(i = 0; i + 4 <= buflen; i += 4 + pktlen)
+	{
+		pktlen = rd32(&buf[i]);
+		pkt	 = &buf[i + 4];
+		if(i + 4 + pktlen > buflen)
+			break;
+		if(pktlen < 12 || (pkt[0] >> 6) != 2)
+			continue;
+		if(pkt[1] >= 200 && pkt[1] <= 204)
+			continue;
+		rtpnack_history_put(c->history[ch], pkt, pktlen);
+	}
+	return;
+}
+
+/**
+ * Send a packet lost by a client again. Called from the control thread.
+ * The packet is not held back, but takes the pacer's tokens, so that the
+ * next frames leave room for it. It is not part of the pacing metrics.
+ * Each client has its own history, so \a to is not needed.
+ */
+static void ff_client_resend(void* arg, const struct sockaddr_in* to, const unsigned char* pkt, int len)
+{
+	ff_client_rtx_t* rtx = (ff_client_rtx_t*)arg;
+	uint8_t buf[4 + RTPNACK_PACKET_MAX];
+	//
+	wr32(buf, len);
+	bcopy(pkt, &buf[4], len);
+	if(rtp_write_bindata(rtx->c->rtsp, rtx->ch, buf, 4 + len) >= 0)
+		pacer_take(rtx->c->pacer, len);
+	return;
+}
+
+/**
+ * Append the FEC packet of a group to a packet buffer.
+ */
+static int ff_fec_flush(rtpfec_group_t* g, uint8_t* out, int outsize)
+{
+	int len;
+	if(outsize < 4 || (len = rtpfec_group_flush(g, rtpfec_payload_type(), out + 4, outsize - 4)) <= 0)
+		return 0;
+	wr32(out, len);
+	return 4 + len;
+}
+
+/**
+ * Interleave a client's FEC packets with a rewritten frame.
+ *
+ * A FEC packet follows the last media packet of its group. Video groups
+ * end with the frame, so that no lost packet waits for the next frame to
+ * be recovered. An audio frame is a single packet, so audio groups span
+ * up to FF_FEC_AUDIO_GROUP frames.
+ *
+ * @return The size of the output, which is at most 3 times \a buflen
+ *		plus one FEC packet.
+ */
+static int ff_client_protect(ff_client_t* c, int ch, const uint8_t* buf, int buflen, uint8_t* out, int outsize)
+{
+	rtpfec_group_t* g = &c->fec[ch];
+	int video			= ch < video_source_channels();
+	int i, n, k, pktlen, outlen = 0;
+	const uint8_t* pkt;
+	//
+	k = rtpfec_group_size();
+	if(video == 0 && k > FF_FEC_AUDIO_GROUP)
+		k = FF_FEC_AUDIO_GROUP;
+	for(i = 0; i + 4 <= buflen; i += 4 + pktlen)
+	{
+		pktlen = rd32(&buf[i]);
+		pkt	 = &buf[i + 4];
+		if(i + 4 + pktlen > buflen)
+			break;
+		bcopy(&buf[i], &out[outlen], 4 + pktlen);
+		outlen += 4 + pktlen;
+		if(pktlen < 12 || (pkt[0] >> 6) != 2)
+			continue;
+		if(pkt[1] >= 200 && pkt[1] <= 204)
+			continue;
+		if((n = rtpfec_group_add(g, pkt, pktlen)) < 0)
+		{
+			// e.g., a sequence gap from a dropped frame
+			outlen += ff_fec_flush(g, &out[outlen], outsize - outlen);
+			if((n = rtpfec_group_add(g, pkt, pktlen)) < 0)
+				continue;
+		}
+		if(n >= k)
+			outlen += ff_fec_flush(g, &out[outlen], outsize - outlen);
+	}
+	if(video)
+		outlen += ff_fec_flush(g, &out[outlen], outsize - outlen);
+	return outlen;
+}
+
+/**
+ * Write a batch of RTP packets of a frame, from \a start to \a end, and
+ * take their tokens once they are written.
+ */
+static int ff_client_flush(ff_client_t* c, int ch, ff_rtp_au_t* au, uint8_t* buf, int buflen, int start, int end)
+{
+	int i, pktlen;
+	//
+	if(end <= start)
+		return 0;
+	if(rtp_write_bindata(c->rtsp, ch, &buf[start], end - start) < 0)
+		return -1;
+	for(i = start; i < end; i += 4 + pktlen)
+	{
+		pktlen = rd32(&buf[i]);
+		pacer_sent(c->pacer, pktlen, buflen - i, au->queued);
+	}
+	return 0;
+}
+
+/**
+ * Write the RTP packets of a frame to a client.
+ *
+ * Over UDP, the packets of a video frame are paced to be sent by the
+ * frame's deadline instead of at line rate: the packets that fit in the
+ * pacer's bucket are written at once, then the sender waits for tokens.
+ * Audio frames are not held back, but take tokens as well.
+ */
+static int ff_client_write(ff_client_t* c, int ch, ff_rtp_au_t* au, uint8_t* buf, int buflen)
+{
+	RTSPContext* rtsp = c->rtsp;
+	int i, start, pktlen;
+	long long wait;
+	// TCP has its own congestion control
+	if(rtsp->lower_transport[ch] == RTSP_LOWER_TRANSPORT_TCP)
+		return rtsp_write_bindata(rtsp, ch, buf, buflen);
+	if(c->pacer == NULL)
+		return rtp_write_bindata(rtsp, ch, buf, buflen);
+	for(i = start = 0; i + 4 <= buflen; i += 4 + pktlen)
+	{
+		pktlen = rd32(&buf[i]);
+		if(i + 4 + pktlen > buflen)
+			break;
+		// the batch has not taken its tokens yet: ask for them as well
+		if(au->deadline != 0
+		   && (wait = pacer_delay(c->pacer, i - start + pktlen, buflen - start, au->deadline)) > 0)
+		{
+			if(ff_client_flush(c, ch, au, buf, buflen, start, i) < 0)
+				return -1;
+			start = i;
+			usleep(wait);
+		}
+	}
+	return ff_client_flush(c, ch, au, buf, buflen, start, i);
+}
+
+/**
+ * Send a packetized frame to a client. This is an internal function.
+ */
+static int ff_client_send(ff_client_t* c, ff_rtp_au_t* au)
+{
+	RTSPContext* rtsp = c->rtsp;
+	int ch				= au->channelId;
+	int expected		= 0;
+	uint8_t* buf;
+	int buflen;
+	//
+	if(rtsp->fmtctx[ch] == NULL)
+	{
+		// not initialized - disabled?
+		return 0;
+	}
+	if(c->scratchsize < au->buflen)
+	{
+		av_free(c->scratch);
+		if((c->scratch = (uint8_t*)av_malloc(au->buflen)) == NULL)
+		{
+			c->scratchsize = 0;
+			return -1;
+		}
+		c->scratchsize = au->buflen;
+	}
+	bcopy(au->buf, c->scratch, au->buflen);
+	ff_client_rewrite(c, ch, c->scratch, au->buflen);
+	buf	 = c->scratch;
+	buflen = au->buflen;
+	if(c->history[ch] != NULL && rtsp->lower_transport[ch] == RTSP_LOWER_TRANSPORT_UDP)
+		ff_client_keep(c, ch, c->scratch, au->buflen);
+	// TCP does not lose packets
+	if(rtpfec_enabled() && rtsp->lower_transport[ch] == RTSP_LOWER_TRANSPORT_UDP)
+	{
+		int need = 3 * au->buflen + 4 + RTPFEC_HEADER_SIZE + RTPFEC_PACKET_MAX;
+		if(c->fecbufsize < need)
+		{
+			av_free(c->fecbuf);
+			if((c->fecbuf = (uint8_t*)av_malloc(need)) == NULL)
+			{
+				c->fecbufsize = 0;
+				return -1;
+			}
+			c->fecbufsize = need;
+		}
+		buf	 = c->fecbuf;
+		buflen = ff_client_protect(c, ch, c->scratch, au->buflen, c->fecbuf, c->fecbufsize);
+	}
+	if(ff_client_write(c, ch, au, buf, buflen) < 0)
+		return -1;
+	if(au->traced.compare_exchange_strong(expected, 1))
+		ga_trace_stamp(&au->trace, GA_TRACE_SEND);
+	return 0;
+}
+
+/**
+ * Sender thread of a client: sends the queued frames in order.
+ */
+static void* ff_client_sender(void* arg)
+{
+	ff_client_t* c = (ff_client_t*)arg;
+	ff_rtp_au_t* au;
+	//
+	while(true)
+	{
+		pthread_mutex_lock(&c->mutex);
+		while(c->qcount == 0 && c->quit == 0)
+			pthread_cond_wait(&c->cond, &c->mutex);
+		if(c->quit != 0)
+		{
+			pthread_mutex_unlock(&c->mutex);
+			break;
+		}
+		au = c->queue[c->qhead];
+		c->qhead = (c->qhead + 1) % c->qsize;
+		c->qcount--;
+		pthread_mutex_unlock(&c->mutex);
+		//
+		if(ff_client_send(c, au) < 0)
+			ga_error("ffmpeg-server: send to client %p failed (channel %d).\n", c->rtsp, au->channelId);
+		ff_rtp_au_release(au);
+	}
+	return NULL;
+}
+
+/**
+ * Append a packetized frame to a client's sender queue.
+ * The frame is dropped for the client if its queue is full.
+ */
+static void ff_client_enqueue(ff_client_t* c, ff_rtp_au_t* au)
+{
+	pthread_mutex_lock(&c->mutex);
+	if(c->qcount == c->qsize)
+	{
+		pthread_mutex_unlock(&c->mutex);
+		if((c->dropped++ % 100) == 0)
+			ga_error("ffmpeg-server: client %p is too slow, %u frame(s) dropped.\n", c->rtsp, c->dropped);
+		return;
+	}
+	au->refcnt.fetch_add(1, std::memory_order_relaxed);
+	c->queue[(c->qhead + c->qcount) % c->qsize] = au;
+	c->qcount++;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->mutex);
+	return;
+}
+
+static ff_client_t* ff_client_create(RTSPContext* rtsp)
+{
+	ff_client_t* c;
+	char name[32];
+	int i;
+	//
+	if(send_queue_size == 0)
+	{
+		char buf[64];
+		send_queue_size = FF_SEND_QUEUE_DEFAULT;
+		if(ga_conf_readv("rtp-sender-queue", buf, sizeof(buf)) != NULL)
+			send_queue_size = ga_conf_readint("rtp-sender-queue");
+		if(send_queue_size <= 0)
+			send_queue_size = FF_SEND_QUEUE_DEFAULT;
+		if(send_queue_size > FF_SEND_QUEUE_MAX)
+			send_queue_size = FF_SEND_QUEUE_MAX;
+	}
+	if((c = (ff_client_t*)calloc(1, sizeof(ff_client_t))) == NULL)
+		return NULL;
+	if((c->queue = (ff_rtp_au_t**)calloc(send_queue_size, sizeof(ff_rtp_au_t*))) == NULL)
+	{
+		free(c);
+		return NULL;
+	}
+	c->rtsp	= rtsp;
+	c->qsize = send_queue_size;
+	for(i = 0; i < RTSP_CHANNEL_MAX; i++)
+	{
+		c->ssrc[i]	  = av_get_random_seed();
+		c->seqoff[i] = av_get_random_seed() & 0x0ffff;
+		c->tsoff[i]	  = av_get_random_seed();
+		rtpfec_group_init(&c->fec[i], av_get_random_seed() & 0x0ffff);
+		c->rtx[i].c		= c;
+		c->rtx[i].ch	= i;
+		c->history[i] = rtpnack_history_create(ff_client_resend, &c->rtx[i]);
+	}
+	snprintf(name, sizeof(name), "client %p", rtsp);
+	c->pacer = pacer_create(name);
+	pthread_mutex_init(&c->mutex, NULL);
+	pthread_cond_init(&c->cond, NULL);
+	if(pthread_create(&c->thread, NULL, ff_client_sender, c) != 0)
+	{
+		pthread_mutex_destroy(&c->mutex);
+		pthread_cond_destroy(&c->cond);
+		for(i = 0; i < RTSP_CHANNEL_MAX; i++)
+			rtpnack_history_destroy(c->history[i]);
+		pacer_destroy(c->pacer);
+		free(c->queue);
+		free(c);
+		return NULL;
+	}
+	return c;
+}
+
+static void ff_client_destroy(ff_client_t* c)
+{
+	pacer_stats_t ps;
+	int i;
+	//
+	pthread_mutex_lock(&c->mutex);
+	c->quit = 1;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->mutex);
+	pthread_join(c->thread, NULL);
+	// also waits for a retransmission in progress
+	for(i = 0; i < RTSP_CHANNEL_MAX; i++)
+		rtpnack_history_destroy(c->history[i]);
+	pacer_stats(c->pacer, &ps, 0);
+	if(ps.packets > 0)
+		ga_error("ffmpeg-server: client %p paced %llu pkts, queuing delay avg %lldus max %lldus, "
+					"backlog avg %lld bytes, %llu pkts late\n",
+					c->rtsp,
+					ps.packets,
+					ps.delay_sum / (long long)ps.packets,
+					ps.delay_max,
+					ps.backlog_sum / (long long)ps.packets,
+					ps.late);
+	pacer_destroy(c->pacer);
+	// release the frames not sent
+	while(c->qcount > 0)
+	{
+		ff_rtp_au_release(c->queue[c->qhead]);
+		c->qhead = (c->qhead + 1) % c->qsize;
+		c->qcount--;
+	}
+	pthread_mutex_destroy(&c->mutex);
+	pthread_cond_destroy(&c->cond);
+	av_free(c->scratch);
+	av_free(c->fecbuf);
+	free(c->queue);
+	free(c);
+	return;
+}
 
 int ff_server_register_client(void* ccontext)
 {
+	ff_client_t* c;
+	bool registered;
+	// e.g., PLAY after PAUSE
+	pthread_rwlock_rdlock(&cclock);
+	registered = client_context.find(ccontext) != client_context.end();
+	pthread_rwlock_unlock(&cclock);
+	if(registered)
+		return encoder_register_client(ccontext);
+	//
+	if((c = ff_client_create((RTSPContext*)ccontext)) == NULL)
+	{
+		ga_error("ffmpeg-server: cannot create sender for client %p.\n", ccontext);
+		return -1;
+	}
 	if(encoder_register_client(ccontext) < 0)
+	{
+		ff_client_destroy(c);
 		return -1;
+	}
 	//
 	pthread_rwlock_wrlock(&cclock);
-	client_context[ccontext] = ccontext;
+	// the encoders have (re)started for the first client, maybe with new parameters
+	if(client_context.empty())
+		ff_packetizer_reset();
+	client_context[ccontext] = c;
 	pthread_rwlock_unlock(&cclock);
 	return 0;
 }
 
 int ff_server_unregister_client(void* ccontext)
 {
+	map<void*, ff_client_t*>::iterator mi;
+	ff_client_t* c = NULL;
+	//
 	if(encoder_unregister_client(ccontext) < 0)
 		return -1;
 	//
 	pthread_rwlock_wrlock(&cclock);
-	client_context.erase(ccontext);
+	if((mi = client_context.find(ccontext)) != client_context.end())
+	{
+		c = mi->second;
+		client_context.erase(mi);
+	}
+	if(client_context.empty())
+		ff_packetizer_reset();
 	pthread_rwlock_unlock(&cclock);
+	// no more frames are queued for the client
+	if(c != NULL)
+		ff_client_destroy(c);
 	return 0;
 }
 
@@ -81,8 +672,10 @@ static void* ff_server_main(void* arg)
 	socklen_t csinlen;
 #endif
 	struct sockaddr_in csin;
+	int reactor;
 	//
 	server_started = 1;
+	reactor			= rtsp_reactor_init() == 0;
 	//
 	do
 	{
@@ -109,6 +702,11 @@ static void* ff_server_main(void* arg)
 			}
 		} while(0);
 		//
+		if(reactor)
+		{
+			rtsp_reactor_add(cs);
+			continue;
+		}
 		pthread_cancel_init();
 		if(pthread_create(&thread, NULL, rtspserver, &cs) != 0)
 		{
@@ -127,6 +725,9 @@ static int ff_server_init(void* arg)
 	struct sockaddr_in sin;
 	struct RTSPConf* conf = rtspconf_global();
 	//
+	rtpfec_init();
+	rtpnack_init();
+	pacer_init();
 	if((server_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
 	{
 		perror("socket");
@@ -178,11 +779,16 @@ static int ff_server_stop(void* arg)
 	pthread_cancel(server_tid);
 	ga_error("wait for ffmpeg-server termination ...\n");
 	pthread_join(server_tid, &x);
+	// no connection is accepted anymore
+	rtsp_reactor_deinit();
 	return 0;
 }
 
 static int ff_server_deinit(void* arg)
 {
+	pthread_rwlock_wrlock(&cclock);
+	ff_packetizer_reset();
+	pthread_rwlock_unlock(&cclock);
 #ifdef WIN32
 	if(server_socket != INVALID_SOCKET)
 	{
@@ -199,98 +805,169 @@ static int ff_server_deinit(void* arg)
 	return 0;
 }
 
-static int ff_server_send_packet_1(const char* prefix,
-											  void* ctx,
-											  int channelId,
-											  AVPacket* pkt,
-											  int64_t encoderPts,
-											  struct timeval* ptv)
+/**
+ * Set up the shared packetizer of a channel. This is an internal function.
+ *
+ * @param p [out] The packetizer.
+ * @param rtsp [in] A client whose stream of the channel has been set up.
+ * @param channelId [in] The channel.
+ * @return 0 on success, or -1 on error.
+ *
+ * The packetizer is an RTP muxer with a copy of the client's stream
+ * parameters, so it produces the same payload as the client's own muxer.
+ */
+static int ff_packetizer_init(ff_packetizer_t* p, RTSPContext* rtsp, int channelId)
 {
-	int iolen;
-	uint8_t* iobuf;
-	RTSPContext* rtsp = (RTSPContext*)ctx;
+	AVOutputFormat* fmt;
+	AVFormatContext* fmtctx;
+	AVStream* stream;
+	uint8_t* dummybuf = NULL;
 	//
-	if(rtsp->fmtctx[channelId] == NULL)
+	if((fmt = av_guess_format("rtp", NULL, NULL)) == NULL)
 	{
-		// not initialized - disabled?
-		return 0;
+		ga_error("ffmpeg-server: RTP not supported.\n");
+		return -1;
 	}
-	if(encoderPts != (int64_t)AV_NOPTS_VALUE)
+	if((fmtctx = avformat_alloc_context()) == NULL)
 	{
-		pkt->pts = av_rescale_q(encoderPts, rtsp->encoder[channelId]->time_base, rtsp->stream[channelId]->time_base);
+		ga_error("ffmpeg-server: create packetizer context failed.\n");
+		return -1;
 	}
-#ifdef HOLE_PUNCHING
-	if(ffio_open_dyn_packet_buf(&rtsp->fmtctx[channelId]->pb, rtsp->mtu) < 0)
+	fmtctx->oformat	  = fmt;
+	fmtctx->packet_size = rtsp->fmtctx[channelId]->packet_size;
+	if((stream = avformat_new_stream(fmtctx, NULL)) == NULL
+		|| avcodec_copy_context(stream->codec, rtsp->stream[channelId]->codec) < 0)
 	{
-		ga_error("%s: buffer allocation failed.\n", prefix);
+		ga_error("ffmpeg-server: create packetizer stream failed (channel %d).\n", channelId);
+		avformat_free_context(fmtctx);
 		return -1;
 	}
-	if(av_write_frame(rtsp->fmtctx[channelId], pkt) != 0)
+	stream->time_base = rtsp->stream[channelId]->time_base;
+	if(ffio_open_dyn_packet_buf(&fmtctx->pb, rtsp->mtu) < 0)
 	{
-		ga_error("%s: write failed.\n", prefix);
+		avformat_free_context(fmtctx);
 		return -1;
 	}
-	iolen = avio_close_dyn_buf(rtsp->fmtctx[channelId]->pb, &iobuf);
-	if(rtsp->lower_transport[channelId] == RTSP_LOWER_TRANSPORT_TCP)
+	fmtctx->pb->seekable = 0;
+	// anchor the sender reports, so that the clients' presentation times are known
+	fmtctx->start_time_realtime = av_gettime() / 1000 * 1000;
+	if(avformat_write_header(fmtctx, NULL) < 0)
 	{
-		if(rtsp_write_bindata(rtsp, channelId, iobuf, iolen) < 0)
-		{
-			av_free(iobuf);
-			ga_error("%s: RTSP write failed.\n", prefix);
-			return -1;
-		}
+		ga_error("ffmpeg-server: cannot write packetizer header (channel %d).\n", channelId);
+		avio_close_dyn_buf(fmtctx->pb, &dummybuf);
+		av_free(dummybuf);
+		avformat_free_context(fmtctx);
+		return -1;
 	}
-	else
+	avio_close_dyn_buf(fmtctx->pb, &dummybuf);
+	av_free(dummybuf);
+	//
+	p->fmtctx	  = fmtctx;
+	p->stream	  = stream;
+	p->encoder_tb = rtsp->encoder[channelId]->time_base;
+	p->mtu		  = rtsp->mtu;
+	p->starttime  = fmtctx->start_time_realtime;
+	ga_error("ffmpeg-server: shared packetizer created for channel %d, packet size %d.\n",
+				channelId,
+				fmtctx->packet_size);
+	return 0;
+}
+
+/**
+ * Packetize a frame once for all the clients. Called with \a cclock held.
+ *
+ * @return The packetized frame with a reference count of one, or NULL on error.
+ */
+static ff_rtp_au_t* ff_packetize(const char* prefix, int channelId, AVPacket* pkt, int64_t encoderPts)
+{
+	ff_packetizer_t* p = &packetizer[channelId];
+	map<void*, ff_client_t*>::iterator mi;
+	ff_rtp_au_t* au;
+	uint8_t* iobuf;
+	int iolen, partial;
+	int64_t ptv;
+	struct timeval tv;
+	//
+	if(p->fmtctx == NULL)
 	{
-		if(rtp_write_bindata(rtsp, channelId, iobuf, iolen) < 0)
+		for(mi = client_context.begin(); mi != client_context.end(); mi++)
 		{
-			av_free(iobuf);
-			ga_error("%s: RTP write failed.\n", prefix);
-			return -1;
+			if(mi->second->rtsp->fmtctx[channelId] != NULL)
+				break;
 		}
+		// not initialized - disabled?
+		if(mi == client_context.end())
+			return NULL;
+		if(ff_packetizer_init(p, mi->second->rtsp, channelId) < 0)
+			return NULL;
 	}
-	av_free(iobuf);
-#else
-	if(rtsp->lower_transport[channelId] == RTSP_LOWER_TRANSPORT_TCP)
+	if(encoderPts != (int64_t)AV_NOPTS_VALUE)
 	{
-		// if(avio_open_dyn_buf(&rtsp->fmtctx[channelId]->pb) < 0)
-		if(ffio_open_dyn_packet_buf(&rtsp->fmtctx[channelId]->pb, rtsp->mtu) < 0)
-		{
-			ga_error("%s: buffer allocation failed.\n", prefix);
-			return -1;
-		}
+		pkt->pts = av_rescale_q(encoderPts, p->encoder_tb, p->stream->time_base);
+		ptv		= p->starttime + av_rescale_q(pkt->pts, p->stream->time_base, AV_TIME_BASE_Q);
+		tv.tv_sec  = ptv / 1000000;
+		tv.tv_usec = ptv % 1000000;
+		encoder_framelog_put(channelId, encoderPts, &tv);
 	}
-	if(av_write_frame(rtsp->fmtctx[channelId], pkt) != 0)
+	// a slice of a frame, more slices follow
+	partial = pkt->flags & ENCODER_PKT_FLAG_PARTIAL;
+	pkt->flags &= ~ENCODER_PKT_FLAG_PARTIAL;
+	if(ffio_open_dyn_packet_buf(&p->fmtctx->pb, p->mtu) < 0)
 	{
-		ga_error("%s: write failed.\n", prefix);
-		return -1;
+		ga_error("%s: buffer allocation failed.\n", prefix);
+		return NULL;
 	}
-	if(rtsp->lower_transport[channelId] == RTSP_LOWER_TRANSPORT_TCP)
+	if(av_write_frame(p->fmtctx, pkt) != 0)
 	{
-		int iolen;
-		uint8_t* iobuf;
-		iolen = avio_close_dyn_buf(rtsp->fmtctx[channelId]->pb, &iobuf);
-		if(rtsp_write_bindata(rtsp, channelId, iobuf, iolen) < 0)
-		{
-			av_free(iobuf);
-			ga_error("%s: write failed.\n", prefix);
-			return -1;
-		}
+		ga_error("%s: write failed.\n", prefix);
+		iolen = avio_close_dyn_buf(p->fmtctx->pb, &iobuf);
 		av_free(iobuf);
+		return NULL;
 	}
-#endif
-	return 0;
+	iolen = avio_close_dyn_buf(p->fmtctx->pb, &iobuf);
+	if(partial)
+		ff_rtp_clear_marker(iobuf, iolen);
+	//
+	au				 = new ff_rtp_au_t();
+	au->channelId = channelId;
+	au->buf		 = iobuf;
+	au->buflen	 = iolen;
+	au->queued	 = ga_trace_now();
+	au->deadline = 0;
+	// the slices of a frame share its deadline
+	if(channelId < video_source_channels())
+	{
+		if(p->partial == 0)
+			p->framestart = au->queued;
+		au->deadline = p->framestart + pacer_interval();
+	}
+	p->partial = partial;
+	au->refcnt.store(1);
+	au->traced.store(0);
+	return au;
 }
 
 static int ff_server_send_packet(const char* prefix, int channelId, AVPacket* pkt, int64_t encoderPts, struct timeval* ptv)
 {
-	map<void*, void*>::iterator mi;
+	map<void*, ff_client_t*>::iterator mi;
+	ga_trace_t* trace = encoder_get_trace(channelId);
+	ff_rtp_au_t* au;
+	// packetized once, and queued to the sender of each client
 	pthread_rwlock_rdlock(&cclock);
-	for(mi = client_context.begin(); mi != client_context.end(); mi++)
+	if((au = ff_packetize(prefix, channelId, pkt, encoderPts)) != NULL)
 	{
-		ff_server_send_packet_1(prefix, mi->second, channelId, pkt, encoderPts, ptv);
+		ga_trace_stamp(trace, GA_TRACE_QUEUE);
+		if(trace != NULL)
+			au->trace = *trace;
+		for(mi = client_context.begin(); mi != client_context.end(); mi++)
+		{
+			ff_client_enqueue(mi->second, au);
+		}
 	}
 	pthread_rwlock_unlock(&cclock);
+	if(au != NULL)
+		ff_rtp_au_release(au);
+	encoder_set_trace(channelId, NULL);
 	return 0;
 }
 
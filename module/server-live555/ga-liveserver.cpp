@@ -3,6 +3,7 @@
 #include "encoder-common.h"
 #include "ga-common.h"
 #include "ga-mediasubsession.h"
+#include "ratectl.h"
 #include "rtspconf.h"
 #include "vsource.h"
 
@@ -138,11 +139,6 @@ static void qos_server_report(void* clientData)
 				continue;
 			}
 			//
-			elapsed = tvdiff_us(&now, &mj->second.timestamp);
-			if(elapsed < QOS_SERVER_REPORT_INTERVAL_MS * 1000)
-				continue;
-			mj->second.timestamp = now;
-			//
 			pkts_lost = stats->totNumPacketsLost();
 			stats->getTotalPacketCount(pkts_sent_hi, pkts_sent_lo);
 			stats->getTotalOctetCount(bytes_sent_hi, bytes_sent_lo);
@@ -150,6 +146,13 @@ static void qos_server_report(void* clientData)
 			pkts_sent  = (pkts_sent << 32) | pkts_sent_lo;
 			bytes_sent = bytes_sent_hi;
 			bytes_sent = (bytes_sent << 32) | bytes_sent_lo;
+			// the bitrate controller is fed at every check
+			ratectl_rtcp(ssrc, pkts_sent, pkts_lost, 1000000LL * stats->roundTripDelay() / 65536);
+			//
+			elapsed = tvdiff_us(&now, &mj->second.timestamp);
+			if(elapsed < QOS_SERVER_REPORT_INTERVAL_MS * 1000)
+				continue;
+			mj->second.timestamp = now;
 			// delta
 			d_pkt_lost	= pkts_lost - mj->second.pkts_lost;
 			d_pkt_sent	= pkts_sent - mj->second.pkts_sent;
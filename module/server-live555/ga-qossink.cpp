@@ -21,6 +21,197 @@
 #include "ga-common.h"
 #include "ga-liveserver.h"
 
+#include <GroupsockHelper.hh>
+#include <list>
+#include <pthread.h>
+
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A packet to be sent again, or a FEC packet, by a sink.
+ */
+typedef struct qos_rtx_s {
+	RTPSink* sink;
+	int fec;						 /**< A FEC packet, sent to all the clients */
+	int hasto;					 /**< The client that reported the loss is known */
+	struct sockaddr_in to;	 /**< Its RTP address */
+	int len;
+	unsigned char data[RTPFEC_HEADER_SIZE + RTPFEC_PACKET_MAX];
+} qos_rtx_t;
+
+static EventTriggerId rtx_trigger = 0;
+static pthread_mutex_t rtx_mutex	 = PTHREAD_MUTEX_INITIALIZER;
+static std::list<qos_rtx_t*> rtx_pending;
+
+/**
+ * Send the pending retransmissions. Called from the live555 thread.
+ *
+ * The sinks are shared by the clients of a stream, so the groupsock sends
+ * to all of them. A retransmission goes to the client that reported the
+ * loss only, through the socket of the groupsock. If that client is not
+ * known, it is sent only if the stream has a single client. FEC packets
+ * go to all the clients.
+ */
+static void qos_rtx_deliver(void* clientData)
+{
+	std::list<qos_rtx_t*> pending;
+	std::list<qos_rtx_t*>::iterator li;
+	Groupsock* gs;
+	//
+	pthread_mutex_lock(&rtx_mutex);
+	pending.swap(rtx_pending);
+	pthread_mutex_unlock(&rtx_mutex);
+	for(li = pending.begin(); li != pending.end(); li++)
+	{
+		gs = &(*li)->sink->groupsockBeingUsed();
+		if((*li)->fec)
+		{
+			gs->output((*li)->sink->envir(), (*li)->data, (*li)->len);
+		}
+		else if((*li)->hasto)
+		{
+			sendto(gs->socketNum(), (const char*)(*li)->data, (*li)->len, 0, (struct sockaddr*)&(*li)->to, sizeof((*li)->to));
+		}
+		else if(gs->hasMultipleDestinations() == False)
+		{
+			gs->output((*li)->sink->envir(), (*li)->data, (*li)->len);
+		}
+		free(*li);
+	}
+	return;
+}
+
+/**
+ * Queue a retransmission for the live555 thread. Called from the control thread.
+ */
+static void qos_rtx_send(void* arg, const struct sockaddr_in* to, const unsigned char* pkt, int len)
+{
+	RTPSink* sink = (RTPSink*)arg;
+	qos_rtx_t* r;
+	//
+	if((r = (qos_rtx_t*)malloc(sizeof(qos_rtx_t))) == NULL)
+		return;
+	r->sink	= sink;
+	r->fec	= 0;
+	r->hasto = to != NULL;
+	if(to != NULL)
+		r->to = *to;
+	r->len = len;
+	bcopy(pkt, r->data, len);
+	pthread_mutex_lock(&rtx_mutex);
+	rtx_pending.push_back(r);
+	pthread_mutex_unlock(&rtx_mutex);
+	sink->envir().taskScheduler().triggerEvent(rtx_trigger, NULL);
+	return;
+}
+
+static rtpnack_history_t* qos_rtx_attach(RTPSink* sink)
+{
+	if(rtpnack_enabled() == 0)
+		return NULL;
+	if(rtx_trigger == 0)
+		rtx_trigger = sink->envir().taskScheduler().createEventTrigger(qos_rtx_deliver);
+	return rtpnack_history_create(qos_rtx_send, sink);
+}
+
+/**
+ * Drop a sink's history and its pending packets, retransmissions and FEC.
+ */
+static void qos_rtx_detach(RTPSink* sink, rtpnack_history_t* history)
+{
+	std::list<qos_rtx_t*>::iterator li;
+	//
+	rtpnack_history_destroy(history);
+	if(rtx_trigger == 0)
+		return;
+	pthread_mutex_lock(&rtx_mutex);
+	for(li = rtx_pending.begin(); li != rtx_pending.end();)
+	{
+		if((*li)->sink != sink)
+		{
+			li++;
+			continue;
+		}
+		free(*li);
+		li = rtx_pending.erase(li);
+	}
+	pthread_mutex_unlock(&rtx_mutex);
+	return;
+}
+
+/*
+ * The H.264 and H.265 sinks put one NAL unit or fragment in each packet,
+ * with no special header, so the RTP header is right before the frame.
+ * The marker bit and the timestamp are set by the parent class.
+ */
+static void qos_rtx_keep(rtpnack_history_t* history, unsigned char* frameStart, unsigned numBytesInFrame)
+{
+	if(history != NULL)
+		rtpnack_history_put(history, frameStart - 12, 12 + numBytesInFrame);
+	return;
+}
+
+/*
+ * FEC for the H.264 and H.265 sinks. A FEC packet is queued when the last
+ * media packet of its group is built, and sent by qos_rtx_deliver() once
+ * that packet is out. Groups end with the frame, so that no lost packet
+ * waits for the next frame to be recovered.
+ */
+static rtpfec_group_t* qos_fec_attach(RTPSink* sink)
+{
+	rtpfec_group_t* g;
+	//
+	if(rtpfec_enabled() == 0)
+		return NULL;
+	if((g = (rtpfec_group_t*)malloc(sizeof(rtpfec_group_t))) == NULL)
+		return NULL;
+	rtpfec_group_init(g, our_random32() & 0x0ffff);
+	if(rtx_trigger == 0)
+		rtx_trigger = sink->envir().taskScheduler().createEventTrigger(qos_rtx_deliver);
+	return g;
+}
+
+static void qos_fec_flush(RTPSink* sink, rtpfec_group_t* g)
+{
+	qos_rtx_t* r;
+	//
+	if((r = (qos_rtx_t*)malloc(sizeof(qos_rtx_t))) == NULL)
+		return;
+	if((r->len = rtpfec_group_flush(g, rtpfec_payload_type(), r->data, sizeof(r->data))) <= 0)
+	{
+		free(r);
+		return;
+	}
+	r->sink	= sink;
+	r->fec	= 1;
+	r->hasto = 0;
+	pthread_mutex_lock(&rtx_mutex);
+	rtx_pending.push_back(r);
+	pthread_mutex_unlock(&rtx_mutex);
+	sink->envir().taskScheduler().triggerEvent(rtx_trigger, NULL);
+	return;
+}
+
+static void qos_fec_protect(RTPSink* sink, rtpfec_group_t* g, unsigned char* frameStart, unsigned numBytesInFrame)
+{
+	unsigned char* pkt = frameStart - 12;
+	int n, len = 12 + numBytesInFrame;
+	//
+	if(g == NULL)
+		return;
+	if((n = rtpfec_group_add(g, pkt, len)) < 0)
+	{
+		// e.g., a sequence gap from a dropped frame
+		qos_fec_flush(sink, g);
+		if((n = rtpfec_group_add(g, pkt, len)) < 0)
+			return;
+	}
+	// the marker bit ends the frame
+	if(n >= rtpfec_group_size() || (pkt[1] & 0x80) != 0)
+		qos_fec_flush(sink, g);
+	return;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 QoSMPEG1or2AudioRTPSink* QoSMPEG1or2AudioRTPSink ::createNew(UsageEnvironment& env, Groupsock* RTPgs)
@@ -241,9 +432,31 @@ QoSH264VideoRTPSink ::QoSH264VideoRTPSink(UsageEnvironment& env,
 	H264VideoRTPSink(env, RTPgs, rtpPayloadFormat, sps, spsSize, pps, ppsSize)
 {
 	qos_server_add_sink("H.264", this);
+	history = qos_rtx_attach(this);
+	fec	  = qos_fec_attach(this);
+}
+
+QoSH264VideoRTPSink ::~QoSH264VideoRTPSink()
+{
+	qos_rtx_detach(this, history);
+	free(fec);
+	qos_server_remove_sink(this);
 }
 
-QoSH264VideoRTPSink ::~QoSH264VideoRTPSink() { qos_server_remove_sink(this); }
+void QoSH264VideoRTPSink ::doSpecialFrameHandling(unsigned fragmentationOffset,
+																 unsigned char* frameStart,
+																 unsigned numBytesInFrame,
+																 struct timeval framePresentationTime,
+																 unsigned numRemainingBytes)
+{
+	H264VideoRTPSink::doSpecialFrameHandling(
+	  fragmentationOffset, frameStart, numBytesInFrame, framePresentationTime, numRemainingBytes);
+	if(isFirstFrameInPacket())
+	{
+		qos_rtx_keep(history, frameStart, numBytesInFrame);
+		qos_fec_protect(this, fec, frameStart, numBytesInFrame);
+	}
+}
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -277,9 +490,31 @@ QoSH265VideoRTPSink ::QoSH265VideoRTPSink(UsageEnvironment& env,
 	H265VideoRTPSink(env, RTPgs, rtpPayloadFormat, vps, vpsSize, sps, spsSize, pps, ppsSize)
 {
 	qos_server_add_sink("H.265", this);
+	history = qos_rtx_attach(this);
+	fec	  = qos_fec_attach(this);
 }
 
-QoSH265VideoRTPSink ::~QoSH265VideoRTPSink() { qos_server_remove_sink(this); }
+QoSH265VideoRTPSink ::~QoSH265VideoRTPSink()
+{
+	qos_rtx_detach(this, history);
+	free(fec);
+	qos_server_remove_sink(this);
+}
+
+void QoSH265VideoRTPSink ::doSpecialFrameHandling(unsigned fragmentationOffset,
+																 unsigned char* frameStart,
+																 unsigned numBytesInFrame,
+																 struct timeval framePresentationTime,
+																 unsigned numRemainingBytes)
+{
+	H265VideoRTPSink::doSpecialFrameHandling(
+	  fragmentationOffset, frameStart, numBytesInFrame, framePresentationTime, numRemainingBytes);
+	if(isFirstFrameInPacket())
+	{
+		qos_rtx_keep(history, frameStart, numBytesInFrame);
+		qos_fec_protect(this, fec, frameStart, numBytesInFrame);
+	}
+}
 
 //////////////////////////////////////////////////////////////////////////////
 
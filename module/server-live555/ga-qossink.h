@@ -30,6 +30,10 @@
 #include <VP8VideoRTPSink.hh>
 #include <VorbisAudioRTPSink.hh>
 
+#include "encoder-common.h"
+#include "rtpfec.h"
+#include "rtpnack.h"
+
 //////////////////////////////////////////////////////////////////////////////
 
 class QoSMPEG1or2AudioRTPSink : public MPEG1or2AudioRTPSink
@@ -172,6 +176,15 @@ class QoSH264VideoRTPSink : public H264VideoRTPSink
 							  u_int8_t const* pps = NULL,
 							  unsigned ppsSize	 = 0);
 	~QoSH264VideoRTPSink();
+	virtual void doSpecialFrameHandling(unsigned fragmentationOffset,
+												  unsigned char* frameStart,
+												  unsigned numBytesInFrame,
+												  struct timeval framePresentationTime,
+												  unsigned numRemainingBytes);
+
+  private:
+	rtpnack_history_t* history; /**< Sent packets, for NACK retransmission */
+	rtpfec_group_t* fec;			 /**< FEC group being built, or NULL */
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -201,6 +214,15 @@ class QoSH265VideoRTPSink : public H265VideoRTPSink
 							  u_int8_t const* pps = NULL,
 							  unsigned ppsSize	 = 0);
 	~QoSH265VideoRTPSink();
+	virtual void doSpecialFrameHandling(unsigned fragmentationOffset,
+												  unsigned char* frameStart,
+												  unsigned numBytesInFrame,
+												  struct timeval framePresentationTime,
+												  unsigned numRemainingBytes);
+
+  private:
+	rtpnack_history_t* history; /**< Sent packets, for NACK retransmission */
+	rtpfec_group_t* fec;			 /**< FEC group being built, or NULL */
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -40,6 +40,7 @@ GAVideoLiveSource* GAVideoLiveSource ::createNew(UsageEnvironment& env, int cid
 
 GAVideoLiveSource ::GAVideoLiveSource(UsageEnvironment& env, int cid) : FramedSource(env)
 {
+	char name[32];
 	//
 	if(referenceCount == 0)
 	{
@@ -53,6 +54,11 @@ GAVideoLiveSource ::GAVideoLiveSource(UsageEnvironment& env, int cid) : FramedSo
 	// Any instance-specific initialization of the device would be done here:
 	this->channelId  = cid;
 	vLiveSource[cid] = this;
+	snprintf(name, sizeof(name), "video %d", cid);
+	pacer		 = pacer_create(name);
+	pacingTask = NULL;
+	frameStart = 0;
+	bzero(&framePts, sizeof(framePts));
 	if(eventTriggerId[cid] == 0)
 	{
 		eventTriggerId[cid] = envir().taskScheduler().createEventTrigger(deliverFrame0);
@@ -63,7 +69,20 @@ GAVideoLiveSource ::GAVideoLiveSource(UsageEnvironment& env, int cid) : FramedSo
 GAVideoLiveSource ::~GAVideoLiveSource()
 {
 	// Any instance-specific 'destruction' (i.e., resetting) of the device would be done here:
+	pacer_stats_t ps;
 	vLiveSource[this->channelId] = NULL;
+	envir().taskScheduler().unscheduleDelayedTask(pacingTask);
+	pacer_stats(pacer, &ps, 0);
+	if(ps.packets > 0)
+		ga_error("live555: video %d paced %llu NAL units, queuing delay avg %lldus max %lldus, "
+					"backlog avg %lld bytes, %llu late\n",
+					this->channelId,
+					ps.packets,
+					ps.delay_sum / (long long)ps.packets,
+					ps.delay_max,
+					ps.backlog_sum / (long long)ps.packets,
+					ps.late);
+	pacer_destroy(pacer);
 	--referenceCount;
 	if(referenceCount == 0)
 	{
@@ -80,6 +99,13 @@ GAVideoLiveSource ::~GAVideoLiveSource()
 
 void GAVideoLiveSource ::deliverFrame0(void* clientData) { ((GAVideoLiveSource*)clientData)->deliverFrame(); }
 
+void GAVideoLiveSource ::deliverPaced(void* clientData)
+{
+	GAVideoLiveSource* source = (GAVideoLiveSource*)clientData;
+	source->pacingTask		  = NULL;
+	source->deliverFrame();
+}
+
 void GAVideoLiveSource ::doGetNextFrame()
 {
 	// This function is called (by our 'downstream' object) when it asks for new data.
@@ -124,6 +150,8 @@ void GAVideoLiveSource ::deliverFrame()
 
 	if(!isCurrentlyAwaitingData())
 		return; // we're not ready for the data yet
+	if(pacingTask != NULL)
+		return; // waiting for the pacer
 
 	encoder_packet_t pkt;
 	u_int8_t* newFrameDataStart = NULL; //%%% TO BE WRITTEN %%%
@@ -133,6 +161,27 @@ void GAVideoLiveSource ::deliverFrame()
 	if(newFrameDataStart == NULL)
 		return;
 	newFrameSize = pkt.size;
+	// Pace the NAL units of a frame to be sent by one frame interval after
+	// the first one was ready. The RTP sink sends the packets of a NAL unit
+	// at once, so the slices of slice-max-size, set by the server when pacing
+	// is enabled, make the pacing per packet.
+	// The backlog is what is queued of the frame: the later frames have
+	// their own deadlines.
+	if(pacer != NULL)
+	{
+		long long wait, backlog = encoder_pktqueue_frame_size(this->channelId);
+		if(frameStart == 0 || pkt.pts_tv.tv_sec != framePts.tv_sec || pkt.pts_tv.tv_usec != framePts.tv_usec)
+		{
+			framePts	  = pkt.pts_tv;
+			frameStart = pkt.trace.ts[GA_TRACE_QUEUE] != 0 ? pkt.trace.ts[GA_TRACE_QUEUE] : ga_trace_now();
+		}
+		if((wait = pacer_delay(pacer, newFrameSize, backlog, frameStart + pacer_interval())) > 0)
+		{
+			pacingTask = envir().taskScheduler().scheduleDelayedTask(wait, deliverPaced, this);
+			return;
+		}
+		pacer_sent(pacer, newFrameSize, backlog, frameStart);
+	}
 #ifdef DISCRETE_FRAMER // special handling for packets with startcode
 	if(remove_startcode != 0)
 	{
@@ -171,6 +220,11 @@ void GAVideoLiveSource ::deliverFrame()
 	// If the device is *not* a 'live source' (e.g., it comes instead from a file or buffer), then set "fDurationInMicroseconds"
 	// here.
 	memmove(fTo, newFrameDataStart, fFrameSize);
+	// the last part of a frame is handed to the RTP sink
+	if(fFrameSize == newFrameSize)
+		ga_trace_stamp(&pkt.trace, GA_TRACE_SEND);
+	// for mapping the clients' frame loss reports to encoder pts
+	encoder_framelog_put(channelId, pkt.pts_int64, &fPresentationTime);
 
 	encoder_pktqueue_pop_front(channelId);
 
@@ -19,7 +19,9 @@
 #ifndef __GA_VIDEOLIVESOURCE_H__
 #define __GA_VIDEOLIVESOURCE_H__
 
+#include "encoder-common.h"
 #include "ga-module.h"
+#include "pacer.h"
 
 #include <FramedSource.hh>
 
@@ -37,8 +39,14 @@ class GAVideoLiveSource : public FramedSource
 	static int remove_startcode;
 	static ga_module_t* m;
 	int channelId;
+	// send-side pacing, one NAL unit at a time
+	pacer_t* pacer;
+	TaskToken pacingTask;
+	struct timeval framePts; /**< Presentation time of the frame being sent */
+	long long frameStart;	 /**< Time its first NAL unit was ready to be sent */
 	//
 	static void deliverFrame0(void* clientData);
+	static void deliverPaced(void* clientData);
 	void doGetNextFrame();
 	// virtual void doStopGettingFrames(); // optional
 	void deliverFrame();
@@ -31,11 +31,17 @@
 
 #include "encoder-common.h"
 #include "ga-common.h"
+#include "ga-conf.h"
 #include "ga-liveserver.h"
 #include "ga-module.h"
+#include "pacer.h"
+#include "rtpfec.h"
+#include "rtpnack.h"
 #include "rtspconf.h"
 #include "server-live555.h"
 
+#define LIVE_PACING_SLICE_SIZE "1400" /**< Slice size that fits a packet of the RTP sink */
+
 static pthread_t server_tid;
 
 int live_server_register_client(void* ccontext)
@@ -52,9 +58,31 @@ int live_server_unregister_client(void* ccontext)
 	return 0;
 }
 
+/**
+ * The RTP sink sends the packets of a NAL unit back to back, so the video
+ * source paces whole NAL units. A key frame coded as a single slice would
+ * still leave at line rate: when pacing is enabled, have the encoder cut
+ * the frames into slices of one packet, unless a slice size is configured.
+ * This is called on module load, before the encoder reads its parameters.
+ */
+static void live_server_slice_pacing()
+{
+	char buf[64];
+	if(ga_conf_readbool("rtp-pacing", 0) == 0)
+		return;
+	if(ga_conf_mapreadv("video-specific", "slice-max-size", buf, sizeof(buf)) != NULL)
+		return;
+	ga_conf_mapwritev("video-specific", "slice-max-size", LIVE_PACING_SLICE_SIZE);
+	ga_error("live555: rtp-pacing sends a packet per slice, video-specific[slice-max-size] = %s\n",
+				LIVE_PACING_SLICE_SIZE);
+	return;
+}
+
 static int live_server_init(void* arg)
 {
-	// nothing to do now
+	rtpfec_init();
+	rtpnack_init();
+	pacer_init();
 	return 0;
 }
 
@@ -101,6 +129,7 @@ ga_module_t* module_load()
 	m.send_packet = live_server_send_packet;
 	//
 	encoder_register_sinkserver(&m);
+	live_server_slice_pacing();
 	//
 	return &m;
 }
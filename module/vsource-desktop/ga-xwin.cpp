@@ -20,12 +20,17 @@
 
 #include "ga-common.h"
 
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#include <map>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
+#define DAMAGE_HISTORY 16 /**< Captures remembered to refresh reused frame buffers, must exceed the pipe pool size */
+
 static int screenNumber;
 static int width, height, depth;
 
@@ -38,6 +43,27 @@ static XImage* image	 = NULL;
 static XShmSegmentInfo __xshminfo;
 static bool __xshmattached = false;
 
+// damage-tracked capture: image is the persistent shadow of the screen,
+// dirty regions are fetched through damageimage and copied into image
+static Damage damage					= None;
+static XserverRegion damageregion = None;
+static int damageevent				= 0;
+static XImage* damageimage			= NULL;
+static XShmSegmentInfo __damageshminfo;
+static bool __damageshmattached = false;
+// pending dirty rectangles of the screen, or full refresh
+static bool damagefull = true;
+static int ndamage	  = 0;
+static vsource_rect_t damagerect[VIDEO_SOURCE_DIRTY_MAX];
+// dirty rectangles of recent captures, indexed by capture sequence number
+static struct {
+	bool full;
+	int n;
+	vsource_rect_t rect[VIDEO_SOURCE_DIRTY_MAX];
+} history[DAMAGE_HISTORY];
+static unsigned long long captureseq = 0;
+static std::map<char*, unsigned long long> bufferseq; /**< Capture written into each frame buffer */
+
 int ga_xwin_init(const char* displayname, gaImage* gaimg)
 {
 	int ignore = 0;
@@ -115,6 +141,32 @@ void
 // ga_xwin_deinit(Display *display, XImage *image) {
 ga_xwin_deinit()
 {
+	//
+	if(damage != None)
+	{
+		XDamageDestroy(display, damage);
+		damage = None;
+	}
+	if(damageregion != None)
+	{
+		XFixesDestroyRegion(display, damageregion);
+		damageregion = None;
+	}
+	if(__damageshmattached)
+	{
+		XShmDetach(display, &__damageshminfo);
+		__damageshmattached = false;
+	}
+	if(__damageshminfo.shmaddr)
+	{
+		shmdt(__damageshminfo.shmaddr);
+		shmctl(__damageshminfo.shmid, IPC_RMID, NULL);
+		__damageshminfo.shmaddr = NULL;
+	}
+	if(damageimage)
+		XDestroyImage(damageimage);
+	damageimage = NULL;
+	bufferseq.clear();
 	//
 	if(__xshmattached)
 	{
@@ -157,26 +209,335 @@ void ga_xwin_imageinfo(XImage* image)
 	return;
 }
 
-void ga_xwin_capture(char* buf, int buflen, struct gaRect* rect)
+/**
+ * Enable damage-tracked capture.
+ *
+ * @return 0 on success, or -1 if XDamage is not supported.
+ *
+ * Once enabled, only the regions reported by the XDamage extension
+ * are fetched from the X server, and ga_xwin_damage_pending() tells
+ * whether the screen has changed since the last capture.
+ */
+int ga_xwin_damage_init()
+{
+	int errorbase, fixesevent, major = 1, minor = 1;
+	//
+	if(display == NULL || image == NULL)
+		return -1;
+	if(damage != None)
+		return 0;
+	if(XDamageQueryExtension(display, &damageevent, &errorbase) == False
+		|| XDamageQueryVersion(display, &major, &minor) == 0)
+	{
+		ga_error("XDamage extension not supported.\n");
+		return -1;
+	}
+	if(XFixesQueryExtension(display, &fixesevent, &errorbase) == False)
+	{
+		ga_error("XFixes extension not supported.\n");
+		return -1;
+	}
+	major = 2;
+	minor = 0;
+	XFixesQueryVersion(display, &major, &minor);
+	// scratch image for dirty regions, resized on each fetch
+	bzero(&__damageshminfo, sizeof(__damageshminfo));
+	if((damageimage = XShmCreateImage(display,
+												 XDefaultVisual(display, screenNumber),
+												 depth,
+												 ZPixmap,
+												 NULL,
+												 &__damageshminfo,
+												 width,
+												 height))
+		== NULL)
+	{
+		ga_error("XShmCreateImage failed (damage).\n");
+		return -1;
+	}
+	if((__damageshminfo.shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height, IPC_CREAT | 0777)) < 0)
+	{
+		perror("shmget");
+		goto damage_init_error;
+	}
+	__damageshminfo.shmaddr = damageimage->data = (char*)shmat(__damageshminfo.shmid, 0, 0);
+	__damageshminfo.readOnly = False;
+	if(XShmAttach(display, &__damageshminfo) == 0)
+	{
+		ga_error("XShmAttach failed (damage).\n");
+		goto damage_init_error;
+	}
+	__damageshmattached = true;
+	//
+	damage		 = XDamageCreate(display, rootWindow, XDamageReportNonEmpty);
+	damageregion = XFixesCreateRegion(display, NULL, 0);
+	damagefull	 = true;
+	ndamage		 = 0;
+	ga_error("XDamage extension version %d.%d: damage-tracked capture enabled\n", major, minor);
+	return 0;
+damage_init_error:
+	if(__damageshminfo.shmaddr)
+	{
+		shmdt(__damageshminfo.shmaddr);
+		shmctl(__damageshminfo.shmid, IPC_RMID, NULL);
+		__damageshminfo.shmaddr = NULL;
+	}
+	XDestroyImage(damageimage);
+	damageimage = NULL;
+	return -1;
+}
+
+/**
+ * Clip rectangle \a r to the rectangle (\a x, \a y, \a w, \a h).
+ *
+ * @return 0 if the clipped rectangle is empty, otherwise 1.
+ */
+static int damage_clip(vsource_rect_t* r, int x, int y, int w, int h)
+{
+	int right	= r->x + r->width;
+	int bottom = r->y + r->height;
+	if(r->x < x)
+		r->x = x;
+	if(r->y < y)
+		r->y = y;
+	if(right > x + w)
+		right = x + w;
+	if(bottom > y + h)
+		bottom = y + h;
+	r->width	 = right - r->x;
+	r->height = bottom - r->y;
+	return (r->width > 0 && r->height > 0) ? 1 : 0;
+}
+
+/**
+ * Add a dirty rectangle of the screen.
+ * Rectangles are merged into their bounding box when there are too many,
+ * and a full refresh is requested when they cover half of the screen.
+ */
+static void damage_add(int x, int y, int w, int h)
+{
+	vsource_rect_t r = {x, y, w, h};
+	long long area	  = 0;
+	int i;
+	//
+	if(damagefull || damage_clip(&r, 0, 0, width, height) == 0)
+		return;
+	if(ndamage >= VIDEO_SOURCE_DIRTY_MAX)
+	{
+		int right = r.x + r.width, bottom = r.y + r.height;
+		for(i = 0; i < ndamage; i++)
+		{
+			if(damagerect[i].x < r.x)
+				r.x = damagerect[i].x;
+			if(damagerect[i].y < r.y)
+				r.y = damagerect[i].y;
+			if(damagerect[i].x + damagerect[i].width > right)
+				right = damagerect[i].x + damagerect[i].width;
+			if(damagerect[i].y + damagerect[i].height > bottom)
+				bottom = damagerect[i].y + damagerect[i].height;
+		}
+		r.width	= right - r.x;
+		r.height = bottom - r.y;
+		ndamage	= 0;
+	}
+	damagerect[ndamage++] = r;
+	for(i = 0; i < ndamage; i++)
+		area += (long long)damagerect[i].width * damagerect[i].height;
+	if(area * 2 >= (long long)width * height)
+		damagefull = true;
+}
+
+/**
+ * Collect the damage reported by the X server.
+ *
+ * @param rect [in] Crop rectangle, or NULL for the whole screen.
+ * @return 1 if the captured region has changed since the last capture, otherwise 0.
+ *
+ * It always returns 1 if damage-tracked capture is not enabled.
+ */
+int ga_xwin_damage_pending(struct gaRect* rect)
+{
+	XEvent ev;
+	bool notified = false;
+	int i, n;
+	//
+	if(damage == None)
+		return 1;
+	while(XPending(display) > 0)
+	{
+		XNextEvent(display, &ev);
+		if(ev.type == damageevent + XDamageNotify)
+			notified = true;
+	}
+	if(notified)
+	{
+		XRectangle* rects;
+		int nrects = 0;
+		// move the damage into our region, which also re-arms the notification
+		XDamageSubtract(display, damage, None, damageregion);
+		if((rects = XFixesFetchRegion(display, damageregion, &nrects)) != NULL)
+		{
+			for(i = 0; i < nrects; i++)
+				damage_add(rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+			XFree(rects);
+		}
+	}
+	if(damagefull)
+		return 1;
+	if(rect == NULL)
+		return ndamage > 0 ? 1 : 0;
+	// only the cropped region is captured: the damage elsewhere is not needed,
+	// and would otherwise build up until a full refresh is requested
+	for(i = n = 0; i < ndamage; i++)
+	{
+		vsource_rect_t r = damagerect[i];
+		if(damage_clip(&r, rect->left, rect->top, rect->width, rect->height) != 0)
+			damagerect[n++] = r;
+	}
+	ndamage = n;
+	return ndamage > 0 ? 1 : 0;
+}
+
+/**
+ * Fetch the pending dirty rectangles into the shadow image.
+ */
+static void damage_fetch()
+{
+	int i, j, bpp = image->bits_per_pixel / 8;
+	//
+	for(i = 0; i < ndamage; i++)
+	{
+		vsource_rect_t* r = &damagerect[i];
+		char *src, *dst;
+		// XShmGetImage fetches the size of the image
+		damageimage->width			 = r->width;
+		damageimage->height			 = r->height;
+		damageimage->bytes_per_line = r->width * bpp;
+		if(XShmGetImage(display, rootWindow, damageimage, r->x, r->y, XAllPlanes()) == 0)
+		{
+			ga_error("FATAL: XShmGetImage failed (damage).\n");
+			exit(-1);
+		}
+		src = damageimage->data;
+		dst = image->data + image->bytes_per_line * r->y + bpp * r->x;
+		for(j = 0; j < r->height; j++)
+		{
+			bcopy(src, dst, damageimage->bytes_per_line);
+			src += damageimage->bytes_per_line;
+			dst += image->bytes_per_line;
+		}
+	}
+}
+
+/**
+ * Copy a region of the shadow image into a frame buffer.
+ */
+static void copy_region(char* buf, struct gaRect* rect, vsource_rect_t* r)
+{
+	int i, bpp = image->bits_per_pixel / 8;
+	int dstlinesize = rect ? rect->linesize : image->bytes_per_line;
+	char *src, *dst;
+	//
+	src = image->data + image->bytes_per_line * r->y + bpp * r->x;
+	dst = buf + dstlinesize * (r->y - (rect ? rect->top : 0)) + bpp * (r->x - (rect ? rect->left : 0));
+	for(i = 0; i < r->height; i++)
+	{
+		bcopy(src, dst, bpp * r->width);
+		src += image->bytes_per_line;
+		dst += dstlinesize;
+	}
+}
+
+/**
+ * Capture the screen.
+ *
+ * @param buf [out] Frame buffer.
+ * @param buflen [in] Size of \a buf.
+ * @param rect [in] Crop rectangle, or NULL for the whole screen.
+ * @param dirty [out] Dirty rectangles in frame coordinates,
+ *	must hold VIDEO_SOURCE_DIRTY_MAX rectangles. Can be NULL.
+ * @return Number of dirty rectangles, or 0 if the whole frame may have changed.
+ *
+ * With damage-tracked capture, only the dirty regions are fetched
+ * from the X server, and a frame buffer reused from the pipe pool
+ * is only refreshed with the regions changed since it was last written.
+ */
+int ga_xwin_capture(char* buf, int buflen, struct gaRect* rect, vsource_rect_t* dirty)
 {
 	int frameSize = image->height * image->bytes_per_line;
+	int i, ndirty = 0;
+	unsigned long long seq, last, s;
+	std::map<char*, unsigned long long>::iterator mi;
+	bool full;
+	//
 	if(buflen < frameSize)
 	{
 		ga_error("FATAL: insufficient buffer size\n");
 		exit(-1);
 	}
-	if(XShmGetImage(display, rootWindow, image, 0, 0, XAllPlanes()) == 0)
+	if(damage == None || damagefull)
 	{
-		ga_error("FATAL: XShmGetImage failed.\n");
-		exit(-1);
+		if(XShmGetImage(display, rootWindow, image, 0, 0, XAllPlanes()) == 0)
+		{
+			ga_error("FATAL: XShmGetImage failed.\n");
+			exit(-1);
+		}
+	}
+	else
+	{
+		damage_fetch();
 	}
+	if(damage == None)
+		goto copy_all;
+	// remember the dirty rectangles of this capture
+	seq								= ++captureseq;
+	history[seq % DAMAGE_HISTORY].full = damagefull;
+	history[seq % DAMAGE_HISTORY].n	  = ndamage;
+	bcopy(damagerect, history[seq % DAMAGE_HISTORY].rect, sizeof(damagerect));
+	if(damagefull == false && dirty != NULL)
+	{
+		for(i = 0; i < ndamage; i++)
+		{
+			vsource_rect_t r = damagerect[i];
+			if(rect != NULL && damage_clip(&r, rect->left, rect->top, rect->width, rect->height) == 0)
+				continue;
+			if(rect != NULL)
+			{
+				r.x -= rect->left;
+				r.y -= rect->top;
+			}
+			dirty[ndirty++] = r;
+		}
+	}
+	damagefull = false;
+	ndamage	  = 0;
+	// refresh the frame buffer with the regions changed since it was written
+	last = (mi = bufferseq.find(buf)) == bufferseq.end() ? 0 : mi->second;
+	bufferseq[buf] = seq;
+	if(last == 0 || seq - last > DAMAGE_HISTORY)
+		goto copy_all;
+	for(s = last + 1, full = false; s <= seq && full == false; s++)
+		full = history[s % DAMAGE_HISTORY].full;
+	if(full)
+		goto copy_all;
+	for(s = last + 1; s <= seq; s++)
+	{
+		for(i = 0; i < history[s % DAMAGE_HISTORY].n; i++)
+		{
+			vsource_rect_t r = history[s % DAMAGE_HISTORY].rect[i];
+			if(rect != NULL && damage_clip(&r, rect->left, rect->top, rect->width, rect->height) == 0)
+				continue;
+			copy_region(buf, rect, &r);
+		}
+	}
+	return ndirty;
+copy_all:
 	if(rect == NULL)
 	{
 		bcopy(image->data, buf, frameSize /*buflen*/);
 	}
 	else
 	{
-		int i;
 		char *src, *dst;
 		src = ((char*)image->data);
 		src += image->bytes_per_line * rect->top;
@@ -190,5 +551,5 @@ void ga_xwin_capture(char* buf, int buflen, struct gaRect* rect)
 			dst += rect->linesize;
 		}
 	}
-	return;
+	return ndirty;
 }
@@ -20,6 +20,7 @@
 #define __XCAP_XWIN_H__
 
 #include "ga-common.h"
+#include "vsource.h"
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -34,7 +35,9 @@ extern "C"
 	int ga_xwin_init(const char* displayname, gaImage* gaimg);
 	void ga_xwin_deinit();
 	void ga_xwin_imageinfo(XImage* image);
-	void ga_xwin_capture(char* buf, int buflen, struct gaRect* rect);
+	int ga_xwin_damage_init();
+	int ga_xwin_damage_pending(struct gaRect* rect);
+	int ga_xwin_capture(char* buf, int buflen, struct gaRect* rect, vsource_rect_t* dirty);
 #ifdef __cplusplus
 }
 #endif
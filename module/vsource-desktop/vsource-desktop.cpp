@@ -26,6 +26,7 @@
 #include "dpipe.h"
 #include "encoder-common.h"
 #include "ga-common.h"
+#include "ga-conf.h"
 #include "rtspconf.h"
 #include "vsource.h"
 
@@ -71,6 +72,10 @@ static int vsource_framerate_n  = -1;
 static int vsource_framerate_d  = -1;
 static int vsource_reconfigured = 0;
 
+/* damage-tracked capture: skip unchanged frames, but send one per keepalive interval */
+static int vsource_damage			  = 0;
+static long long vsource_keepalive = 1000000LL;
+
 /* video source has to send images to video-# pipes */
 /* the format is defined in VIDEO_SOURCE_PIPEFORMAT */
 
@@ -143,6 +148,13 @@ static int vsource_init(void* arg)
 		ga_error("XWindow capture init failed.\n");
 		return -1;
 	}
+	if(ga_conf_readbool("capture-damage", 0) != 0 && ga_xwin_damage_init() == 0)
+	{
+		char buf[64];
+		vsource_damage = 1;
+		if(ga_conf_readv("capture-damage-keepalive", buf, sizeof(buf)) != NULL)
+			vsource_keepalive = 1000LL * ga_conf_readint("capture-damage-keepalive");
+	}
 #endif
 
 	screenwidth	 = image->width;
@@ -191,7 +203,7 @@ static void* vsource_threadproc(void* arg)
 	dpipe_buffer_t* data;
 	vsource_frame_t* frame;
 	dpipe_t* pipe[SOURCES];
-	struct timeval initialTv, lastTv, captureTv;
+	struct timeval initialTv, lastTv, captureTv, lastFrameTv;
 	struct RTSPConf* rtspconf = rtspconf_global();
 	// reset framerate setup
 	vsource_framerate_n	= rtspconf->video_fps;
@@ -216,7 +228,8 @@ static void* vsource_threadproc(void* arg)
 	//
 	ga_error("video source thread started: tid=%ld\n", ga_gettid());
 	gettimeofday(&initialTv, NULL);
-	lastTv = initialTv;
+	lastTv		= initialTv;
+	lastFrameTv = initialTv;
 	token	 = frame_interval;
 	while(vsource_started != 0)
 	{
@@ -251,8 +264,21 @@ static void* vsource_threadproc(void* arg)
 			continue;
 		}
 		token -= frame_interval;
+#if !defined WIN32 && !defined __APPLE__ && !defined ANDROID
+		// nothing changed?
+		if(vsource_damage != 0 && ga_xwin_damage_pending(prect) == 0
+			&& tvdiff_us(&captureTv, &lastFrameTv) < vsource_keepalive)
+		{
+			continue;
+		}
+		lastFrameTv = captureTv;
+#endif
 		// copy image
-		data	= dpipe_get(pipe[0]);
+		if((data = dpipe_get_shared(pipe, SOURCES)) == NULL)
+		{
+			// the consumers hold all the frames: skip this one
+			continue;
+		}
 		frame = (vsource_frame_t*)data->pointer;
 #ifdef __APPLE__
 		frame->pixelformat = AV_PIX_FMT_RGBA;
@@ -278,6 +304,7 @@ static void* vsource_threadproc(void* arg)
 			////////////////////////////////////////
 		}
 		frame->linesize[0] = frame->realstride /*frame->stride*/;
+		frame->ndirty		 = 0;
 #ifdef WIN32
 #ifdef D3D_CAPTURE
 		ga_win32_D3D_capture((char*)frame->imgbuf, frame->imgbufsize, prect);
@@ -291,7 +318,7 @@ static void* vsource_threadproc(void* arg)
 #elif defined ANDROID
 		ga_androidvideo_capture((char*)frame->imgbuf, frame->imgbufsize);
 #else // X11
-		ga_xwin_capture((char*)frame->imgbuf, frame->imgbufsize, prect);
+		frame->ndirty = ga_xwin_capture((char*)frame->imgbuf, frame->imgbufsize, prect, frame->dirty);
 #endif
 		// draw cursor
 #ifdef WIN32
@@ -300,23 +327,14 @@ static void* vsource_threadproc(void* arg)
 		// gImgPts++;
 		frame->imgpts	  = tvdiff_us(&captureTv, &initialTv) / frame_interval;
 		frame->timestamp = captureTv;
+		ga_trace_begin(&frame->trace);
 		// embed color code?
 #ifdef ENABLE_EMBED_COLORCODE
 		vsource_embed_colorcode_inc(frame);
 #endif
-		// duplicate from channel 0 to other channels
-		for(i = 1; i < SOURCES; i++)
-		{
-			dpipe_buffer_t* dupdata;
-			vsource_frame_t* dupframe;
-			dupdata	= dpipe_get(pipe[i]);
-			dupframe = (vsource_frame_t*)dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
-			dpipe_store(pipe[i], dupdata);
-		}
-		dpipe_store(pipe[0], data);
+		ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+		// publish to all channels without duplicating the frame
+		dpipe_store_shared(pipe, SOURCES, data);
 		// reconfigured?
 		if(vsource_reconfigured != 0)
 		{
@@ -190,7 +190,10 @@ static bool D3D9_screen_capture(IDirect3DDevice9* pDevice)
 	do
 	{
 		unsigned char *src, *dst;
-		data					 = dpipe_get(g_pipe[0]);
+		data					 = dpipe_get_shared(g_pipe, SOURCES);
+		// the consumers hold all the frames: skip this one
+		if(data == NULL)
+			break;
 		frame					 = (vsource_frame_t*)data->pointer;
 		frame->pixelformat = PIX_FMT_BGRA;
 		frame->realwidth	 = desc.Width;
@@ -211,22 +214,15 @@ static bool D3D9_screen_capture(IDirect3DDevice9* pDevice)
 		}
 		frame->imgpts = pcdiff_us(captureTv, initialTv, freq) / frame_interval;
 		gettimeofday(&frame->timestamp, NULL);
+		ga_trace_begin(&frame->trace);
 	} while(0);
 
-	// duplicate from channel 0 to other channels
-	for(i = 1; i < SOURCES; i++)
+	if(data != NULL)
 	{
-		int j;
-		dpipe_buffer_t* dupdata;
-		vsource_frame_t* dupframe;
-		dupdata	= dpipe_get(g_pipe[i]);
-		dupframe = (vsource_frame_t*)dupdata->pointer;
-		//
-		vsource_dup_frame(frame, dupframe);
-		//
-		dpipe_store(g_pipe[i], dupdata);
+		ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+		// publish to all channels without duplicating the frame
+		dpipe_store_shared(g_pipe, SOURCES, data);
 	}
-	dpipe_store(g_pipe[0], data);
 
 	offscreenSurface->UnlockRect();
 #if 1 // XXX: disable until we have found a good place to safely Release()
@@ -751,7 +747,10 @@ DllExport HRESULT __stdcall hook_DXGISwapChainPresent(IDXGISwapChain* This, UINT
 		do
 		{
 			unsigned char *src, *dst;
-			data					 = dpipe_get(g_pipe[0]);
+			data					 = dpipe_get_shared(g_pipe, SOURCES);
+			// the consumers hold all the frames: skip this one
+			if(data == NULL)
+				break;
 			frame					 = (vsource_frame_t*)data->pointer;
 			frame->pixelformat = PIX_FMT_BGRA;
 			frame->realwidth	 = desc.Width;
@@ -770,22 +769,15 @@ DllExport HRESULT __stdcall hook_DXGISwapChainPresent(IDXGISwapChain* This, UINT
 			}
 			frame->imgpts = pcdiff_us(captureTv, initialTv, freq) / frame_interval;
 			gettimeofday(&frame->timestamp, NULL);
+			ga_trace_begin(&frame->trace);
 		} while(0);
 
-		// duplicate from channel 0 to other channels
-		for(i = 1; i < SOURCES; i++)
+		if(data != NULL)
 		{
-			int j;
-			dpipe_buffer_t* dupdata;
-			vsource_frame_t* dupframe;
-			dupdata	= dpipe_get(g_pipe[i]);
-			dupframe = (vsource_frame_t*)dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
-			dpipe_store(g_pipe[i], dupdata);
+			ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+			// publish to all channels without duplicating the frame
+			dpipe_store_shared(g_pipe, SOURCES, data);
 		}
-		dpipe_store(g_pipe[0], data);
 
 		pDstBuffer->Unmap(0);
 
@@ -840,7 +832,10 @@ DllExport HRESULT __stdcall hook_DXGISwapChainPresent(IDXGISwapChain* This, UINT
 		do
 		{
 			unsigned char *src, *dst;
-			data					 = dpipe_get(g_pipe[0]);
+			data					 = dpipe_get_shared(g_pipe, SOURCES);
+			// the consumers hold all the frames: skip this one
+			if(data == NULL)
+				break;
 			frame					 = (vsource_frame_t*)data->pointer;
 			frame->pixelformat = PIX_FMT_BGRA;
 			frame->realwidth	 = desc.Width;
@@ -859,22 +854,15 @@ DllExport HRESULT __stdcall hook_DXGISwapChainPresent(IDXGISwapChain* This, UINT
 			}
 			frame->imgpts = pcdiff_us(captureTv, initialTv, freq) / frame_interval;
 			gettimeofday(&frame->timestamp, NULL);
+			ga_trace_begin(&frame->trace);
 		} while(0);
 
-		// duplicate from channel 0 to other channels
-		for(i = 1; i < SOURCES; i++)
+		if(data != NULL)
 		{
-			int j;
-			dpipe_buffer_t* dupdata;
-			vsource_frame_t* dupframe;
-			dupdata	= dpipe_get(g_pipe[i]);
-			dupframe = (vsource_frame_t*)dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
-			dpipe_store(g_pipe[i], dupdata);
+			ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+			// publish to all channels without duplicating the frame
+			dpipe_store_shared(g_pipe, SOURCES, data);
 		}
-		dpipe_store(g_pipe[0], data);
 
 		pDeviceContext->Unmap(pDstBuffer, 0);
 
@@ -160,23 +160,6 @@ int ga_hook_capture_prepared(int width, int height, int check_resolution)
 	return 0;
 }
 
-void ga_hook_capture_dupframe(vsource_frame_t* frame)
-{
-	int i;
-	for(i = 1; i < SOURCES; i++)
-	{
-		dpipe_buffer_t* dupdata;
-		vsource_frame_t* dupframe;
-		dupdata	= dpipe_get(g_pipe[i]);
-		dupframe = (vsource_frame_t*)dupdata->pointer;
-		//
-		vsource_dup_frame(frame, dupframe);
-		//
-		dpipe_store(g_pipe[i], dupdata);
-	}
-	return;
-}
-
 #ifdef WIN32
 #define BACKSLASHDIR(fwd, back) back
 #else
@@ -184,7 +184,10 @@ void
 		//
 		frameLinesize = game_width << 2;
 		//
-		data					 = dpipe_get(g_pipe[0]);
+		data					 = dpipe_get_shared(g_pipe, SOURCES);
+		// the consumers hold all the frames: skip this one
+		if(data == NULL)
+			break;
 		frame					 = (vsource_frame_t*)data->pointer;
 		frame->pixelformat = AV_PIX_FMT_RGBA;
 		frame->realwidth	 = game_width;
@@ -207,10 +210,14 @@ void
 		}
 		frame->imgpts	  = tvdiff_us(&captureTv, &initialTv) / frame_interval;
 		frame->timestamp = captureTv;
+		ga_trace_begin(&frame->trace);
 	} while(0);
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
-	dpipe_store(g_pipe[0], data);
+	if(data != NULL)
+	{
+		ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+		// publish to all channels without duplicating the frame
+		dpipe_store_shared(g_pipe, SOURCES, data);
+	}
 	//
 	return;
 }
@@ -897,7 +897,10 @@ static void hook_SDL_capture_screen(const char* caller)
 	// copy screen
 	do
 	{
-		data					 = dpipe_get(g_pipe[0]);
+		data					 = dpipe_get_shared(g_pipe, SOURCES);
+		// the consumers hold all the frames: skip this one
+		if(data == NULL)
+			break;
 		frame					 = (vsource_frame_t*)data->pointer;
 		frame->pixelformat = AV_PIX_FMT_RGBA;
 		frame->realwidth	 = dupsurface->w;
@@ -908,10 +911,14 @@ static void hook_SDL_capture_screen(const char* caller)
 		bcopy(dupsurface->pixels, frame->imgbuf, frame->realsize);
 		frame->imgpts	  = tvdiff_us(&captureTv, &initialTv) / frame_interval;
 		frame->timestamp = captureTv;
+		ga_trace_begin(&frame->trace);
 	} while(0);
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
-	dpipe_store(g_pipe[0], data);
+	if(data != NULL)
+	{
+		ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+		// publish to all channels without duplicating the frame
+		dpipe_store_shared(g_pipe, SOURCES, data);
+	}
 	return;
 }
 
@@ -1042,7 +1049,10 @@ void hook_SDL_GL_SwapBuffers()
 		//
 		frameLinesize = vp_width << 2;
 		//
-		data					 = dpipe_get(g_pipe[0]);
+		data					 = dpipe_get_shared(g_pipe, SOURCES);
+		// the consumers hold all the frames: skip this one
+		if(data == NULL)
+			break;
 		frame					 = (vsource_frame_t*)data->pointer;
 		frame->pixelformat = AV_PIX_FMT_RGBA;
 		frame->realwidth	 = vp_width;
@@ -1065,11 +1075,15 @@ void hook_SDL_GL_SwapBuffers()
 		}
 		frame->imgpts	  = tvdiff_us(&captureTv, &initialTv) / frame_interval;
 		frame->timestamp = captureTv;
+		ga_trace_begin(&frame->trace);
 	} while(0);
 
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
-	dpipe_store(g_pipe[0], data);
+	if(data != NULL)
+	{
+		ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+		// publish to all channels without duplicating the frame
+		dpipe_store_shared(g_pipe, SOURCES, data);
+	}
 
 	return;
 }
@@ -464,7 +464,10 @@ static void hook_SDL2_capture_screen(const char* caller, SDL_Renderer* renderer)
 	// copy screen
 	do
 	{
-		data					 = dpipe_get(g_pipe[0]);
+		data					 = dpipe_get_shared(g_pipe, SOURCES);
+		// the consumers hold all the frames: skip this one
+		if(data == NULL)
+			break;
 		frame					 = (vsource_frame_t*)data->pointer;
 		frame->pixelformat = AV_PIX_FMT_BGRA;
 		frame->realwidth	 = curr_width;							// dupsurface->w;
@@ -479,10 +482,14 @@ static void hook_SDL2_capture_screen(const char* caller, SDL_Renderer* renderer)
 		}
 		frame->imgpts	  = tvdiff_us(&captureTv, &initialTv) / frame_interval;
 		frame->timestamp = captureTv;
+		ga_trace_begin(&frame->trace);
 	} while(0);
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
-	dpipe_store(g_pipe[0], data);
+	if(data != NULL)
+	{
+		ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+		// publish to all channels without duplicating the frame
+		dpipe_store_shared(g_pipe, SOURCES, data);
+	}
 	return;
 }
 
@@ -594,7 +601,10 @@ static void GL_capture()
 		//
 		frameLinesize = game_width << 2;
 		//
-		data					 = dpipe_get(g_pipe[0]);
+		data					 = dpipe_get_shared(g_pipe, SOURCES);
+		// the consumers hold all the frames: skip this one
+		if(data == NULL)
+			break;
 		frame					 = (vsource_frame_t*)data->pointer;
 		frame->pixelformat = AV_PIX_FMT_RGBA;
 		frame->realwidth	 = game_width;
@@ -616,11 +626,15 @@ static void GL_capture()
 		}
 		frame->imgpts	  = tvdiff_us(&captureTv, &initialTv) / frame_interval;
 		frame->timestamp = captureTv;
+		ga_trace_begin(&frame->trace);
 	} while(0);
 
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
-	dpipe_store(g_pipe[0], data);
+	if(data != NULL)
+	{
+		ga_trace_stamp(&frame->trace, GA_TRACE_STORE);
+		// publish to all channels without duplicating the frame
+		dpipe_store_shared(g_pipe, SOURCES, data);
+	}
 
 	return;
 }
@@ -24,15 +24,29 @@
 
 #include "controller.h"
 #include "encoder-common.h"
+#include "ga-avcodec.h"
 #include "ga-common.h"
 #include "ga-conf.h"
 #include "ga-module.h"
+#include "ratectl.h"
+#include "rtpfec.h"
+#include "rtpnack.h"
 #include "rtspconf.h"
+#include "vsource.h"
 
 //#define	TEST_RECONFIGURE
 
 // image source pipeline:
 //	vsource -- [vsource-%d] --> filter -- [filter-%d] --> encoder
+// or, if the encoder accepts the captured frames (see check_direct_input):
+//	vsource -- [vsource-%d] --> encoder
+
+// pixel format of the frames captured by vsource-desktop
+#ifdef __APPLE__
+#define VSOURCE_PIXFMT AV_PIX_FMT_RGBA
+#else
+#define VSOURCE_PIXFMT AV_PIX_FMT_BGRA
+#endif
 
 // configurations:
 static char* imagepipefmt			= "video-%d";
@@ -41,6 +55,7 @@ static char* imagepipe0				= "video-0";
 static char* filterpipe0			= "filter-0";
 static char* filter_param[]		= {imagepipefmt, filterpipefmt};
 static char* video_encoder_param = filterpipefmt;
+static int video_direct_input		= 0;
 static void* audio_encoder_param = NULL;
 
 static struct gaRect* prect = NULL;
@@ -74,6 +89,39 @@ int load_modules()
 	return 0;
 }
 
+/*
+ * Check if the video encoder can read the captured frames without the filter.
+ * This requires the encoder to accept the captured pixel format,
+ * and no scaling or color code embedding, which are done by the filter.
+ * Can be disabled by setting encoder-direct-input to false.
+ */
+static int check_direct_input()
+{
+	ga_ioctl_pixfmts_t fmts;
+	char buf[64];
+	int i;
+	//
+	if(ga_conf_readbool("encoder-direct-input", 1) == 0)
+		return 0;
+	if(ga_conf_readv("embed-colorcode", buf, sizeof(buf)) != NULL)
+		return 0;
+	for(i = 0; i < video_source_channels(); i++)
+	{
+		if(video_source_out_width(i) != video_source_curr_width(i)
+			|| video_source_out_height(i) != video_source_curr_height(i))
+			return 0;
+	}
+	bzero(&fmts, sizeof(fmts));
+	if(ga_module_ioctl(m_vencoder, GA_IOCTL_GETPIXFMTS, sizeof(fmts), &fmts) < 0)
+		return 0;
+	for(i = 0; i < fmts.count && i < GA_IOCTL_PIXFMTS_MAX; i++)
+	{
+		if(fmts.pixfmts[i] == VSOURCE_PIXFMT)
+			return 1;
+	}
+	return 0;
+}
+
 int init_modules()
 {
 	struct RTSPConf* conf = rtspconf_global();
@@ -85,9 +133,17 @@ int init_modules()
 	// controller server is built-in - no need to init
 	// note the order of the two modules ...
 	ga_init_single_module_or_quit("video-source", m_vsource, (void*)prect);
-	ga_init_single_module_or_quit("filter", m_filter, (void*)filter_param);
+	if((video_direct_input = check_direct_input()) != 0)
+	{
+		ga_error("*** Filter bypassed: video encoder reads the captured frames directly.\n");
+		video_encoder_param = imagepipefmt;
+	}
+	else
+	{
+		ga_init_single_module_or_quit("filter", m_filter, (void*)filter_param);
+	}
 	//
-	ga_init_single_module_or_quit("video-encoder", m_vencoder, filterpipefmt);
+	ga_init_single_module_or_quit("video-encoder", m_vencoder, video_encoder_param);
 	if(ga_conf_readbool("enable-audio", 1) != 0)
 	{
 		//////////////////////////
@@ -119,7 +175,7 @@ int run_modules()
 	if(m_vsource->start(prect) < 0)
 		exit(-1);
 	// ga_run_single_module_or_quit("filter 0", m_filter->threadproc, (void*) filterpipe);
-	if(m_filter->start(filter_param) < 0)
+	if(video_direct_input == 0 && m_filter->start(filter_param) < 0)
 		exit(-1);
 	encoder_register_vencoder(m_vencoder, video_encoder_param);
 	// audio
@@ -220,6 +276,64 @@ void handle_netreport(ctrlmsg_system_t* msg)
 				msgn->bytecount / 1024,
 				msgn->duration / 1000000.0,
 				msgn->bytecount / 1024.0 / (msgn->duration / 1000000.0));
+	ratectl_netreport(msgn->duration, msgn->pktcount, msgn->pktloss, msgn->bytecount, msgn->capacity);
+	rtpfec_netreport(msgn->pktcount, msgn->pktloss);
+	return;
+}
+
+#define FRAMELOSS_TOLERANCE_US 2000 /**< Error of the client's presentation time */
+
+void handle_frameloss(ctrlmsg_system_t* msg)
+{
+	ctrlmsg_system_frameloss_t* msgf = (ctrlmsg_system_frameloss_t*)msg;
+	ga_ioctl_invalidate_t inv;
+	struct timeval tv;
+	int err;
+	//
+	if(msgf->channel >= video_source_channels())
+		return;
+	inv.id  = msgf->channel;
+	inv.pts = -1LL;
+	// without RTCP synchronization, the presentation time is the client's own
+	if(msgf->synced && (msgf->tv_sec != 0 || msgf->tv_usec != 0))
+	{
+		tv.tv_sec  = msgf->tv_sec;
+		tv.tv_usec = msgf->tv_usec;
+		inv.pts	  = encoder_framelog_lookup(inv.id, &tv, FRAMELOSS_TOLERANCE_US);
+	}
+	err = ga_module_ioctl(m_vencoder, GA_IOCTL_INVALIDATE, sizeof(inv), &inv);
+	ga_error("frame-loss: ch%d %u packets lost, last intact frame %u.%06u (pts=%lld)%s\n",
+				inv.id,
+				msgf->pktloss,
+				msgf->tv_sec,
+				msgf->tv_usec,
+				inv.pts,
+				err < 0 ? ", not supported by the encoder" : "");
+	return;
+}
+
+void handle_nack(ctrlmsg_system_t* msg)
+{
+	ctrlmsg_system_nack_t* msgn = (ctrlmsg_system_nack_t*)msg;
+	unsigned short pid[CTRL_NACK_FCI_MAX], blp[CTRL_NACK_FCI_MAX];
+	struct sockaddr_in to;
+	int i;
+	//
+	for(i = 0; i < msgn->nfci; i++)
+	{
+		pid[i] = msgn->fci[i].pid;
+		blp[i] = msgn->fci[i].blp;
+	}
+	// the RTP port of the client, at the address of its control channel
+	if(msgn->rtpport != 0 && ctrl_server_get_client(&to) == 0)
+	{
+		to.sin_port = htons(msgn->rtpport);
+		rtpnack_retransmit(msgn->ssrc, msgn->nfci, pid, blp, &to);
+	}
+	else
+	{
+		rtpnack_retransmit(msgn->ssrc, msgn->nfci, pid, blp, NULL);
+	}
 	return;
 }
 
@@ -282,6 +396,12 @@ int main(int argc, char* argv[])
 	}
 	// enable handler to monitored network status
 	ctrlsys_set_handler(CTRL_MSGSYS_SUBTYPE_NETREPORT, handle_netreport);
+	// recover the video from frames lost by the client
+	ctrlsys_set_handler(CTRL_MSGSYS_SUBTYPE_FRAMELOSS, handle_frameloss);
+	// send the RTP packets lost by the client again
+	ctrlsys_set_handler(CTRL_MSGSYS_SUBTYPE_NACK, handle_nack);
+	// adapt the bitrate to the network reports
+	ratectl_init(m_vsource, m_vencoder);
 	//
 #ifdef TEST_RECONFIGURE
 	pthread_t t;
@@ -296,6 +416,7 @@ int main(int argc, char* argv[])
 	// alternatively, it is able to create a thread to run rtspserver_main:
 	//	pthread_create(&t, NULL, rtspserver_main, NULL);
 	//
+	ratectl_deinit();
 	ga_deinit();
 	//
 	return 0;